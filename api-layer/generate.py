@@ -96,6 +96,17 @@ layer_name = "OverlaysLayer"
 registryFilename = sys.argv[1]
 outputFilename = sys.argv[2]
 
+# Types and commands guarded by one of these platform macros in the
+# registry are generated; the build passes the ones it defines, e.g.
+# "--protect=XR_USE_PLATFORM_WIN32,XR_USE_GRAPHICS_API_D3D11"
+have_protection = {
+    "XR_USE_PLATFORM_WIN32",
+    "XR_USE_GRAPHICS_API_D3D11",
+}
+for arg in sys.argv[3:]:
+    if arg.startswith("--protect="):
+        have_protection = set(p for p in arg[len("--protect="):].split(",") if p)
+
 tree = etree.parse(registryFilename)
 root = tree.getroot()
 
@@ -129,10 +140,14 @@ atoms = set()
 structs = {} # value is a tuple of struct name, type enum, extends struct name, and list of members
     # members are dict of "name", "type", other goop depending on type
 
-have_protection = {
-    "XR_USE_PLATFORM_WIN32",
-    "XR_USE_GRAPHICS_API_D3D11",
-}
+# Commands from extensions that are only available with a platform macro
+unavailable_commands = set()
+
+for reg_extension in root.find("extensions") if root.find("extensions") is not None else []:
+    protect = reg_extension.attrib.get("protect", "")
+    if protect and not protect in have_protection:
+        for reg_command in reg_extension.iter("command"):
+            unavailable_commands.add(reg_command.attrib["name"])
 
 for reg_type in reg_types:
 
@@ -343,6 +358,13 @@ supported_structs = [
     "XrEventDataMainSessionVisibilityChangedEXTX",
 ]
 
+# Commands that may block in the runtime or waiting on Main
+blocking_commands = [
+    "xrWaitFrame",
+    "xrAcquireSwapchainImage",
+    "xrWaitSwapchainImage",
+]
+
 manually_implemented_commands = [
     "xrApplyHapticFeedback",
     "xrStopHapticFeedback",
@@ -425,6 +447,10 @@ supported_commands = [
     "xrStopHapticFeedback",
 ]
 
+# Drop what the platform macros given on the command line leave out
+supported_structs = [name for name in supported_structs if name in structs]
+supported_commands = [name for name in supported_commands if name not in unavailable_commands]
+
 supported_handles = [
     "XrAction",
     "XrActionSet",
@@ -546,16 +572,17 @@ add_to_handle_struct = {}
 add_to_handle_struct["XrInstance"] = {
     "members" : """
     const XrInstanceCreateInfo *createInfo = nullptr;
-    std::set<XrDebugUtilsMessengerEXT> debugUtilsMessengers;
-    std::unordered_map<XrPath, std::vector<XrActionSuggestedBinding>> profilesToBindings;
-    std::set<OverlaysLayerXrActionSetHandleInfo::Ptr> childActionSets;
-    std::set<OverlaysLayerXrSessionHandleInfo::Ptr> childSessions;
-    std::set<OverlaysLayerXrDebugUtilsMessengerEXTHandleInfo::Ptr> childDebugUtilsMessengerEXTs;
-    std::unordered_map<WellKnownStringIndex, XrPath> OverlaysLayerWellKnownStringToPath;
-    std::unordered_map<XrPath, WellKnownStringIndex> OverlaysLayerPathToWellKnownString;
-    std::unordered_map<XrPath, XrPath> OverlaysLayerBindingToSubaction;
-    std::set<XrPath> OverlaysLayerAllSubactionPaths;
-
+    ChildList<OverlaysLayerXrActionSetHandleInfo> childActionSets;
+    ChildList<OverlaysLayerXrSessionHandleInfo> childSessions;
+    ChildList<OverlaysLayerXrDebugUtilsMessengerEXTHandleInfo> childDebugUtilsMessengerEXTs;
+""",
+    "cold_members" : """
+        std::set<XrDebugUtilsMessengerEXT> debugUtilsMessengers;
+        std::unordered_map<XrPath, std::vector<XrActionSuggestedBinding>> profilesToBindings;
+        std::unordered_map<WellKnownStringIndex, XrPath> OverlaysLayerWellKnownStringToPath;
+        std::unordered_map<XrPath, WellKnownStringIndex> OverlaysLayerPathToWellKnownString;
+        std::unordered_map<XrPath, XrPath> OverlaysLayerBindingToSubaction;
+        std::set<XrPath> OverlaysLayerAllSubactionPaths;
 """,
 }
 
@@ -564,22 +591,26 @@ add_to_handle_struct["XrInstance"] = {
 
 add_to_handle_struct["XrSession"] = {
     "members" : """
-    ID3D11Device*   d3d11Device;
     XrSession localHandle;
-    const XrSessionCreateInfo *createInfo = nullptr;
-    std::set<OverlaysLayerXrSwapchainHandleInfo::Ptr> childSwapchains;
-    std::set<OverlaysLayerXrSpaceHandleInfo::Ptr> childSpaces;
     XrActionSet placeholderActionSet;
-    std::unordered_map<XrAction, std::string> placeholderActionNames;
+    bool actionSetsWereAttached = false;
+    bool interactionProfileChangePending = false;
+    const XrSessionCreateInfo *createInfo = nullptr;
+    ChildList<OverlaysLayerXrSwapchainHandleInfo> childSwapchains;
+    ChildList<OverlaysLayerXrSpaceHandleInfo> childSpaces;
     std::unordered_map<XrPath, std::pair<XrAction, XrActionType>> placeholderActions;
-    std::map<std::pair<XrPath /* interaction profile */, XrPath /* full binding */>, std::pair<XrAction, XrActionType>> placeholderActionsByProfileAndFullBinding;
-    std::unordered_map<XrPath, std::vector<XrActionSuggestedBinding>> bindingsByProfile;
     std::unordered_map<XrAction, XrPath> bindingsByAction;
     std::vector<XrActiveActionSet> lastSyncedActiveActionSets;
-    bool actionSetsWereAttached = false;
-    std::set<XrPath> interactionProfiles;
     std::unordered_map<XrPath,XrPath> currentInteractionProfileBySubactionPath;
-    bool interactionProfileChangePending = false;
+""",
+    "cold_members" : """
+#if defined(XR_USE_GRAPHICS_API_D3D11)
+        ID3D11Device*   d3d11Device = nullptr;
+#endif
+        std::unordered_map<XrAction, std::string> placeholderActionNames;
+        std::map<std::pair<XrPath /* interaction profile */, XrPath /* full binding */>, std::pair<XrAction, XrActionType>> placeholderActionsByProfileAndFullBinding;
+        std::unordered_map<XrPath, std::vector<XrActionSuggestedBinding>> bindingsByProfile;
+        std::set<XrPath> interactionProfiles;
 """,
 }
 
@@ -633,6 +664,7 @@ after_downchain_main["xrCreateSwapchain"] = """
 """
 
 after_downchain_main["xrCreateSwapchain"] = """
+    auto l = sessionInfo->GetLock();
     sessionInfo->childSwapchains.insert(OverlaysLayerGetHandleInfoFromXrSwapchain(*swapchain));
 """
 
@@ -672,7 +704,7 @@ add_to_handle_struct["XrDebugUtilsMessengerEXT"] = {
 in_destructor["XrDebugUtilsMessengerEXT"] = "    if(createInfo) { FreeXrStructChainWithFree(parentInstance, createInfo); }\n"
 
 after_downchain_main["xrCreateDebugUtilsMessengerEXT"] = f"""
-    gOverlaysLayerXrInstanceToHandleInfo.at(instance)->debugUtilsMessengers.insert(*messenger);
+    OverlaysLayerGetHandleInfoFromXrInstance(instance)->cold->debugUtilsMessengers.insert(*messenger);
     OverlaysLayerXrDebugUtilsMessengerEXTHandleInfo::Ptr info = std::make_shared<OverlaysLayerXrDebugUtilsMessengerEXTHandleInfo>(instance, instance, instanceInfo->downchain);
     info->createInfo = reinterpret_cast<XrDebugUtilsMessengerCreateInfoEXT*>(CopyXrStructChainWithMalloc(instance, createInfo));
     info->handle = *messenger; // XXX should be part of autogenerated ctor
@@ -687,7 +719,7 @@ add_to_handle_struct["XrActionSet"] = {
     XrActionSet handle;
     XrActionSetCreateInfo *createInfo = nullptr;
     ActionBindLocation bindLocation = BIND_PENDING;
-    std::set<OverlaysLayerXrActionHandleInfo::Ptr> childActions;
+    ChildList<OverlaysLayerXrActionHandleInfo> childActions;
 """,
 }
 
@@ -743,7 +775,10 @@ add_to_handle_struct["XrSpace"] = {
 
 after_downchain_main["xrCreateReferenceSpace"] = """
     auto info = OverlaysLayerGetHandleInfoFromXrSpace(*space);
-    sessionInfo->childSpaces.insert(info);
+    {
+        auto l = sessionInfo->GetLock();
+        sessionInfo->childSpaces.insert(info);
+    }
     info->localHandle = *space;
 """
 
@@ -835,8 +870,6 @@ source_text = """
 
 std::unordered_map<XrPath, XrInteractionProfileSuggestedBinding*> gPathToSuggestedInteractionProfileBinding;
 
-std::mutex gIPCMutex;
-
 // MUST BE DEFAULT ONLY FOR LEAF OBJECTS (no pointers in them)
 template <typename T>
 void IPCCopyOut(T* dst, const T* src)
@@ -863,137 +896,115 @@ template <typename T>
 T* IPCSerialize(XrInstance instance, IPCBuffer& ipcbuf, IPCHeader* header, T* srcbase, CopyType copyType, size_t size)
 {
     T* serialized = reinterpret_cast<T*>(ipcbuf.allocate(sizeof(T) * size));
+    if(!serialized) {
+        return nullptr;
+    }
+
+    // Take everything the structs point to from the buffer at once
+    size_t chainsSize = 0;
+    for(size_t i = 0; i < size; i++) {
+        chainsSize += XrStructChainSerializedSize(instance, &srcbase[i]);
+    }
+    void *storage = ipcbuf.allocate(chainsSize);
+    if(!storage && (chainsSize > 0)) {
+        return nullptr;
+    }
+    IPCStructChainAllocator allocator{XrStructChainBlock(storage, chainsSize), ipcbuf, header};
 
     for(size_t i = 0; i < size; i++) {
-        CopyXrStructChain(instance, &srcbase[i], &serialized[i], copyType,
-            [&ipcbuf](size_t size){return ipcbuf.allocate(size);},
-            [&ipcbuf,&header](void* pointerToPointer){header->addOffsetToPointer(ipcbuf.base, pointerToPointer);});
+        CopyXrStructChain(instance, &srcbase[i], &serialized[i], copyType, allocator);
+        ValidateXrStructChainCopy(instance, "IPCSerialize", reinterpret_cast<const XrBaseInStructure*>(&srcbase[i]), reinterpret_cast<const XrBaseInStructure*>(&serialized[i]));
     }
 
     return serialized;
 }
 
 // CopyOut XR structs -------------------------------------------------------
-template <>
-void IPCCopyOut(XrBaseOutStructure* dstbase, const XrBaseOutStructure* srcbase)
-{
-    bool skipped = true;
-
-    do {
-        skipped = false;
-
-        if(!srcbase) {
-            return;
-        }
-
-        switch(dstbase->type) {
-            case XR_TYPE_SPACE_LOCATION: {
-                auto src = reinterpret_cast<const XrSpaceLocation*>(srcbase);
-                auto dst = reinterpret_cast<XrSpaceLocation*>(dstbase);
-                dst->locationFlags = src->locationFlags;
-                dst->pose = src->pose;
-                break;
-            }
-
-            case XR_TYPE_GRAPHICS_REQUIREMENTS_D3D11_KHR: {
-                auto src = reinterpret_cast<const XrGraphicsRequirementsD3D11KHR*>(srcbase);
-                auto dst = reinterpret_cast<XrGraphicsRequirementsD3D11KHR*>(dstbase);
-                dst->adapterLuid = src->adapterLuid;
-                dst->minFeatureLevel = src->minFeatureLevel;
-                break;
-            }
+// Output members of the structs that come back from Main; the chain walk
+// is IPCCopyOut(XrBaseOutStructure*, ...) after the struct type table
 
-            case XR_TYPE_FRAME_STATE: {
-                auto src = reinterpret_cast<const XrFrameState*>(srcbase);
-                auto dst = reinterpret_cast<XrFrameState*>(dstbase);
-                dst->predictedDisplayTime = src->predictedDisplayTime;
-                dst->predictedDisplayPeriod = src->predictedDisplayPeriod;
-                dst->shouldRender = src->shouldRender;
-                break;
-            }
+void IPCCopyOutMembers(XrSpaceLocation* dst, const XrSpaceLocation* src)
+{
+    dst->locationFlags = src->locationFlags;
+    dst->pose = src->pose;
+}
 
-            case XR_TYPE_INSTANCE_PROPERTIES: {
-                auto src = reinterpret_cast<const XrInstanceProperties*>(srcbase);
-                auto dst = reinterpret_cast<XrInstanceProperties*>(dstbase);
-                dst->runtimeVersion = src->runtimeVersion;
-                strncpy_s(dst->runtimeName, src->runtimeName, XR_MAX_RUNTIME_NAME_SIZE);
-                break;
-            }
+void IPCCopyOutMembers(XrSpaceVelocity* dst, const XrSpaceVelocity* src)
+{
+    dst->velocityFlags = src->velocityFlags;
+    dst->linearVelocity = src->linearVelocity;
+    dst->angularVelocity = src->angularVelocity;
+}
 
-            case XR_TYPE_EXTENSION_PROPERTIES: {
-                auto src = reinterpret_cast<const XrExtensionProperties*>(srcbase);
-                auto dst = reinterpret_cast<XrExtensionProperties*>(dstbase);
-                strncpy_s(dst->extensionName, src->extensionName, XR_MAX_EXTENSION_NAME_SIZE);
-                dst->extensionVersion = src->extensionVersion;
-                break;
-            }
+void IPCCopyOutMembers(XrFrameState* dst, const XrFrameState* src)
+{
+    dst->predictedDisplayTime = src->predictedDisplayTime;
+    dst->predictedDisplayPeriod = src->predictedDisplayPeriod;
+    dst->shouldRender = src->shouldRender;
+}
 
-            case XR_TYPE_SYSTEM_PROPERTIES: {
-                auto src = reinterpret_cast<const XrSystemProperties*>(srcbase);
-                auto dst = reinterpret_cast<XrSystemProperties*>(dstbase);
-                dst->systemId = src->systemId;
-                dst->vendorId = src->vendorId;
-                dst->graphicsProperties = src->graphicsProperties;
-                dst->trackingProperties = src->trackingProperties;
-                strncpy_s(dst->systemName, src->systemName, XR_MAX_SYSTEM_NAME_SIZE);
-                break;
-            }
+void IPCCopyOutMembers(XrInstanceProperties* dst, const XrInstanceProperties* src)
+{
+    dst->runtimeVersion = src->runtimeVersion;
+    strncpy_s(dst->runtimeName, src->runtimeName, XR_MAX_RUNTIME_NAME_SIZE);
+}
 
-            case XR_TYPE_VIEW_CONFIGURATION_PROPERTIES: {
-                auto src = reinterpret_cast<const XrViewConfigurationProperties*>(srcbase);
-                auto dst = reinterpret_cast<XrViewConfigurationProperties*>(dstbase);
-                dst->viewConfigurationType = src->viewConfigurationType;
-                dst->fovMutable = src->fovMutable;
-                break;
-            }
+void IPCCopyOutMembers(XrExtensionProperties* dst, const XrExtensionProperties* src)
+{
+    strncpy_s(dst->extensionName, src->extensionName, XR_MAX_EXTENSION_NAME_SIZE);
+    dst->extensionVersion = src->extensionVersion;
+}
 
-            case XR_TYPE_VIEW_CONFIGURATION_VIEW: {
-                auto src = reinterpret_cast<const XrViewConfigurationView*>(srcbase);
-                auto dst = reinterpret_cast<XrViewConfigurationView*>(dstbase);
-                dst->recommendedImageRectWidth = src->recommendedImageRectWidth;
-                dst->maxImageRectWidth = src->maxImageRectWidth;
-                dst->recommendedImageRectHeight = src->recommendedImageRectHeight;
-                dst->maxImageRectHeight = src->maxImageRectHeight;
-                dst->recommendedSwapchainSampleCount = src->recommendedSwapchainSampleCount;
-                dst->maxSwapchainSampleCount = src->maxSwapchainSampleCount;
-                break;
-            }
+void IPCCopyOutMembers(XrSystemProperties* dst, const XrSystemProperties* src)
+{
+    dst->systemId = src->systemId;
+    dst->vendorId = src->vendorId;
+    dst->graphicsProperties = src->graphicsProperties;
+    dst->trackingProperties = src->trackingProperties;
+    strncpy_s(dst->systemName, src->systemName, XR_MAX_SYSTEM_NAME_SIZE);
+}
 
-            case XR_TYPE_VIEW: {
-                auto src = reinterpret_cast<const XrView*>(srcbase);
-                auto dst = reinterpret_cast<XrView*>(dstbase);
-                dst->pose = src->pose;
-                dst->fov = src->fov;
-                break;
-            }
+void IPCCopyOutMembers(XrViewConfigurationProperties* dst, const XrViewConfigurationProperties* src)
+{
+    dst->viewConfigurationType = src->viewConfigurationType;
+    dst->fovMutable = src->fovMutable;
+}
 
-            case XR_TYPE_VIEW_STATE: {
-                auto src = reinterpret_cast<const XrViewState*>(srcbase);
-                auto dst = reinterpret_cast<XrViewState*>(dstbase);
-                dst->viewStateFlags = src->viewStateFlags;
-                break;
-            }
+void IPCCopyOutMembers(XrViewConfigurationView* dst, const XrViewConfigurationView* src)
+{
+    dst->recommendedImageRectWidth = src->recommendedImageRectWidth;
+    dst->maxImageRectWidth = src->maxImageRectWidth;
+    dst->recommendedImageRectHeight = src->recommendedImageRectHeight;
+    dst->maxImageRectHeight = src->maxImageRectHeight;
+    dst->recommendedSwapchainSampleCount = src->recommendedSwapchainSampleCount;
+    dst->maxSwapchainSampleCount = src->maxSwapchainSampleCount;
+}
 
-            default: {
-                // I don't know what this is, drop it and keep going
-                OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, "unknown",
-                    OverlaysLayerNoObjectInfo, fmt("IPCCopyOut called to copy out to %p of unknown type %d - skipped.", dstbase, dstbase->type).c_str());
+void IPCCopyOutMembers(XrView* dst, const XrView* src)
+{
+    dst->pose = src->pose;
+    dst->fov = src->fov;
+}
 
-                dstbase = dstbase->next;
-                skipped = true;
+void IPCCopyOutMembers(XrViewState* dst, const XrViewState* src)
+{
+    dst->viewStateFlags = src->viewStateFlags;
+}
 
-                // Don't increment srcbase.  Unknown structs were
-                // dropped during serialization, so keep going until we
-                // see a type we know and then we'll have caught up with
-                // what was serialized.
-                //
-                break;
-            }
-        }
-    } while(skipped);
+"""
 
-    IPCCopyOut(dstbase->next, srcbase->next);
+if "XR_USE_GRAPHICS_API_D3D11" in have_protection:
+    source_text += """
+void IPCCopyOutMembers(XrGraphicsRequirementsD3D11KHR* dst, const XrGraphicsRequirementsD3D11KHR* src)
+{
+    dst->adapterLuid = src->adapterLuid;
+    dst->minFeatureLevel = src->minFeatureLevel;
 }
+"""
+
+source_text += """
+template <>
+void IPCCopyOut(XrBaseOutStructure* dstbase, const XrBaseOutStructure* srcbase);
 
 
 """
@@ -1070,6 +1081,7 @@ for handle_type in supported_handles:
         parent_members = f"""
     {parent_type} parentHandle;
     XrInstance parentInstance;
+    size_t indexInParent = SIZE_MAX; // Position in the parent's ChildList, if it's in one
 """
         parent_dtor = f"""
             parentHandle = XR_NULL_HANDLE;
@@ -1099,17 +1111,25 @@ for handle_type in supported_handles:
 """
         substitution_destroy = f"""
             if(!isProxied) {{
-                auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
+                auto procLock = LockForProc(&procMutex);
 
                 downchain->Destroy{handle_type[2:]}(actualHandle);
             }}
 """
         substitution_header_text = f"""
-extern std::recursive_mutex gActual{handle_type}ToLocalHandleMutex;
+{handle_type} {layer_name}NewLocal{handle_type}();
+extern ProfiledMutex gActual{handle_type}ToLocalHandleMutex;
 extern std::unordered_map<{handle_type}, {handle_type}> gActual{handle_type}ToLocalHandle;
 """
         substitution_source_text = f"""
-std::recursive_mutex gActual{handle_type}ToLocalHandleMutex;
+// Local handles are slots in the handle info table, so reserve one;
+// XR_NULL_HANDLE if the table is full
+{handle_type} {layer_name}NewLocal{handle_type}()
+{{
+    return g{layer_name}{handle_type}ToHandleInfo.NewHandle();
+}}
+
+ProfiledMutex gActual{handle_type}ToLocalHandleMutex{{"gActual{handle_type}ToLocalHandleMutex"}};
 std::unordered_map<{handle_type}, {handle_type}> gActual{handle_type}ToLocalHandle;
 """
     else:
@@ -1119,16 +1139,40 @@ std::unordered_map<{handle_type}, {handle_type}> gActual{handle_type}ToLocalHand
         substitution_header_text = ""
         substitution_source_text = ""
 
+    # Local handles are minted by this layer, so they can index straight
+    # into a table instead of being hashed
+    if handle_type in handles_needing_substitution:
+        handle_info_table_type = f"LocalHandleTable<{handle_type}, {layer_name}{handle_type}HandleInfo::Ptr>"
+    else:
+        handle_info_table_type = f"EpochHashMap<{handle_type}, {layer_name}{handle_type}HandleInfo::Ptr>"
+
+    # Members only touched during setup or on rare paths live behind
+    # "cold" so the ones used on every call share fewer cache lines
+    cold_members = add_to_handle_struct.get(handle_type, {}).get("cold_members", "")
+    if cold_members:
+        cold_text = f"""
+    struct Cold
+    {{
+        {cold_members}
+    }};
+    std::unique_ptr<Cold> cold = std::make_unique<Cold>();
+"""
+    else:
+        cold_text = ""
+
     handle_header_text = f"""
 
 struct {layer_name}{handle_type}HandleInfo
 {{
 
+    // Members used on every call come first
     std::shared_ptr<XrGeneratedDispatchTable> downchain;
     bool valid = true;
-    {parent_members}
     {substitution_members}
+    {parent_members}
+    ProfiledMutex procMutex{{"{handle_type} procMutex"}}; // See LockForProc()
     {add_to_handle_struct.get(handle_type, {}).get("members", "")}
+    {cold_text}
 
     void Destroy() /* For OpenXR's intents.  Not class destructor. */
     {{
@@ -1171,49 +1215,98 @@ struct {layer_name}{handle_type}HandleInfo
     {add_to_handle_struct.get(handle_type, {}).get("methods", "")}
 }};
 
-extern std::unordered_map<{handle_type}, {layer_name}{handle_type}HandleInfo::Ptr> g{layer_name}{handle_type}ToHandleInfo;
-extern std::recursive_mutex g{layer_name}{handle_type}ToHandleInfoMutex;
+extern {handle_info_table_type} g{layer_name}{handle_type}ToHandleInfo;
 
 void {layer_name}AddHandleInfoFor{handle_type}({handle_type} handle, {layer_name}{handle_type}HandleInfo::Ptr info);
 {layer_name}{handle_type}HandleInfo::Ptr {layer_name}GetHandleInfoFrom{handle_type}({handle_type} handle);
+{layer_name}{handle_type}HandleInfo* {layer_name}BorrowHandleInfoFrom{handle_type}({handle_type} handle);
+XrResult {layer_name}TryBorrowHandleInfoFrom{handle_type}({handle_type} handle, {layer_name}{handle_type}HandleInfo** info);
+XrResult {layer_name}TryGetHandleInfoFrom{handle_type}({handle_type} handle, {layer_name}{handle_type}HandleInfo::Ptr& info);
 void {layer_name}Remove{handle_type}FromHandleInfoMap({handle_type} handle);
+void {layer_name}Remove{handle_type}sFromHandleInfoMap(const std::vector<{handle_type}>& handles);
 {substitution_header_text}
 """
 
     handle_source_text = f"""
 
-std::unordered_map<{handle_type}, {layer_name}{handle_type}HandleInfo::Ptr> g{layer_name}{handle_type}ToHandleInfo;
-std::recursive_mutex g{layer_name}{handle_type}ToHandleInfoMutex;
+{handle_info_table_type} g{layer_name}{handle_type}ToHandleInfo;
 
 void {layer_name}AddHandleInfoFor{handle_type}({handle_type} handle, {layer_name}{handle_type}HandleInfo::Ptr info)
 {{
-    std::unique_lock<std::recursive_mutex> mlock(g{layer_name}{handle_type}ToHandleInfoMutex);
-    g{layer_name}{handle_type}ToHandleInfo.insert({{handle, info}});
+    g{layer_name}{handle_type}ToHandleInfo.Insert(handle, info);
 }}
 
 // could throw if handle not in the map
 {layer_name}{handle_type}HandleInfo::Ptr {layer_name}GetHandleInfoFrom{handle_type}({handle_type} handle)
 {{
-    std::unique_lock<std::recursive_mutex> mlock(g{layer_name}{handle_type}ToHandleInfoMutex);
-    auto it = g{layer_name}{handle_type}ToHandleInfo.find(handle);
-    if(it == g{layer_name}{handle_type}ToHandleInfo.end()) {{
+    {layer_name}{handle_type}HandleInfo::Ptr info;
+    if(!g{layer_name}{handle_type}ToHandleInfo.Find(handle, info)) {{
         OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
             OverlaysLayerNoObjectInfo, fmt("Could not look up info from {handle_type} handle %llX", handle).c_str());
         throw OverlaysLayerXrException(XR_ERROR_HANDLE_INVALID);
     }}
-    return it->second;
+    return info;
+}}
+
+// Like GetHandleInfoFrom{handle_type} but without taking a reference; only
+// use the result inside the EpochReadGuard that was active for this call.
+// Returns XR_ERROR_HANDLE_INVALID rather than throwing if the handle isn't known.
+XrResult {layer_name}TryBorrowHandleInfoFrom{handle_type}({handle_type} handle, {layer_name}{handle_type}HandleInfo** info)
+{{
+    const {layer_name}{handle_type}HandleInfo::Ptr* found = g{layer_name}{handle_type}ToHandleInfo.Borrow(handle);
+    if(!found) {{
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+            OverlaysLayerNoObjectInfo, fmt("Could not look up info from {handle_type} handle %llX", handle).c_str());
+        return XR_ERROR_HANDLE_INVALID;
+    }}
+    *info = found->get();
+    return XR_SUCCESS;
+}}
+
+// Like TryBorrowHandleInfoFrom{handle_type} but taking a reference, for
+// commands that may block and so mustn't hold an EpochReadGuard
+XrResult {layer_name}TryGetHandleInfoFrom{handle_type}({handle_type} handle, {layer_name}{handle_type}HandleInfo::Ptr& info)
+{{
+    EpochReadGuard guard;
+    const {layer_name}{handle_type}HandleInfo::Ptr* found = g{layer_name}{handle_type}ToHandleInfo.Borrow(handle);
+    if(!found) {{
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+            OverlaysLayerNoObjectInfo, fmt("Could not look up info from {handle_type} handle %llX", handle).c_str());
+        return XR_ERROR_HANDLE_INVALID;
+    }}
+    info = *found;
+    return XR_SUCCESS;
+}}
+
+// could throw if handle not in the map
+{layer_name}{handle_type}HandleInfo* {layer_name}BorrowHandleInfoFrom{handle_type}({handle_type} handle)
+{{
+    {layer_name}{handle_type}HandleInfo* info;
+    XrResult result = {layer_name}TryBorrowHandleInfoFrom{handle_type}(handle, &info);
+    if(result != XR_SUCCESS) {{
+        throw OverlaysLayerXrException(result);
+    }}
+    return info;
 }}
 
 void {layer_name}Remove{handle_type}FromHandleInfoMap({handle_type} handle)
 {{
-    std::unique_lock<std::recursive_mutex> mlock(g{layer_name}{handle_type}ToHandleInfoMutex);
-    auto it = g{layer_name}{handle_type}ToHandleInfo.find(handle);
-    if(it == g{layer_name}{handle_type}ToHandleInfo.end()) {{
+    if(!g{layer_name}{handle_type}ToHandleInfo.Erase(handle)) {{
         OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
             OverlaysLayerNoObjectInfo, fmt("Could not look up info from {handle_type} handle %llX", handle).c_str());
         throw OverlaysLayerXrException(XR_ERROR_HANDLE_INVALID);
     }}
-    g{layer_name}{handle_type}ToHandleInfo.erase(it);
+}}
+
+// For removing all the children of a handle; the table is only updated once
+void {layer_name}Remove{handle_type}sFromHandleInfoMap(const std::vector<{handle_type}>& handles)
+{{
+    size_t erased = g{layer_name}{handle_type}ToHandleInfo.Erase(handles);
+    if(erased != handles.size()) {{
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+            OverlaysLayerNoObjectInfo, fmt("Could not look up info from %zu of %zu {handle_type} handles", handles.size() - erased, handles.size()).c_str());
+        throw OverlaysLayerXrException(XR_ERROR_HANDLE_INVALID);
+    }}
 }}
 
 {substitution_source_text}
@@ -1318,7 +1411,8 @@ CreateSwapchainRPC = {
             "name" : "createInfo",
             "type" : "xr_struct_pointer",
             "struct_type" : "XrSwapchainCreateInfo",
-            "is_const" : True
+            "is_const" : True,
+            "restore_handles_in_place" : True
         },
         {
             "name" : "swapchain",
@@ -1348,7 +1442,8 @@ CreateReferenceSpaceRPC = {
             "name" : "createInfo",
             "type" : "xr_struct_pointer",
             "struct_type" : "XrReferenceSpaceCreateInfo",
-            "is_const" : True
+            "is_const" : True,
+            "restore_handles_in_place" : True
         },
         {
             "name" : "space",
@@ -1454,17 +1549,37 @@ BeginFrameRPC = {
             "is_const" : True
         },
     ),
-    "function" : "OverlaysLayerBeginFrameMainAsOverlay"
+    "function" : "OverlaysLayerBeginFrameMainAsOverlay",
+    "async" : True
 }
 
-EndFrameRPC = {
-    "command_name" : "EndFrame",
+SubmitFrameRPC = {
+    "command_name" : "SubmitFrame",
     "args" : (
         {
             "name" : "session",
             "type" : "POD",
             "pod_type" : "XrSession",
         },
+        {
+            "name" : "releaseCount",
+            "type" : "POD",
+            "pod_type" : "uint32_t",
+        },
+        {
+            "name" : "releaseSwapchains",
+            "type" : "fixed_array",
+            "base_type" : "XrSwapchain",
+            "input_size" : "releaseCount",
+            "is_const" : True
+        },
+        {
+            "name" : "releaseSourceImages",
+            "type" : "fixed_array",
+            "base_type" : "SharedImageHandle",
+            "input_size" : "releaseCount",
+            "is_const" : True
+        },
         {
             "name" : "frameEndInfo",
             "type" : "xr_struct_pointer",
@@ -1472,7 +1587,8 @@ EndFrameRPC = {
             "is_const" : True
         },
     ),
-    "function" : "OverlaysLayerEndFrameMainAsOverlay"
+    "function" : "OverlaysLayerSubmitFrameMainAsOverlay",
+    "async" : True
 }
 
 AcquireSwapchainImageRPC = {
@@ -1487,7 +1603,8 @@ AcquireSwapchainImageRPC = {
             "name" : "acquireInfo",
             "type" : "xr_struct_pointer",
             "struct_type" : "XrSwapchainImageAcquireInfo",
-            "is_const" : True
+            "is_const" : True,
+            "restore_handles_in_place" : True
         },
         {
             "name" : "index",
@@ -1511,40 +1628,18 @@ WaitSwapchainImageRPC = {
             "name" : "acquireInfo",
             "type" : "xr_struct_pointer",
             "struct_type" : "XrSwapchainImageWaitInfo",
-            "is_const" : True
+            "is_const" : True,
+            "restore_handles_in_place" : True
         },
         {
             "name" : "sharedResourceHandle",
             "type" : "POD",
-            "pod_type" : "HANDLE",
+            "pod_type" : "SharedImageHandle",
         },
     ),
     "function" : "OverlaysLayerWaitSwapchainImageMainAsOverlay"
 }
 
-ReleaseSwapchainImageRPC = {
-    "command_name" : "ReleaseSwapchainImage",
-    "args" : (
-        {
-            "name" : "swapchain",
-            "type" : "POD",
-            "pod_type" : "XrSwapchain",
-        },
-        {
-            "name" : "acquireInfo",
-            "type" : "xr_struct_pointer",
-            "struct_type" : "XrSwapchainImageReleaseInfo",
-            "is_const" : True
-        },
-        {
-            "name" : "sharedResourceHandle",
-            "type" : "POD",
-            "pod_type" : "HANDLE",
-        },
-    ),
-    "function" : "OverlaysLayerReleaseSwapchainImageMainAsOverlay"
-}
-
 EnumerateReferenceSpacesRPC = {
     "command_name" : "EnumerateReferenceSpaces",
     "args" : (
@@ -1611,7 +1706,8 @@ LocateViewsRPC = {
             "name" : "viewLocateInfo",
             "type" : "xr_struct_pointer",
             "struct_type" : "XrViewLocateInfo",
-            "is_const" : True
+            "is_const" : True,
+            "restore_handles_in_place" : True
         },
         {
             "name" : "viewState",
@@ -1680,7 +1776,8 @@ DestroySpaceRPC = {
             "pod_type" : "XrSpace",
         },
     ),
-    "function" : "OverlaysLayerDestroySpaceMainAsOverlay"
+    "function" : "OverlaysLayerDestroySpaceMainAsOverlay",
+    "async" : True
 }
 
 DestroySwapchainRPC = {
@@ -1859,10 +1956,12 @@ ApplyHapticFeedbackRPC = {
             "name" : "hapticFeedback",
             "type" : "xr_struct_pointer",
             "struct_type" : "XrHapticBaseHeader",
-            "is_const" : True
+            "is_const" : True,
+            "restore_handles_in_place" : True
         },
     ),
-    "function" : "OverlaysLayerApplyHapticFeedbackMainAsOverlay"
+    "function" : "OverlaysLayerApplyHapticFeedbackMainAsOverlay",
+    "async" : True
 }
 
 StopHapticFeedbackRPC = {
@@ -1893,7 +1992,28 @@ StopHapticFeedbackRPC = {
             "is_const" : True
         },
     ),
-    "function" : "OverlaysLayerStopHapticFeedbackMainAsOverlay"
+    "function" : "OverlaysLayerStopHapticFeedbackMainAsOverlay",
+    "async" : True
+}
+
+# Does nothing in Main; for measuring the RPC transport by itself
+PingRPC = {
+    "command_name" : "Ping",
+    "args" : (
+        {
+            "name" : "payloadSize",
+            "type" : "POD",
+            "pod_type" : "uint32_t",
+        },
+        {
+            "name" : "payload",
+            "type" : "fixed_array",
+            "base_type" : "uint8_t",
+            "input_size" : "payloadSize",
+            "is_const" : True
+        },
+    ),
+    "function" : "OverlaysLayerPingMainAsOverlay",
 }
 
 rpcs = (
@@ -1914,15 +2034,15 @@ rpcs = (
     EndSessionRPC,
     WaitFrameRPC,
     BeginFrameRPC,
-    EndFrameRPC,
+    SubmitFrameRPC,
     AcquireSwapchainImageRPC,
     WaitSwapchainImageRPC,
-    ReleaseSwapchainImageRPC,
     SyncActionsAndGetStateRPC,
     CreateActionSpaceFromBindingRPC,
     GetInputSourceLocalizedNameRPC,
     ApplyHapticFeedbackRPC,
     StopHapticFeedbackRPC,
+    PingRPC,
 )
 
 
@@ -1957,36 +2077,36 @@ def rpc_arg_to_serialize(arg):
         if arg.get("is_const", False):
             return f"""
     dst->{arg["name"]} = IPCSerialize(ipcbuf, header, src->{arg["name"]}); // pointer_to_pod
-    header->addOffsetToPointer(ipcbuf.base, &dst->{arg["name"]});
+    header->addOffsetToPointer(ipcbuf, &dst->{arg["name"]});
 """
         else:
             return f"""
     dst->{arg["name"]} = IPCSerializeNoCopy(ipcbuf, header, src->{arg["name"]}); // pointer_to_pod
-    header->addOffsetToPointer(ipcbuf.base, &dst->{arg["name"]});
+    header->addOffsetToPointer(ipcbuf, &dst->{arg["name"]});
 """
     elif arg["type"] == "fixed_array":
         if arg.get("is_const", False):
             return f"""
     dst->{arg['name']} = IPCSerialize(ipcbuf, header, src->{arg['name']}, src->{arg['input_size']});
-    header->addOffsetToPointer(ipcbuf.base, &dst->{arg['name']});
+    header->addOffsetToPointer(ipcbuf, &dst->{arg['name']});
 """
         else:
             return f"""
     dst->{arg['name']} = IPCSerializeNoCopy(ipcbuf, header, src->{arg['name']}, src->{arg['input_size']});
-    header->addOffsetToPointer(ipcbuf.base, &dst->{arg['name']});
+    header->addOffsetToPointer(ipcbuf, &dst->{arg['name']});
 """
     elif arg["type"] == "xr_struct_pointer":
         copy_type = {True: "COPY_EVERYTHING", False: "COPY_ONLY_TYPE_NEXT"}[arg["is_const"]]
         return f"""
     dst->{arg["name"]} = reinterpret_cast<{arg["struct_type"]}*>(IPCSerialize(instance, ipcbuf, header, reinterpret_cast<const XrBaseInStructure*>(src->{arg["name"]}), {copy_type}));
-    header->addOffsetToPointer(ipcbuf.base, &dst->{arg["name"]});
+    header->addOffsetToPointer(ipcbuf, &dst->{arg["name"]});
 """
     elif arg["type"] == "fixed_xrstruct_array":
         copy_type = {True: "COPY_EVERYTHING", False: "COPY_ONLY_TYPE_NEXT"}[arg["is_const"]]
         return f"""
     if(src->{arg["input_size"]} > 0) {{
         dst->{arg["name"]} = IPCSerialize(instance, ipcbuf, header, src->{arg["name"]}, {copy_type}, src->{arg["input_size"]});
-        header->addOffsetToPointer(ipcbuf.base, &dst->{arg["name"]});
+        header->addOffsetToPointer(ipcbuf, &dst->{arg["name"]});
     }}
 """
     else:
@@ -2055,8 +2175,17 @@ for rpc in rpcs:
 header_text += "enum {\n"
 for rpc in rpcs:
     header_text += "    %(command_enum)s,\n" % rpc
+header_text += "    RPC_XR_REQUEST_TYPE_COUNT,\n"
 header_text += "};\n"
 
+source_text += "\nconst char* RPCRequestTypeName(uint64_t requestType)\n{\n"
+source_text += "    static const char* names[RPC_XR_REQUEST_TYPE_COUNT] = {\n"
+for rpc in rpcs:
+    source_text += "        \"%(command_name)s\",\n" % rpc
+source_text += "    };\n"
+source_text += "    return (requestType < RPC_XR_REQUEST_TYPE_COUNT) ? names[requestType] : \"(unknown)\";\n"
+source_text += "}\n"
+
 rpc_case_bodies = ""
 
 for rpc in rpcs:
@@ -2087,6 +2216,9 @@ struct RPCXr{command_name}
 RPCXr{command_name}* IPCSerialize(XrInstance instance, IPCBuffer& ipcbuf, IPCHeader* header, const RPCXr{command_name}* src)
 {{
     auto dst = new(ipcbuf) RPCXr{command_name};
+    if(!dst) {{
+        return nullptr;
+    }}
 
 {rpc_serialize_members}
 
@@ -2105,37 +2237,137 @@ void IPCCopyOut(RPCXr{command_name}* dst, const RPCXr{command_name}* src)
     else: 
         ipc_copyout_function = ""
 
-    rpc_call_function_proto = f"{command_type} RPCCall{command_name}(XrInstance instance, {served_args_cdecls});\n"
+    rpc_pending_struct = f"""
+// Request published into an RPC slot whose response hasn't been collected yet
+struct RPCPending{command_name}
+{{
+    ConnectionToMain::Channel* channel;
+    uint64_t sequence;
+    IPCHeader* header;
+    RPCXr{command_name} args;
+    RPCXr{command_name}* argsSerialized;
+}};
+"""
+
+    is_async = rpc.get("async", False)
 
-    rpc_call_function = f"""
-{command_type} RPCCall{command_name}(XrInstance instance, {served_args_cdecls})
+    if is_async and (rpc_copyout_members or "command_post" in rpc):
+        raise Exception(f"RPC {command_name} is async but has output parameters or a command_post")
+
+    if is_async:
+        rpc_call_function_proto = f"""XrResult RPCPost{command_name}(XrInstance instance, RPCPending{command_name}& pending, {served_args_cdecls});
+{command_type} RPCCall{command_name}(XrInstance instance, {served_args_cdecls});
+"""
+    else:
+        rpc_call_function_proto = f"""XrResult RPCPost{command_name}(XrInstance instance, RPCPending{command_name}& pending, {served_args_cdecls});
+{command_type} RPCWait{command_name}(XrInstance instance, RPCPending{command_name}& pending);
+{command_type} RPCCall{command_name}(XrInstance instance, {served_args_cdecls});
+"""
+
+    finish_overlay_request = {True: "FinishOverlayAsyncRequest", False: "FinishOverlayRequest"}[is_async]
+    record_async_sequence = {True: "    channel.lastAsyncSequence.store(pending.sequence);\n", False: ""}[is_async]
+
+    rpc_post_function = f"""
+XrResult RPCPost{command_name}(XrInstance instance, RPCPending{command_name}& pending, {served_args_cdecls})
 {{
+    ConnectionToMain::Channel& channel = gConnectionToMain->GetChannelForThisThread();
+    RPCChannels& conn = channel.conn;
+    pending.channel = &channel;
+
+    uint64_t startNanoseconds = IPCGetTimestampNanoseconds();
+
+    XrResult orderResult = gConnectionToMain->WaitForAsyncOnOtherChannels(channel);
+    if(orderResult != XR_SUCCESS) {{
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+            OverlaysLayerNoObjectInfo, "couldn't RPC {command_name} to main process.");
+        return orderResult;
+    }}
+
+    pending.sequence = conn.BeginOverlayRequest();
+    if(pending.sequence == 0) {{
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+            OverlaysLayerNoObjectInfo, "couldn't get an RPC slot for {command_name}; too many requests in flight or main process is gone.");
+        return XR_ERROR_LIMIT_REACHED;
+    }}
+
     // Create a header for RPC
-    std::unique_lock<std::mutex> ipcLock(gIPCMutex);
-    IPCBuffer ipcbuf = gConnectionToMain->conn.GetIPCBuffer();
-    IPCHeader* header = new(ipcbuf) IPCHeader{{ {rpc["command_enum"]} }};
+    IPCBuffer ipcbuf = conn.GetSlotIPCBuffer(pending.sequence);
+    pending.header = new(ipcbuf) IPCHeader{{ {rpc["command_enum"]}, pending.sequence, conn.PointersAreShared(), ipcbuf.size }};
+
+    pending.args = RPCXr{command_name} {{ {rpc_arguments_list} }};
+    pending.argsSerialized = IPCSerialize(instance, ipcbuf, pending.header, &pending.args);
+
+    if(ipcbuf.overflowAllocationFailed) {{
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+            OverlaysLayerNoObjectInfo, "couldn't allocate memory to measure RPC {command_name} request.");
+        return XR_ERROR_OUT_OF_MEMORY;
+    }}
+
+    conn.requestHighWater = std::max(conn.requestHighWater, ipcbuf.bytesNeeded());
+
+    // Too big for the slot, so serialize again into the slot's overflow segment
+    if(ipcbuf.overflowed()) {{
+        if(!conn.PrepareOverflowIPCBuffer(pending.sequence, pending.header, ipcbuf)) {{
+            OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+                OverlaysLayerNoObjectInfo, fmt("RPC {command_name} request needs %zu bytes, couldn't get an overflow segment that big (limit is %zu): %s",
+                    ipcbuf.bytesNeeded(), RPCChannels::maxOverflowSize, IPCGetLastErrorString().c_str()).c_str());
+            return XR_ERROR_OUT_OF_MEMORY;
+        }}
+        pending.argsSerialized = IPCSerialize(instance, ipcbuf, pending.header, &pending.args);
+    }}
 
-    RPCXr{command_name} args {{ {rpc_arguments_list} }};
-    RPCXr{command_name}* argsSerialized = IPCSerialize(instance, ipcbuf, header, &args);
+    if(!pending.argsSerialized || ipcbuf.overflowed() || ipcbuf.overflowAllocationFailed) {{
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+            OverlaysLayerNoObjectInfo, "couldn't serialize RPC {command_name} request.");
+        return XR_ERROR_OUT_OF_MEMORY;
+    }}
 
     // XXX substitute handles in input XR structs 
 
     // Make pointers relative in anticipation of RPC (who will make them absolute, work on them, then make them relative again)
-    header->makePointersRelative(ipcbuf.base);
+    pending.header->makePointersRelative(ipcbuf.base);
+
+    pending.header->postedNanoseconds = IPCGetTimestampNanoseconds();
+    RPCRecordLatency({rpc["command_enum"]}, RPC_PHASE_SERIALIZE, pending.header->postedNanoseconds - startNanoseconds);
 
     // Release Main process to do our work
-    gConnectionToMain->conn.FinishOverlayRequest();
+    conn.{finish_overlay_request}(pending.sequence);
+{record_async_sequence}
+    return XR_SUCCESS;
+}}
+"""
+
+    rpc_wait_function = f"""
+{command_type} RPCWait{command_name}(XrInstance instance, RPCPending{command_name}& pending)
+{{
+    RPCChannels& conn = pending.channel->conn;
 
     // Wait for Main to report to us it has done the work
-    bool success = gConnectionToMain->conn.WaitForMainResponseOrFail();
-    if(!success) {{
+    RPCChannels::WaitResult waitResult = conn.WaitForMainResponseOrFail(pending.sequence);
+    if(waitResult == RPCChannels::MAIN_PROCESS_TERMINATED_GRACEFULLY) {{
+        // Main stopped serving this connection, e.g. after xrDestroySession on another thread
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+            OverlaysLayerNoObjectInfo, "main process closed the connection before serving {command_name}.");
+        return XR_ERROR_SESSION_LOST;
+    }}
+    if(waitResult != RPCChannels::MAIN_RESPONSE_READY) {{
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
             OverlaysLayerNoObjectInfo, "couldn't RPC {command_name} to main process.");
         return XR_ERROR_INITIALIZATION_FAILED;
     }}
 
+    uint64_t responseNanoseconds = IPCGetTimestampNanoseconds();
+    if(pending.header->serveEndNanoseconds != 0) {{
+        RPCRecordLatency({rpc["command_enum"]}, RPC_PHASE_WAKE,
+            (pending.header->serveStartNanoseconds - pending.header->postedNanoseconds) + (responseNanoseconds - pending.header->serveEndNanoseconds));
+        RPCRecordLatency({rpc["command_enum"]}, RPC_PHASE_SERVICE, pending.header->serveEndNanoseconds - pending.header->serveStartNanoseconds);
+    }}
+
+    IPCBuffer ipcbuf = conn.GetSlotIPCBuffer(pending.sequence);
+    conn.GetRequestIPCBuffer(pending.sequence, pending.header, ipcbuf);
+
     // Set pointers absolute so they are valid in our process space again
-    header->makePointersAbsolute(ipcbuf.base);
+    pending.header->makePointersAbsolute(ipcbuf.base);
 
     // is this necessary?  Are events the only structs that need handles substituted back to local?
     // for now, yes, only sessions, but eventually space and swapchain will need to be made local
@@ -2143,32 +2375,100 @@ void IPCCopyOut(RPCXr{command_name}* dst, const RPCXr{command_name}* src)
 """
 
     if ipc_copyout_function:
-        rpc_call_function += f"""
+        rpc_wait_function += f"""
     // Copy anything that were "output" parameters into the command arguments
-    if(header->result == XR_SUCCESS) {{ // XXX Some other codes may indicate qualified success, requiring CopyOut
-        IPCCopyOut(&args, argsSerialized);
+    if(pending.header->result == XR_SUCCESS) {{ // XXX Some other codes may indicate qualified success, requiring CopyOut
+        IPCCopyOut(&pending.args, pending.argsSerialized);
     }}
 """
 
     if "command_post" in rpc:
-        rpc_call_function += f"""
-    if(XR_SUCCEEDED(header->result)) {{
+        rpc_wait_function += f"""
+    if(XR_SUCCEEDED(pending.header->result)) {{
         {rpc["command_post"]}
     }}
 """
 
-    rpc_call_function += """
-    return header->result;
+    rpc_wait_function += f"""
+    XrResult result = pending.header->result;
+
+    RPCRecordLatency({rpc["command_enum"]}, RPC_PHASE_COPY_OUT, IPCGetTimestampNanoseconds() - responseNanoseconds);
+"""
+
+    rpc_wait_function += """
+    conn.RetireOverlayRequest(pending.sequence);
+
+    // Main serves requests in order, so any earlier asynchronous requests are done too
+    if(conn.CollectAsyncResponses(pending.sequence) != RPCChannels::MAIN_RESPONSE_READY) {
+        return XR_ERROR_INITIALIZATION_FAILED;
+    }
+
+    // An earlier asynchronous request's failure replaces this request's
+    // result if this one succeeded, including qualified successes like
+    // XR_FRAME_DISCARDED; if this one failed, its own error is returned
+    // and the asynchronous failure waits for the next synchronous RPC
+    if(XR_SUCCEEDED(result)) {
+        XrResult deferredResult = conn.TakeDeferredAsyncResult();
+        if(!XR_SUCCEEDED(deferredResult)) {
+            result = deferredResult;
+        }
+    }
+
+    RPCLogLatencyHistogramsIfDue(instance, "Overlay");
+
+    return result;
 }
 """
 
+    if is_async:
+        rpc_wait_function = ""
+        rpc_call_function = f"""
+{command_type} RPCCall{command_name}(XrInstance instance, {served_args_cdecls})
+{{
+    auto ipcLock = gConnectionToMain->LockChannelForThisThread();
+
+    // Don't wait for Main; a failure is returned from the next
+    // synchronous RPC on this thread's channel that otherwise succeeds
+    RPCPending{command_name} pending;
+    return RPCPost{command_name}(instance, pending, {rpc_arguments_list});
+}}
+"""
+    else:
+        rpc_call_function = f"""
+{command_type} RPCCall{command_name}(XrInstance instance, {served_args_cdecls})
+{{
+    auto ipcLock = gConnectionToMain->LockChannelForThisThread();
+
+    RPCPending{command_name} pending;
+    XrResult result = RPCPost{command_name}(instance, pending, {rpc_arguments_list});
+    if(result != XR_SUCCESS) {{
+        return result;
+    }}
+
+    return RPCWait{command_name}(instance, pending);
+}}
+"""
+
+    restore_in_place = ""
+    for arg in rpc["args"]:
+        if arg.get("restore_handles_in_place", False):
+            restore_in_place += f"""    if(!RestoreActualHandles(connection->channels[0].instance, reinterpret_cast<XrBaseInStructure*>(const_cast<{arg["struct_type"]}*>(args->{arg["name"]})))) {{
+        return XR_ERROR_HANDLE_INVALID;
+    }}
+"""
+    if restore_in_place:
+        restore_in_place = """
+    // The request owns its buffer until it is answered, so handles are
+    // restored where they were serialized instead of in another copy
+""" + restore_in_place
+
     rpc_service_function = f"""
 XrResult RPCServe{command_name}(
     ConnectionToOverlay::Ptr        connection,
     RPCXr{command_name}*              args)
 {{
     // potential connection related goop
-
+{restore_in_place}
     XrResult result = {rpc["function"]}(connection, {served_args});
 
     // potential hand-written completion, checking return value and possibly overwriting result
@@ -2185,19 +2485,22 @@ XrResult RPCServe{command_name}(
         }}
 """
 
+    header_text += rpc_args_struct
+    header_text += rpc_pending_struct
     header_text += rpc_call_function_proto
 
-    source_text += rpc_args_struct
     source_text += ipc_serialize_function
     if ipc_copyout_function:
         source_text += ipc_copyout_function
+    source_text += rpc_post_function
+    source_text += rpc_wait_function
     source_text += rpc_call_function
     source_text += rpc_service_function
 
 
 header_text += "bool ProcessOverlayRequestOrReturnConnectionLost(ConnectionToOverlay::Ptr connection, IPCBuffer &ipcbuf, IPCHeader *hdr);\n"
 source_text += f"""
-bool ProcessOverlayRequestOrReturnConnectionLost(ConnectionToOverlay::Ptr connection, IPCBuffer &ipcbuf, IPCHeader *hdr)
+static bool DispatchOverlayRequestOrReturnConnectionLost(ConnectionToOverlay::Ptr connection, IPCBuffer &ipcbuf, IPCHeader *hdr)
 {{
     try{{
         switch(hdr->requestType) {{
@@ -2230,9 +2533,21 @@ source_text += f"""
 
     }}
 }}
-"""
 
-# XXX temporary stubs
+bool ProcessOverlayRequestOrReturnConnectionLost(ConnectionToOverlay::Ptr connection, IPCBuffer &ipcbuf, IPCHeader *hdr)
+{{
+    hdr->serveStartNanoseconds = IPCGetTimestampNanoseconds();
+
+    bool success = DispatchOverlayRequestOrReturnConnectionLost(connection, ipcbuf, hdr);
+
+    hdr->serveEndNanoseconds = IPCGetTimestampNanoseconds();
+    RPCRecordLatency(hdr->requestType, RPC_PHASE_SERVICE, hdr->serveEndNanoseconds - hdr->serveStartNanoseconds);
+
+    return success;
+}}
+"""
+
+# XXX temporary stubs
 stub_em = (
 
     "SessionBeginDebugUtilsLabelRegionEXT",
@@ -2284,9 +2599,15 @@ def get_code_to_restore_handle(member, instance_string, accessor_prefix):
         if member["struct_type"] in handles_needing_substitution:
             return f"""
             // array of {member["struct_type"]} for {name}
-            for(uint32_t i = 0; i < {accessor_prefix}{member["size"]}; i++) {{
-                auto info = {layer_name}GetHandleInfoFrom{member["struct_type"]}({accessor_prefix}{member["name"]}[i]);
-                (({member["struct_type"]}*){accessor_prefix}{member["name"]})[i] = info->actualHandle;
+            {{
+                EpochReadGuard guard;
+                for(uint32_t i = 0; i < {accessor_prefix}{member["size"]}; i++) {{
+                    {layer_name}{member["struct_type"]}HandleInfo* info;
+                    if({layer_name}TryBorrowHandleInfoFrom{member["struct_type"]}({accessor_prefix}{member["name"]}[i], &info) != XR_SUCCESS) {{
+                        return false;
+                    }}
+                    (({member["struct_type"]}*){accessor_prefix}{member["name"]})[i] = info->actualHandle;
+                }}
             }}
 """
         else:
@@ -2313,7 +2634,11 @@ def get_code_to_restore_handle(member, instance_string, accessor_prefix):
         if member["pod_type"] in handles_needing_substitution:
             return f"""
                 {{
-                    auto info = {layer_name}GetHandleInfoFrom{member["pod_type"]}({accessor_prefix}{member["name"]});
+                    EpochReadGuard guard;
+                    {layer_name}{member["pod_type"]}HandleInfo* info;
+                    if({layer_name}TryBorrowHandleInfoFrom{member["pod_type"]}({accessor_prefix}{member["name"]}, &info) != XR_SUCCESS) {{
+                        return false;
+                    }}
                     {accessor_prefix}{member["name"]} = info->actualHandle;
                 }}
 """
@@ -2353,7 +2678,9 @@ def get_code_to_substitute_handle(member, instance_string, accessor_prefix):
         return f"""
             // array of pointers to XR structs for {name}
             for(uint32_t i = 0; i < {accessor_prefix}{member["size"]}; i++) {{
-                SubstituteLocalHandles({instance_string}, (XrBaseOutStructure *){accessor_prefix}{member["name"]}[i]);
+                if(!SubstituteLocalHandles({instance_string}, (XrBaseOutStructure *){accessor_prefix}{member["name"]}[i])) {{
+                    return false;
+                }}
             }}
 """
     elif member["type"] == "pointer_to_struct":
@@ -2363,12 +2690,12 @@ def get_code_to_substitute_handle(member, instance_string, accessor_prefix):
             return f"""
             // array of {member["struct_type"]} for {name}
             for(uint32_t i = 0; i < {accessor_prefix}{member["size"]}; i++) {{
-                std::unique_lock<std::recursive_mutex> lock(gActual{member["struct_type"]}ToLocalHandleMutex);
+                std::unique_lock<ProfiledMutex> lock(gActual{member["struct_type"]}ToLocalHandleMutex);
                 auto it = gActual{member["struct_type"]}ToLocalHandle.find({accessor_prefix}{member["name"]}[i]);
                 if(it == gActual{member["struct_type"]}ToLocalHandle.end()) {{
                     OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
                         OverlaysLayerNoObjectInfo, fmt("Could not look up local handle for {member["struct_type"]} handle %llX", {accessor_prefix}{member["name"]}).c_str());
-                    throw OverlaysLayerXrException(XR_ERROR_HANDLE_INVALID);
+                    return false;
                 }}
                 (({member["struct_type"]}*){accessor_prefix}{member["name"]})[i] = gActual{member["struct_type"]}ToLocalHandle.at({accessor_prefix}{member["name"]}[i]);
             }}
@@ -2381,7 +2708,9 @@ def get_code_to_substitute_handle(member, instance_string, accessor_prefix):
             return f"""
                 // pointer to XR structs for {name}
                 for(uint32_t i = 0; i < {accessor_prefix}{member["size"]}; i++) {{
-                    SubstituteLocalHandles({instance_string}, ({member["struct_type"]}*)&{accessor_prefix}{member["name"]}[i]);
+                    if(!SubstituteLocalHandles({instance_string}, ({member["struct_type"]}*)&{accessor_prefix}{member["name"]}[i])) {{
+                        return false;
+                    }}
                 }}
 """
         else:
@@ -2396,12 +2725,12 @@ def get_code_to_substitute_handle(member, instance_string, accessor_prefix):
         if member["pod_type"] in handles_needing_substitution:
             return f"""
                 {{
-                    std::unique_lock<std::recursive_mutex> lock(gActual{member["pod_type"]}ToLocalHandleMutex);
+                    std::unique_lock<ProfiledMutex> lock(gActual{member["pod_type"]}ToLocalHandleMutex);
                     auto it = gActual{member["pod_type"]}ToLocalHandle.find({accessor_prefix}{member["name"]});
                     if(it == gActual{member["pod_type"]}ToLocalHandle.end()) {{
                         OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
                             OverlaysLayerNoObjectInfo, fmt("Could not look up local handle for {member["pod_type"]} handle %llX", {accessor_prefix}{member["name"]}).c_str());
-                        throw OverlaysLayerXrException(XR_ERROR_HANDLE_INVALID);
+                        return false;
                     }}
                     {accessor_prefix}{member["name"]} = gActual{member["pod_type"]}ToLocalHandle.at({accessor_prefix}{member["name"]});
                 }}
@@ -2411,13 +2740,17 @@ def get_code_to_substitute_handle(member, instance_string, accessor_prefix):
     elif member["type"] == "xr_simple_struct":
         return f"""
             // Expect this to find function with signature by type
-            SubstituteLocalHandles({instance_string}, &{accessor_prefix}{member["name"]});
+            if(!SubstituteLocalHandles({instance_string}, &{accessor_prefix}{member["name"]})) {{
+                return false;
+            }}
 """
     elif member["type"] == "pointer_to_xr_struct_array":
         return f"""
             // pointer to XR structs for {name}
             for(uint32_t i = 0; i < {accessor_prefix}{member["size"]}; i++) {{
-                SubstituteLocalHandles({instance_string}, (XrBaseOutStructure *)&{accessor_prefix}{member["name"]}[i]);
+                if(!SubstituteLocalHandles({instance_string}, (XrBaseOutStructure *)&{accessor_prefix}{member["name"]}[i])) {{
+                    return false;
+                }}
             }}
 """
 
@@ -2425,13 +2758,58 @@ def get_code_to_substitute_handle(member, instance_string, accessor_prefix):
 
 
 
-copy_function_case_bodies = ""
+# True if a struct of this type holds an XrSession, XrSwapchain, or XrSpace
+# in its own members or in members whose struct type is fixed.  Members
+# that are arrays of chained structs can hold anything and are checked at
+# runtime by XrStructChainContainsSubstitutableHandles().
+struct_has_substitutable_handles_cache = {}
+
+def struct_has_substitutable_handles(name):
+    if name in struct_has_substitutable_handles_cache:
+        return struct_has_substitutable_handles_cache[name]
+    struct_has_substitutable_handles_cache[name] = False # no struct contains itself, but don't recurse forever
+    result = False
+    for member in structs[name][3]:
+        if member["type"] == "POD":
+            result = result or member["pod_type"] in handles_needing_substitution
+        elif member["type"] == "pointer_to_atom_or_handle":
+            result = result or member["struct_type"] in handles_needing_substitution
+        elif member["type"] == "xr_simple_struct":
+            result = result or struct_has_substitutable_handles(member["struct_type"])
+        elif member["type"] == "pointer_to_struct_array" and member["struct_type"] in structs:
+            result = result or struct_has_substitutable_handles(member["struct_type"])
+    struct_has_substitutable_handles_cache[name] = result
+    return result
+
+def get_code_to_check_for_substitutable_handles(member, accessor_prefix):
+    if member["type"] == "list_of_struct_pointers":
+        return f"""
+                for(uint32_t i = 0; i < {accessor_prefix}{member["size"]}; i++) {{
+                    if(XrStructChainContainsSubstitutableHandles(reinterpret_cast<const XrBaseInStructure*>({accessor_prefix}{member["name"]}[i]))) {{
+                        return true;
+                    }}
+                }}
+"""
+    elif member["type"] == "pointer_to_xr_struct_array":
+        return f"""
+                for(uint32_t i = 0; i < {accessor_prefix}{member["size"]}; i++) {{
+                    if(XrStructChainContainsSubstitutableHandles(reinterpret_cast<const XrBaseInStructure*>(&{accessor_prefix}{member["name"]}[i]))) {{
+                        return true;
+                    }}
+                }}
+"""
+    return ""
+
+# Structs with IPCCopyOutMembers() above
+ipc_copyout_struct_types = ['XrSpaceLocation', 'XrSpaceVelocity', 'XrGraphicsRequirementsD3D11KHR', 'XrFrameState', 'XrInstanceProperties',
+    'XrExtensionProperties', 'XrSystemProperties', 'XrViewConfigurationProperties', 'XrViewConfigurationView', 'XrView', 'XrViewState']
+ipc_copyout_struct_types = [name for name in ipc_copyout_struct_types if name in structs]
 
-free_function_case_bodies = ""
+struct_type_info_entries = ""
 
-restore_handles_case_bodies = ""
+copy_function_entries = ""
 
-substitute_handles_case_bodies = ""
+free_function_entries = ""
 
 
 for name in xr_simple_structs:
@@ -2450,7 +2828,7 @@ for name in xr_simple_structs:
 }}
 """
 
-    substitute_handles_function_prototype = f"void SubstituteLocalHandles(XrInstance instance, {name} *xrstruct)"
+    substitute_handles_function_prototype = f"bool SubstituteLocalHandles(XrInstance instance, {name} *xrstruct)"
     substitute_handles_function_header = f"{substitute_handles_function_prototype};\n"
     substitute_handles_function_source = f"""
 {substitute_handles_function_prototype}
@@ -2459,6 +2837,7 @@ for name in xr_simple_structs:
     for member in struct[3]:
         substitute_handles_function_source += get_code_to_substitute_handle(member, "instance", "xrstruct->")
     substitute_handles_function_source += f"""
+    return true;
 }}
 """
 
@@ -2468,34 +2847,108 @@ for name in xr_simple_structs:
     header_text += substitute_handles_function_header
 
 
+def get_code_to_compare_member(member):
+    if member["type"] == "char_array":
+        return "    if(memcmp(a->%(name)s, b->%(name)s, %(size)s) != 0) return false;\n" % member
+    elif member["type"] == "c_string":
+        return "    if((a->%(name)s == nullptr) != (b->%(name)s == nullptr) || (a->%(name)s && strcmp(a->%(name)s, b->%(name)s) != 0)) return false;\n" % member
+    elif member["type"] == "string_list":
+        return """    for(uint32_t i = 0; i < a->%(size)s; i++) {
+        if(strcmp(a->%(name)s[i], b->%(name)s[i]) != 0) return false;
+    }
+""" % member
+    elif member["type"] == "list_of_struct_pointers":
+        return """    for(uint32_t i = 0; i < a->%(size)s; i++) {
+        if(!XrStructChainEquals(reinterpret_cast<const XrBaseInStructure*>(a->%(name)s[i]), reinterpret_cast<const XrBaseInStructure*>(b->%(name)s[i]))) return false;
+    }
+""" % member
+    elif member["type"] == "pointer_to_struct":
+        if member["struct_type"] in special_functions:
+            return "    if(a->%(name)s != b->%(name)s) return false;\n" % member
+        return ""
+    elif member["type"] in ("pointer_to_atom_or_handle", "pointer_to_struct_array"):
+        return "    if((a->%(size)s > 0) && memcmp(a->%(name)s, b->%(name)s, sizeof(%(struct_type)s) * a->%(size)s) != 0) return false;\n" % member
+    elif member["type"] == "pointer_to_xr_struct_array":
+        return """    for(uint32_t i = 0; i < a->%(size)s; i++) {
+        if(!XrStructChainEquals(reinterpret_cast<const XrBaseInStructure*>(&a->%(name)s[i]), reinterpret_cast<const XrBaseInStructure*>(&b->%(name)s[i]))) return false;
+    }
+""" % member
+    elif member["type"] == "void_pointer":
+        if member["name"] == "next":
+            return ""
+        return "    if(a->%(name)s != b->%(name)s) return false;\n" % member
+    elif member["type"] == "fixed_array":
+        if member["base_type"] == "char":
+            # Only the string; IPCCopyOut copies no further than its terminator
+            return "    if(strncmp(a->%(name)s, b->%(name)s, %(size)s) != 0) return false;\n" % member
+        return "    if(memcmp(a->%(name)s, b->%(name)s, sizeof(%(base_type)s) * %(size)s) != 0) return false;\n" % member
+    elif member["type"] == "POD":
+        return "    if(memcmp(&a->%(name)s, &b->%(name)s, sizeof(a->%(name)s)) != 0) return false;\n" % member
+    elif member["type"] == "xr_simple_struct":
+        if member["struct_type"] in supported_structs:
+            return "    if(!XrStructMembersEqual(&a->%(name)s, &b->%(name)s)) return false;\n" % member
+        return "    if(memcmp(&a->%(name)s, &b->%(name)s, sizeof(a->%(name)s)) != 0) return false;\n" % member
+    return ""
+
+# Compare what CopyXrStructChain copies, member by member, not following "next"
+for name in supported_structs:
+    source_text += f"static bool XrStructMembersEqual(const {name}* a, const {name}* b);\n"
+
+for name in supported_structs:
+    struct = structs[name]
+    source_text += f"""
+static bool XrStructMembersEqual(const {name}* a, const {name}* b)
+{{
+"""
+    for member in struct[3]:
+        source_text += get_code_to_compare_member(member)
+    source_text += """    return true;
+}
+"""
+
+
+source_text += """
+template <class Allocator>
+XrBaseInStructure *CopyXrStructChain(XrInstance instance, const XrBaseInStructure* srcbase, CopyType copyType, Allocator& allocator);
+
+template <class Deallocator>
+void FreeXrStructChain(XrInstance instance, const XrBaseInStructure* p, Deallocator& deallocator);
+"""
+
 for name in xr_typed_structs:
     struct = structs[name]
 
     copy_function = """
-bool CopyXrStructChain(XrInstance instance, const %(name)s* src, %(name)s *dst, CopyType copyType, AllocateFunc alloc, std::function<void (void* pointerToPointer)> addOffsetToPointer)
+template <class Allocator>
+bool CopyXrStructChain(XrInstance instance, const %(name)s* src, %(name)s *dst, CopyType copyType, Allocator& allocator)
 {
 """ % {"name" : struct[0]}
 
     free_function = """
-void FreeXrStructChain(XrInstance instance, const %(name)s* p, FreeFunc freefunc)
+template <class Deallocator>
+void FreeXrStructChain(XrInstance instance, const %(name)s* p, Deallocator& deallocator)
 {
 """ % {"name" : struct[0]}
 
-    restore_handles_case_bodies += f"""
-            case {struct[1]}: {{
-                auto p = reinterpret_cast<{name}*>(xrstruct);
-"""
+    # Bytes allocated by the CopyXrStructChain above for everything %(name)s
+    # points to, each allocation padded the way IPCBuffer pads them
+    size_function = """
+size_t XrStructChainSerializedSize(XrInstance instance, const %(name)s* src)
+{
+    size_t size = 0;
+""" % {"name" : struct[0]}
 
-    substitute_handles_case_bodies += f"""
-            case {struct[1]}: {{
-                auto p = reinterpret_cast<{name}*>(xrstruct);
-"""
+    restore_handles_body = ""
+
+    substitute_handles_body = ""
+
+    contains_handles_checks = "".join([get_code_to_check_for_substitutable_handles(member, "p->") for member in struct[3]])
 
     for member in struct[3]:
 
-        restore_handles_case_bodies += f'/* {member["type"]} {member["name"]} */' + get_code_to_restore_handle(member, "instance", "p->")
+        restore_handles_body += f'/* {member["type"]} {member["name"]} */' + get_code_to_restore_handle(member, "instance", "p->")
 
-        substitute_handles_case_bodies += get_code_to_substitute_handle(member, "instance", "p->");
+        substitute_handles_body += get_code_to_substitute_handle(member, "instance", "p->");
 
         if member["type"] == "char_array":
 
@@ -2503,22 +2956,24 @@ void FreeXrStructChain(XrInstance instance, const %(name)s* p, FreeFunc freefunc
 
         elif member["type"] == "c_string":
 
-            copy_function += "    char *%(name)s = (char *)alloc(strlen(src->%(name)s) + 1);\n" % member
-            copy_function += "    memcpy(%(name)s, src->%(name)s, strlen(src->%(name)s + 1));\n" % member
+            copy_function += "    char *%(name)s = (char *)allocator.allocate(strlen(src->%(name)s) + 1);\n" % member
+            copy_function += "    memcpy(%(name)s, src->%(name)s, strlen(src->%(name)s) + 1);\n" % member
             copy_function += "    dst->%(name)s = %(name)s;\n" % member
-            free_function += "    freefunc(p->%(name)s);\n" % member
+            copy_function += "    allocator.addOffsetToPointer(&dst->%(name)s);\n" % member
+            free_function += "    deallocator.deallocate(p->%(name)s);\n" % member
+            size_function += "    size += pad(strlen(src->%(name)s) + 1);\n" % member
 
         elif member["type"] == "string_list":
 
             copy_function += """    
     // array of pointers to C strings for %(name)s
-    auto %(name)s = (char **)alloc(sizeof(char *) * src->%(size)s);
+    auto %(name)s = (char **)allocator.allocate(sizeof(char *) * src->%(size)s);
     dst->%(name)s = %(name)s;
-    addOffsetToPointer(&dst->%(name)s);
+    allocator.addOffsetToPointer(&dst->%(name)s);
     for(uint32_t i = 0; i < dst->%(size)s; i++) {
-        %(name)s[i] = (char *)alloc(strlen(src->%(name)s[i]) + 1);
+        %(name)s[i] = (char *)allocator.allocate(strlen(src->%(name)s[i]) + 1);
         strncpy_s(%(name)s[i], strlen(src->%(name)s[i]) + 1, src->%(name)s[i], strlen(src->%(name)s[i]) + 1);
-        addOffsetToPointer(&%(name)s[i]);
+        allocator.addOffsetToPointer(&%(name)s[i]);
     }
 
 """ % member
@@ -2526,22 +2981,29 @@ void FreeXrStructChain(XrInstance instance, const %(name)s* p, FreeFunc freefunc
             free_function += """    
     // array of pointers to C strings for %(name)s
     for(uint32_t i = 0; i < p->%(size)s; i++) {
-        freefunc(p->%(name)s[i]);
+        deallocator.deallocate(p->%(name)s[i]);
     }
-    freefunc(p->%(name)s);
+    deallocator.deallocate(p->%(name)s);
+
+""" % member
 
+            size_function += """
+    size += pad(sizeof(char *) * src->%(size)s);
+    for(uint32_t i = 0; i < src->%(size)s; i++) {
+        size += pad(strlen(src->%(name)s[i]) + 1);
+    }
 """ % member
 
         elif member["type"] == "list_of_struct_pointers":
 
             copy_function += """    
     // array of pointers to XR structs for %(name)s
-    auto %(name)s = (%(struct_type)s **)alloc(sizeof(%(struct_type)s) * src->%(size)s);
+    auto %(name)s = (%(struct_type)s **)allocator.allocate(sizeof(%(struct_type)s *) * src->%(size)s);
     dst->%(name)s = %(name)s;
-    addOffsetToPointer(&dst->%(name)s);
+    allocator.addOffsetToPointer(&dst->%(name)s);
     for(uint32_t i = 0; i < dst->%(size)s; i++) {
-        %(name)s[i] = reinterpret_cast<%(struct_type)s *>(CopyXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(src->%(name)s[i]), copyType, alloc, addOffsetToPointer));
-        addOffsetToPointer(&%(name)s[i]);
+        %(name)s[i] = reinterpret_cast<%(struct_type)s *>(CopyXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(src->%(name)s[i]), copyType, allocator));
+        allocator.addOffsetToPointer(&%(name)s[i]);
     }
 
 """ % member
@@ -2549,10 +3011,17 @@ void FreeXrStructChain(XrInstance instance, const %(name)s* p, FreeFunc freefunc
             free_function += """    
     // array of pointers to XR structs for %(name)s
     for(uint32_t i = 0; i < p->%(size)s; i++) {
-        freefunc(p->%(name)s[i]);
+        FreeXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(p->%(name)s[i]), deallocator);
     }
-    freefunc(p->%(name)s);
+    deallocator.deallocate(p->%(name)s);
 
+""" % member
+
+            size_function += """
+    size += pad(sizeof(%(struct_type)s *) * src->%(size)s);
+    for(uint32_t i = 0; i < src->%(size)s; i++) {
+        size += XrStructChainSerializedSize(instance, reinterpret_cast<const XrBaseInStructure*>(src->%(name)s[i]));
+    }
 """ % member
 
         elif member["type"] == "pointer_to_struct":
@@ -2569,21 +3038,22 @@ void FreeXrStructChain(XrInstance instance, const %(name)s* p, FreeFunc freefunc
 
         elif member["type"] == "pointer_to_atom_or_handle":
 
-            copy_function += "    %(struct_type)s *%(name)s = reinterpret_cast<%(struct_type)s*>(alloc(sizeof(%(struct_type)s) * src->%(size)s));\n" % member
+            copy_function += "    %(struct_type)s *%(name)s = reinterpret_cast<%(struct_type)s*>(allocator.allocate(sizeof(%(struct_type)s) * src->%(size)s));\n" % member
             copy_function += "    memcpy(%(name)s, src->%(name)s, sizeof(%(struct_type)s) * src->%(size)s);\n" % member
             copy_function += "    dst->%(name)s = %(name)s;\n" % member
-            copy_function += "    addOffsetToPointer(&dst->%(name)s);\n" % member
-            free_function += "    freefunc(p->%(name)s);\n" % member
+            copy_function += "    allocator.addOffsetToPointer(&dst->%(name)s);\n" % member
+            free_function += "    deallocator.deallocate(p->%(name)s);\n" % member
+            size_function += "    size += pad(sizeof(%(struct_type)s) * src->%(size)s);\n" % member
 
         elif member["type"] == "pointer_to_xr_struct_array":
 
             copy_function += """
     // Lay down %(name)s...
-    auto %(name)s = (%(struct_type)s*)alloc(sizeof(%(struct_type)s) * src->%(size)s);
+    auto %(name)s = (%(struct_type)s*)allocator.allocate(sizeof(%(struct_type)s) * src->%(size)s);
     dst->%(name)s = %(name)s;
-    addOffsetToPointer(&dst->%(name)s);
+    allocator.addOffsetToPointer(&dst->%(name)s);
     for(uint32_t i = 0; i < dst->%(size)s; i++) {
-        bool result = CopyXrStructChain(instance, &src->%(name)s[i], &%(name)s[i], copyType, alloc, addOffsetToPointer);
+        bool result = CopyXrStructChain(instance, &src->%(name)s[i], &%(name)s[i], copyType, allocator);
         if(!result) {
             return result;
         }
@@ -2591,15 +3061,27 @@ void FreeXrStructChain(XrInstance instance, const %(name)s* p, FreeFunc freefunc
 """ % member
 
             free_function += """
-    freefunc(p->%(name)s);
+    for(uint32_t i = 0; i < p->%(size)s; i++) {
+        FreeXrStructChain(instance, &p->%(name)s[i], deallocator);
+    }
+    deallocator.deallocate(p->%(name)s);
+""" % member
+
+            size_function += """
+    size += pad(sizeof(%(struct_type)s) * src->%(size)s);
+    for(uint32_t i = 0; i < src->%(size)s; i++) {
+        size += XrStructChainSerializedSize(instance, &src->%(name)s[i]);
+    }
 """ % member
 
 
         elif member["type"] == "pointer_to_struct_array":
-            copy_function += "    %(struct_type)s *%(name)s = reinterpret_cast<%(struct_type)s*>(alloc(sizeof(%(struct_type)s) * src->%(size)s));\n" % member
+            copy_function += "    %(struct_type)s *%(name)s = reinterpret_cast<%(struct_type)s*>(allocator.allocate(sizeof(%(struct_type)s) * src->%(size)s));\n" % member
             copy_function += "    memcpy(%(name)s, src->%(name)s, sizeof(%(struct_type)s) * src->%(size)s);\n" % member
             copy_function += "    dst->%(name)s = %(name)s;\n" % member
-            free_function += "    freefunc(p->%(name)s);\n" % member
+            copy_function += "    allocator.addOffsetToPointer(&dst->%(name)s);\n" % member
+            free_function += "    deallocator.deallocate(p->%(name)s);\n" % member
+            size_function += "    size += pad(sizeof(%(struct_type)s) * src->%(size)s);\n" % member
         elif member["type"] == "pointer_to_opaque":
             copy_function += "    // XXX opaque %s* %s\n" % (member["opaque_type"], member["name"])
             free_function += "    // XXX opaque %s* %s\n" % (member["opaque_type"], member["name"])
@@ -2623,145 +3105,433 @@ void FreeXrStructChain(XrInstance instance, const %(name)s* p, FreeFunc freefunc
 
 
     copy_function += """
-    dst->next = reinterpret_cast<XrBaseInStructure*>(CopyXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(src->next), copyType, alloc, addOffsetToPointer));
+    dst->next = reinterpret_cast<XrBaseInStructure*>(CopyXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(src->next), copyType, allocator));
     if(dst->next) {
-        addOffsetToPointer(&dst->next);
+        allocator.addOffsetToPointer(&dst->next);
     }
     return true;
 }
 """
 
-    free_function += "    FreeXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(p->next), freefunc);\n"
+    free_function += "    FreeXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(p->next), deallocator);\n"
     free_function += "}\n\n"
 
-    restore_handles_case_bodies += f"""
-                break;
-            }}
+    size_function += """
+    size += XrStructChainSerializedSize(instance, reinterpret_cast<const XrBaseInStructure*>(src->next));
+    return size;
+}
 """
 
-    substitute_handles_case_bodies += f"""
-                break;
-            }}
+    if struct_has_substitutable_handles(name) or contains_handles_checks:
+        restore_handles_function = f"RestoreActualHandlesIn{name}"
+        substitute_handles_function = f"SubstituteLocalHandlesIn{name}"
+        source_text += f"""
+static bool {restore_handles_function}(XrInstance instance, XrBaseInStructure *xrstruct)
+{{
+    auto p = reinterpret_cast<{name}*>(xrstruct);
+{restore_handles_body}
+    return true;
+}}
+
+static bool {substitute_handles_function}(XrInstance instance, XrBaseOutStructure *xrstruct)
+{{
+    auto p = reinterpret_cast<{name}*>(xrstruct);
+{substitute_handles_body}
+    return true;
+}}
 """
+    else:
+        restore_handles_function = "nullptr"
+        substitute_handles_function = "nullptr"
 
+    if contains_handles_checks:
+        contains_handles_function = f"ContainsSubstitutableHandlesIn{name}"
+        source_text += f"""
+static bool {contains_handles_function}(const XrBaseInStructure *xrstruct)
+{{
+    auto p = reinterpret_cast<const {name}*>(xrstruct);
+{contains_handles_checks}
+    return false;
+}}
+"""
+    else:
+        contains_handles_function = "nullptr"
+
+    source_text += size_function
     source_text += copy_function
     source_text += free_function
 
-    copy_function_case_bodies += """
-            case %(enum)s: {
-                auto src = reinterpret_cast<const %(name)s*>(srcbase);
-                auto dst = reinterpret_cast<%(name)s*>(alloc(sizeof(%(name)s)));
-                dstbase = reinterpret_cast<XrBaseInStructure*>(dst);
-                bool result = CopyXrStructChain(instance, src, dst, copyType, alloc, addOffsetToPointer);
-                if(!result) {
-                    return nullptr;
-                }
-                break;
-            }
-""" % {"name" : name, "enum" : struct[1]}
+    struct_type_info_entries += f"""
+    {{
+        {struct[1]}, sizeof({name}), {"true" if struct_has_substitutable_handles(name) else "false"},
+        XrStructChainSerializedSizeAs<{name}>,
+        {restore_handles_function},
+        {substitute_handles_function},
+        {contains_handles_function},
+        {f"IPCCopyOutAs<{name}>" if name in ipc_copyout_struct_types else "nullptr"},
+        XrStructMembersEqualAs<{name}>,
+    }},"""
 
-    free_function_case_bodies += """
-            case %(enum)s: {
-                FreeXrStructChain(instance, reinterpret_cast<const %(name)s*>(p), freefunc);
-                break;
-            }
-""" % {"name" : name, "enum" : struct[1]}
+    copy_function_entries += f"""
+        CopyXrStructAs<Allocator, {name}>,"""
+
+    free_function_entries += f"""
+        FreeXrStructAs<Deallocator, {name}>,"""
 
 
 source_text += """
-XrBaseInStructure *CopyXrStructChain(XrInstance instance, const XrBaseInStructure* srcbase, CopyType copyType, AllocateFunc alloc, std::function<void (void* pointerToPointer)> addOffsetToPointer)
+// Wrappers giving the typed functions above one signature per table column
+
+template <typename T>
+size_t XrStructChainSerializedSizeAs(XrInstance instance, const XrBaseInStructure* src)
 {
-    XrBaseInStructure *dstbase = nullptr;
-    bool skipped;
+    return XrStructChainSerializedSize(instance, reinterpret_cast<const T*>(src));
+}
 
-    do {
-        skipped = false;
+template <typename T>
+void IPCCopyOutAs(XrBaseOutStructure* dst, const XrBaseOutStructure* src)
+{
+    IPCCopyOutMembers(reinterpret_cast<T*>(dst), reinterpret_cast<const T*>(src));
+}
 
-        if(!srcbase) {
-            return nullptr;
-        }
+template <typename T>
+bool XrStructMembersEqualAs(const XrBaseInStructure* a, const XrBaseInStructure* b)
+{
+    return XrStructMembersEqual(reinterpret_cast<const T*>(a), reinterpret_cast<const T*>(b));
+}
 
-        // next pointer of struct is copied after switch statement
+template <class Allocator, typename T>
+bool CopyXrStructAs(XrInstance instance, const XrBaseInStructure* src, XrBaseInStructure* dst, CopyType copyType, Allocator& allocator)
+{
+    return CopyXrStructChain(instance, reinterpret_cast<const T*>(src), reinterpret_cast<T*>(dst), copyType, allocator);
+}
 
-        switch(srcbase->type) {
-"""
-source_text += copy_function_case_bodies
+template <class Deallocator, typename T>
+void FreeXrStructAs(XrInstance instance, const XrBaseInStructure* p, Deallocator& deallocator)
+{
+    FreeXrStructChain(instance, reinterpret_cast<const T*>(p), deallocator);
+}
 
+// Everything the chain walkers need to know about one struct type.
+// Function pointers are nullptr where there is nothing to do.
+struct XrStructTypeInfo
+{
+    XrStructureType type;
+    size_t size;
+    bool hasSubstitutableHandles;       // XrSession, XrSwapchain, or XrSpace in the struct or its fixed-type members
+    size_t (*serializedSize)(XrInstance instance, const XrBaseInStructure* src);
+    bool (*restoreActualHandles)(XrInstance instance, XrBaseInStructure* xrstruct);
+    bool (*substituteLocalHandles)(XrInstance instance, XrBaseOutStructure* xrstruct);
+    bool (*containsSubstitutableHandles)(const XrBaseInStructure* xrstruct);   // walks arrays of chained structs
+    void (*copyOut)(XrBaseOutStructure* dst, const XrBaseOutStructure* src);
+    bool (*membersEqual)(const XrBaseInStructure* a, const XrBaseInStructure* b);
+};
+
+static const XrStructTypeInfo gXrStructTypeInfo[] = {"""
+source_text += struct_type_info_entries
 source_text += """
+};
 
-            default: {
-                // I don't know what this is, skip it and try the next one
-                auto info = OverlaysLayerGetHandleInfoFromXrInstance(instance);
-                char structTypeName[XR_MAX_STRUCTURE_NAME_SIZE];
-                structTypeName[0] = '\\0';
-                if(info->downchain->StructureTypeToString(instance, srcbase->type, structTypeName) != XR_SUCCESS) {
-                    sprintf(structTypeName, "<type %08X>", srcbase->type);
+// CopyXrStructChain() and FreeXrStructChain() are templates, so their
+// columns of the table are too, in the same order as gXrStructTypeInfo
+template <class Allocator>
+struct XrStructCopyFunctions
+{
+    typedef bool (*Function)(XrInstance instance, const XrBaseInStructure* src, XrBaseInStructure* dst, CopyType copyType, Allocator& allocator);
+    static constexpr Function byIndex[] = {"""
+source_text += copy_function_entries
+source_text += """
+    };
+};
+
+template <class Deallocator>
+struct XrStructFreeFunctions
+{
+    typedef void (*Function)(XrInstance instance, const XrBaseInStructure* p, Deallocator& deallocator);
+    static constexpr Function byIndex[] = {"""
+source_text += free_function_entries
+source_text += """
+    };
+};
+
+// Core structure types are small and dense, so they index straight into
+// an array.  Extension types are 1000000000 + 1000 * (extension number - 1)
+// + offset, so those are sorted into a side table and binary searched.
+constexpr uint32_t XrStructureTypeExtensionBase = 1000000000;
+
+struct XrStructTypeLookup
+{
+    std::vector<int32_t> coreIndices; // -1 if the type isn't one we know
+    std::vector<std::pair<XrStructureType, int32_t>> extensionIndices;
+
+    XrStructTypeLookup()
+    {
+        for(int32_t i = 0; i < (int32_t)(sizeof(gXrStructTypeInfo) / sizeof(gXrStructTypeInfo[0])); i++) {
+            uint32_t type = static_cast<uint32_t>(gXrStructTypeInfo[i].type);
+            if(type < XrStructureTypeExtensionBase) {
+                if(type >= coreIndices.size()) {
+                    coreIndices.resize(type + 1, -1);
                 }
-                OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
-                         nullptr, OverlaysLayerNoObjectInfo, fmt("CopyXrStructChain called on %p of unhandled type %s - dropped from \\"next\\" chain.", srcbase, structTypeName).c_str());
-                srcbase = srcbase->next;
-                skipped = true;
-                break;
+                coreIndices[type] = i;
+            } else {
+                extensionIndices.push_back({gXrStructTypeInfo[i].type, i});
             }
         }
-    } while(skipped);
+        std::sort(extensionIndices.begin(), extensionIndices.end());
+    }
+};
+
+static const XrStructTypeLookup gXrStructTypeLookup;
+
+static int32_t FindXrStructTypeIndex(XrStructureType type)
+{
+    uint32_t value = static_cast<uint32_t>(type);
+    if(value < XrStructureTypeExtensionBase) {
+        return (value < gXrStructTypeLookup.coreIndices.size()) ? gXrStructTypeLookup.coreIndices[value] : -1;
+    }
+    auto& extensions = gXrStructTypeLookup.extensionIndices;
+    auto it = std::lower_bound(extensions.begin(), extensions.end(), type,
+        [](const std::pair<XrStructureType, int32_t>& entry, XrStructureType type) { return entry.first < type; });
+    return (it != extensions.end() && it->first == type) ? it->second : -1;
+}
+
+static const XrStructTypeInfo* FindXrStructTypeInfo(XrStructureType type)
+{
+    int32_t index = FindXrStructTypeIndex(type);
+    return (index < 0) ? nullptr : &gXrStructTypeInfo[index];
+}
+
+// For messages about structs we don't know
+static std::string XrStructureTypeName(XrInstance instance, XrStructureType type)
+{
+    char structTypeName[XR_MAX_STRUCTURE_NAME_SIZE];
+    structTypeName[0] = '\\0';
+    if(instance != XR_NULL_HANDLE) {
+        auto info = OverlaysLayerGetHandleInfoFromXrInstance(instance);
+        if(info->downchain->StructureTypeToString(instance, type, structTypeName) == XR_SUCCESS) {
+            return structTypeName;
+        }
+    }
+    sprintf(structTypeName, "<type %08X>", type);
+    return structTypeName;
+}
+
+size_t XrStructChainSerializedSize(XrInstance instance, const XrBaseInStructure* srcbase)
+{
+    // Structs CopyXrStructChain doesn't know are dropped, so skip them here too
+    while(srcbase) {
+        const XrStructTypeInfo* info = FindXrStructTypeInfo(srcbase->type);
+        if(info) {
+            return pad(info->size) + info->serializedSize(instance, srcbase);
+        }
+        srcbase = srcbase->next;
+    }
+
+    return 0;
+}
+
+template <class Allocator>
+XrBaseInStructure *CopyXrStructChain(XrInstance instance, const XrBaseInStructure* srcbase, CopyType copyType, Allocator& allocator)
+{
+    int32_t index = -1;
+
+    // I don't know what these are, skip them and try the next one
+    while(srcbase && (index = FindXrStructTypeIndex(srcbase->type)) < 0) {
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
+                 nullptr, OverlaysLayerNoObjectInfo, fmt("CopyXrStructChain called on %p of unhandled type %s - dropped from \\"next\\" chain.", srcbase, XrStructureTypeName(instance, srcbase->type).c_str()).c_str());
+        srcbase = srcbase->next;
+    }
+
+    if(!srcbase) {
+        return nullptr;
+    }
+
+    // next pointer of struct is copied by the typed function
+    auto dstbase = reinterpret_cast<XrBaseInStructure*>(allocator.allocate(gXrStructTypeInfo[index].size));
+    if(!XrStructCopyFunctions<Allocator>::byIndex[index](instance, srcbase, dstbase, copyType, allocator)) {
+        return nullptr;
+    }
 
     return dstbase;
 }
-"""
 
-source_text += """
-void FreeXrStructChain(XrInstance instance, const XrBaseInStructure* p, FreeFunc freefunc)
+template <class Deallocator>
+void FreeXrStructChain(XrInstance instance, const XrBaseInStructure* p, Deallocator& deallocator)
 {
     if(!p) {
         return;
     }
 
-    switch(p->type) {
-
-"""
+    int32_t index = FindXrStructTypeIndex(p->type);
+    if(index >= 0) {
+        XrStructFreeFunctions<Deallocator>::byIndex[index](instance, p, deallocator);
+    } else {
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
+             nullptr, OverlaysLayerNoObjectInfo, fmt("Warning: Free called on %p of unknown type %s - will not descend \\"next\\" or free any other pointers.", p, XrStructureTypeName(instance, p->type).c_str()).c_str());
+    }
 
-source_text += free_function_case_bodies
+    deallocator.deallocate(p);
+}
 
-source_text += """
+template <>
+void IPCCopyOut(XrBaseOutStructure* dstbase, const XrBaseOutStructure* srcbase)
+{
+    if(!srcbase) {
+        return;
+    }
 
-        default: {
-            // I don't know what this is, skip it and try the next one
-            auto info = OverlaysLayerGetHandleInfoFromXrInstance(instance);
-            char structTypeName[XR_MAX_STRUCTURE_NAME_SIZE];
-            structTypeName[0] = '\\0';
-            if(info->downchain->StructureTypeToString(instance, p->type, structTypeName) != XR_SUCCESS) {
-                sprintf(structTypeName, "<type %08X>", p->type);
-            }
-            OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
-                 nullptr, OverlaysLayerNoObjectInfo, fmt("Warning: Free called on %p of unknown type %d - will descend \\"next\\" but don't know any other pointers.", p, structTypeName).c_str());
-            break;
+    const XrStructTypeInfo* info = FindXrStructTypeInfo(dstbase->type);
+    while(!info || !info->copyOut) {
+        // I don't know what this is, drop it and keep going
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, "unknown",
+            OverlaysLayerNoObjectInfo, fmt("IPCCopyOut called to copy out to %p of unknown type %d - skipped.", dstbase, dstbase->type).c_str());
+
+        // Don't increment srcbase.  Unknown structs were
+        // dropped during serialization, so keep going until we
+        // see a type we know and then we'll have caught up with
+        // what was serialized.
+        //
+        dstbase = dstbase->next;
+        if(!dstbase) {
+            return;
         }
+        info = FindXrStructTypeInfo(dstbase->type);
     }
 
-    freefunc(p);
+    info->copyOut(dstbase, srcbase);
+
+    IPCCopyOut(dstbase->next, srcbase->next);
 }
 
 XrBaseInStructure* CopyEventChainIntoBuffer(XrInstance instance, const XrEventDataBaseHeader* eventData, XrEventDataBuffer* buffer)
 {
-    size_t remaining = sizeof(XrEventDataBuffer);
-    unsigned char* next = reinterpret_cast<unsigned char *>(buffer);
-    return CopyXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(eventData), COPY_EVERYTHING,
-            [&buffer,&remaining,&next](size_t s){unsigned char* cur = next; next += s; return cur; },
-            [](void *){ });
+    XrStructChainBlock block(buffer, sizeof(XrEventDataBuffer));
+    return CopyXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(eventData), COPY_EVERYTHING, block);
 }
 
+XrBaseInStructure* IPCSerialize(XrInstance instance, IPCBuffer& ipcbuf, IPCHeader* header, const XrBaseInStructure* srcbase, CopyType copyType)
+{
+    // Take the whole chain from the buffer at once
+    size_t size = XrStructChainSerializedSize(instance, srcbase);
+    if(size == 0) {
+        return nullptr;
+    }
+
+    void *storage = ipcbuf.allocate(size);
+    if(!storage) {
+        return nullptr;
+    }
+
+    IPCStructChainAllocator allocator{XrStructChainBlock(storage, size), ipcbuf, header};
+    XrBaseInStructure* serialized = CopyXrStructChain(instance, srcbase, copyType, allocator);
+
+    // Pointers in the buffer aren't made relative until the request is posted
+    ValidateXrStructChainCopy(instance, "IPCSerialize", srcbase, serialized);
+
+    return serialized;
+}
+
+// Structs CopyXrStructChain doesn't know are dropped from "a" as they
+// would be from its copy
+bool XrStructChainEquals(const XrBaseInStructure* a, const XrBaseInStructure* b)
+{
+    while(true) {
+        while(a && FindXrStructTypeIndex(a->type) < 0) {
+            a = a->next;
+        }
+        if(!a || !b) {
+            return a == b;
+        }
+        if(a->type != b->type) {
+            return false;
+        }
+        if(!FindXrStructTypeInfo(a->type)->membersEqual(a, b)) {
+            return false;
+        }
+        a = a->next;
+        b = b->next;
+    }
+}
+
+void ValidateXrStructChainCopy(XrInstance instance, const char* func, const XrBaseInStructure* src, const XrBaseInStructure* copy)
+{
+    if(gValidateStructCopies && src && !XrStructChainEquals(src, copy)) {
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, func,
+            OverlaysLayerNoObjectInfo, fmt("copy %p of struct chain %p (%s) is not equal to the original", copy, src, XrStructureTypeName(instance, src->type).c_str()).c_str());
+    }
+}
+
+// The whole copy is one malloc'd block starting with the first struct
 XrBaseInStructure* CopyXrStructChainWithMalloc(XrInstance instance, const void* xrstruct)
 {
-    return CopyXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(xrstruct), COPY_EVERYTHING,
-            [](size_t s){return malloc(s); },
-            [](void *){ });
+    auto srcbase = reinterpret_cast<const XrBaseInStructure*>(xrstruct);
+
+    size_t size = XrStructChainSerializedSize(instance, srcbase);
+    if(size == 0) {
+        return nullptr;
+    }
+
+    void *storage = malloc(size);
+    if(!storage) {
+        throw std::bad_alloc();
+    }
+
+    XrStructChainBlock block(storage, size);
+    XrBaseInStructure* copy = CopyXrStructChain(instance, srcbase, COPY_EVERYTHING, block);
+
+    if(!copy) {
+        free(storage);
+    } else {
+        ValidateXrStructChainCopy(instance, "CopyXrStructChainWithMalloc", srcbase, copy);
+    }
+
+    return copy;
 }
 
 void FreeXrStructChainWithFree(XrInstance instance, const void* xrstruct)
 {
-    FreeXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(xrstruct),
-            [](const void *p){free(const_cast<void*>(p));});
+    free(const_cast<void*>(xrstruct));
+}
+
+// Like CopyXrStructChainWithMalloc but from this thread's ScratchArena,
+// and nullptr rather than std::bad_alloc if that's out of memory;
+// release the copy with ScratchArena::Free()
+XrBaseInStructure* CopyXrStructChainWithScratch(XrInstance instance, const void* xrstruct)
+{
+    auto srcbase = reinterpret_cast<const XrBaseInStructure*>(xrstruct);
+
+    size_t size = XrStructChainSerializedSize(instance, srcbase);
+    if(size == 0) {
+        return nullptr;
+    }
+
+    void *storage = ScratchArena::ForThisThread().Allocate(size);
+    if(!storage) {
+        return nullptr;
+    }
+
+    XrStructChainBlock block(storage, size);
+    XrBaseInStructure* copy = CopyXrStructChain(instance, srcbase, COPY_EVERYTHING, block);
+
+    if(!copy) {
+        ScratchArena::Free(storage);
+    } else {
+        ValidateXrStructChainCopy(instance, "CopyXrStructChainWithScratch", srcbase, copy);
+    }
+
+    return copy;
+}
+
+// Every struct and member a separate allocation from "heap", so the
+// per-member FreeXrStructChain() has something to check it against
+XrBaseInStructure* CopyXrStructChainWithCountingHeap(XrInstance instance, const void* xrstruct, XrStructChainCountingHeap& heap)
+{
+    return CopyXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(xrstruct), COPY_EVERYTHING, heap);
+}
+
+void FreeXrStructChainWithCountingHeap(XrInstance instance, const void* xrstruct, XrStructChainCountingHeap& heap)
+{
+    FreeXrStructChain(instance, reinterpret_cast<const XrBaseInStructure*>(xrstruct), heap);
 }
 """
 
@@ -2769,52 +3539,53 @@ source_text += """
 bool RestoreActualHandles(XrInstance instance, XrBaseInStructure *xrstruct)
 {
     while(xrstruct) {
-        switch(xrstruct->type)
-        {
-"""
-source_text += restore_handles_case_bodies
-source_text += """
-            default: {
-                // I don't know what this is, skip it and try the next one
-                auto info = OverlaysLayerGetHandleInfoFromXrInstance(instance);
-                char structTypeName[XR_MAX_STRUCTURE_NAME_SIZE];
-                structTypeName[0] = '\\0';
-                if(info->downchain->StructureTypeToString(instance, xrstruct->type, structTypeName) != XR_SUCCESS) {
-                    sprintf(structTypeName, "<type %08X>", xrstruct->type);
-                }
-                OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
-                    nullptr, OverlaysLayerNoObjectInfo, fmt("RestoreActualHandles called on %p of unhandled type %s. Handles will not be substituted. Behavior will be undefined; expect a validation error.", xrstruct, structTypeName).c_str());
-                break;
-            }
+        const XrStructTypeInfo* info = FindXrStructTypeInfo(xrstruct->type);
+        if(!info) {
+            // I don't know what this is, skip it and try the next one
+            OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
+                nullptr, OverlaysLayerNoObjectInfo, fmt("RestoreActualHandles called on %p of unhandled type %s. Handles will not be substituted. Behavior will be undefined; expect a validation error.", xrstruct, XrStructureTypeName(instance, xrstruct->type).c_str()).c_str());
+        } else if(info->restoreActualHandles && !info->restoreActualHandles(instance, xrstruct)) {
+            return false;
         }
         xrstruct = (XrBaseInStructure*)xrstruct->next; /* We allocated this copy ourselves, so just cast ugly */
     }
     return true;
 }
 
-void SubstituteLocalHandles(XrInstance instance, XrBaseOutStructure *xrstruct)
+// Like RestoreActualHandles, false if a handle from the runtime has no
+// local handle
+bool SubstituteLocalHandles(XrInstance instance, XrBaseOutStructure *xrstruct)
 {
     while(xrstruct) {
-        switch(xrstruct->type)
-        {
-"""
-source_text += substitute_handles_case_bodies
-source_text += """
-            default: {
-                // I don't know what this is, skip it and try the next one
-                auto info = OverlaysLayerGetHandleInfoFromXrInstance(instance);
-                char structTypeName[XR_MAX_STRUCTURE_NAME_SIZE];
-                structTypeName[0] = '\\0';
-                if(info->downchain->StructureTypeToString(instance, xrstruct->type, structTypeName) != XR_SUCCESS) {
-                    sprintf(structTypeName, "<type %08X>", xrstruct->type);
-                }
-                OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
-                    nullptr, OverlaysLayerNoObjectInfo, fmt("SubstituteHandles called on %p of unhandled type %s. Handles will not be substituted. Behavior will be undefined; expect a validation error.", xrstruct, structTypeName).c_str());
-                break;
-            }
+        const XrStructTypeInfo* info = FindXrStructTypeInfo(xrstruct->type);
+        if(!info) {
+            // I don't know what this is, skip it and try the next one
+            OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
+                nullptr, OverlaysLayerNoObjectInfo, fmt("SubstituteHandles called on %p of unhandled type %s. Handles will not be substituted. Behavior will be undefined; expect a validation error.", xrstruct, XrStructureTypeName(instance, xrstruct->type).c_str()).c_str());
+        } else if(info->substituteLocalHandles && !info->substituteLocalHandles(instance, xrstruct)) {
+            return false;
         }
         xrstruct = (XrBaseOutStructure*)xrstruct->next; /* We allocated this copy ourselves, so just cast ugly */
     }
+    return true;
+}
+
+// Cheaper than copying and then calling RestoreActualHandles() when the
+// chain only carries handles that are already the runtime's, like XrAction
+bool XrStructChainContainsSubstitutableHandles(const XrBaseInStructure *xrstruct)
+{
+    while(xrstruct) {
+        const XrStructTypeInfo* info = FindXrStructTypeInfo(xrstruct->type);
+        if(!info || info->hasSubstitutableHandles) {
+            // Let RestoreActualHandles() report what it doesn't know
+            return true;
+        }
+        if(info->containsSubstitutableHandles && info->containsSubstitutableHandles(xrstruct)) {
+            return true;
+        }
+        xrstruct = xrstruct->next;
+    }
+    return false;
 }
 """
 
@@ -2880,8 +3651,11 @@ for command_name in [c for c in supported_commands if c not in manually_implemen
                 if is_const:
                     restore_preamble += f"""
     auto {parameter_name}Save = {parameter_name};
-    auto {parameter_name}Copy = GetSharedCopyHandlesRestored({handle_name}Info->parentInstance, "{command_name}", {parameter_name});
-    {parameter_name} = {parameter_name}Copy.get();
+    std::unique_ptr<{parameter_type}, ScratchArenaDeleter> {parameter_name}Copy;
+    result = TryCopyHandlesRestored({handle_name}Info->parentInstance, "{command_name}", {parameter_name}, {parameter_name}Copy, {parameter_name});
+    if(result != XR_SUCCESS) {{
+        return result;
+    }}
 """
                     undo_restore_postscript += f"""
     {parameter_name} = {parameter_name}Save;
@@ -2889,11 +3663,15 @@ for command_name in [c for c in supported_commands if c not in manually_implemen
                 else:
                     if is_an_xr_chained_struct(parameter_type):
                         substitute_postscript += f"""
-        SubstituteLocalHandles({handle_name}Info->parentInstance, reinterpret_cast<XrBaseOutStructure*>({parameter_name}));
+        if(!SubstituteLocalHandles({handle_name}Info->parentInstance, reinterpret_cast<XrBaseOutStructure*>({parameter_name}))) {{
+            result = XR_ERROR_HANDLE_INVALID;
+        }}
 """
                     else:
                         substitute_postscript += f"""
-        SubstituteLocalHandles({handle_name}Info->parentInstance, {parameter_name});
+        if(!SubstituteLocalHandles({handle_name}Info->parentInstance, {parameter_name})) {{
+            result = XR_ERROR_HANDLE_INVALID;
+        }}
 """
             else:
                 pass # no struct parameters are passed by value at the time of writing
@@ -2901,7 +3679,12 @@ for command_name in [c for c in supported_commands if c not in manually_implemen
             if not is_pointer:
                 restore_preamble += f"""
     auto {parameter_name}Save = {parameter_name};
-    {parameter_name} = {layer_name}GetHandleInfoFrom{parameter_type}({parameter_name})->actualHandle;
+    {layer_name}{parameter_type}HandleInfo* {parameter_name}Info;
+    result = {layer_name}TryBorrowHandleInfoFrom{parameter_type}({parameter_name}, &{parameter_name}Info);
+    if(result != XR_SUCCESS) {{
+        return result;
+    }}
+    {parameter_name} = {parameter_name}Info->actualHandle;
 """
                 undo_restore_postscript += f"""
     {parameter_name} = {parameter_name}Save;
@@ -2924,11 +3707,16 @@ for command_name in [c for c in supported_commands if c not in manually_implemen
         if created_type in handles_needing_substitution:
             allocate_local_handle_and_substitute = f"""
         {created_type} actualHandle = *{created_name};
-        {created_type} localHandle = ({created_type})GetNextLocalHandle();
+        {created_type} localHandle = {layer_name}NewLocal{created_type}();
+        if(localHandle == XR_NULL_HANDLE) {{
+            {handle_name}Info->downchain->Destroy{created_type[2:]}(actualHandle);
+            *{created_name} = XR_NULL_HANDLE;
+            return XR_ERROR_LIMIT_REACHED;
+        }}
         *{created_name} = localHandle;
 
         {{
-            std::unique_lock<std::recursive_mutex> lock(gActual{created_type}ToLocalHandleMutex);
+            std::unique_lock<ProfiledMutex> lock(gActual{created_type}ToLocalHandleMutex);
             gActual{created_type}ToLocalHandle.insert({{actualHandle, localHandle}});
         }}
 """
@@ -2949,15 +3737,45 @@ for command_name in [c for c in supported_commands if c not in manually_implemen
     else:
         make_and_store_new_local_handle = ""
 
+    # xrWaitFrame can block until xrEndFrame is called on another thread,
+    # so it can't hold the session's lock; see LockForProc()
+    if command_name == "xrWaitFrame":
+        proc_mutex = "nullptr"
+    else:
+        proc_mutex = f"&{handle_name}Info->procMutex"
+
+    # Most commands borrow their handle's info inside an EpochReadGuard
+    # held for the whole command.  Commands that may block take a
+    # reference instead, so a guard held while waiting doesn't keep
+    # Epochs::Reclaim() from freeing retired tables.
+    if command_name in blocking_commands:
+        if "TryBorrowHandleInfoFrom" in restore_preamble:
+            raise Exception(f"{command_name} may block but borrows the infos of its handle parameters")
+        lookup_handle_info = f"""
+    {layer_name}{handle_type}HandleInfo::Ptr {handle_name}InfoRef;
+    XrResult lookupResult = {layer_name}TryGetHandleInfoFrom{handle_type}({handle_name}, {handle_name}InfoRef);
+    if(lookupResult != XR_SUCCESS) {{
+        return lookupResult;
+    }}
+    {layer_name}{handle_type}HandleInfo* {handle_name}Info = {handle_name}InfoRef.get();
+"""
+    else:
+        lookup_handle_info = f"""
+    EpochReadGuard guard;
+    {layer_name}{handle_type}HandleInfo* {handle_name}Info;
+    XrResult lookupResult = {layer_name}TryBorrowHandleInfoFrom{handle_type}({handle_name}, &{handle_name}Info);
+    if(lookupResult != XR_SUCCESS) {{
+        return lookupResult;
+    }}
+"""
+
     if handle_type in handles_needing_substitution:
         command_for_main_side = f"""
 {command_type} {layer_command}Main(XrInstance parentInstance, {parameter_cdecls})
 {{
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
-
-    auto {handle_name}Info = {layer_name}GetHandleInfoFrom{handle_type}({handle_name});
+{lookup_handle_info}
+    auto procLock = LockForProc({proc_mutex});
 
     // restore the actual handle
     {handle_type} localHandleStore = {handle_name};
@@ -3001,7 +3819,7 @@ for command_name in [c for c in supported_commands if c not in manually_implemen
         call_actual_command = f"""
     XrResult result;
     {{
-        auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
+        auto procLock = LockForProc(nullptr);
 
         result = {handle_name}Info->downchain->{dispatch_command}({parameter_names});
     }}
@@ -3023,14 +3841,61 @@ for command_name in [c for c in supported_commands if c not in manually_implemen
     else:
         special_case_postscript = ""
 
+    catch_exceptions = f"""
+    }} catch (const OverlaysLayerXrException exc) {{
+
+        return exc.result();
+
+    }} catch (const std::bad_alloc& e) {{
+
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "{command_name}", OverlaysLayerNoObjectInfo, e.what());
+        return XR_ERROR_OUT_OF_MEMORY;
+
+    }}"""
+
+    # Making and dropping handle infos, hand-written code, and the
+    # hand-written Overlay side of a command may throw.  Without those,
+    # the lookup, the generated Main side and the downchain call return
+    # errors as XrResults, so they run outside a try.
+    only_calls_nothrow_code = not (command_is_create or command_is_destroy or
+        command_name in after_downchain_main or command_name in before_downchain)
+
     # handles are guaranteed not to be destroyed while in another command according to the spec
-    api_layer_proc = f"""
+    # The guard keeps the borrowed info alive for the whole command even
+    # if the command removes it, and saves a reference count round trip
+    # on every call.  Blocking commands take a reference instead so a
+    # frame wait doesn't hold off reclamation of retired tables
+    if only_calls_nothrow_code and handle_type in handles_needing_substitution:
+        api_layer_proc = f"""
 {command_type} {layer_command}({parameter_cdecls})
 {{
+{lookup_handle_info}
+    if(!{handle_name}Info->isProxied) {{
+        return {layer_command}Main({handle_name}Info->parentInstance, {parameter_names});
+    }}
+
     try {{
 
-        auto {handle_name}Info = {layer_name}GetHandleInfoFrom{handle_type}({handle_name});
+        return OverlaysLayer{dispatch_command}Overlay({handle_name}Info->parentInstance, {parameter_names});
+{catch_exceptions}
+}}
+"""
+    elif only_calls_nothrow_code:
+        api_layer_proc = f"""
+{command_type} {layer_command}({parameter_cdecls})
+{{
+{lookup_handle_info}
+    {call_actual_command}
 
+    return result;
+}}
+"""
+    else:
+        api_layer_proc = f"""
+{command_type} {layer_command}({parameter_cdecls})
+{{
+    try {{
+{lookup_handle_info}
         {call_actual_command}
 
         {special_case_postscript}
@@ -3038,17 +3903,7 @@ for command_name in [c for c in supported_commands if c not in manually_implemen
         {after_downchain_if_success}
 
         return result;
-
-    }} catch (const OverlaysLayerXrException exc) {{
-
-        return exc.result();
-
-    }} catch (const std::bad_alloc& e) {{
-
-        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "{command_name}", OverlaysLayerNoObjectInfo, e.what());
-        return XR_ERROR_OUT_OF_MEMORY;
-
-    }}
+{catch_exceptions}
 }}
 """
 
@@ -3118,8 +3973,175 @@ source_text += """
 }
 """
 
+# Struct fixtures for the tests -----------------------------------------------
+# One valid instance of each struct the layer copies, with seeded random
+# members: counts match their arrays, strings are terminated, and the
+# supported structs that extend a struct are sometimes chained to it
+
+# Structs pointing to runtime objects like ID3D11Device can't be made up
+fixture_structs = [name for name in supported_structs
+    if not [member for member in structs[name][3] if member["type"] == "pointer_to_struct"]]
+fixture_typed_structs = [name for name in fixture_structs if structs[name][1]]
+
+def fixture_extending_structs(name):
+    return [other for other in fixture_typed_structs if name in [s.strip() for s in structs[other][2].split(",")]]
+
+# Structs that start with the members of a base header, like
+# XrCompositionLayerQuad with XrCompositionLayerBaseHeader
+def fixture_derived_structs(base):
+    base_members = [member["name"] for member in structs[base][3]]
+    return [name for name in fixture_typed_structs
+        if [member["name"] for member in structs[name][3]][0:len(base_members)] == base_members]
+
+def fixture_value(pod_type):
+    if pod_type in ("float", "double"):
+        return "arena.Real()"
+    elif pod_type == "XrBool32":
+        return "XrBool32(arena.Below(2))"
+    elif pod_type in handles:
+        return f"({pod_type})arena.Handle()"
+    elif pod_type in atoms:
+        return f"{pod_type}(arena.Handle())"
+    elif pod_type.startswith("PFN_"):
+        return "nullptr"
+    elif "Flags" in pod_type:
+        return f"{pod_type}(arena.Bits() & 0xff)"
+    elif pod_type in ("XrTime", "XrDuration"):
+        return f"{pod_type}(arena.Bits() >> 1)"
+    elif pod_type[0:2] == "Xr" and pod_type != "XrVersion":
+        # An enum; the copying code passes these through unchanged
+        return f"{pod_type}(arena.Below(4))"
+    elif pod_type in ("XrVersion", "uint8_t", "int32_t", "uint32_t", "int64_t", "uint64_t"):
+        return f"{pod_type}(arena.Bits())"
+    return None
+
+def get_code_to_fill_array(member, element_type, fill_element):
+    return f"""    {{
+        auto {member["name"]} = arena.New<{element_type}>(s->{member["size"]});
+        for(uint32_t i = 0; i < s->{member["size"]}; i++) {{
+{fill_element}
+        }}
+        s->{member["name"]} = {member["name"]};
+    }}
+"""
+
+def get_code_to_fill_member(name, member):
+    if member["name"] == "type" and structs[name][1]:
+        return f"    s->type = {structs[name][1]};\n"
+    elif member["type"] == "POD":
+        value = fixture_value(member["pod_type"])
+        if value is None:
+            # A platform type, like LUID
+            return f"    arena.FillBytes(&s->{member['name']}, sizeof(s->{member['name']}));\n"
+        return f"    s->{member['name']} = {value};\n"
+    elif member["type"] == "xr_simple_struct":
+        if member["struct_type"] in fixture_structs:
+            return f"    FillFixture(arena, &s->{member['name']});\n"
+        return f"    arena.FillBytes(&s->{member['name']}, sizeof(s->{member['name']}));\n"
+    elif member["type"] == "fixed_array":
+        if member["base_type"] == "char":
+            return f"    arena.FillString(s->{member['name']}, {member['size']});\n"
+        return f"    arena.FillBytes(s->{member['name']}, sizeof(s->{member['name']}));\n"
+    elif member["type"] == "c_string":
+        return f"    s->{member['name']} = arena.String();\n"
+    elif member["type"] == "string_list":
+        return get_code_to_fill_array(member, "const char*", f"""            {member["name"]}[i] = arena.String();""")
+    elif member["type"] == "pointer_to_atom_or_handle":
+        return get_code_to_fill_array(member, member["struct_type"], f"""            {member["name"]}[i] = {fixture_value(member["struct_type"])};""")
+    elif member["type"] in ("pointer_to_struct_array", "pointer_to_xr_struct_array"):
+        return get_code_to_fill_array(member, member["struct_type"], f"""            FillFixture(arena, &{member["name"]}[i]);""")
+    elif member["type"] == "list_of_struct_pointers":
+        if member["struct_type"] in fixture_typed_structs:
+            derived = [member["struct_type"]]
+        else:
+            derived = fixture_derived_structs(member["struct_type"])
+        if not derived:
+            return f"    s->{member['size']} = 0;\n"
+        cases = "".join([f"""                case {i}: {{
+                    auto element = arena.New<{derived_name}>();
+                    FillFixture(arena, element);
+                    {member["name"]}[i] = reinterpret_cast<const {member["struct_type"]}*>(element);
+                    break;
+                }}
+""" for i, derived_name in enumerate(derived[:-1])])
+        cases += f"""                default: {{
+                    auto element = arena.New<{derived[-1]}>();
+                    FillFixture(arena, element);
+                    {member["name"]}[i] = reinterpret_cast<const {member["struct_type"]}*>(element);
+                    break;
+                }}
+"""
+        return get_code_to_fill_array(member, f"const {member['struct_type']}*", f"""            switch(arena.Below({len(derived)})) {{
+{cases}            }}""")
+    elif member["type"] == "void_pointer":
+        if member["name"] == "next":
+            return ""
+        # Only copied, never followed
+        return f"    s->{member['name']} = reinterpret_cast<void*>(uintptr_t(arena.Handle()));\n"
+    return f"#error    unhandled member type {member['type']} of {name}\n"
+
+fixture_text = """
+// Struct fixtures for the tests, generated by generate.py
+
+#include "layer_test_support.h"
+
+"""
+
+for name in fixture_structs:
+    fixture_text += f"static void FillFixture(XrStructFixtureArena& arena, {name}* s);\n"
+
+for name in fixture_structs:
+    struct = structs[name]
+    fixture_text += f"""
+static void FillFixture(XrStructFixtureArena& arena, {name}* s)
+{{
+"""
+    # Counts are chosen here and set the size of the arrays that follow
+    sizes = []
+    for member in struct[3]:
+        if member["type"] in ("string_list", "pointer_to_atom_or_handle", "pointer_to_struct_array", "pointer_to_xr_struct_array", "list_of_struct_pointers") and member["size"] not in sizes:
+            sizes.append(member["size"])
+            fixture_text += f"    s->{member['size']} = arena.Below(5);\n"
+    for member in struct[3]:
+        if member["type"] == "POD" and member["name"] in sizes:
+            continue
+        fixture_text += get_code_to_fill_member(name, member)
+
+    extending = fixture_extending_structs(name)
+    if extending:
+        cases = "".join([f"""        case {i}: {{
+            auto next = arena.New<{extending_name}>();
+            FillFixture(arena, next);
+            s->next = next;
+            break;
+        }}
+""" for i, extending_name in enumerate(extending)])
+        fixture_text += f"""    switch(arena.Below({len(extending) + 1})) {{
+{cases}        default:
+            break;
+    }}
+"""
+    fixture_text += "}\n"
+
+fixture_text += """
+template <typename T>
+XrBaseInStructure* MakeFixture(XrStructFixtureArena& arena)
+{
+    T* s = arena.New<T>();
+    FillFixture(arena, s);
+    return reinterpret_cast<XrBaseInStructure*>(s);
+}
+
+const std::vector<XrStructFixtureType> gXrStructFixtureTypes = {
+"""
+for name in fixture_typed_structs:
+    fixture_text += f"""    {{"{name}", {structs[name][1]}, sizeof({name}), {"true" if name in ipc_copyout_struct_types else "false"}, MakeFixture<{name}>}},\n"""
+fixture_text += "};\n"
+
 if outputFilename == "xr_generated_overlays.cpp":
     open(outputFilename, "w").write(source_text)
+elif outputFilename == "xr_generated_struct_fixtures.cpp":
+    open(outputFilename, "w").write(fixture_text)
 else:
     open(outputFilename, "w").write(header_text)
 
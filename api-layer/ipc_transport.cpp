@@ -0,0 +1,598 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif  // !NOMINMAX
+
+#include "ipc_transport.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#if !defined(_WIN32)
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
+static thread_local std::string gIPCLastError;
+
+std::string IPCGetLastErrorString()
+{
+    return gIPCLastError;
+}
+
+#if defined(_WIN32)
+
+static void SetLastErrorFromWindows(const char* function)
+{
+    DWORD lastError = GetLastError();
+    LPVOID messageBuf = nullptr;
+    FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s error was %08X (%s)", function, (unsigned int)lastError, messageBuf ? (const char*)messageBuf : "no message");
+    gIPCLastError = buffer;
+    LocalFree(messageBuf);
+}
+
+IPCProcessId IPCGetCurrentProcessId()
+{
+    return GetCurrentProcessId();
+}
+
+bool IPCSharedMemory::Open(const char* name, size_t size_)
+{
+    handle = CreateFileMappingA(
+        INVALID_HANDLE_VALUE,   // use sys paging file instead of an existing file
+        NULL,                   // default security attributes
+        PAGE_READWRITE,         // read/write access
+        (DWORD)((uint64_t)size_ >> 32),          // size: high 32-bits
+        (DWORD)((uint64_t)size_ & 0xFFFFFFFF),   // size: low 32-bits
+        name);                  // name of map object
+
+    if(handle == NULL) {
+        SetLastErrorFromWindows("CreateFileMappingA");
+        return false;
+    }
+
+    // Get a pointer to the file-mapped shared memory, read/write
+    base = MapViewOfFile(handle, FILE_MAP_WRITE, 0, 0, 0);
+    if(base == NULL) {
+        SetLastErrorFromWindows("MapViewOfFile");
+        CloseHandle(handle);
+        handle = NULL;
+        return false;
+    }
+
+    size = size_;
+    return true;
+}
+
+void IPCSharedMemory::Close()
+{
+    if(base) {
+        UnmapViewOfFile(base);
+        base = nullptr;
+        size = 0;
+    }
+    if(handle) {
+        CloseHandle(handle);
+        handle = NULL;
+    }
+}
+
+bool IPCSharedMemory::MapAt(void* address)
+{
+    void* p = MapViewOfFileEx(handle, FILE_MAP_WRITE, 0, 0, 0, address);
+    if(p == NULL) {
+        SetLastErrorFromWindows("MapViewOfFileEx");
+        return false;
+    }
+
+    UnmapViewOfFile(base);
+    base = p;
+    return true;
+}
+
+void IPCSharedMemory::Unlink(const char* /*name*/)
+{
+}
+
+bool IPCSemaphore::Open(const char* name, uint32_t maxCount)
+{
+    handle = CreateSemaphoreA(nullptr, 0, maxCount, name);
+    if(handle == NULL) {
+        SetLastErrorFromWindows("CreateSemaphoreA");
+        return false;
+    }
+    return true;
+}
+
+void IPCSemaphore::Close()
+{
+    if(handle) {
+        CloseHandle(handle);
+        handle = NULL;
+    }
+}
+
+void IPCSemaphore::Unlink(const char* /*name*/)
+{
+}
+
+bool IPCSemaphore::Post()
+{
+    // Fails harmlessly if the semaphore is already at its maximum count
+    return ReleaseSemaphore(handle, 1, nullptr) != 0;
+}
+
+IPCWaitStatus IPCSemaphore::Wait(uint32_t millis)
+{
+    DWORD result = WaitForSingleObject(handle, millis);
+    if(result == WAIT_OBJECT_0) {
+        return IPC_WAIT_SIGNALED;
+    }
+    if(result == WAIT_TIMEOUT) {
+        return IPC_WAIT_TIMEOUT;
+    }
+    SetLastErrorFromWindows("WaitForSingleObject");
+    return IPC_WAIT_FAILED;
+}
+
+bool IPCMutex::Open(const char* name, bool takeOwnership)
+{
+    handle = CreateMutexA(NULL, takeOwnership ? TRUE : FALSE, name);
+    if(handle == NULL) {
+        SetLastErrorFromWindows("CreateMutexA");
+        return false;
+    }
+    return true;
+}
+
+void IPCMutex::Close()
+{
+    if(handle) {
+        CloseHandle(handle);
+        handle = NULL;
+    }
+}
+
+void IPCMutex::Unlink(const char* /*name*/)
+{
+}
+
+IPCWaitStatus IPCMutex::Lock(uint32_t millis)
+{
+    DWORD result = WaitForSingleObject(handle, millis);
+    if((result == WAIT_OBJECT_0) || (result == WAIT_ABANDONED)) {
+        return IPC_WAIT_SIGNALED;
+    }
+    if(result == WAIT_TIMEOUT) {
+        return IPC_WAIT_TIMEOUT;
+    }
+    SetLastErrorFromWindows("WaitForSingleObject");
+    return IPC_WAIT_FAILED;
+}
+
+void IPCMutex::Unlock()
+{
+    ReleaseMutex(handle);
+}
+
+bool IPCStopEvent::Create()
+{
+    handle = CreateEventA(nullptr, false, false, nullptr);
+    if(handle == NULL) {
+        SetLastErrorFromWindows("CreateEventA");
+        return false;
+    }
+    return true;
+}
+
+void IPCStopEvent::Signal()
+{
+    SetEvent(handle);
+}
+
+bool IPCProcess::Open(IPCProcessId id_)
+{
+    id = id_;
+    handle = OpenProcess(PROCESS_ALL_ACCESS, TRUE, id);
+    if(handle == NULL) {
+        SetLastErrorFromWindows("OpenProcess");
+        return false;
+    }
+    return true;
+}
+
+void IPCProcess::Close()
+{
+    if(handle) {
+        CloseHandle(handle);
+        handle = NULL;
+    }
+}
+
+bool IPCProcess::HasExited()
+{
+    return WaitForSingleObject(handle, 0) == WAIT_OBJECT_0;
+}
+
+IPCWaitStatus IPCWaitForSemaphoreOrProcessExit(IPCSemaphore& sema, IPCProcess& process, uint32_t millis)
+{
+    HANDLE handles[2];
+
+    handles[0] = sema.handle;
+    handles[1] = process.handle;
+
+    DWORD result = WaitForMultipleObjects(2, handles, FALSE, millis);
+
+    if(result == WAIT_OBJECT_0 + 0) {
+        return IPC_WAIT_SIGNALED;
+    }
+    if(result == WAIT_OBJECT_0 + 1) {
+        return IPC_WAIT_PROCESS_EXITED;
+    }
+    if(result == WAIT_TIMEOUT) {
+        return IPC_WAIT_TIMEOUT;
+    }
+    SetLastErrorFromWindows("WaitForMultipleObjects");
+    return IPC_WAIT_FAILED;
+}
+
+IPCWaitStatus IPCWaitForSemaphoreOrStop(IPCSemaphore& sema, IPCStopEvent& stop, uint32_t millis)
+{
+    HANDLE handles[2];
+
+    // stop first so it wins if both are signaled
+    handles[0] = stop.handle;
+    handles[1] = sema.handle;
+
+    DWORD result = WaitForMultipleObjects(2, handles, FALSE, millis);
+
+    if(result == WAIT_OBJECT_0 + 0) {
+        return IPC_WAIT_STOPPED;
+    }
+    if(result == WAIT_OBJECT_0 + 1) {
+        return IPC_WAIT_SIGNALED;
+    }
+    if(result == WAIT_TIMEOUT) {
+        return IPC_WAIT_TIMEOUT;
+    }
+    SetLastErrorFromWindows("WaitForMultipleObjects");
+    return IPC_WAIT_FAILED;
+}
+
+#else // !_WIN32
+
+static void SetLastErrorFromErrno(const char* function)
+{
+    int lastError = errno;
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s error was %d (%s)", function, lastError, strerror(lastError));
+    gIPCLastError = buffer;
+}
+
+// POSIX shared memory and semaphore names must start with a single slash
+static std::string PosixObjectName(const char* name)
+{
+    return std::string("/") + name;
+}
+
+static std::string PosixLockFileName(const char* name)
+{
+    return std::string("/tmp/") + name + ".lock";
+}
+
+static timespec DeadlineFromNow(uint32_t millis)
+{
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += millis / 1000;
+    deadline.tv_nsec += (millis % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+IPCProcessId IPCGetCurrentProcessId()
+{
+    return getpid();
+}
+
+bool IPCSharedMemory::Open(const char* name, size_t size_)
+{
+    fd = shm_open(PosixObjectName(name).c_str(), O_RDWR | O_CREAT, 0600);
+    if(fd == -1) {
+        SetLastErrorFromErrno("shm_open");
+        return false;
+    }
+
+    // Either process may get here first; only grow, never shrink
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        SetLastErrorFromErrno("fstat");
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    if(static_cast<size_t>(st.st_size) < size_) {
+        if(ftruncate(fd, size_) == -1) {
+            SetLastErrorFromErrno("ftruncate");
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+
+    void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED) {
+        SetLastErrorFromErrno("mmap");
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    base = p;
+    size = size_;
+    return true;
+}
+
+bool IPCSharedMemory::MapAt(void* address)
+{
+#if defined(MAP_FIXED_NOREPLACE)
+    int flags = MAP_SHARED | MAP_FIXED_NOREPLACE;
+#else
+    int flags = MAP_SHARED;
+#endif
+
+    // Without MAP_FIXED_NOREPLACE the address is only a hint
+    void* p = mmap(address, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(p == MAP_FAILED) {
+        SetLastErrorFromErrno("mmap");
+        return false;
+    }
+    if(p != address) {
+        munmap(p, size);
+        gIPCLastError = "mmap placed the mapping at a different address";
+        return false;
+    }
+
+    munmap(base, size);
+    base = p;
+    return true;
+}
+
+void IPCSharedMemory::Close()
+{
+    if(base) {
+        munmap(base, size);
+        base = nullptr;
+        size = 0;
+    }
+    if(fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void IPCSharedMemory::Unlink(const char* name)
+{
+    shm_unlink(PosixObjectName(name).c_str());
+}
+
+bool IPCSemaphore::Open(const char* name, uint32_t /*maxCount*/)
+{
+    // POSIX semaphores have no maximum count; RPC and negotiation treat
+    // a post as a wakeup and recheck their state, so that's harmless.
+    sem = sem_open(PosixObjectName(name).c_str(), O_CREAT, 0600, 0);
+    if(sem == SEM_FAILED) {
+        SetLastErrorFromErrno("sem_open");
+        return false;
+    }
+    return true;
+}
+
+void IPCSemaphore::Close()
+{
+    if(sem != SEM_FAILED) {
+        sem_close(sem);
+        sem = SEM_FAILED;
+    }
+}
+
+void IPCSemaphore::Unlink(const char* name)
+{
+    sem_unlink(PosixObjectName(name).c_str());
+}
+
+bool IPCSemaphore::Post()
+{
+    if(sem_post(sem) == -1) {
+        SetLastErrorFromErrno("sem_post");
+        return false;
+    }
+    return true;
+}
+
+IPCWaitStatus IPCSemaphore::Wait(uint32_t millis)
+{
+    timespec deadline = DeadlineFromNow(millis);
+    while(sem_timedwait(sem, &deadline) == -1) {
+        if(errno == ETIMEDOUT) {
+            return IPC_WAIT_TIMEOUT;
+        }
+        if(errno != EINTR) {
+            SetLastErrorFromErrno("sem_timedwait");
+            return IPC_WAIT_FAILED;
+        }
+    }
+    return IPC_WAIT_SIGNALED;
+}
+
+bool IPCMutex::Open(const char* name, bool takeOwnership)
+{
+    fd = open(PosixLockFileName(name).c_str(), O_RDWR | O_CREAT, 0600);
+    if(fd == -1) {
+        SetLastErrorFromErrno("open");
+        return false;
+    }
+    if(takeOwnership) {
+        // Like CreateMutex, failing to get initial ownership isn't an error
+        flock(fd, LOCK_EX | LOCK_NB);
+    }
+    return true;
+}
+
+void IPCMutex::Close()
+{
+    if(fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void IPCMutex::Unlink(const char* name)
+{
+    unlink(PosixLockFileName(name).c_str());
+}
+
+IPCWaitStatus IPCMutex::Lock(uint32_t millis)
+{
+    // flock has no timed variant, so poll
+    constexpr uint32_t pollMillis = 1;
+    uint32_t waited = 0;
+    while(flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        if(errno != EWOULDBLOCK && errno != EINTR) {
+            SetLastErrorFromErrno("flock");
+            return IPC_WAIT_FAILED;
+        }
+        if(waited >= millis) {
+            return IPC_WAIT_TIMEOUT;
+        }
+        usleep(pollMillis * 1000);
+        waited += pollMillis;
+    }
+    return IPC_WAIT_SIGNALED;
+}
+
+void IPCMutex::Unlock()
+{
+    flock(fd, LOCK_UN);
+}
+
+bool IPCStopEvent::Create()
+{
+    // Lives as long as the thread that might be waiting on it, which is
+    // detached, so this is intentionally never freed.
+    stopped = new std::atomic<bool>(false);
+    return true;
+}
+
+void IPCStopEvent::Signal()
+{
+    stopped->store(true);
+}
+
+bool IPCProcess::Open(IPCProcessId id_)
+{
+    id = id_;
+#if defined(SYS_pidfd_open)
+    pidfd = static_cast<int>(syscall(SYS_pidfd_open, id, 0));
+    if(pidfd != -1) {
+        return true;
+    }
+    if(errno != ENOSYS) {
+        SetLastErrorFromErrno("pidfd_open");
+        return false;
+    }
+#endif
+    // Kernel without pidfd; fall back to probing the process ID, which
+    // could in principle be reused after the process exits
+    if(kill(id, 0) == -1 && errno == ESRCH) {
+        SetLastErrorFromErrno("kill");
+        return false;
+    }
+    return true;
+}
+
+void IPCProcess::Close()
+{
+    if(pidfd != -1) {
+        close(pidfd);
+        pidfd = -1;
+    }
+}
+
+bool IPCProcess::HasExited()
+{
+    if(pidfd != -1) {
+        // a pidfd becomes readable when the process exits
+        pollfd p { pidfd, POLLIN, 0 };
+        return poll(&p, 1, 0) > 0;
+    }
+    if(id == 0) {
+        return false;
+    }
+    return (kill(id, 0) == -1) && (errno == ESRCH);
+}
+
+// A POSIX semaphore can't be waited on together with a pidfd, so check
+// the other process each time the semaphore wait times out.  Callers
+// already loop on short timeouts, so exit is noticed about as quickly
+// as with WaitForMultipleObjects.
+IPCWaitStatus IPCWaitForSemaphoreOrProcessExit(IPCSemaphore& sema, IPCProcess& process, uint32_t millis)
+{
+    IPCWaitStatus result = sema.Wait(millis);
+    if(result == IPC_WAIT_TIMEOUT && process.HasExited()) {
+        return IPC_WAIT_PROCESS_EXITED;
+    }
+    return result;
+}
+
+IPCWaitStatus IPCWaitForSemaphoreOrStop(IPCSemaphore& sema, IPCStopEvent& stop, uint32_t millis)
+{
+    constexpr uint32_t stopCheckMillis = 100;
+    uint32_t waited = 0;
+    do {
+        if(stop.stopped->load()) {
+            return IPC_WAIT_STOPPED;
+        }
+        uint32_t slice = std::min(stopCheckMillis, millis - waited);
+        IPCWaitStatus result = sema.Wait(slice);
+        if(result != IPC_WAIT_TIMEOUT) {
+            return result;
+        }
+        waited += slice;
+    } while(waited < millis);
+
+    return IPC_WAIT_TIMEOUT;
+}
+
+#endif // _WIN32
@@ -0,0 +1,185 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef _IPC_TRANSPORT_H_
+#define _IPC_TRANSPORT_H_
+
+// Platform primitives underneath NegotiationChannels and RPCChannels.
+// Everything here is named so that Main and Overlay processes can open
+// the same object independently, and every object is a plain handle
+// that can be copied along with the channels struct that holds it.
+//
+// Win32 uses file mappings on the paging file, named semaphores and
+// mutexes, and process handles.  POSIX uses shm_open, named POSIX
+// semaphores, flock() on a lock file for the named mutex, and a pidfd
+// (where available) to notice that the other process has exited.
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <atomic>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <semaphore.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(_WIN32)
+typedef DWORD IPCProcessId;
+#else
+typedef pid_t IPCProcessId;
+#endif
+
+enum IPCWaitStatus {
+    IPC_WAIT_SIGNALED,
+    IPC_WAIT_TIMEOUT,
+    IPC_WAIT_PROCESS_EXITED,
+    IPC_WAIT_STOPPED,
+    IPC_WAIT_FAILED,
+};
+
+IPCProcessId IPCGetCurrentProcessId();
+
+// Tell the CPU this thread is busy-waiting on memory another thread or
+// process will write
+inline void IPCCpuRelax()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(_M_ARM64) || defined(_M_ARM)
+    __yield();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Monotonic time in nanoseconds, comparable between processes on the
+// same machine (steady_clock is QueryPerformanceCounter on Windows and
+// CLOCK_MONOTONIC on Linux)
+inline uint64_t IPCGetTimestampNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Description of the last transport call that failed on this thread,
+// e.g. "CreateSemaphoreA error was 00000005 (Access is denied.)"
+std::string IPCGetLastErrorString();
+
+// Shared memory mapped read/write, created if it doesn't exist yet.
+// New mappings are zero-filled.
+struct IPCSharedMemory
+{
+#if defined(_WIN32)
+    HANDLE handle = NULL;
+#else
+    int fd = -1;
+#endif
+    void* base = nullptr;
+    size_t size = 0;
+
+    bool Open(const char* name, size_t size);
+    void Close();
+
+    // Map the memory again at "address".  On success the original view
+    // is released and "base" is "address"; otherwise nothing changes.
+    bool MapAt(void* address);
+
+    // Remove the name so a later Open() creates a fresh object.  Win32
+    // objects go away with their last handle so this is a no-op there.
+    static void Unlink(const char* name);
+};
+
+struct IPCSemaphore
+{
+#if defined(_WIN32)
+    HANDLE handle = NULL;
+#else
+    sem_t* sem = SEM_FAILED;
+#endif
+
+    bool Open(const char* name, uint32_t maxCount);
+    void Close();
+    static void Unlink(const char* name);
+
+    bool Post();
+    IPCWaitStatus Wait(uint32_t millis);
+};
+
+// Named mutex that is released by the system if the holding process exits
+struct IPCMutex
+{
+#if defined(_WIN32)
+    HANDLE handle = NULL;
+#else
+    int fd = -1;
+#endif
+
+    // If takeOwnership is true and this process created the mutex, it
+    // is returned locked (like CreateMutex with bInitialOwner)
+    bool Open(const char* name, bool takeOwnership);
+    void Close();
+    static void Unlink(const char* name);
+
+    IPCWaitStatus Lock(uint32_t millis);
+    void Unlock();
+};
+
+// Unnamed event used to ask a waiting thread in this process to stop
+struct IPCStopEvent
+{
+#if defined(_WIN32)
+    HANDLE handle = NULL;
+#else
+    std::atomic<bool>* stopped = nullptr;
+#endif
+
+    bool Create();
+    void Signal();
+};
+
+// Another process, kept open so it is possible to find out that it
+// exited, even if it exited without cleaning up
+struct IPCProcess
+{
+    IPCProcessId id = 0;
+#if defined(_WIN32)
+    HANDLE handle = NULL;
+#else
+    int pidfd = -1;
+#endif
+
+    bool Open(IPCProcessId id);
+    void Close();
+    bool HasExited();
+};
+
+// Wait for "sema" to be posted, for "process" to exit, or for the timeout
+IPCWaitStatus IPCWaitForSemaphoreOrProcessExit(IPCSemaphore& sema, IPCProcess& process, uint32_t millis);
+
+// Wait for "sema" to be posted, for "stop" to be signaled, or for the timeout
+IPCWaitStatus IPCWaitForSemaphoreOrStop(IPCSemaphore& sema, IPCStopEvent& stop, uint32_t millis);
+
+#endif /* _IPC_TRANSPORT_H_ */
@@ -40,6 +40,7 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <mutex>
 #include <sstream>
 #include <stdexcept>
@@ -51,10 +52,18 @@
 #include <vector>
 #include <unordered_set>
 
+#if defined(XR_USE_GRAPHICS_API_D3D11)
 #include <dxgi1_2.h>
 #include <d3d11_1.h>
 #include <d3d11_4.h>
 //#include <d3d12.h>
+#endif
+
+#if !defined(_WIN32)
+#include <dlfcn.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 
 
@@ -83,10 +92,34 @@ void LogToFile(const char *str)
     if(LogFile) {
         fprintf(LogFile, "%s", str);
     } else {
+#if defined(_WIN32)
         MessageBoxA(NULL, str, NULL, MB_OK);
+#else
+        fputs(str, stderr);
+#endif
     }
 }
 
+// Debugger output on Windows, stderr elsewhere
+void LogToDebugger(const char *str)
+{
+#if defined(_WIN32)
+    OutputDebugStringA(str);
+#else
+    fputs(str, stderr);
+#endif
+}
+
+// Only for log messages
+static unsigned long GetLogThreadId()
+{
+#if defined(_WIN32)
+    return GetCurrentThreadId();
+#else
+    return static_cast<unsigned long>(syscall(SYS_gettid));
+#endif
+}
+
 std::unordered_map<WellKnownStringIndex, const char *> OverlaysLayerWellKnownStrings = {
     {USER_HAND_LEFT_INPUT_GRIP_POSE, "/user/hand/left/input/grip/pose"},
     {USER_HAND_LEFT_INPUT_Y_TOUCH, "/user/hand/left/input/y/touch"},
@@ -260,16 +293,6 @@ std::unordered_map<WellKnownStringIndex, const char *> OverlaysLayerWellKnownStr
 
 
 
-struct PlaceholderActionId
-{
-    std::string name;
-    XrActionType type;
-    WellKnownStringIndex interactionProfileString;
-    WellKnownStringIndex subActionString;
-    WellKnownStringIndex componentString;
-    WellKnownStringIndex fullBindingString;
-};
-
 std::vector<PlaceholderActionId> PlaceholderActionIds =
 {
     {"/interaction_profiles/khr/simple_controller/user/hand/left/input/aim/pose", XR_ACTION_TYPE_POSE_INPUT, INTERACTION_PROFILES_KHR_SIMPLE_CONTROLLER, USER_HAND_LEFT, INPUT_AIM_POSE, USER_HAND_LEFT_INPUT_AIM_POSE},
@@ -515,30 +538,31 @@ std::vector<PlaceholderActionId> PlaceholderActionIds =
 
 
 // Just in case everything is terrible and every proc has to be synchronized
-std::recursive_mutex gSynchronizeEveryProcMutex;
+ProfiledMutex gSynchronizeEveryProcMutex{"gSynchronizeEveryProcMutex"};
+uint32_t gRPCSpinMicroseconds = 50;
+bool gRPCSpinYield = false;
+uint32_t gRPCHistogramSeconds = 0;
+bool gScratchArenaStrict = false;
+bool gValidateStructCopies = false;
+std::atomic<uint64_t> gEndFrameCount{0};
 bool gSynchronizeEveryProc = true; // XXX Currently true because of both layer view loss and ReleaseSwapchainImage VALIDATION_FAILURE
+bool gSynchronizePerHandle = false;
 
 // LATER understand which lock isn't doing its job and take this out
 // But I'm also using to enforce synchronization between LocateSpace and EndFrame, which seem to conflict
-std::recursive_mutex EndFrameMutex;
+ProfiledMutex EndFrameMutex{"EndFrameMutex"};
 
 // On OVR I get regular deadlocks in one thread in runtime ReleaseSwapchainImage and in another thread in ApplyHapticFeedback.
-std::recursive_mutex HapticQuirkMutex;
+ProfiledMutex HapticQuirkMutex{"HapticQuirkMutex"};
 
 
 const std::set<HandleTypePair> OverlaysLayerNoObjectInfo = {};
 
-uint64_t GetNextLocalHandle()
-{
-    static std::atomic_uint64_t nextHandle = 1;
-    return nextHandle++;
-}
 
-
-std::unique_lock<std::recursive_mutex> GetSyncActionsLock()
+std::unique_lock<ProfiledMutex> GetSyncActionsLock()
 {
-    static std::recursive_mutex syncActionsMutex;
-    return std::unique_lock<std::recursive_mutex>(syncActionsMutex);
+    static ProfiledMutex syncActionsMutex{"GetSyncActionsLock()"};
+    return std::unique_lock<ProfiledMutex>(syncActionsMutex);
 }
 
 
@@ -560,8 +584,8 @@ std::string PathToString(XrInstance instance, XrPath path)
     }
 
     if(result != XR_SUCCESS) {
-        if(instanceInfo->OverlaysLayerPathToWellKnownString.count(path) > 0) {
-            auto index = instanceInfo->OverlaysLayerPathToWellKnownString.at(path);
+        if(instanceInfo->cold->OverlaysLayerPathToWellKnownString.count(path) > 0) {
+            auto index = instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(path);
             auto str = OverlaysLayerWellKnownStrings.at(index);
             sprintf(buffer, "<PathToString failed?! %08llX, \"%s\">", path, str);
             return buffer;
@@ -715,6 +739,8 @@ void UpdateActionStateLastChange(XrActionType actionType, const ActionStateUnion
     }
 }
 
+#if defined(XR_USE_GRAPHICS_API_D3D11)
+
 void LogWindowsLastError(const char *xrfunc, const char* what, const char *file, int line)
 {
     DWORD lastError = GetLastError();
@@ -895,6 +921,19 @@ bool OverlaySwapchain::CreateTextures(XrInstance instance, ID3D11Device *d3d11,
     return true;
 }
 
+#else // XR_USE_GRAPHICS_API_D3D11
+
+// Overlay swapchain images are shared between processes as D3D11
+// textures, so without D3D11 Overlay sessions can't create swapchains
+static XrResult OverlaySwapchainsUnsupported(const char *xrfunc)
+{
+    OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, xrfunc,
+        OverlaysLayerNoObjectInfo, "Overlay swapchains require D3D11, which this build of the layer doesn't include");
+    return XR_ERROR_FUNCTION_UNSUPPORTED;
+}
+
+#endif // XR_USE_GRAPHICS_API_D3D11
+
 OptionalSessionStateChange SessionStateTracker::GetAndDoPendingStateChange(MainSessionSessionState *mainState)
 {
     if((sessionState != XR_SESSION_STATE_LOSS_PENDING) &&
@@ -966,6 +1005,8 @@ OptionalSessionStateChange SessionStateTracker::GetAndDoPendingStateChange(MainS
 }
 
 
+#if defined(XR_USE_GRAPHICS_API_D3D11)
+
 SwapchainCachedData::~SwapchainCachedData()
 {
     for(HANDLE acquired : remoteImagesAcquired) {
@@ -1020,6 +1061,8 @@ ID3D11Texture2D* SwapchainCachedData::getSharedTexture(ID3D11Device *d3d11Device
     return sharedTexture;
 }
 
+#endif // XR_USE_GRAPHICS_API_D3D11
+
 
 // LATER could generate
 void OverlaysLayerRemoveXrSpaceHandleInfo(XrSpace localHandle)
@@ -1027,6 +1070,7 @@ void OverlaysLayerRemoveXrSpaceHandleInfo(XrSpace localHandle)
     {
         OverlaysLayerXrSpaceHandleInfo::Ptr info = OverlaysLayerGetHandleInfoFromXrSpace(localHandle);
         OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(info->parentHandle);
+        auto l = sessionInfo->GetLock();
         sessionInfo->childSpaces.erase(info);
     }
 
@@ -1039,6 +1083,7 @@ void OverlaysLayerRemoveXrSwapchainHandleInfo(XrSwapchain localHandle)
     {
         OverlaysLayerXrSwapchainHandleInfo::Ptr info = OverlaysLayerGetHandleInfoFromXrSwapchain(localHandle);
         OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(info->parentHandle);
+        auto l = sessionInfo->GetLock();
         sessionInfo->childSwapchains.erase(info);
     }
 
@@ -1051,6 +1096,7 @@ void OverlaysLayerRemoveXrActionHandleInfo(XrAction localHandle)
     {
         OverlaysLayerXrActionHandleInfo::Ptr info = OverlaysLayerGetHandleInfoFromXrAction(localHandle);
         OverlaysLayerXrActionSetHandleInfo::Ptr actionSetInfo = OverlaysLayerGetHandleInfoFromXrActionSet(info->parentHandle);
+        auto l = actionSetInfo->GetLock();
         actionSetInfo->childActions.erase(info);
     }
 
@@ -1063,13 +1109,22 @@ void OverlaysLayerRemoveXrActionSetHandleInfo(XrActionSet actionSet)
     OverlaysLayerXrActionSetHandleInfo::Ptr info = OverlaysLayerGetHandleInfoFromXrActionSet(actionSet);
 
     /* remove all XrAction children of this XrActionSet */
-    for(auto action: info->childActions) {
-        OverlaysLayerRemoveXrActionFromHandleInfoMap(action->handle);
+    std::vector<XrAction> actions;
+    {
+        auto l = info->GetLock();
+        actions.reserve(info->childActions.size());
+        for(auto action: info->childActions) {
+            actions.push_back(action->handle);
+        }
     }
+    OverlaysLayerRemoveXrActionsFromHandleInfoMap(actions);
 
     // remove self from Instance childActionSets
     OverlaysLayerXrInstanceHandleInfo::Ptr instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(info->parentHandle);
-    instanceInfo->childActionSets.erase(info);
+    {
+        auto l = instanceInfo->GetLock();
+        instanceInfo->childActionSets.erase(info);
+    }
 
 
     OverlaysLayerRemoveXrActionSetFromHandleInfoMap(actionSet);
@@ -1081,18 +1136,30 @@ void OverlaysLayerRemoveXrSessionHandleInfo(XrSession session)
     OverlaysLayerXrSessionHandleInfo::Ptr info = OverlaysLayerGetHandleInfoFromXrSession(session);
 
     /* remove all XrSwapchain children of this XrSession */
-    for(auto swapchain: info->childSwapchains) {
-        OverlaysLayerRemoveXrSwapchainFromHandleInfoMap(swapchain->localHandle);
-    }
+    std::vector<XrSwapchain> swapchains;
+    std::vector<XrSpace> spaces;
+    {
+        auto l = info->GetLock();
+        swapchains.reserve(info->childSwapchains.size());
+        for(auto swapchain: info->childSwapchains) {
+            swapchains.push_back(swapchain->localHandle);
+        }
 
-    /* remove all XrSpace children of this XrSession */
-    for(auto space: info->childSpaces) {
-        OverlaysLayerRemoveXrSpaceFromHandleInfoMap(space->localHandle);
+        /* remove all XrSpace children of this XrSession */
+        spaces.reserve(info->childSpaces.size());
+        for(auto space: info->childSpaces) {
+            spaces.push_back(space->localHandle);
+        }
     }
+    OverlaysLayerRemoveXrSwapchainsFromHandleInfoMap(swapchains);
+    OverlaysLayerRemoveXrSpacesFromHandleInfoMap(spaces);
 
     // remove self from Instance childSessions
     OverlaysLayerXrInstanceHandleInfo::Ptr instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(info->parentHandle);
-    instanceInfo->childSessions.erase(info);
+    {
+        auto l = instanceInfo->GetLock();
+        instanceInfo->childSessions.erase(info);
+    }
 
     OverlaysLayerRemoveXrSessionFromHandleInfoMap(session);
 }
@@ -1103,19 +1170,31 @@ void OverlaysLayerRemoveXrInstanceHandleInfo(XrInstance instance)
     OverlaysLayerXrInstanceHandleInfo::Ptr info = OverlaysLayerGetHandleInfoFromXrInstance(instance);
 
     /* remove all XrActionSet children of this XrInstance */
-    for(auto actionSet: info->childActionSets) {
-        OverlaysLayerRemoveXrActionSetFromHandleInfoMap(actionSet->handle);
-    }
+    std::vector<XrActionSet> actionSets;
+    std::vector<XrSession> sessions;
+    std::vector<XrDebugUtilsMessengerEXT> messengers;
+    {
+        auto l = info->GetLock();
+        actionSets.reserve(info->childActionSets.size());
+        for(auto actionSet: info->childActionSets) {
+            actionSets.push_back(actionSet->handle);
+        }
 
-    /* remove all XrSession children of this XrInstance */
-    for(auto session: info->childSessions) {
-        OverlaysLayerRemoveXrSessionFromHandleInfoMap(session->localHandle);
-    }
+        /* remove all XrSession children of this XrInstance */
+        sessions.reserve(info->childSessions.size());
+        for(auto session: info->childSessions) {
+            sessions.push_back(session->localHandle);
+        }
 
-    /* remove all XrSession children of this XrInstance */
-    for(auto messenger: info->childDebugUtilsMessengerEXTs) {
-        OverlaysLayerRemoveXrDebugUtilsMessengerEXTFromHandleInfoMap(messenger->handle);
+        /* remove all XrDebugUtilsMessengerEXT children of this XrInstance */
+        messengers.reserve(info->childDebugUtilsMessengerEXTs.size());
+        for(auto messenger: info->childDebugUtilsMessengerEXTs) {
+            messengers.push_back(messenger->handle);
+        }
     }
+    OverlaysLayerRemoveXrActionSetsFromHandleInfoMap(actionSets);
+    OverlaysLayerRemoveXrSessionsFromHandleInfoMap(sessions);
+    OverlaysLayerRemoveXrDebugUtilsMessengerEXTsFromHandleInfoMap(messengers);
 
     OverlaysLayerRemoveXrInstanceFromHandleInfoMap(instance);
 }
@@ -1125,10 +1204,10 @@ void OverlaysLayerLogMessage(XrInstance instance,
                          const std::set<HandleTypePair>& objects_info, const char* message)
 {
     // If we have instance information, see if we need to log this information out to a debug messenger
-    // callback.
-    if(instance != XR_NULL_HANDLE) {
-
-        auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(instance);
+    // callback.  A thread serving an Overlay may log after Main destroyed
+    // the instance, so a stale one is logged as if there were none.
+    OverlaysLayerXrInstanceHandleInfo::Ptr instanceInfo;
+    if((instance != XR_NULL_HANDLE) && (OverlaysLayerTryGetHandleInfoFromXrInstance(instance, instanceInfo) == XR_SUCCESS)) {
 
         // To be a little more performant, check all messenger's
         // messageSeverities and messageTypes to make sure we will call at
@@ -1136,7 +1215,7 @@ void OverlaysLayerLogMessage(XrInstance instance,
 
         /* XXX TBD !instanceInfo->debug_data.Empty() */
 
-        if (!instanceInfo->debugUtilsMessengers.empty()) {
+        if (!instanceInfo->cold->debugUtilsMessengers.empty()) {
 
             // Setup our callback data once
             XrDebugUtilsMessengerCallbackDataEXT callback_data = {};
@@ -1159,7 +1238,7 @@ void OverlaysLayerLogMessage(XrInstance instance,
 #endif
 
             // Loop through all active messengers and give each a chance to output information
-            for (const auto &messenger : instanceInfo->debugUtilsMessengers) {
+            for (const auto &messenger : instanceInfo->cold->debugUtilsMessengers) {
 
                 auto messengerInfo = OverlaysLayerGetHandleInfoFromXrDebugUtilsMessengerEXT(messenger);
 
@@ -1180,12 +1259,12 @@ void OverlaysLayerLogMessage(XrInstance instance,
             }
         } else {
             if(command_name) {
-                OutputDebugStringA(fmt("Overlays API Layer: %s, %s\n", command_name, message).c_str());
+                LogToDebugger(fmt("Overlays API Layer: %s, %s\n", command_name, message).c_str());
                 if(AlsoLogToFile) {
                     LogToFile(fmt("Overlays API Layer: %s, %s\n", command_name, message).c_str());
                 }
             } else {
-                OutputDebugStringA(fmt("Overlays API Layer: %s\n", message).c_str());
+                LogToDebugger(fmt("Overlays API Layer: %s\n", message).c_str());
                 if(AlsoLogToFile) {
                     LogToFile(fmt("Overlays API Layer: %s\n", message).c_str());
                 }
@@ -1193,12 +1272,12 @@ void OverlaysLayerLogMessage(XrInstance instance,
         }
     } else {
         if(command_name) {
-            OutputDebugStringA(fmt("Overlays API Layer: %s, %s\n", command_name, message).c_str());
+            LogToDebugger(fmt("Overlays API Layer: %s, %s\n", command_name, message).c_str());
             if(AlsoLogToFile) {
                 LogToFile(fmt("Overlays API Layer: %s, %s\n", command_name, message).c_str());
             }
         } else {
-            OutputDebugStringA(fmt("Overlays API Layer: %s\n", message).c_str());
+            LogToDebugger(fmt("Overlays API Layer: %s\n", message).c_str());
             if(AlsoLogToFile) {
                 LogToFile(fmt("Overlays API Layer: %s\n", message).c_str());
             }
@@ -1220,6 +1299,31 @@ XrResult OverlaysLayerXrCreateInstance(const XrInstanceCreateInfo * /*info*/, Xr
 }
 
 
+// If environment variable "name" is set, store in "flag" whether it's
+// one of "true", "TRUE", "True", "1", or "yes" and return true
+static bool GetEnvFlag(const char* name, bool& flag)
+{
+    const char* value = getenv(name);
+    if(!value) {
+        return false;
+    }
+    static const std::set<std::string> truths {"true", "TRUE", "True", "1", "yes"};
+    flag = (truths.count(value) > 0);
+    return true;
+}
+
+// If environment variable "name" is set, store it in "number" as a
+// decimal and return true
+static bool GetEnvUint32(const char* name, uint32_t& number)
+{
+    const char* value = getenv(name);
+    if(!value) {
+        return false;
+    }
+    number = (uint32_t)strtoul(value, nullptr, 10);
+    return true;
+}
+
 XrResult OverlaysLayerXrCreateApiLayerInstance(const XrInstanceCreateInfo *instanceCreateInfo,
         const struct XrApiLayerCreateInfo *apiLayerInfo, XrInstance *instance)
 {
@@ -1227,15 +1331,49 @@ XrResult OverlaysLayerXrCreateApiLayerInstance(const XrInstanceCreateInfo *insta
     PFN_xrCreateApiLayerInstance next_create_api_layer_instance = nullptr;
     XrApiLayerCreateInfo new_api_layer_info = {};
 
-    const char *sync_everything_env = getenv("OVERLAYS_API_LAYER_SYNCHRONIZE_EVERYTHING");
-    if(sync_everything_env) {
-        std::string sync_everything = sync_everything_env;
-        std::set<std::string> truths {"true", "TRUE", "True", "1", "yes"};
-        gSynchronizeEveryProc = (truths.count(sync_everything) > 0);
+    if(GetEnvFlag("OVERLAYS_API_LAYER_SYNCHRONIZE_EVERYTHING", gSynchronizeEveryProc)) {
         OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateInstance", 
             OverlaysLayerNoObjectInfo, fmt("gSynchronizeEveryProc set to %s", gSynchronizeEveryProc ? "true" : "false").c_str());
     }
 
+    if(GetEnvFlag("OVERLAYS_API_LAYER_SYNCHRONIZE_PER_HANDLE", gSynchronizePerHandle)) {
+        if(gSynchronizePerHandle) {
+            gSynchronizeEveryProc = false;
+        }
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateInstance", 
+            OverlaysLayerNoObjectInfo, fmt("gSynchronizePerHandle set to %s", gSynchronizePerHandle ? "true" : "false").c_str());
+    }
+
+    if(GetEnvUint32("OVERLAYS_API_LAYER_RPC_SPIN_MICROSECONDS", gRPCSpinMicroseconds)) {
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateInstance", 
+            OverlaysLayerNoObjectInfo, fmt("gRPCSpinMicroseconds set to %u", gRPCSpinMicroseconds).c_str());
+    }
+
+    if(GetEnvFlag("OVERLAYS_API_LAYER_RPC_SPIN_YIELD", gRPCSpinYield)) {
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateInstance", 
+            OverlaysLayerNoObjectInfo, fmt("gRPCSpinYield set to %s", gRPCSpinYield ? "true" : "false").c_str());
+    }
+
+    if(GetEnvUint32("OVERLAYS_API_LAYER_RPC_HISTOGRAM_SECONDS", gRPCHistogramSeconds)) {
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateInstance", 
+            OverlaysLayerNoObjectInfo, fmt("gRPCHistogramSeconds set to %u", gRPCHistogramSeconds).c_str());
+    }
+
+    if(GetEnvUint32("OVERLAYS_API_LAYER_LOCK_PROFILE_SECONDS", gLockProfileSeconds)) {
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateInstance", 
+            OverlaysLayerNoObjectInfo, fmt("gLockProfileSeconds set to %u", gLockProfileSeconds).c_str());
+    }
+
+    if(GetEnvFlag("OVERLAYS_API_LAYER_SCRATCH_ARENA_STRICT", gScratchArenaStrict)) {
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateInstance", 
+            OverlaysLayerNoObjectInfo, fmt("gScratchArenaStrict set to %s", gScratchArenaStrict ? "true" : "false").c_str());
+    }
+
+    if(GetEnvFlag("OVERLAYS_API_LAYER_VALIDATE_STRUCT_COPIES", gValidateStructCopies)) {
+        OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateInstance", 
+            OverlaysLayerNoObjectInfo, fmt("gValidateStructCopies set to %s", gValidateStructCopies ? "true" : "false").c_str());
+    }
+
     // Validate the API layer info and next API layer info structures before we try to use them
     if (!apiLayerInfo ||
         XR_LOADER_INTERFACE_STRUCT_API_LAYER_CREATE_INFO != apiLayerInfo->structType ||
@@ -1289,8 +1427,8 @@ XrResult OverlaysLayerXrCreateApiLayerInstance(const XrInstanceCreateInfo *insta
 
     // Create XrPaths for well-known strings.  We can use the compile-time fixed string enums to pass strings and paths over RPC
     // XXX This should be on CreateInstance in the instance info
-    instanceInfo->OverlaysLayerWellKnownStringToPath.insert({WellKnownStringIndex::NULL_PATH, XR_NULL_PATH});
-    instanceInfo->OverlaysLayerPathToWellKnownString.insert({XR_NULL_PATH, WellKnownStringIndex::NULL_PATH});
+    instanceInfo->cold->OverlaysLayerWellKnownStringToPath.insert({WellKnownStringIndex::NULL_PATH, XR_NULL_PATH});
+    instanceInfo->cold->OverlaysLayerPathToWellKnownString.insert({XR_NULL_PATH, WellKnownStringIndex::NULL_PATH});
     for(auto& w : OverlaysLayerWellKnownStrings) {
         XrPath path;
         XrResult result2 = instanceInfo->downchain->StringToPath(*instance, w.second, &path);
@@ -1299,18 +1437,18 @@ XrResult OverlaysLayerXrCreateApiLayerInstance(const XrInstanceCreateInfo *insta
                 OverlaysLayerNoObjectInfo, fmt("Could not create path from \"%s\".", w.second).c_str());
             return XR_ERROR_INITIALIZATION_FAILED;
         }
-        instanceInfo->OverlaysLayerWellKnownStringToPath.insert({w.first, path});
-        instanceInfo->OverlaysLayerPathToWellKnownString.insert({path, w.first});
+        instanceInfo->cold->OverlaysLayerWellKnownStringToPath.insert({w.first, path});
+        instanceInfo->cold->OverlaysLayerPathToWellKnownString.insert({path, w.first});
     }
     for(auto& id : PlaceholderActionIds) {
-        XrPath profilePath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(id.interactionProfileString);
-        XrPath subactionPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(id.subActionString);
-        XrPath componentPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(id.componentString);
-        XrPath fullBindingPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(id.fullBindingString);
+        XrPath profilePath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(id.interactionProfileString);
+        XrPath subactionPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(id.subActionString);
+        XrPath componentPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(id.componentString);
+        XrPath fullBindingPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(id.fullBindingString);
 
-        instanceInfo->OverlaysLayerBindingToSubaction.insert({fullBindingPath, subactionPath});
+        instanceInfo->cold->OverlaysLayerBindingToSubaction.insert({fullBindingPath, subactionPath});
 
-        instanceInfo->OverlaysLayerAllSubactionPaths.insert(subactionPath);
+        instanceInfo->cold->OverlaysLayerAllSubactionPaths.insert(subactionPath);
     }
 
     OverlaysLayerAddHandleInfoForXrInstance(*instance, instanceInfo);
@@ -1334,160 +1472,429 @@ NegotiationChannels gNegotiationChannels;
 
 XrInstance gMainSessionInstance;
 MainSessionContext::Ptr gMainSessionContext;
-DWORD gMainProcessId;   // Set by Overlay to check for main process unexpected exit
-HANDLE gMainMutexHandle; // Held by Main for duration of operation as Main Session
+IPCProcessId gMainProcessId;   // Set by Overlay to check for main process unexpected exit
+IPCMutex gMainMutex; // Held by Main for duration of operation as Main Session
 
 // Both main and overlay processes call this function, which creates/opens
 // the negotiation mutex, shmem, and semaphores.
 bool OpenNegotiationChannels(XrInstance instance, NegotiationChannels &ch)
 {
     ch.instance = instance;
-    ch.mutexHandle = CreateMutexA(NULL, TRUE, NegotiationChannels::mutexName);
-    if (ch.mutexHandle == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    if(!ch.mutex.Open(NegotiationChannels::mutexName, true)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession", 
-            OverlaysLayerNoObjectInfo, fmt("Could not initialize the negotiation mutex: CreateMutex error was %d (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
+            OverlaysLayerNoObjectInfo, fmt("Could not initialize the negotiation mutex: %s", IPCGetLastErrorString().c_str()).c_str());
         return false;
     }
 
-    ch.shmemHandle = CreateFileMappingA( 
-        INVALID_HANDLE_VALUE,   // use sys paging file instead of an existing file
-        NULL,                   // default security attributes
-        PAGE_READWRITE,         // read/write access
-        0,                      // size: high 32-bits
-        NegotiationChannels::shmemSize,         // size: low 32-bits
-        NegotiationChannels::shmemName);        // name of map object
-
-    if (ch.shmemHandle == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    if(!ch.shmem.Open(NegotiationChannels::shmemName, NegotiationChannels::shmemSize)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession",
-            OverlaysLayerNoObjectInfo, fmt("Could not initialize the negotiation shmem: CreateFileMappingA error was %08X (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
+            OverlaysLayerNoObjectInfo, fmt("Could not initialize the negotiation shmem: %s", IPCGetLastErrorString().c_str()).c_str());
         return false; 
     }
+    ch.params = reinterpret_cast<NegotiationParams*>(ch.shmem.base);
 
-    // Get a pointer to the file-mapped shared memory, read/write
-    ch.params = reinterpret_cast<NegotiationParams*>(MapViewOfFile(ch.shmemHandle, FILE_MAP_WRITE, 0, 0, 0));
-    if (!ch.params) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    if(!ch.overlayWaitSema.Open(NegotiationChannels::overlayWaitSemaName, 1)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession",
-            OverlaysLayerNoObjectInfo, fmt("Could not get the negotiation shmem: MapViewOfFile error was %08X (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
-        return false; 
-    }
-
-    ch.overlayWaitSema = CreateSemaphoreA(nullptr, 0, 1, NegotiationChannels::overlayWaitSemaName);
-    if(ch.overlayWaitSema == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
-        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession",
-            OverlaysLayerNoObjectInfo, fmt("Could not create negotiation overlay wait sema: CreateSemaphore error was %08X (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
+            OverlaysLayerNoObjectInfo, fmt("Could not create negotiation overlay wait sema: %s", IPCGetLastErrorString().c_str()).c_str());
         return false;
     }
 
-    ch.mainWaitSema = CreateSemaphoreA(nullptr, 0, 1, NegotiationChannels::mainWaitSemaName);
-    if(ch.mainWaitSema == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    if(!ch.mainWaitSema.Open(NegotiationChannels::mainWaitSemaName, 1)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession",
-            OverlaysLayerNoObjectInfo, fmt("Could not create negotiation main wait sema: CreateSemaphore error was %08X (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
+            OverlaysLayerNoObjectInfo, fmt("Could not create negotiation main wait sema: %s", IPCGetLastErrorString().c_str()).c_str());
         return false;
     }
 
     return true;
 }
 
-bool OpenRPCChannels(XrInstance instance, DWORD otherProcessId, DWORD overlayId, RPCChannels& ch)
+bool OpenRPCChannels(XrInstance instance, IPCProcessId otherProcessId, IPCProcessId overlayId, uint32_t channelIndex, RPCChannels& ch)
 {
     ch.instance = instance;
+    ch.overlayId = overlayId;
+    ch.channelIndex = channelIndex;
 
-    ch.otherProcessId = otherProcessId;
-    ch.otherProcessHandle = OpenProcess(PROCESS_ALL_ACCESS, TRUE, ch.otherProcessId);
-
-    ch.mutexHandle = CreateMutexA(NULL, TRUE, fmt(RPCChannels::mutexNameTemplate, overlayId).c_str());
-    if (ch.mutexHandle == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    if(!ch.otherProcess.Open(otherProcessId)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "no function", 
-            OverlaysLayerNoObjectInfo, fmt("Could not initialize the RPC mutex: CreateMutex error was %d (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
+            OverlaysLayerNoObjectInfo, fmt("Could not open the other process %u: %s", (uint32_t)otherProcessId, IPCGetLastErrorString().c_str()).c_str());
         return false;
     }
 
-    ch.shmemHandle = CreateFileMappingA( 
-        INVALID_HANDLE_VALUE,   // use sys paging file instead of an existing file
-        NULL,                   // default security attributes
-        PAGE_READWRITE,         // read/write access
-        0,                      // size: high 32-bits
-        RPCChannels::shmemSize,         // size: low 32-bits
-        fmt(RPCChannels::shmemNameTemplate, overlayId).c_str());        // name of map object
+    if(!ch.mutex.Open(fmt(RPCChannels::mutexNameTemplate, overlayId, channelIndex).c_str(), true)) {
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "no function", 
+            OverlaysLayerNoObjectInfo, fmt("Could not initialize the RPC mutex: %s", IPCGetLastErrorString().c_str()).c_str());
+        return false;
+    }
 
-    if (ch.shmemHandle == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    if(!ch.shmem.Open(fmt(RPCChannels::shmemNameTemplate, overlayId, channelIndex).c_str(), RPCChannels::shmemSize)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "no function", 
-            OverlaysLayerNoObjectInfo, fmt("Could not initialize the RPC shmem: CreateFileMappingA error was %08X (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
+            OverlaysLayerNoObjectInfo, fmt("Could not initialize the RPC shmem: %s", IPCGetLastErrorString().c_str()).c_str());
         return false; 
     }
 
-    // Get a pointer to the file-mapped shared memory, read/write
-    ch.shmem = MapViewOfFile(ch.shmemHandle, FILE_MAP_WRITE, 0, 0, 0);
-    if (ch.shmem == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
-        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession", 
-            OverlaysLayerNoObjectInfo, fmt("Could not get the RPC shmem: MapViewOfFile error was %08X (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
-        return false; 
+    ch.AttachRing();
+
+    // If the other process already mapped the shared memory, try to map
+    // it at the same address so pointers in requests need no fixups
+    bool isMain = (IPCGetCurrentProcessId() != overlayId);
+    uint64_t otherBase = isMain ? ch.ring->overlayBase.load() : ch.ring->mainBase.load();
+    if((otherBase != 0) && (otherBase != reinterpret_cast<uintptr_t>(ch.shmem.base))) {
+        if(ch.shmem.MapAt(reinterpret_cast<void*>(otherBase))) {
+            ch.AttachRing();
+        } else {
+            OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "no function", 
+                OverlaysLayerNoObjectInfo, fmt("Could not map the RPC shmem at the other process's address, will fix up pointers: %s", IPCGetLastErrorString().c_str()).c_str());
+        }
     }
+    (isMain ? ch.ring->mainBase : ch.ring->overlayBase).store(reinterpret_cast<uintptr_t>(ch.shmem.base));
 
-    ch.overlayRequestSema = CreateSemaphoreA(nullptr, 0, 1, fmt(RPCChannels::overlayRequestSemaNameTemplate, overlayId).c_str());
-    if(ch.overlayRequestSema == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    if(!ch.overlayRequestSema.Open(fmt(RPCChannels::overlayRequestSemaNameTemplate, overlayId, channelIndex).c_str(), RPCChannels::slotCount)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession", 
-            OverlaysLayerNoObjectInfo, fmt("Could not create RPC overlay request sema: CreateSemaphore error was %08X (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
+            OverlaysLayerNoObjectInfo, fmt("Could not create RPC overlay request sema: %s", IPCGetLastErrorString().c_str()).c_str());
         return false;
     }
 
-    ch.mainResponseSema = CreateSemaphoreA(nullptr, 0, 1, fmt(RPCChannels::mainResponseSemaNameTemplate, overlayId).c_str());
-    if(ch.mainResponseSema == NULL) {
-        DWORD lastError = GetLastError();
-        LPVOID messageBuf;
-        FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
+    if(!ch.mainResponseSema.Open(fmt(RPCChannels::mainResponseSemaNameTemplate, overlayId, channelIndex).c_str(), RPCChannels::slotCount)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession", 
-            OverlaysLayerNoObjectInfo, fmt("Could not create RPC main response sema: CreateSemaphore error was %08X (%s)", lastError, messageBuf).c_str());
-        LocalFree(messageBuf);
+            OverlaysLayerNoObjectInfo, fmt("Could not create RPC main response sema: %s", IPCGetLastErrorString().c_str()).c_str());
         return false;
     }
 
     return true;
 }
 
+// Named objects outlive both processes on POSIX, so Main removes the
+// names once an overlay's connection is over.  The objects themselves
+// stay valid until every process has closed them.
+void UnlinkRPCChannels(IPCProcessId overlayId)
+{
+    for(uint32_t channelIndex = 0; channelIndex < RPCChannels::channelsPerConnection; channelIndex++) {
+        IPCMutex::Unlink(fmt(RPCChannels::mutexNameTemplate, overlayId, channelIndex).c_str());
+        IPCSharedMemory::Unlink(fmt(RPCChannels::shmemNameTemplate, overlayId, channelIndex).c_str());
+        IPCSemaphore::Unlink(fmt(RPCChannels::overlayRequestSemaNameTemplate, overlayId, channelIndex).c_str());
+        IPCSemaphore::Unlink(fmt(RPCChannels::mainResponseSemaNameTemplate, overlayId, channelIndex).c_str());
+    }
+}
+
+XrResult ConnectionToMain::WaitForAsyncOnOtherChannels(const Channel& channel)
+{
+    for(auto& other: channels) {
+        if(&other == &channel) {
+            continue;
+        }
+
+        uint64_t sequence = other.lastAsyncSequence.load();
+        RPCChannels& conn = other.conn;
+
+        // Usually served long ago.  Otherwise block alongside the other
+        // channel's own thread; Main answers everything it's going to
+        // before it marks a channel closed, so a closed channel that's
+        // behind stays behind.
+        IPCWaitStatus result = conn.BlockUntil([&conn, sequence]{ return conn.ring->responseSequence.load() >= sequence; }, conn.ring->overlayWaiting, conn.mainResponseSema,
+            [&conn]{ return conn.ring->mainClosed.load() != 0; });
+
+        if(result == IPC_WAIT_STOPPED) {
+            return XR_ERROR_SESSION_LOST;
+        }
+        if(result == IPC_WAIT_PROCESS_EXITED) {
+            OverlaysLayerLogMessage(conn.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+                fmt("main process exited before answering RPC request %llu", (unsigned long long)sequence).c_str());
+            return XR_ERROR_INSTANCE_LOST;
+        }
+        if(result != IPC_WAIT_SIGNALED) {
+            OverlaysLayerLogMessage(conn.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+                fmt("couldn't wait for main process to answer RPC request %llu: %s", (unsigned long long)sequence, IPCGetLastErrorString().c_str()).c_str());
+            return XR_ERROR_INITIALIZATION_FAILED;
+        }
+    }
+
+    return XR_SUCCESS;
+}
+
+// Counts of latencies in power-of-two buckets; bucket i counts
+// [2^i, 2^(i+1)) nanoseconds and the last counts everything longer
+struct LatencyHistogram
+{
+    constexpr static uint32_t bucketCount = 32;
+
+    std::atomic<uint64_t> buckets[bucketCount];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalNanoseconds;
+
+    void Record(uint64_t nanoseconds)
+    {
+        uint32_t bucket = 0;
+        while((bucket < bucketCount - 1) && ((nanoseconds >> (bucket + 1)) != 0)) {
+            bucket++;
+        }
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    // Upper end of the bucket holding the given per-mille point
+    uint64_t PercentileBound(uint32_t permille) const
+    {
+        uint64_t target = (count.load(std::memory_order_relaxed) * permille + 999) / 1000;
+        uint64_t seen = 0;
+        for(uint32_t bucket = 0; bucket < bucketCount; bucket++) {
+            seen += buckets[bucket].load(std::memory_order_relaxed);
+            if(seen >= std::max<uint64_t>(target, 1)) {
+                return uint64_t(1) << (bucket + 1);
+            }
+        }
+        return uint64_t(1) << bucketCount;
+    }
+};
+
+// Zero-initialized as a global; shared by all channels and connections in this process
+LatencyHistogram gLatencyHistograms[RPC_XR_REQUEST_TYPE_COUNT][RPC_PHASE_COUNT];
+
+void RPCRecordLatency(uint64_t requestType, RPCLatencyPhase phase, uint64_t nanoseconds)
+{
+    if(requestType < RPC_XR_REQUEST_TYPE_COUNT) {
+        gLatencyHistograms[requestType][phase].Record(nanoseconds);
+    }
+}
+
+void RPCLogLatencyHistograms(XrInstance instance, const char* processName)
+{
+    static const char* phaseNames[RPC_PHASE_COUNT] = {"serialize", "wake", "service", "copy-out"};
+
+    for(uint64_t requestType = 0; requestType < RPC_XR_REQUEST_TYPE_COUNT; requestType++) {
+        std::string phases;
+        uint64_t calls = 0;
+
+        for(uint32_t phase = 0; phase < RPC_PHASE_COUNT; phase++) {
+            const LatencyHistogram& histogram = gLatencyHistograms[requestType][phase];
+            uint64_t count = histogram.count.load(std::memory_order_relaxed);
+            if(count == 0) {
+                continue;
+            }
+            calls = std::max(calls, count);
+            phases += fmt("; %s mean %.2fus, p50 <%.2fus, p99 <%.2fus, max <%.2fus", phaseNames[phase],
+                histogram.totalNanoseconds.load(std::memory_order_relaxed) / 1000.0 / count,
+                histogram.PercentileBound(500) / 1000.0, histogram.PercentileBound(990) / 1000.0, histogram.PercentileBound(1000) / 1000.0);
+        }
+
+        if(calls > 0) {
+            OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+                fmt("%s RPC %s latency over %llu calls%s", processName, RPCRequestTypeName(requestType), (unsigned long long)calls, phases.c_str()).c_str());
+        }
+    }
+}
+
+// Call after each RPC; logs the histograms every gRPCHistogramSeconds
+void RPCLogLatencyHistogramsIfDue(XrInstance instance, const char* processName)
+{
+    static std::atomic<uint64_t> nextLogNanoseconds{0};
+
+    if(gRPCHistogramSeconds == 0) {
+        return;
+    }
+
+    uint64_t now = IPCGetTimestampNanoseconds();
+    uint64_t next = nextLogNanoseconds.load();
+    if(now < next) {
+        return;
+    }
+
+    // Only one thread logs; the first call just starts the clock
+    if(nextLogNanoseconds.compare_exchange_strong(next, now + gRPCHistogramSeconds * 1000000000ull) && (next != 0)) {
+        RPCLogLatencyHistograms(instance, processName);
+    }
+}
+
+#if defined(_MSC_VER)
+#define OVERLAYS_NOINLINE __declspec(noinline)
+#define OVERLAYS_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define OVERLAYS_NOINLINE __attribute__((noinline))
+#define OVERLAYS_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+uint32_t gLockProfileSeconds = 0;
+
+struct LockProfile
+{
+    std::string name;
+    std::atomic<uint64_t> acquisitions;
+    LatencyHistogram waits;     // Only acquisitions that had to wait
+    LatencyHistogram holds;
+
+    // Number of times a thread at the first site waited for a thread
+    // that had taken the lock at the second site
+    std::mutex contentionsMutex;
+    std::map<std::pair<const void*, const void*>, uint64_t> contentions;
+};
+
+// Global ProfiledMutexes in any file register during static
+// initialization, so the list is constructed on first use.  Profiles
+// are never freed, so a ProfiledMutex's profile outlives it; nor is the
+// list, so they are still reachable at exit for leak checkers.
+std::vector<LockProfile*>& GetLockProfiles(std::unique_lock<std::mutex>& lock)
+{
+    static std::mutex profilesMutex;
+    static std::vector<LockProfile*>* profiles = new std::vector<LockProfile*>();
+    lock = std::unique_lock<std::mutex>(profilesMutex);
+    return *profiles;
+}
+
+LockProfile* GetLockProfile(const char* name)
+{
+    std::unique_lock<std::mutex> lock;
+    auto& profiles = GetLockProfiles(lock);
+    for(LockProfile* profile: profiles) {
+        if(profile->name == name) {
+            return profile;
+        }
+    }
+    // Value-initialized, so the counters and histograms start at zero
+    LockProfile* profile = new LockProfile();
+    profile->name = name;
+    profiles.push_back(profile);
+    return profile;
+}
+
+ProfiledMutex::ProfiledMutex(const char* name) :
+    profile(GetLockProfile(name))
+{
+}
+
+// Not inlined, so the return address is the code that asked for the lock
+OVERLAYS_NOINLINE void ProfiledMutex::lock()
+{
+    if(gLockProfileSeconds == 0) {
+        mutex.lock();
+        return;
+    }
 
-std::unordered_map<DWORD, ConnectionToOverlay::Ptr> gConnectionsToOverlayByProcessId;
+    const void* site = OVERLAYS_RETURN_ADDRESS();
+
+    if(!mutex.try_lock()) {
+        const void* holder = holderSite.load(std::memory_order_relaxed);
+        uint64_t waitStart = IPCGetTimestampNanoseconds();
+        mutex.lock();
+        profile->waits.Record(IPCGetTimestampNanoseconds() - waitStart);
+        std::unique_lock<std::mutex> lock(profile->contentionsMutex);
+        profile->contentions[{site, holder}]++;
+    }
+
+    if(depth++ == 0) {
+        acquiredNanoseconds = IPCGetTimestampNanoseconds();
+        holderSite.store(site, std::memory_order_relaxed);
+        profile->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ProfiledMutex::unlock()
+{
+    // depth is 0 if this was locked before profiling was turned on
+    if((depth > 0) && (--depth == 0)) {
+        profile->holds.Record(IPCGetTimestampNanoseconds() - acquiredNanoseconds);
+        holderSite.store(nullptr, std::memory_order_relaxed);
+    }
+    mutex.unlock();
+}
+
+// e.g. "overlays_api_layer.dll+0x1c2f0" to look up in the PDB, or
+// "libxr_extx_overlay.so+0x1c2f0" for addr2line
+std::string FormatCodeAddress(const void* address)
+{
+#if defined(_WIN32)
+    HMODULE module;
+    char path[MAX_PATH];
+    if(address && GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, reinterpret_cast<LPCSTR>(address), &module) &&
+        (GetModuleFileNameA(module, path, sizeof(path)) > 0)) {
+
+        const char* base = strrchr(path, '\\');
+        return fmt("%s+0x%llx", base ? base + 1 : path, (unsigned long long)(reinterpret_cast<const char*>(address) - reinterpret_cast<const char*>(module)));
+    }
+#else
+    Dl_info info;
+    if(address && dladdr(address, &info) && info.dli_fname && info.dli_fbase) {
+
+        const char* base = strrchr(info.dli_fname, '/');
+        return fmt("%s+0x%llx", base ? base + 1 : info.dli_fname, (unsigned long long)(reinterpret_cast<const char*>(address) - reinterpret_cast<const char*>(info.dli_fbase)));
+    }
+#endif
+    return fmt("%p", address);
+}
+
+void LogLockProfiles(XrInstance instance)
+{
+    constexpr size_t contentionsToLog = 3;
+
+    std::unique_lock<std::mutex> lock;
+    for(LockProfile* profile: GetLockProfiles(lock)) {
+        uint64_t acquisitions = profile->acquisitions.load(std::memory_order_relaxed);
+        if(acquisitions == 0) {
+            continue;
+        }
+
+        std::string report = fmt("Lock %s: %llu acquisitions", profile->name.c_str(), (unsigned long long)acquisitions);
+
+        const LatencyHistogram& holds = profile->holds;
+        uint64_t holdCount = holds.count.load(std::memory_order_relaxed);
+        if(holdCount > 0) {
+            report += fmt("; held mean %.2fus, p99 <%.2fus, max <%.2fus",
+                holds.totalNanoseconds.load(std::memory_order_relaxed) / 1000.0 / holdCount,
+                holds.PercentileBound(990) / 1000.0, holds.PercentileBound(1000) / 1000.0);
+        }
+
+        const LatencyHistogram& waits = profile->waits;
+        uint64_t waitCount = waits.count.load(std::memory_order_relaxed);
+        if(waitCount > 0) {
+            report += fmt("; %llu waited (%.1f%%), mean %.2fus, p50 <%.2fus, p99 <%.2fus, max <%.2fus",
+                (unsigned long long)waitCount, 100.0 * waitCount / acquisitions,
+                waits.totalNanoseconds.load(std::memory_order_relaxed) / 1000.0 / waitCount,
+                waits.PercentileBound(500) / 1000.0, waits.PercentileBound(990) / 1000.0, waits.PercentileBound(1000) / 1000.0);
+
+            std::vector<std::pair<uint64_t, std::pair<const void*, const void*>>> worst;
+            {
+                std::unique_lock<std::mutex> contentionsLock(profile->contentionsMutex);
+                for(const auto& [sites, count]: profile->contentions) {
+                    worst.push_back({count, sites});
+                }
+            }
+            std::sort(worst.begin(), worst.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+            for(size_t i = 0; i < std::min(worst.size(), contentionsToLog); i++) {
+                report += fmt("; %s waited on %s %llu times", FormatCodeAddress(worst[i].second.first).c_str(),
+                    FormatCodeAddress(worst[i].second.second).c_str(), (unsigned long long)worst[i].first);
+            }
+        }
+
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo, report.c_str());
+    }
+}
+
+// Call once a frame; logs the lock profiles every gLockProfileSeconds
+void LogLockProfilesIfDue(XrInstance instance)
+{
+    static std::atomic<uint64_t> nextLogNanoseconds{0};
+
+    if(gLockProfileSeconds == 0) {
+        return;
+    }
+
+    uint64_t now = IPCGetTimestampNanoseconds();
+    uint64_t next = nextLogNanoseconds.load();
+    if(now < next) {
+        return;
+    }
+
+    if(nextLogNanoseconds.compare_exchange_strong(next, now + gLockProfileSeconds * 1000000000ull) && (next != 0)) {
+        LogLockProfiles(instance);
+    }
+}
+
+
+std::unordered_map<IPCProcessId, ConnectionToOverlay::Ptr> gConnectionsToOverlayByProcessId;
 std::vector<ConnectionToOverlay::Ptr> gConnectionsToOverlayInDepthOrder;
 std::recursive_mutex gConnectionsToOverlayByProcessIdMutex;
 
 // Assumes exclusive access to parameters, so lock around this if necessary
-void SortOverlaysByPriority(const std::unordered_map<DWORD, ConnectionToOverlay::Ptr>& connectionsToOverlayByProcessId, 
+void SortOverlaysByPriority(const std::unordered_map<IPCProcessId, ConnectionToOverlay::Ptr>& connectionsToOverlayByProcessId, 
     std::vector<ConnectionToOverlay::Ptr>& connectionsToOverlayInDepthOrder)
 {
     connectionsToOverlayInDepthOrder.clear();
@@ -1498,15 +1905,161 @@ void SortOverlaysByPriority(const std::unordered_map<DWORD, ConnectionToOverlay:
         }
     }
 
-    std::sort(connectionsToOverlayInDepthOrder.begin(), connectionsToOverlayInDepthOrder.end(), [](const ConnectionToOverlay::Ptr &a, const ConnectionToOverlay::Ptr &b){ auto la = a->GetLock(); auto la2 = a->ctx->GetLock(); auto lb = b->GetLock(); auto lb2 = b->ctx->GetLock(); return a->ctx->sessionLayersPlacement < b->ctx->sessionLayersPlacement; });
-}
+    std::sort(connectionsToOverlayInDepthOrder.begin(), connectionsToOverlayInDepthOrder.end(), [](const ConnectionToOverlay::Ptr &a, const ConnectionToOverlay::Ptr &b){ auto la = a->GetLock(); auto la2 = a->ctx->GetLock(); auto lb = b->GetLock(); auto lb2 = b->ctx->GetLock(); return a->ctx->sessionLayersPlacement < b->ctx->sessionLayersPlacement; });
+}
+
+
+ScratchArena& ScratchArena::ForThisThread()
+{
+    thread_local ScratchArena arena;
+    return arena;
+}
+
+void* ScratchArena::Allocate(size_t size)
+{
+    // Each allocation is preceded by a pointer to its chunk
+    size_t needed = RoundUp(sizeof(Chunk*)) + RoundUp(size);
+
+    if(current && (current->references.load() == 1)) {
+        current->used = 0;
+    }
+
+    if(!current || (current->size - current->used < needed)) {
+        size_t chunkSize = std::max(needed, current ? std::min(current->size * 2, maxChunkSize) : initialChunkSize);
+
+        // Every way out of this block allocates from the heap
+        if(gScratchArenaStrict && (gEndFrameCount.load() > warmupFrames)) {
+            OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+                fmt("scratch arena allocated a %zu byte chunk for a %zu byte allocation after %llu frames", chunkSize, size, (unsigned long long)gEndFrameCount.load()).c_str());
+            abort();
+        }
+
+        if(needed > maxChunkSize) {
+            // Its own chunk, whose one reference is this allocation
+            Chunk* chunk = NewChunk(needed);
+            if(!chunk) {
+                return nullptr;
+            }
+            chunk->used = needed;
+            *reinterpret_cast<Chunk**>(chunk->memory.get()) = chunk;
+            return chunk->memory.get() + RoundUp(sizeof(Chunk*));
+        }
+
+        Chunk* chunk = NewChunk(chunkSize);
+        if(!chunk) {
+            return nullptr;
+        }
+        if(current) {
+            Release(current);
+        }
+        current = chunk;
+    }
+
+    unsigned char* p = current->memory.get() + current->used;
+    current->used += needed;
+    current->references++;
+
+    *reinterpret_cast<Chunk**>(p) = current;
+    return p + RoundUp(sizeof(Chunk*));
+}
+
+ScratchArena::Chunk* ScratchArena::NewChunk(size_t size)
+{
+    Chunk* chunk = new(std::nothrow) Chunk(size);
+    if(chunk && !chunk->memory) {
+        delete chunk;
+        return nullptr;
+    }
+    return chunk;
+}
+
+void ScratchArena::Free(const void* p)
+{
+    if(!p) {
+        return;
+    }
+    const unsigned char* allocation = reinterpret_cast<const unsigned char*>(p) - RoundUp(sizeof(Chunk*));
+    Release(*reinterpret_cast<Chunk* const*>(allocation));
+}
+
+void ScratchArena::Release(Chunk* chunk)
+{
+    if(chunk->references.fetch_sub(1) == 1) {
+        delete chunk;
+    }
+}
+
+std::atomic<uint64_t> Epochs::current{1};
+Epochs::Reader Epochs::readers[Epochs::maxReaders];
+std::atomic<uint32_t> Epochs::readersWithoutSlot{0};
+std::mutex Epochs::retiredMutex;
+std::vector<std::pair<uint64_t, std::function<void()>>> Epochs::retired;
+
+Epochs::ThisThread::ThisThread()
+{
+    for(auto& r: readers) {
+        bool unclaimed = false;
+        if(r.claimed.compare_exchange_strong(unclaimed, true)) {
+            reader = &r;
+            return;
+        }
+    }
+    OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+        fmt("more than %u threads have read epoch-protected tables; retired tables won't be freed while this one reads them", maxReaders).c_str());
+}
+
+Epochs::ThisThread::~ThisThread()
+{
+    if(reader) {
+        reader->claimed.store(false);
+    }
+}
+
+Epochs::ThisThread& Epochs::ForThisThread()
+{
+    thread_local ThisThread thisThread;
+    return thisThread;
+}
+
+void Epochs::Retire(std::function<void()> deleter)
+{
+    {
+        std::unique_lock<std::mutex> lock(retiredMutex);
+        // Readers entering after this see the replacement table
+        retired.push_back({current.fetch_add(1), std::move(deleter)});
+    }
+    Reclaim();
+}
+
+void Epochs::Reclaim()
+{
+    std::vector<std::function<void()>> ready;
+    {
+        std::unique_lock<std::mutex> lock(retiredMutex);
+
+        if(retired.empty() || (readersWithoutSlot.load() != 0)) {
+            return;
+        }
+
+        uint64_t oldest = std::numeric_limits<uint64_t>::max();
+        for(auto& r: readers) {
+            uint64_t epoch = r.epoch.load();
+            if(epoch != 0) {
+                oldest = std::min(oldest, epoch);
+            }
+        }
 
+        auto stillVisible = std::partition(retired.begin(), retired.end(), [oldest](const std::pair<uint64_t, std::function<void()>>& r) { return r.first >= oldest; });
+        for(auto it = stillVisible; it != retired.end(); it++) {
+            ready.push_back(std::move(it->second));
+        }
+        retired.erase(stillVisible, retired.end());
+    }
 
-XrBaseInStructure* IPCSerialize(XrInstance instance, IPCBuffer& ipcbuf, IPCHeader* header, const XrBaseInStructure* srcbase, CopyType copyType)
-{
-    return CopyXrStructChain(instance, srcbase, copyType,
-            [&ipcbuf](size_t size){return ipcbuf.allocate(size);},
-            [&ipcbuf,&header](void* pointerToPointer){header->addOffsetToPointer(ipcbuf.base, pointerToPointer);});
+    // Outside the lock, since deleting a table can retire another
+    for(auto& d: ready) {
+        d();
+    }
 }
 
 
@@ -1552,8 +2105,8 @@ XrResult OverlaysLayerCreateSessionMainAsOverlay(ConnectionToOverlay::Ptr connec
     for(const XrBaseInStructure* p = reinterpret_cast<const XrBaseInStructure*>(createInfo->next); p; p = reinterpret_cast<const XrBaseInStructure*>(p->next)) {
         switch(p->type) {
 
+#if defined(XR_USE_GRAPHICS_API_D3D11)
             case XR_TYPE_GRAPHICS_BINDING_D3D11_KHR: {
-                const XrGraphicsBindingD3D11KHR* d3dbinding = reinterpret_cast<const XrGraphicsBindingD3D11KHR*>(p);
                 const XrGraphicsBindingD3D11KHR* other = FindStructInChain< XrGraphicsBindingD3D11KHR>(sessionInfo->createInfo->next, p->type);
 
                 if(!other) {
@@ -1565,6 +2118,7 @@ XrResult OverlaysLayerCreateSessionMainAsOverlay(ConnectionToOverlay::Ptr connec
 
                 break;
             }
+#endif
 
             // XXX Check out all other GAPI structs as support for them is added
 
@@ -1638,6 +2192,10 @@ XrResult OverlaysLayerCreateSessionMainAsOverlay(ConnectionToOverlay::Ptr connec
     {
         auto l = connection->GetLock();
         connection->ctx = std::make_shared<MainAsOverlaySessionContext>(createInfoOverlay);
+    }
+
+    {
+        std::unique_lock<std::recursive_mutex> m(gConnectionsToOverlayByProcessIdMutex);
         SortOverlaysByPriority(gConnectionsToOverlayByProcessId, gConnectionsToOverlayInDepthOrder);
     }
 
@@ -1647,84 +2205,138 @@ XrResult OverlaysLayerCreateSessionMainAsOverlay(ConnectionToOverlay::Ptr connec
 }
 
 
-void MainRPCThreadBody(ConnectionToOverlay::Ptr connection, DWORD overlayProcessId)
+void MainRPCThreadBody(ConnectionToOverlay::Ptr connection, IPCProcessId overlayProcessId, uint32_t channelIndex)
 {
     auto l = connection->GetLock();
-    RPCChannels rpc = connection->conn;
+    RPCChannels rpc = connection->channels[channelIndex];
     l.unlock();
 
     bool connectionLost = false;
+    uint64_t servedSequence = rpc.ring->responseSequence.load(std::memory_order_acquire);
 
     do {
-        RPCChannels::WaitResult result = rpc.WaitForOverlayRequestOrFail();
+        RPCChannels::WaitResult result = rpc.WaitForOverlayRequestOrFail(servedSequence, connection->closed);
+
+        if(result == RPCChannels::WaitResult::OVERLAY_PROCESS_TERMINATED_GRACEFULLY) {
 
-        if(result == RPCChannels::WaitResult::OVERLAY_PROCESS_TERMINATED_UNEXPECTEDLY) {
+            // Another channel served xrDestroySession or lost the connection
 
-            OutputDebugStringA("**OVERLAY** other process terminated\n");
+        } else if(result == RPCChannels::WaitResult::OVERLAY_PROCESS_TERMINATED_UNEXPECTEDLY) {
+
+            LogToDebugger("**OVERLAY** other process terminated\n");
             connectionLost = true;
 
         } else if(result == RPCChannels::WaitResult::WAIT_ERROR) {
 
-            OutputDebugStringA("**OVERLAY** IPC Wait Error\n");
+            LogToDebugger("**OVERLAY** IPC Wait Error\n");
             // DebugBreak();
             connectionLost = true;
 
         } else {
 
-            IPCBuffer ipcbuf = rpc.GetIPCBuffer();
-            IPCHeader *hdr = ipcbuf.getAndAdvance<IPCHeader>();
+            // Serve everything Overlay has published so far, in order
+            uint64_t publishedSequence = rpc.ring->requestSequence.load(std::memory_order_acquire);
 
-            hdr->makePointersAbsolute(ipcbuf.base);
+            while(!connectionLost && (servedSequence < publishedSequence)) {
 
-            bool success = ProcessOverlayRequestOrReturnConnectionLost(connection, ipcbuf, hdr);
+                uint64_t sequence = servedSequence + 1;
+                IPCBuffer ipcbuf = rpc.GetSlotIPCBuffer(sequence);
+                IPCHeader *hdr = ipcbuf.getAndAdvance<IPCHeader>();
 
-            if(success) {
-                hdr->makePointersRelative(ipcbuf.base);
-                rpc.FinishMainResponse();
-            } else {
-                connectionLost = true;
+                if(hdr->sequence != sequence) {
+                    OverlaysLayerLogMessage(rpc.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+                        OverlaysLayerNoObjectInfo, fmt("RPC slot held request %llu but expected %llu", (unsigned long long)hdr->sequence, (unsigned long long)sequence).c_str());
+                    connectionLost = true;
+                    break;
+                }
+
+                if(!rpc.GetRequestIPCBuffer(sequence, hdr, ipcbuf)) {
+                    OverlaysLayerLogMessage(rpc.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+                        OverlaysLayerNoObjectInfo, fmt("Could not map RPC overflow segment of %llu bytes (limit is %zu): %s", (unsigned long long)hdr->overflowSize, RPCChannels::maxOverflowSize, IPCGetLastErrorString().c_str()).c_str());
+                    hdr->result = XR_ERROR_OUT_OF_MEMORY;
+                    rpc.FinishMainResponse(sequence);
+                    servedSequence = sequence;
+                    continue;
+                }
+
+                // Overlay wrote the header and fixup table, so check them
+                // before rewriting any pointers
+                bool pointersMayBeShared = (hdr->overflowGeneration == 0) && rpc.PointersAreShared();
+                if((hdr->pointersAreShared && !pointersMayBeShared) || !hdr->fixupTableIsInside(ipcbuf)) {
+                    OverlaysLayerLogMessage(rpc.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr,
+                        OverlaysLayerNoObjectInfo, fmt("RPC request %llu has a pointer fixup table that can't be trusted (%u fixups ending at %llu in %zu bytes)",
+                            (unsigned long long)sequence, hdr->pointerFixupCount, (unsigned long long)hdr->fixupTableEnd, ipcbuf.size).c_str());
+                    hdr->result = XR_ERROR_VALIDATION_FAILURE;
+                    rpc.FinishMainResponse(sequence);
+                    servedSequence = sequence;
+                    continue;
+                }
+
+                hdr->makePointersAbsolute(ipcbuf.base);
+
+                bool success = ProcessOverlayRequestOrReturnConnectionLost(connection, ipcbuf, hdr);
+
+                if(success) {
+                    hdr->makePointersRelative(ipcbuf.base);
+                    rpc.FinishMainResponse(sequence);
+                    servedSequence = sequence;
+                    RPCLogLatencyHistogramsIfDue(rpc.instance, "Main");
+                } else {
+                    connectionLost = true;
+                }
             }
         }
 
     } while(!connectionLost && !connection->closed);
 
+    // Let the threads serving the other channels know to stop too
+    connection->closed = true;
+
+    // Requests Overlay published on this channel after the session was
+    // destroyed, or that weren't served because the connection broke,
+    // are answered here so none of its threads waits on them forever
+    rpc.CloseMainAndAnswerPublished(servedSequence, connectionLost ? XR_ERROR_INSTANCE_LOST : XR_ERROR_SESSION_LOST);
+
+    rpc.LogWaitCounters(fmt("Main channel %u", channelIndex).c_str());
+    rpc.CloseOverflowSegments();
+
+    if(connection->threadsRunning.fetch_sub(1) != 1) {
+        return;
+    }
+
     {
         std::unique_lock<std::recursive_mutex> m(gConnectionsToOverlayByProcessIdMutex);
-        gConnectionsToOverlayByProcessId.erase(connection->conn.otherProcessId);
+        gConnectionsToOverlayByProcessId.erase(overlayProcessId);
         SortOverlaysByPriority(gConnectionsToOverlayByProcessId, gConnectionsToOverlayInDepthOrder);
     }
+
+    RPCLogLatencyHistograms(rpc.instance, "Main");
+
+    UnlinkRPCChannels(overlayProcessId);
 }
 
 void MainNegotiateThreadBody()
 {
-    DWORD result;
-    HANDLE handles[2];
-    handles[0] = gNegotiationChannels.mainNegotiateThreadStop;
-    handles[1] = gNegotiationChannels.mainWaitSema;
+    IPCWaitStatus result;
 
     while(1) {
         // Signal that one overlay app may attempt to connect
-        ReleaseSemaphore(gNegotiationChannels.overlayWaitSema, 1, nullptr);
+        gNegotiationChannels.overlayWaitSema.Post();
 
         do {
-            result = WaitForMultipleObjects(2, handles, FALSE, NegotiationChannels::negotiationWaitMillis);
-        } while(result == WAIT_TIMEOUT);
+            result = IPCWaitForSemaphoreOrStop(gNegotiationChannels.mainWaitSema, gNegotiationChannels.mainNegotiateThreadStop, NegotiationChannels::negotiationWaitMillis);
+        } while(result == IPC_WAIT_TIMEOUT);
 
-        if(result == WAIT_OBJECT_0 + 0) {
+        if(result == IPC_WAIT_STOPPED) {
 
             // Main process has signaled us to stop, probably Session was destroyed.
             return;
 
-        } else if(result != WAIT_OBJECT_0 + 1) {
+        } else if(result != IPC_WAIT_SIGNALED) {
 
-            // WAIT_FAILED
-            DWORD lastError = GetLastError();
-            LPVOID messageBuf;
-            FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR) &messageBuf, 0, nullptr);
             OverlaysLayerLogMessage(gNegotiationChannels.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession", 
-                OverlaysLayerNoObjectInfo, fmt("Could not wait on negotiation sema sema: WaitForMultipleObjects error was %08X (%s)", lastError, messageBuf).c_str());
+                OverlaysLayerNoObjectInfo, fmt("Could not wait on negotiation sema sema: %s", IPCGetLastErrorString().c_str()).c_str());
             // XXX need way to signal main process that thread errored unexpectedly
-            LocalFree(messageBuf);
             return;
         }
 
@@ -1735,10 +2347,15 @@ void MainNegotiateThreadBody()
 
         } else {
 
-            DWORD overlayProcessId = gNegotiationChannels.params->overlayProcessId;
-            RPCChannels channels;
+            IPCProcessId overlayProcessId = gNegotiationChannels.params->overlayProcessId;
+            RPCChannels channels[RPCChannels::channelsPerConnection];
+
+            bool opened = true;
+            for(uint32_t i = 0; opened && (i < RPCChannels::channelsPerConnection); i++) {
+                opened = OpenRPCChannels(gNegotiationChannels.instance, overlayProcessId, overlayProcessId, i, channels[i]);
+            }
 
-            if(!OpenRPCChannels(gNegotiationChannels.instance, overlayProcessId, overlayProcessId, channels)) {
+            if(!opened) {
 
                 OverlaysLayerLogMessage(gNegotiationChannels.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, "xrCreateSession",
                     OverlaysLayerNoObjectInfo, fmt("Couldn't open RPC channels to overlay app, connection rejected.").c_str());
@@ -1751,12 +2368,11 @@ void MainNegotiateThreadBody()
                     gConnectionsToOverlayByProcessId[overlayProcessId] = connection;
                 }
 
-                std::thread receiverThread(MainRPCThreadBody, connection, overlayProcessId);
-
-                {
-                    auto l = connection->GetLock();
-                    connection->thread = std::move(receiverThread);
-                    connection->thread.detach();
+                auto l = connection->GetLock();
+                connection->threadsRunning = RPCChannels::channelsPerConnection;
+                for(uint32_t i = 0; i < RPCChannels::channelsPerConnection; i++) {
+                    connection->threads[i] = std::thread(MainRPCThreadBody, connection, overlayProcessId, i);
+                    connection->threads[i].detach();
                 }
             }
         }
@@ -1773,25 +2389,29 @@ bool CreateMainSessionNegotiateThread(XrInstance instance, XrSession hostingSess
         return false;
     }
 
-    DWORD waitresult = WaitForSingleObject(gMainMutexHandle, NegotiationChannels::mutexWaitMillis);
-    if (waitresult == WAIT_TIMEOUT) {
+    IPCWaitStatus waitresult = gMainMutex.Lock(NegotiationChannels::mutexWaitMillis);
+    if (waitresult == IPC_WAIT_TIMEOUT) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession",
             OverlaysLayerNoObjectInfo, fmt("Could not take main mutex sema; is there another main app running?").c_str());
         return false;
     }
 
-    gNegotiationChannels.params->mainProcessId = GetCurrentProcessId();
+    gNegotiationChannels.params->mainProcessId = IPCGetCurrentProcessId();
     gNegotiationChannels.params->mainLayerBinaryVersion = gLayerBinaryVersion;
-    gNegotiationChannels.mainNegotiateThreadStop = CreateEventA(nullptr, false, false, nullptr);
+    if(!gNegotiationChannels.mainNegotiateThreadStop.Create()) {
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession",
+            OverlaysLayerNoObjectInfo, fmt("Could not create negotiation thread stop event: %s", IPCGetLastErrorString().c_str()).c_str());
+        return false;
+    }
     gNegotiationChannels.mainThread = std::thread(MainNegotiateThreadBody);
     gNegotiationChannels.mainThread.detach();
 
     return true;
 }
 
-XrResult OverlaysLayerCreateSessionMain(XrInstance instance, const XrSessionCreateInfo* createInfo, XrSession* session, ID3D11Device *d3d11Device)
+XrResult OverlaysLayerCreateSessionMain(XrInstance instance, const XrSessionCreateInfo* createInfo, XrSession* session)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
+    auto procLock = LockForProc(nullptr);
 
     OverlaysLayerXrInstanceHandleInfo::Ptr instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(instance);
 
@@ -1799,11 +2419,16 @@ XrResult OverlaysLayerCreateSessionMain(XrInstance instance, const XrSessionCrea
 
     // XXX create unique local id, place as that instead of created handle
     XrSession actualHandle = *session;
-    XrSession localHandle = (XrSession)GetNextLocalHandle();
+    XrSession localHandle = OverlaysLayerNewLocalXrSession();
+    if(localHandle == XR_NULL_HANDLE) {
+        instanceInfo->downchain->DestroySession(actualHandle);
+        *session = XR_NULL_HANDLE;
+        return XR_ERROR_LIMIT_REACHED;
+    }
     *session = localHandle;
 
     {
-        std::unique_lock<std::recursive_mutex> lock(gActualXrSessionToLocalHandleMutex);
+        std::unique_lock<ProfiledMutex> lock(gActualXrSessionToLocalHandleMutex);
         gActualXrSessionToLocalHandle[actualHandle] = localHandle;
     }
 
@@ -1812,16 +2437,23 @@ XrResult OverlaysLayerCreateSessionMain(XrInstance instance, const XrSessionCrea
     info->actualHandle = actualHandle;
     info->localHandle = *session;
     info->isProxied = false;
-    info->d3d11Device = d3d11Device;
 
-    ID3D11Multithread* d3dMultithread;
-    HRESULT hr = d3d11Device->QueryInterface(__uuidof(ID3D11Multithread), reinterpret_cast<void**>(&d3dMultithread));
-    if(hr != S_OK) {
-        LogWindowsError(hr, "xrCreateSession", "QueryInterface", __FILE__, __LINE__);
-        return XR_ERROR_RUNTIME_FAILURE;
+#if defined(XR_USE_GRAPHICS_API_D3D11)
+    // Overlay swapchain images are copied on Main's device from the RPC threads
+    auto d3dbinding = FindStructInChain<XrGraphicsBindingD3D11KHR>(createInfo->next, XR_TYPE_GRAPHICS_BINDING_D3D11_KHR);
+    if(d3dbinding) {
+        info->cold->d3d11Device = d3dbinding->device;
+
+        ID3D11Multithread* d3dMultithread;
+        HRESULT hr = d3dbinding->device->QueryInterface(__uuidof(ID3D11Multithread), reinterpret_cast<void**>(&d3dMultithread));
+        if(hr != S_OK) {
+            LogWindowsError(hr, "xrCreateSession", "QueryInterface", __FILE__, __LINE__);
+            return XR_ERROR_RUNTIME_FAILURE;
+        }
+        d3dMultithread->SetMultithreadProtected(TRUE);
+        d3dMultithread->Release();
     }
-    d3dMultithread->SetMultithreadProtected(TRUE);
-    d3dMultithread->Release();
+#endif
 
     // create placeholder Actions
 
@@ -1843,7 +2475,7 @@ XrResult OverlaysLayerCreateSessionMain(XrInstance instance, const XrSessionCrea
         strcpy(createActionInfo.localizedActionName, placeholderNameString);
         createActionInfo.actionType = id.type;
         createActionInfo.countSubactionPaths = 1;
-        XrPath subactionPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(id.subActionString);
+        XrPath subactionPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(id.subActionString);
         createActionInfo.subactionPaths = &subactionPath;
 
         XrAction action;
@@ -1854,23 +2486,26 @@ XrResult OverlaysLayerCreateSessionMain(XrInstance instance, const XrSessionCrea
             return XR_ERROR_INITIALIZATION_FAILED;
         }
 
-        XrPath fullBindingPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(id.fullBindingString);
-        XrPath interactionProfilePath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(id.interactionProfileString);
+        XrPath fullBindingPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(id.fullBindingString);
+        XrPath interactionProfilePath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(id.interactionProfileString);
 
         info->placeholderActions.insert({fullBindingPath, {action, id.type}});
-        info->placeholderActionsByProfileAndFullBinding.insert({{interactionProfilePath, fullBindingPath}, {action, id.type}});
-        info->placeholderActionNames.insert({action, id.name});
+        info->cold->placeholderActionsByProfileAndFullBinding.insert({{interactionProfilePath, fullBindingPath}, {action, id.type}});
+        info->cold->placeholderActionNames.insert({action, id.name});
 
-        info->bindingsByProfile[interactionProfilePath].push_back({action, fullBindingPath});
+        info->cold->bindingsByProfile[interactionProfilePath].push_back({action, fullBindingPath});
         info->bindingsByAction[action] = fullBindingPath;
     }
 
-    for(XrPath p: instanceInfo->OverlaysLayerAllSubactionPaths) {
+    for(XrPath p: instanceInfo->cold->OverlaysLayerAllSubactionPaths) {
         info->currentInteractionProfileBySubactionPath.insert({p, XR_NULL_PATH});
     }
 
     OverlaysLayerAddHandleInfoForXrSession(localHandle, info);
-    instanceInfo->childSessions.insert(info);
+    {
+        auto l = instanceInfo->GetLock();
+        instanceInfo->childSessions.insert(info);
+    }
 
     bool result = CreateMainSessionNegotiateThread(instance, localHandle);
 
@@ -1901,27 +2536,33 @@ bool ConnectToMain(XrInstance instance)
         return false;
     }
 
-    DWORD result;
+    IPCWaitStatus result;
     int attempts = 0;
     do {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateSession", 
             OverlaysLayerNoObjectInfo, fmt("Attempt #%d (of %d) to connect to the main app", attempts, NegotiationChannels::maxAttempts).c_str());
-        result = WaitForSingleObject(gNegotiationChannels.overlayWaitSema, NegotiationChannels::negotiationWaitMillis);
+        result = gNegotiationChannels.overlayWaitSema.Wait(NegotiationChannels::negotiationWaitMillis);
         attempts++;
-    } while(attempts < NegotiationChannels::maxAttempts && result == WAIT_TIMEOUT);
+    } while(attempts < NegotiationChannels::maxAttempts && result == IPC_WAIT_TIMEOUT);
 
-    if(result == WAIT_TIMEOUT) {
+    if(result == IPC_WAIT_TIMEOUT) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession", 
             OverlaysLayerNoObjectInfo, fmt("the Overlay API Layer in the overlay app could not connect to the main app after %d tries.", attempts).c_str());
         return false;
     }
 
+    if(result != IPC_WAIT_SIGNALED) {
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession", 
+            OverlaysLayerNoObjectInfo, fmt("Could not wait on negotiation sema: %s", IPCGetLastErrorString().c_str()).c_str());
+        return false;
+    }
+
     OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "xrCreateSession", 
         OverlaysLayerNoObjectInfo, fmt("connected to the main app after %d %s.", attempts, (attempts < 2) ? "try" : "tries").c_str());
 
     if(gNegotiationChannels.params->mainLayerBinaryVersion != gLayerBinaryVersion) {
         gNegotiationChannels.params->status = NegotiationParams::DIFFERENT_BINARY_VERSION;
-        ReleaseSemaphore(gNegotiationChannels.mainWaitSema, 1, nullptr);
+        gNegotiationChannels.mainWaitSema.Post();
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSession", 
             OverlaysLayerNoObjectInfo, fmt("The Overlay API Layer in the overlay app has a different version (%u) than in the main app (%u).").c_str());
         return false;
@@ -1929,27 +2570,33 @@ bool ConnectToMain(XrInstance instance)
 
     /* save off negotiation parameters because they may be overwritten at any time after we Release mainWait */
     gMainProcessId = gNegotiationChannels.params->mainProcessId;
-    gNegotiationChannels.params->overlayProcessId = GetCurrentProcessId();
+    gNegotiationChannels.params->overlayProcessId = IPCGetCurrentProcessId();
     gNegotiationChannels.params->status = NegotiationParams::SUCCESS;
 
-    ReleaseSemaphore(gNegotiationChannels.mainWaitSema, 1, nullptr);
+    gNegotiationChannels.mainWaitSema.Post();
 
-    if(!OpenRPCChannels(gNegotiationChannels.instance, gMainProcessId, GetCurrentProcessId(), gConnectionToMain->conn)) {
-        OverlaysLayerLogMessage(gNegotiationChannels.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, "xrCreateSession",
-            OverlaysLayerNoObjectInfo, "Couldn't open RPC channels to main app, connection failed.");
-        return false;
+    for(uint32_t i = 0; i < RPCChannels::channelsPerConnection; i++) {
+        if(!OpenRPCChannels(gNegotiationChannels.instance, gMainProcessId, IPCGetCurrentProcessId(), i, gConnectionToMain->channels[i].conn)) {
+            OverlaysLayerLogMessage(gNegotiationChannels.instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, "xrCreateSession",
+                OverlaysLayerNoObjectInfo, "Couldn't open RPC channels to main app, connection failed.");
+            return false;
+        }
     }
 
     return true;
 }
 
 
+XrResult OverlaysLayerPingMainAsOverlay(ConnectionToOverlay::Ptr connection, uint32_t payloadSize, const uint8_t *payload)
+{
+    return XR_SUCCESS;
+}
+
 XrResult OverlaysLayerCreateSessionOverlay(
     XrInstance                                  instance,
     const XrSessionCreateInfo*                  createInfo,
     XrSession*                                  session,
-    const XrSessionCreateInfoOverlayEXTX*       createInfoOverlay,
-    ID3D11Device*   d3d11Device)
+    const XrSessionCreateInfoOverlayEXTX*       createInfoOverlay)
 {
     XrResult result = XR_SUCCESS;
 
@@ -2003,11 +2650,16 @@ XrResult OverlaysLayerCreateSessionOverlay(
     // make a unique local XrSession that notes that this is actually an overlay session and any command on this handle has to be proxied.
     // Non-Overlay XrSessions are also replaced locally with a unique local handle in case an overlay app has one.
     XrSession actualHandle = *session;
-    XrSession localHandle = (XrSession)GetNextLocalHandle();
+    XrSession localHandle = OverlaysLayerNewLocalXrSession();
+    if(localHandle == XR_NULL_HANDLE) {
+        RPCCallDestroySession(instance, actualHandle);
+        *session = XR_NULL_HANDLE;
+        return XR_ERROR_LIMIT_REACHED;
+    }
     *session = localHandle;
 
     {
-        std::unique_lock<std::recursive_mutex> lock(gActualXrSessionToLocalHandleMutex);
+        std::unique_lock<ProfiledMutex> lock(gActualXrSessionToLocalHandleMutex);
         gActualXrSessionToLocalHandle.insert({actualHandle, localHandle});
     }
  
@@ -2015,27 +2667,32 @@ XrResult OverlaysLayerCreateSessionOverlay(
     info->actualHandle = actualHandle;
     info->localHandle = *session;
     info->isProxied = true;
-    info->d3d11Device = d3d11Device;
+#if defined(XR_USE_GRAPHICS_API_D3D11)
+    auto d3dbinding = FindStructInChain<XrGraphicsBindingD3D11KHR>(createInfo->next, XR_TYPE_GRAPHICS_BINDING_D3D11_KHR);
+    info->cold->d3d11Device = d3dbinding ? d3dbinding->device : nullptr;
+#endif
 
-    for(XrPath p: instanceInfo->OverlaysLayerAllSubactionPaths) {
+    for(XrPath p: instanceInfo->cold->OverlaysLayerAllSubactionPaths) {
         info->currentInteractionProfileBySubactionPath.insert({p, XR_NULL_PATH});
     }
 
     OverlaysLayerAddHandleInfoForXrSession(localHandle, info);
-    instanceInfo->childSessions.insert(info);
+    {
+        auto l = instanceInfo->GetLock();
+        instanceInfo->childSessions.insert(info);
+    }
 
     return result;
 }
 
 XrResult OverlaysLayerCreateSession(XrInstance instance, const XrSessionCreateInfo* createInfo, XrSession* session)
 {
-    OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "xrCreateSession", OverlaysLayerNoObjectInfo, fmt("CreateSession called from thread %ld", GetCurrentThreadId()).c_str());  // XXX DEBUG
+    OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "xrCreateSession", OverlaysLayerNoObjectInfo, fmt("CreateSession called from thread %lu", GetLogThreadId()).c_str());  // XXX DEBUG
     try{
         XrResult result;
 
         const XrBaseInStructure* p = reinterpret_cast<const XrBaseInStructure*>(createInfo->next);
         const XrSessionCreateInfoOverlayEXTX* cio = nullptr;
-        const XrGraphicsBindingD3D11KHR* d3dbinding = nullptr;
         while(p) {
             if(p->type == XR_TYPE_SESSION_CREATE_INFO_OVERLAY_EXTX) {
                 cio = reinterpret_cast<const XrSessionCreateInfoOverlayEXTX*>(p);
@@ -2052,19 +2709,16 @@ XrResult OverlaysLayerCreateSession(XrInstance instance, const XrSessionCreateIn
                 (p->type == XR_TYPE_GRAPHICS_REQUIREMENTS_OPENGL_ES_KHR)) {
                 return XR_ERROR_GRAPHICS_DEVICE_INVALID;
             }
-            if(p->type == XR_TYPE_GRAPHICS_BINDING_D3D11_KHR) {
-                d3dbinding = reinterpret_cast<const XrGraphicsBindingD3D11KHR*>(p);
-            }
             p = reinterpret_cast<const XrBaseInStructure*>(p->next);
         }
 
         if(!cio) {
             if(PrintDebugInfo) OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "xrCreateSession", OverlaysLayerNoObjectInfo, "Creating Main Session");  // XXX DEBUG
-            result = OverlaysLayerCreateSessionMain(instance, createInfo, session, d3dbinding->device);
+            result = OverlaysLayerCreateSessionMain(instance, createInfo, session);
             if(PrintDebugInfo) OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "xrCreateSession", OverlaysLayerNoObjectInfo, fmt("result of Create Main Session is %d, session is %08X", result, *session).c_str());  // XXX DEBUG
         } else {
             if(PrintDebugInfo) OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "xrCreateSession", OverlaysLayerNoObjectInfo, "Creating Overlay Session");  // XXX DEBUG
-            result = OverlaysLayerCreateSessionOverlay(instance, createInfo, session, cio, d3dbinding->device);
+            result = OverlaysLayerCreateSessionOverlay(instance, createInfo, session, cio);
             if(PrintDebugInfo) OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "xrCreateSession", OverlaysLayerNoObjectInfo, fmt("result of Create Overlay Session is %d, session is %08X", result, *session).c_str());  // XXX DEBUG
         }
 
@@ -2082,20 +2736,23 @@ XrResult OverlaysLayerCreateSession(XrInstance instance, const XrSessionCreateIn
 
 XrResult OverlaysLayerCreateSwapchainMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, const XrSwapchainCreateInfo* createInfo, XrSwapchain* swapchain, uint32_t *swapchainCount)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
+#if defined(XR_USE_GRAPHICS_API_D3D11)
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
 
-    auto createInfoCopy = GetSharedCopyHandlesRestored(sessionInfo->parentInstance, "xrCreateSwapchain", createInfo);
-
-    XrResult result = sessionInfo->downchain->CreateSwapchain(sessionInfo->actualHandle, createInfoCopy.get(), swapchain);
+    XrResult result = sessionInfo->downchain->CreateSwapchain(sessionInfo->actualHandle, createInfo, swapchain);
 
     if(!XR_SUCCEEDED(result)) {
         return result;
     }
 
     XrSwapchain actualHandle = *swapchain;
-    XrSwapchain localHandle = (XrSwapchain)GetNextLocalHandle();
+    XrSwapchain localHandle = OverlaysLayerNewLocalXrSwapchain();
+    if(localHandle == XR_NULL_HANDLE) {
+        sessionInfo->downchain->DestroySwapchain(actualHandle);
+        *swapchain = XR_NULL_HANDLE;
+        return XR_ERROR_LIMIT_REACHED;
+    }
     *swapchain = localHandle;
 
     uint32_t count;
@@ -2133,10 +2790,14 @@ XrResult OverlaysLayerCreateSwapchainMainAsOverlay(ConnectionToOverlay::Ptr conn
     OverlaysLayerAddHandleInfoForXrSwapchain(*swapchain, swapchainInfo);
 
     return result;
+#else
+    return OverlaySwapchainsUnsupported("xrCreateSwapchain");
+#endif
 }
 
 XrResult OverlaysLayerCreateSwapchainOverlay(XrInstance instance, XrSession session, const XrSwapchainCreateInfo* createInfo, XrSwapchain* swapchain)
 {
+#if defined(XR_USE_GRAPHICS_API_D3D11)
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
 
     uint32_t swapchainCount;
@@ -2150,11 +2811,16 @@ XrResult OverlaysLayerCreateSwapchainOverlay(XrInstance instance, XrSession sess
     }
 
     XrSwapchain actualHandle = *swapchain;
-    XrSwapchain localHandle = (XrSwapchain)GetNextLocalHandle();
+    XrSwapchain localHandle = OverlaysLayerNewLocalXrSwapchain();
+    if(localHandle == XR_NULL_HANDLE) {
+        RPCCallDestroySwapchain(instance, actualHandle);
+        *swapchain = XR_NULL_HANDLE;
+        return XR_ERROR_LIMIT_REACHED;
+    }
     *swapchain = localHandle;
 
     {
-        std::unique_lock<std::recursive_mutex> lock(gActualXrSwapchainToLocalHandleMutex);
+        std::unique_lock<ProfiledMutex> lock(gActualXrSwapchainToLocalHandleMutex);
         gActualXrSwapchainToLocalHandle.insert({actualHandle, localHandle});
     }
 
@@ -2167,7 +2833,7 @@ XrResult OverlaysLayerCreateSwapchainOverlay(XrInstance instance, XrSession sess
     OverlaySwapchain::Ptr overlaySwapchain = std::make_shared<OverlaySwapchain>(*swapchain, swapchainCount, createInfo);
     swapchainInfo->overlaySwapchain = overlaySwapchain;
 
-    if(!overlaySwapchain->CreateTextures(instance, sessionInfo->d3d11Device, gConnectionToMain->conn.otherProcessId)) {
+    if(!overlaySwapchain->CreateTextures(instance, sessionInfo->cold->d3d11Device, gConnectionToMain->channels[0].conn.otherProcess.id)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrCreateSwapchain",
             OverlaysLayerNoObjectInfo, "Couldn't create D3D local resources for swapchain images");
         // XXX This leaks the session in main process if the Session is not closed.
@@ -2177,6 +2843,9 @@ XrResult OverlaysLayerCreateSwapchainOverlay(XrInstance instance, XrSession sess
     OverlaysLayerAddHandleInfoForXrSwapchain(*swapchain, swapchainInfo);
 
     return result;
+#else
+    return OverlaySwapchainsUnsupported("xrCreateSwapchain");
+#endif
 }
 
 XrResult OverlaysLayerDestroySwapchainMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain)
@@ -2194,6 +2863,8 @@ XrResult OverlaysLayerDestroySwapchainOverlay(XrInstance instance, XrSwapchain s
 {
     OverlaysLayerXrSwapchainHandleInfo::Ptr swapchainInfo = OverlaysLayerGetHandleInfoFromXrSwapchain(swapchain);
 
+    FlushSwapchainReleasesToMain(swapchainInfo->parentInstance, swapchainInfo);
+
     XrResult result = RPCCallDestroySwapchain(swapchainInfo->parentInstance, swapchainInfo->actualHandle);
 
     OverlaysLayerRemoveXrSwapchainHandleInfo(swapchain);
@@ -2206,22 +2877,24 @@ XrResult OverlaysLayerDestroySwapchainOverlay(XrInstance instance, XrSwapchain s
 
 XrResult OverlaysLayerCreateReferenceSpaceMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, const XrReferenceSpaceCreateInfo* createInfo, XrSpace* space)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
 
-    auto createInfoCopy = GetSharedCopyHandlesRestored(sessionInfo->parentInstance, "xrCreateSwapchain", createInfo);
-
-    XrResult result = sessionInfo->downchain->CreateReferenceSpace(sessionInfo->actualHandle, createInfoCopy.get(), space);
-
-    XrSpace actualHandle = *space;
-    XrSpace localHandle = (XrSpace)GetNextLocalHandle();
-    *space = localHandle;
+    XrResult result = sessionInfo->downchain->CreateReferenceSpace(sessionInfo->actualHandle, createInfo, space);
 
     if(!XR_SUCCEEDED(result)) {
         return result;
     }
 
+    XrSpace actualHandle = *space;
+    XrSpace localHandle = OverlaysLayerNewLocalXrSpace();
+    if(localHandle == XR_NULL_HANDLE) {
+        sessionInfo->downchain->DestroySpace(actualHandle);
+        *space = XR_NULL_HANDLE;
+        return XR_ERROR_LIMIT_REACHED;
+    }
+    *space = localHandle;
+
     OverlaysLayerXrSpaceHandleInfo::Ptr spaceInfo = std::make_shared<OverlaysLayerXrSpaceHandleInfo>(session, sessionInfo->parentInstance, sessionInfo->downchain);
     spaceInfo->actualHandle = actualHandle;
     spaceInfo->localHandle = localHandle;
@@ -2245,11 +2918,16 @@ XrResult OverlaysLayerCreateReferenceSpaceOverlay(XrInstance instance, XrSession
     }
 
     XrSpace actualHandle = *space;
-    XrSpace localHandle = (XrSpace)GetNextLocalHandle();
+    XrSpace localHandle = OverlaysLayerNewLocalXrSpace();
+    if(localHandle == XR_NULL_HANDLE) {
+        RPCCallDestroySpace(instance, actualHandle);
+        *space = XR_NULL_HANDLE;
+        return XR_ERROR_LIMIT_REACHED;
+    }
     *space = localHandle;
 
     {
-        std::unique_lock<std::recursive_mutex> lock(gActualXrSpaceToLocalHandleMutex);
+        std::unique_lock<ProfiledMutex> lock(gActualXrSpaceToLocalHandleMutex);
         gActualXrSpaceToLocalHandle.insert({actualHandle, localHandle});
     }
 
@@ -2267,9 +2945,8 @@ XrResult OverlaysLayerCreateReferenceSpaceOverlay(XrInstance instance, XrSession
 
 XrResult OverlaysLayerEnumerateReferenceSpacesMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t spaceCapacityInput, uint32_t* spaceCountOutput, XrReferenceSpaceType* spaces)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     return sessionInfo->downchain->EnumerateReferenceSpaces(sessionInfo->actualHandle, spaceCapacityInput, spaceCountOutput, spaces);
 }
 
@@ -2282,9 +2959,8 @@ XrResult OverlaysLayerEnumerateReferenceSpacesOverlay(XrInstance instance, XrSes
 
 XrResult OverlaysLayerGetReferenceSpaceBoundsRectMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, XrReferenceSpaceType referenceSpaceType, XrExtent2Df* bounds)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     return sessionInfo->downchain->GetReferenceSpaceBoundsRect(sessionInfo->actualHandle, referenceSpaceType, bounds);
 }
 
@@ -2297,11 +2973,10 @@ XrResult OverlaysLayerGetReferenceSpaceBoundsRectOverlay(XrInstance instance, Xr
 
 XrResult OverlaysLayerLocateSpaceMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSpace space, XrSpace baseSpace, XrTime time, XrSpaceLocation* location)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
 
     auto spaceInfo = OverlaysLayerGetHandleInfoFromXrSpace(space);
+    auto procLock = LockForProc(&spaceInfo->procMutex);
     auto baseSpaceInfo = OverlaysLayerGetHandleInfoFromXrSpace(baseSpace);
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(spaceInfo->parentHandle);
 
@@ -2330,7 +3005,9 @@ XrResult OverlaysLayerLocateSpaceMainAsOverlay(ConnectionToOverlay::Ptr connecti
     }
 
     if(result == XR_SUCCESS) {
-        SubstituteLocalHandles(spaceInfo->parentInstance, (XrBaseOutStructure *)location);
+        if(!SubstituteLocalHandles(spaceInfo->parentInstance, (XrBaseOutStructure *)location)) {
+            return XR_ERROR_HANDLE_INVALID;
+        }
     }
 
     return result;
@@ -2352,10 +3029,6 @@ bool SynchronizeActionSpaceWithMain(XrInstance instance, XrSpace space)
 
     if((spaceInfo->actualHandle == XR_NULL_HANDLE) || (spaceInfo->createdWithInteractionProfile != currentInteractionProfile)) {
 
-        if(spaceInfo->actualHandle != XR_NULL_HANDLE) {
-            RPCCallDestroySpace(instance, spaceInfo->actualHandle);
-        }
-
         auto actionInfo = spaceInfo->action;
 
         // XXX what if SuggestProfileBindings was never called?  It's not an error.
@@ -2369,7 +3042,7 @@ bool SynchronizeActionSpaceWithMain(XrInstance instance, XrSpace space)
         }
 
         for(XrPath binding : actionInfo->suggestedBindingsByProfile.at(currentInteractionProfile)) {
-            XrPath subactionPath = instanceInfo->OverlaysLayerBindingToSubaction.at(binding); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+            XrPath subactionPath = instanceInfo->cold->OverlaysLayerBindingToSubaction.at(binding); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
             if(subactionPath == spaceInfo->actionSpaceCreateInfo->subactionPath) {
                 matchingBinding = binding;
                 found = true;
@@ -2385,10 +3058,25 @@ bool SynchronizeActionSpaceWithMain(XrInstance instance, XrSpace space)
 
         }
 
-        WellKnownStringIndex bindingString = instanceInfo->OverlaysLayerPathToWellKnownString.at(matchingBinding); // These two .at()s must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-        WellKnownStringIndex profileString = instanceInfo->OverlaysLayerPathToWellKnownString.at(matchingProfile);
+        WellKnownStringIndex bindingString = instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(matchingBinding); // These two .at()s must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        WellKnownStringIndex profileString = instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(matchingProfile);
+
+        // Destroy any previous placeholder space and create the new one with both requests in flight at once
+        auto ipcLock = gConnectionToMain->LockChannelForThisThread();
+
+        if(spaceInfo->actualHandle != XR_NULL_HANDLE) {
+            RPCPendingDestroySpace destroyPending;
+            RPCPostDestroySpace(instance, destroyPending, spaceInfo->actualHandle);
+        }
+
+        RPCPendingCreateActionSpaceFromBinding createPending;
+        XrResult result = RPCPostCreateActionSpaceFromBinding(spaceInfo->parentInstance, createPending, sessionInfo->actualHandle, profileString, bindingString, &spaceInfo->actionSpaceCreateInfo->poseInActionSpace, &spaceInfo->actualHandle);
 
-        XrResult result = RPCCallCreateActionSpaceFromBinding(spaceInfo->parentInstance, sessionInfo->actualHandle, profileString, bindingString, &spaceInfo->actionSpaceCreateInfo->poseInActionSpace, &spaceInfo->actualHandle);
+        if(result == XR_SUCCESS) {
+            result = RPCWaitCreateActionSpaceFromBinding(spaceInfo->parentInstance, createPending);
+        }
+
+        ipcLock.unlock();
 
         if(result != XR_SUCCESS) {
             OverlaysLayerLogMessage(spaceInfo->parentInstance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, "xrAttachSessionActionSets",
@@ -2430,7 +3118,9 @@ XrResult OverlaysLayerLocateSpaceOverlay(XrInstance instance, XrSpace space, XrS
     }
 
     if(result == XR_SUCCESS) {
-        SubstituteLocalHandles(spaceInfo->parentInstance, (XrBaseOutStructure *)location);
+        if(!SubstituteLocalHandles(spaceInfo->parentInstance, (XrBaseOutStructure *)location)) {
+            return XR_ERROR_HANDLE_INVALID;
+        }
     }
 
     return result;
@@ -2439,18 +3129,35 @@ XrResult OverlaysLayerLocateSpaceOverlay(XrInstance instance, XrSpace space, XrS
 
 XrResult OverlaysLayerLocateSpaceMain(XrInstance parentInstance, XrSpace space, XrSpace baseSpace, XrTime time, XrSpaceLocation* location)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
 
-    auto spaceInfo = OverlaysLayerGetHandleInfoFromXrSpace(space);
-    auto baseSpaceInfo = OverlaysLayerGetHandleInfoFromXrSpace(baseSpace);
-    auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(spaceInfo->parentHandle);
+    EpochReadGuard guard;
+    OverlaysLayerXrSpaceHandleInfo* spaceInfo;
+    result = OverlaysLayerTryBorrowHandleInfoFromXrSpace(space, &spaceInfo);
+    if(result != XR_SUCCESS) {
+        return result;
+    }
+    auto procLock = LockForProc(&spaceInfo->procMutex);
+    OverlaysLayerXrSpaceHandleInfo* baseSpaceInfo;
+    result = OverlaysLayerTryBorrowHandleInfoFromXrSpace(baseSpace, &baseSpaceInfo);
+    if(result != XR_SUCCESS) {
+        return result;
+    }
 
     if(spaceInfo->spaceType == SPACE_ACTION) {
 
+        OverlaysLayerXrSessionHandleInfo* sessionInfo;
+        result = OverlaysLayerTryBorrowHandleInfoFromXrSession(spaceInfo->parentHandle, &sessionInfo);
+        if(result != XR_SUCCESS) {
+            return result;
+        }
+
         // Sync this Space's Action so it's active
-        auto actionSetInfo = OverlaysLayerGetHandleInfoFromXrActionSet(spaceInfo->action->parentHandle);
+        OverlaysLayerXrActionSetHandleInfo* actionSetInfo;
+        result = OverlaysLayerTryBorrowHandleInfoFromXrActionSet(spaceInfo->action->parentHandle, &actionSetInfo);
+        if(result != XR_SUCCESS) {
+            return result;
+        }
         // XXX may need to keep XrActionsSyncInfo from previous xrSyncActions and play that back
         XrActiveActionSet activeActionSet { actionSetInfo->handle, spaceInfo->actionSpaceCreateInfo->subactionPath };
         XrActionsSyncInfo syncInfo { XR_TYPE_ACTIONS_SYNC_INFO, nullptr, 1, &activeActionSet };
@@ -2473,28 +3180,32 @@ XrResult OverlaysLayerLocateSpaceMain(XrInstance parentInstance, XrSpace space,
     }
     
     if(result == XR_SUCCESS) {
-        SubstituteLocalHandles(spaceInfo->parentInstance, location);
+        if(!SubstituteLocalHandles(spaceInfo->parentInstance, location)) {
+            return XR_ERROR_HANDLE_INVALID;
+        }
     }
 
     return result;
 }
 
 
+// Same as the generated entry points, Main's side runs outside the try
 XrResult OverlaysLayerLocateSpace(XrSpace space, XrSpace baseSpace, XrTime time, XrSpaceLocation* location)
 {
-    try {
+    EpochReadGuard guard;
+    OverlaysLayerXrSpaceHandleInfo* spaceInfo;
+    XrResult result = OverlaysLayerTryBorrowHandleInfoFromXrSpace(space, &spaceInfo);
+    if(result != XR_SUCCESS) {
+        return result;
+    }
 
-        auto spaceInfo = OverlaysLayerGetHandleInfoFromXrSpace(space);
+    if(!spaceInfo->isProxied) {
+        return OverlaysLayerLocateSpaceMain(spaceInfo->parentInstance, space, baseSpace, time, location);
+    }
 
-        bool isProxied = spaceInfo->isProxied;
-        XrResult result;
-        if(isProxied) {
-            result = OverlaysLayerLocateSpaceOverlay(spaceInfo->parentInstance, space, baseSpace, time, location);
-        } else {
-            result = OverlaysLayerLocateSpaceMain(spaceInfo->parentInstance, space, baseSpace, time, location);
-        }
+    try {
 
-        return result;
+        return OverlaysLayerLocateSpaceOverlay(spaceInfo->parentInstance, space, baseSpace, time, location);
 
     } catch (const OverlaysLayerXrException exc) {
 
@@ -2511,9 +3222,8 @@ XrResult OverlaysLayerLocateSpace(XrSpace space, XrSpace baseSpace, XrTime time,
 
 XrResult OverlaysLayerDestroySpaceMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSpace space)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     OverlaysLayerXrSpaceHandleInfo::Ptr spaceInfo = OverlaysLayerGetHandleInfoFromXrSpace(space);
+    auto procLock = LockForProc(&spaceInfo->procMutex);
 
     // XXX This will need to be smart about ActionSpaces?
 
@@ -2551,19 +3261,20 @@ XrResult OverlaysLayerDestroyActionOverlay(XrInstance instance, XrAction action)
 
 XrResult OverlaysLayerLocateViewsMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, const XrViewLocateInfo* viewLocateInfo, XrViewState* viewState, uint32_t viewCapacityInput, uint32_t* viewCountOutput, XrView* views)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
 
-    auto viewLocateInfoCopy = GetSharedCopyHandlesRestored(sessionInfo->parentInstance, "xrLocateViews", viewLocateInfo);
-
-    XrResult result = sessionInfo->downchain->LocateViews(sessionInfo->actualHandle, viewLocateInfoCopy.get(), viewState, viewCapacityInput, viewCountOutput, views);
+    XrResult result = sessionInfo->downchain->LocateViews(sessionInfo->actualHandle, viewLocateInfo, viewState, viewCapacityInput, viewCountOutput, views);
 
     if(result == XR_SUCCESS) {
-        SubstituteLocalHandles(sessionInfo->parentInstance, (XrBaseOutStructure *)viewState);
+        if(!SubstituteLocalHandles(sessionInfo->parentInstance, (XrBaseOutStructure *)viewState)) {
+            return XR_ERROR_HANDLE_INVALID;
+        }
         if((viewCapacityInput > 0) && (views != nullptr)) {
             for(uint32_t i = 0; i < *viewCountOutput; i++) {
-                SubstituteLocalHandles(sessionInfo->parentInstance, (XrBaseOutStructure *)&views[i]);
+                if(!SubstituteLocalHandles(sessionInfo->parentInstance, (XrBaseOutStructure *)&views[i])) {
+                    return XR_ERROR_HANDLE_INVALID;
+                }
             }
         }
     }
@@ -2580,10 +3291,14 @@ XrResult OverlaysLayerLocateViewsOverlay(XrInstance instance, XrSession session,
     XrResult result = RPCCallLocateViews(instance, sessionInfo->actualHandle, viewLocateInfoCopy.get(), viewState, viewCapacityInput, viewCountOutput, views);
 
     if(result == XR_SUCCESS) {
-        SubstituteLocalHandles(instance, (XrBaseOutStructure *)viewState);
+        if(!SubstituteLocalHandles(instance, (XrBaseOutStructure *)viewState)) {
+            return XR_ERROR_HANDLE_INVALID;
+        }
 		if ((viewCapacityInput > 0) && (views != nullptr)) {
             for(uint32_t i = 0; i < *viewCountOutput; i++) {
-                SubstituteLocalHandles(instance, (XrBaseOutStructure *)&views[i]);
+                if(!SubstituteLocalHandles(instance, (XrBaseOutStructure *)&views[i])) {
+                    return XR_ERROR_HANDLE_INVALID;
+                }
             }
         }
     }
@@ -2609,6 +3324,15 @@ XrResult OverlaysLayerDestroySessionOverlay(XrInstance instance, XrSession sessi
         return result;
     }
 
+    // Main only removes the overflow segment names it has seen
+    for(uint32_t i = 0; i < RPCChannels::channelsPerConnection; i++) {
+        auto& channel = gConnectionToMain->channels[i];
+        std::unique_lock<std::mutex> lock(channel.mutex);
+        channel.conn.LogWaitCounters(fmt("Overlay channel %u", i).c_str());
+        channel.conn.CloseOverflowSegments();
+    }
+    RPCLogLatencyHistograms(instance, "Overlay");
+
     OverlaysLayerRemoveXrSessionHandleInfo(session);
 
     return result;
@@ -2616,9 +3340,8 @@ XrResult OverlaysLayerDestroySessionOverlay(XrInstance instance, XrSession sessi
 
 XrResult OverlaysLayerEnumerateSwapchainFormatsMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t formatCapacityInput, uint32_t* formatCountOutput, int64_t* formats)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
 
     // Already have our tracked information on this XrSession from generated code in sessionInfo
     XrResult result = sessionInfo->downchain->EnumerateSwapchainFormats(sessionInfo->actualHandle, formatCapacityInput, formatCountOutput, formats);
@@ -2648,6 +3371,7 @@ XrResult OverlaysLayerEnumerateSwapchainImagesOverlay(
         uint32_t* imageCountOutput,
         XrSwapchainImageBaseHeader* images)
 {
+#if defined(XR_USE_GRAPHICS_API_D3D11)
     OverlaysLayerXrSwapchainHandleInfo::Ptr swapchainInfo = OverlaysLayerGetHandleInfoFromXrSwapchain(swapchain);
 
     auto& overlaySwapchain = swapchainInfo->overlaySwapchain;
@@ -2680,6 +3404,9 @@ XrResult OverlaysLayerEnumerateSwapchainImagesOverlay(
     *imageCountOutput = toWrite;
 
     return XR_SUCCESS;
+#else
+    return OverlaySwapchainsUnsupported("xrEnumerateSwapchainImages");
+#endif
 }
 
 
@@ -2778,23 +3505,26 @@ void EnqueueEventToOverlay(XrInstance instance, XrEventDataBuffer *eventData, Ma
 
 XrResult OverlaysLayerPollEvent(XrInstance instance, XrEventDataBuffer* eventData)
 {
-    OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "XrPollEvent", OverlaysLayerNoObjectInfo, fmt("PollEvent called from thread %ld", GetCurrentThreadId()).c_str());
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
+    OverlaysLayerLogMessage(XR_NULL_HANDLE, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, "XrPollEvent", OverlaysLayerNoObjectInfo, fmt("PollEvent called from thread %lu", GetLogThreadId()).c_str());
+    auto procLock = LockForProc(nullptr);
 
     try {
 
         // See if any Session needs to return a synthetic interaction profile changed event
-        std::unique_lock<std::recursive_mutex> lock(gOverlaysLayerXrSessionToHandleInfoMutex);
-        for(auto [sessionHandle, sessionInfo]: gOverlaysLayerXrSessionToHandleInfo) {
+        XrSession pendingSession = XR_NULL_HANDLE;
+        gOverlaysLayerXrSessionToHandleInfo.ForEach([&](XrSession sessionHandle, const OverlaysLayerXrSessionHandleInfo::Ptr& sessionInfo) {
             auto l = sessionInfo->GetLock();
-            if(sessionInfo->interactionProfileChangePending) {
-                auto* ipc = reinterpret_cast<XrEventDataInteractionProfileChanged*>(eventData);
-                ipc->type = XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED;
-                ipc->next = nullptr;
-                ipc->session = sessionHandle;
+            if((pendingSession == XR_NULL_HANDLE) && sessionInfo->interactionProfileChangePending) {
                 sessionInfo->interactionProfileChangePending = false;
-                return XR_SUCCESS;
+                pendingSession = sessionHandle;
             }
+        });
+        if(pendingSession != XR_NULL_HANDLE) {
+            auto* ipc = reinterpret_cast<XrEventDataInteractionProfileChanged*>(eventData);
+            ipc->type = XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED;
+            ipc->next = nullptr;
+            ipc->session = pendingSession;
+            return XR_SUCCESS;
         }
 
         auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(instance);
@@ -2812,14 +3542,18 @@ XrResult OverlaysLayerPollEvent(XrInstance instance, XrEventDataBuffer* eventDat
                     const auto* ssc = reinterpret_cast<const XrEventDataSessionStateChanged*>(eventData);
                 }
                 if(result == XR_SUCCESS) {
-                    SubstituteLocalHandles(instance, (XrBaseOutStructure *)eventData);
+                    if(!SubstituteLocalHandles(instance, (XrBaseOutStructure *)eventData)) {
+                        return XR_ERROR_HANDLE_INVALID;
+                    }
                 }
 
             }
 
         } else if(result == XR_SUCCESS) {
 
-            SubstituteLocalHandles(instance, (XrBaseOutStructure *)eventData);
+            if(!SubstituteLocalHandles(instance, (XrBaseOutStructure *)eventData)) {
+                return XR_ERROR_HANDLE_INVALID;
+            }
 
             if(eventData->type == XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED) {
 
@@ -2973,6 +3707,17 @@ XrResult OverlaysLayerEndSessionOverlay(XrInstance instance, XrSession session)
 
 XrResult OverlaysLayerWaitFrameMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, const XrFrameWaitInfo* frameWaitInfo, XrFrameState* frameState)
 {
+    // Overlay's last xrEndFrame returned before Main handled it; if Main
+    // couldn't, this is where Overlay hears about it
+    {
+        auto lock = connection->ctx->GetLock();
+        XrResult endFrameResult = connection->ctx->endFrameResult;
+        connection->ctx->endFrameResult = XR_SUCCESS;
+        if(!XR_SUCCEEDED(endFrameResult)) {
+            return endFrameResult;
+        }
+    }
+
     auto mainSession = gMainSessionContext;
     auto lock2 = mainSession->GetLock();
     // XXX this is incomplete; need to descend next chain and copy as possible from saved requirements.
@@ -3030,13 +3775,10 @@ XrResult OverlaysLayerBeginFrameOverlay(XrInstance instance, XrSession session,
 
 XrResult OverlaysLayerAcquireSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageAcquireInfo* acquireInfo, uint32_t *index)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     OverlaysLayerXrSwapchainHandleInfo::Ptr swapchainInfo = OverlaysLayerGetHandleInfoFromXrSwapchain(swapchain);
+    auto procLock = LockForProc(&swapchainInfo->procMutex);
 
-    auto acquireInfoCopy = GetSharedCopyHandlesRestored(swapchainInfo->parentInstance, "xrAcquireSwapchainImage", acquireInfo);
-
-    XrResult result = swapchainInfo->downchain->AcquireSwapchainImage(swapchainInfo->actualHandle, acquireInfoCopy.get(), index);
+    XrResult result = swapchainInfo->downchain->AcquireSwapchainImage(swapchainInfo->actualHandle, acquireInfo, index);
 
     if(!XR_SUCCEEDED(result)) {
         return result;
@@ -3053,6 +3795,9 @@ XrResult OverlaysLayerAcquireSwapchainImageOverlay(XrInstance instance, XrSwapch
 
     auto acquireInfoCopy = GetSharedCopyHandlesRestored(swapchainInfo->parentInstance, "xrAcquireSwapchainImage", acquireInfo);
 
+    // Main must release this swapchain's images before it can acquire another
+    FlushSwapchainReleasesToMain(instance, swapchainInfo);
+
     XrResult result = RPCCallAcquireSwapchainImage(instance, swapchainInfo->actualHandle, acquireInfoCopy.get(), index);
 
     if(!XR_SUCCEEDED(result)) {
@@ -3064,15 +3809,13 @@ XrResult OverlaysLayerAcquireSwapchainImageOverlay(XrInstance instance, XrSwapch
     return result;
 }
 
-XrResult OverlaysLayerWaitSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageWaitInfo* waitInfo, HANDLE sourceImage)
+XrResult OverlaysLayerWaitSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageWaitInfo* waitInfo, SharedImageHandle sourceImage)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
+#if defined(XR_USE_GRAPHICS_API_D3D11)
     OverlaysLayerXrSwapchainHandleInfo::Ptr swapchainInfo = OverlaysLayerGetHandleInfoFromXrSwapchain(swapchain);
+    auto procLock = LockForProc(&swapchainInfo->procMutex);
 
-    auto waitInfoCopy = GetSharedCopyHandlesRestored(swapchainInfo->parentInstance, "xrWaitSwapchainImage", waitInfo);
-
-    XrResult result = swapchainInfo->downchain->WaitSwapchainImage(swapchainInfo->actualHandle, waitInfoCopy.get());
+    XrResult result = swapchainInfo->downchain->WaitSwapchainImage(swapchainInfo->actualHandle, waitInfo);
 
     if(!XR_SUCCEEDED(result)) {
         return result;
@@ -3085,7 +3828,7 @@ XrResult OverlaysLayerWaitSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr c
             ID3D11Device* d3d11Device;
             {
                 OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(swapchainInfo->parentHandle);
-                d3d11Device = sessionInfo->d3d11Device;
+                d3d11Device = sessionInfo->cold->d3d11Device;
             }
 
             ID3D11Texture2D *sharedTexture = mainAsOverlaySwapchain->getSharedTexture(d3d11Device, sourceImage);
@@ -3105,10 +3848,14 @@ XrResult OverlaysLayerWaitSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr c
     }
 
     return result;
+#else
+    return OverlaySwapchainsUnsupported("xrWaitSwapchainImage");
+#endif
 }
 
 XrResult OverlaysLayerWaitSwapchainImageOverlay(XrInstance instance, XrSwapchain swapchain, const XrSwapchainImageWaitInfo* waitInfo)
 {
+#if defined(XR_USE_GRAPHICS_API_D3D11)
     OverlaysLayerXrSwapchainHandleInfo::Ptr swapchainInfo = OverlaysLayerGetHandleInfoFromXrSwapchain(swapchain);
 
     if(swapchainInfo->overlaySwapchain->waited) {
@@ -3118,7 +3865,7 @@ XrResult OverlaysLayerWaitSwapchainImageOverlay(XrInstance instance, XrSwapchain
     auto& overlaySwapchain = swapchainInfo->overlaySwapchain;
 
     uint32_t wasWaited = overlaySwapchain->acquired[0];
-    HANDLE sourceImage = overlaySwapchain->swapchainHandles[wasWaited];
+    SharedImageHandle sourceImage = overlaySwapchain->swapchainHandles[wasWaited];
 
     auto waitInfoCopy = GetSharedCopyHandlesRestored(swapchainInfo->parentInstance, "xrWaitSwapchainImage", waitInfo);
 
@@ -3145,20 +3892,23 @@ XrResult OverlaysLayerWaitSwapchainImageOverlay(XrInstance instance, XrSwapchain
     }
 
     return result;
+#else
+    return OverlaySwapchainsUnsupported("xrWaitSwapchainImage");
+#endif
 }
 
-XrResult OverlaysLayerReleaseSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageReleaseInfo* releaseInfo, HANDLE sourceImage)
+XrResult OverlaysLayerReleaseSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageReleaseInfo* releaseInfo, SharedImageHandle sourceImage)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
+#if defined(XR_USE_GRAPHICS_API_D3D11)
     OverlaysLayerXrSwapchainHandleInfo::Ptr swapchainInfo = OverlaysLayerGetHandleInfoFromXrSwapchain(swapchain);
+    auto procLock = LockForProc(&swapchainInfo->procMutex);
 
     auto& mainAsOverlaySwapchain = swapchainInfo->mainAsOverlaySwapchain;
 
     ID3D11Device* d3d11Device;
     {
         OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(swapchainInfo->parentHandle);
-        d3d11Device = sessionInfo->d3d11Device;
+        d3d11Device = sessionInfo->cold->d3d11Device;
     }
 
     ID3D11Texture2D *sharedTexture = mainAsOverlaySwapchain->getSharedTexture(d3d11Device, sourceImage);
@@ -3189,20 +3939,22 @@ XrResult OverlaysLayerReleaseSwapchainImageMainAsOverlay(ConnectionToOverlay::Pt
     d3dDevice->GetImmediateContext(&d3dContext);
     d3dContext->CopyResource(mainAsOverlaySwapchain->swapchainImages[which], sharedTexture);
 
-    auto releaseInfoCopy = GetSharedCopyHandlesRestored(swapchainInfo->parentInstance, "xrReleaseSwapchainImage", releaseInfo);
-
 	XrResult result = XR_SUCCESS;
     {
-        std::unique_lock<std::recursive_mutex> HapticQuirkLock(HapticQuirkMutex);
-        result = swapchainInfo->downchain->ReleaseSwapchainImage(swapchainInfo->actualHandle, releaseInfoCopy.get());
+        std::unique_lock<ProfiledMutex> HapticQuirkLock(HapticQuirkMutex);
+        result = swapchainInfo->downchain->ReleaseSwapchainImage(swapchainInfo->actualHandle, releaseInfo);
         if(result != XR_SUCCESS) DebugBreak(); // XXX
     }
 
     return result;
+#else
+    return OverlaySwapchainsUnsupported("xrReleaseSwapchainImage");
+#endif
 }
 
 XrResult OverlaysLayerReleaseSwapchainImageOverlay(XrInstance instance, XrSwapchain swapchain, const XrSwapchainImageReleaseInfo* releaseInfo)
 {
+#if defined(XR_USE_GRAPHICS_API_D3D11)
     OverlaysLayerXrSwapchainHandleInfo::Ptr swapchainInfo = OverlaysLayerGetHandleInfoFromXrSwapchain(swapchain);
 
     if(!swapchainInfo->overlaySwapchain->waited) {
@@ -3228,24 +3980,28 @@ XrResult OverlaysLayerReleaseSwapchainImageOverlay(XrInstance instance, XrSwapch
         return XR_ERROR_RUNTIME_FAILURE;
     }
 
-    HANDLE sourceImage = overlaySwapchain->swapchainHandles[beingReleased];
+    SharedImageHandle sourceImage = overlaySwapchain->swapchainHandles[beingReleased];
 
-    auto releaseInfoCopy = GetSharedCopyHandlesRestored(instance, "xrReleaseSwapchainImage", releaseInfo);
-    XrResult result = RPCCallReleaseSwapchainImage(instance, swapchainInfo->actualHandle, releaseInfoCopy.get(), sourceImage);
-
-    if(!XR_SUCCEEDED(result)) {
-        DebugBreak(); // XXX
-        return result;
+    // Main's side of the release is sent later with SubmitFrame.
+    // XrSwapchainImageReleaseInfo has nothing in it in OpenXR 1.0, so
+    // Main releases with an empty one.
+    {
+        std::unique_lock<std::mutex> pendingLock(gConnectionToMain->pendingReleaseMutex);
+        gConnectionToMain->pendingReleaseSwapchains.push_back(swapchainInfo->actualHandle);
+        gConnectionToMain->pendingReleaseSourceImages.push_back(sourceImage);
     }
 
     swapchainInfo->overlaySwapchain->waited = false;
 
-    return result;
+    return XR_SUCCESS;
+#else
+    return OverlaySwapchainsUnsupported("xrReleaseSwapchainImage");
+#endif
 }
 
 XrResult OverlaysLayerEndFrameMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, const XrFrameEndInfo* frameEndInfo)
 {
-    std::unique_lock<std::recursive_mutex> EndFrameLock(EndFrameMutex);
+    std::unique_lock<ProfiledMutex> EndFrameLock(EndFrameMutex);
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
 
     XrResult result = XR_SUCCESS;
@@ -3285,13 +4041,93 @@ XrResult OverlaysLayerEndFrameMainAsOverlay(ConnectionToOverlay::Ptr connection,
     return result;
 }
 
+XrResult OverlaysLayerSubmitFrameMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t releaseCount, const XrSwapchain* releaseSwapchains, const SharedImageHandle* releaseSourceImages, const XrFrameEndInfo* frameEndInfo)
+{
+    XrResult result = XR_SUCCESS;
+
+    // Same order Overlay called them; releases first, then the frame
+    XrSwapchainImageReleaseInfo releaseInfo { XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO, nullptr };
+
+    for(uint32_t i = 0; i < releaseCount; i++) {
+        XrResult releaseResult = OverlaysLayerReleaseSwapchainImageMainAsOverlay(connection, releaseSwapchains[i], &releaseInfo, releaseSourceImages[i]);
+        if(XR_SUCCEEDED(result) && !XR_SUCCEEDED(releaseResult)) {
+            result = releaseResult;
+        }
+    }
+
+    if(frameEndInfo) {
+        XrResult endFrameResult = OverlaysLayerEndFrameMainAsOverlay(connection, session, frameEndInfo);
+        if(XR_SUCCEEDED(result)) {
+            result = endFrameResult;
+        }
+
+        // Returned from Overlay's next xrWaitFrame rather than from
+        // whichever RPC next collects this one on its channel
+        auto lock = connection->ctx->GetLock();
+        if(XR_SUCCEEDED(connection->ctx->endFrameResult)) {
+            connection->ctx->endFrameResult = result;
+        }
+        return XR_SUCCESS;
+    }
+
+    return result;
+}
+
+// Send deferred swapchain image releases and, if frameEndInfo isn't
+// null, the frame, as one asynchronous request.  Call with this thread's
+// RPC channel locked.
+//
+// Nothing waits for Main to handle it.  If the request carried a frame,
+// Main's failure to release or to take the frame is returned from the
+// session's next xrWaitFrame, whichever thread calls it; releases sent
+// alone report failure from the next synchronous RPC on this channel.
+// A frame with one swapchain costs three synchronous round trips
+// (xrWaitFrame, xrAcquireSwapchainImage, xrWaitSwapchainImage) and two
+// posts that aren't waited for (xrBeginFrame and this).
+XrResult PostSubmitFrameToMain(XrInstance instance, XrSession actualSession, const XrFrameEndInfo* frameEndInfo)
+{
+    std::unique_lock<std::mutex> pendingLock(gConnectionToMain->pendingReleaseMutex);
+
+    auto& swapchains = gConnectionToMain->pendingReleaseSwapchains;
+    auto& sourceImages = gConnectionToMain->pendingReleaseSourceImages;
+
+    RPCPendingSubmitFrame pending;
+    XrResult result = RPCPostSubmitFrame(instance, pending, actualSession, (uint32_t)swapchains.size(), swapchains.data(), sourceImages.data(), frameEndInfo);
+
+    swapchains.clear();
+    sourceImages.clear();
+
+    return result;
+}
+
+// Send releases for any swapchain images still held back, if any of
+// them belong to the given swapchain
+void FlushSwapchainReleasesToMain(XrInstance instance, OverlaysLayerXrSwapchainHandleInfo::Ptr swapchainInfo)
+{
+    auto ipcLock = gConnectionToMain->LockChannelForThisThread();
+
+    {
+        std::unique_lock<std::mutex> pendingLock(gConnectionToMain->pendingReleaseMutex);
+        auto& swapchains = gConnectionToMain->pendingReleaseSwapchains;
+        if(std::find(swapchains.begin(), swapchains.end(), swapchainInfo->actualHandle) == swapchains.end()) {
+            return;
+        }
+    }
+
+    OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(swapchainInfo->parentHandle);
+
+    PostSubmitFrameToMain(instance, sessionInfo->actualHandle, nullptr);
+}
+
 XrResult OverlaysLayerEndFrameOverlay(XrInstance instance, XrSession session, const XrFrameEndInfo* frameEndInfo)
 {
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
 
     auto frameEndInfoCopy = GetSharedCopyHandlesRestored(instance, "xrEndFrame", frameEndInfo);
 
-    XrResult result = RPCCallEndFrame(instance, sessionInfo->actualHandle, frameEndInfoCopy.get());
+    auto ipcLock = gConnectionToMain->LockChannelForThisThread();
+
+    XrResult result = PostSubmitFrameToMain(instance, sessionInfo->actualHandle, frameEndInfoCopy.get());
 
     return result;
 }
@@ -3336,10 +4172,9 @@ void AddSwapchainsFromLayers(OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo,
 
 XrResult OverlaysLayerEndFrameMain(XrInstance parentInstance, XrSession session, const XrFrameEndInfo* frameEndInfo)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
-    std::unique_lock<std::recursive_mutex> EndFrameLock(EndFrameMutex);
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
+    std::unique_lock<ProfiledMutex> EndFrameLock(EndFrameMutex);
 
     // combine overlay and main layers
 
@@ -3351,20 +4186,27 @@ XrResult OverlaysLayerEndFrameMain(XrInstance parentInstance, XrSession session,
 
     std::set<std::shared_ptr<OverlaysLayerXrSwapchainHandleInfo>> swapchainsInFlight;
 
+    // The connections as of now; one that closes while its layers are
+    // merged is kept alive by this copy.  Each connection's lock is taken
+    // without holding gConnectionsToOverlayByProcessIdMutex, which
+    // xrWaitFrame takes first.
+    std::vector<ConnectionToOverlay::Ptr> connectionsInDepthOrder;
     {
         std::unique_lock<std::recursive_mutex> connectionLock(gConnectionsToOverlayByProcessIdMutex);
-        if(!gConnectionsToOverlayInDepthOrder.empty()) {
-            for(auto& overlayconn: gConnectionsToOverlayInDepthOrder) {
-                connectionLock.unlock();
-                auto lock = overlayconn->GetLock();
-                if(overlayconn->ctx) {
-                    auto lock2 = overlayconn->ctx->GetLock();
-                    for(uint32_t i = 0; i < overlayconn->ctx->overlayLayers.size(); i++) {
-                        AddSwapchainsFromLayers(sessionInfo, overlayconn->ctx->overlayLayers[i], swapchainsInFlight);
-                        layersMerged.push_back(overlayconn->ctx->overlayLayers[i].get());
-                    }
-                }
-                connectionLock.lock();
+        connectionsInDepthOrder = gConnectionsToOverlayInDepthOrder;
+    }
+
+    // An Overlay's xrEndSession clears its layers without EndFrameMutex,
+    // so hold references to them until the runtime has them
+    std::vector<std::shared_ptr<const XrCompositionLayerBaseHeader>> overlayLayers;
+    for(auto& overlayconn: connectionsInDepthOrder) {
+        auto lock = overlayconn->GetLock();
+        if(overlayconn->ctx) {
+            auto lock2 = overlayconn->ctx->GetLock();
+            for(uint32_t i = 0; i < overlayconn->ctx->overlayLayers.size(); i++) {
+                AddSwapchainsFromLayers(sessionInfo, overlayconn->ctx->overlayLayers[i], swapchainsInFlight);
+                overlayLayers.push_back(overlayconn->ctx->overlayLayers[i]);
+                layersMerged.push_back(overlayconn->ctx->overlayLayers[i].get());
             }
         }
     }
@@ -3375,31 +4217,13 @@ XrResult OverlaysLayerEndFrameMain(XrInstance parentInstance, XrSession session,
         mainSession->swapchainsInFlight = swapchainsInFlight;
     }
 
-    // Malloc this struct and the layer pointers array and then deep copy "next" and the layer pointers.
-    // unique_ptr will free the whole deep copy later with custom deleter.
-    std::shared_ptr<XrFrameEndInfo> frameEndInfoMerged(reinterpret_cast<XrFrameEndInfo*>(malloc(sizeof(XrFrameEndInfo))), [instance=sessionInfo->parentInstance](const XrFrameEndInfo* p){ FreeXrStructChainWithFree(instance, p);});
-
-    frameEndInfoMerged->type = XR_TYPE_FRAME_END_INFO;
-    frameEndInfoMerged->next = CopyXrStructChainWithMalloc(parentInstance, frameEndInfo->next);
-    frameEndInfoMerged->displayTime = frameEndInfo->displayTime;
-    frameEndInfoMerged->environmentBlendMode = frameEndInfo->environmentBlendMode;
-    frameEndInfoMerged->layerCount = (uint32_t)layersMerged.size();
-
-    if(frameEndInfoMerged->layerCount > 0) {
-
-        auto layerPointers = reinterpret_cast<XrCompositionLayerBaseHeader**>(malloc(sizeof(XrCompositionLayerBaseHeader*) * layersMerged.size()));
-        frameEndInfoMerged->layers = layerPointers;
-        for(size_t i = 0; i < layersMerged.size(); i++) {
-            layerPointers[i] = reinterpret_cast<XrCompositionLayerBaseHeader*>(CopyXrStructChainWithMalloc(parentInstance, layersMerged[i]));
-        }
-
-    } else {
-
-        frameEndInfoMerged->layers = nullptr;
+    // Point at the app's and overlays' layers where they are; the copy
+    // with handles restored is the only deep copy, in one block
+    XrFrameEndInfo frameEndInfoMerged = *frameEndInfo;
+    frameEndInfoMerged.layerCount = (uint32_t)layersMerged.size();
+    frameEndInfoMerged.layers = layersMerged.empty() ? nullptr : layersMerged.data();
 
-    }
-
-    auto frameEndInfoMergedCopy = GetSharedCopyHandlesRestored(sessionInfo->parentInstance, "xrEndFrame", frameEndInfoMerged.get());
+    auto frameEndInfoMergedCopy = GetSharedCopyHandlesRestored(sessionInfo->parentInstance, "xrEndFrame", &frameEndInfoMerged);
 
     auto sessLock = sessionInfo->GetLock();
     XrResult result = sessionInfo->downchain->EndFrame(sessionInfo->actualHandle, frameEndInfoMergedCopy.get());
@@ -3409,10 +4233,17 @@ XrResult OverlaysLayerEndFrameMain(XrInstance parentInstance, XrSession session,
 
 XrResult OverlaysLayerEndFrame(XrSession session, const XrFrameEndInfo* frameEndInfo)
 {
-    try { 
-        auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
+    gEndFrameCount++;
+
+    // Non-blocking commands hold EpochReadGuards for their whole length,
+    // so tables retired while one was running would otherwise wait for
+    // the next Retire()
+    Epochs::Reclaim();
 
+    try { 
         auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+        LogLockProfilesIfDue(sessionInfo->parentInstance);
+        auto procLock = LockForProc(&sessionInfo->procMutex);
         
         bool isProxied = sessionInfo->isProxied;
         XrResult result;
@@ -3440,7 +4271,7 @@ XrResult OverlaysLayerEndFrame(XrSession session, const XrFrameEndInfo* frameEnd
 XrResult OverlaysLayerCreateActionSet(XrInstance instance, const XrActionSetCreateInfo* createInfo, XrActionSet* actionSet)
 {
     try {
-        auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
+        auto procLock = LockForProc(nullptr);
 
         auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(instance);
 
@@ -3453,6 +4284,7 @@ XrResult OverlaysLayerCreateActionSet(XrInstance instance, const XrActionSetCrea
 
             OverlaysLayerAddHandleInfoForXrActionSet(*actionSet, info);
 
+            auto l = instanceInfo->GetLock();
             instanceInfo->childActionSets.insert(info);
         }
 
@@ -3475,7 +4307,7 @@ XrResult OverlaysLayerCreateActionSet(XrInstance instance, const XrActionSetCrea
 XrResult OverlaysLayerCreateAction(XrActionSet actionSet, const XrActionCreateInfo* createInfo, XrAction* action)
 {
     try {
-        auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
+        auto procLock = LockForProc(nullptr);
 
         auto actionSetInfo = OverlaysLayerGetHandleInfoFromXrActionSet(actionSet);
 
@@ -3492,7 +4324,10 @@ XrResult OverlaysLayerCreateAction(XrActionSet actionSet, const XrActionCreateIn
             // Make sure Get on XR_NULL_PATH always succeeds, it will merge all valid subactionPath state
             info->subactionPaths.insert(XR_NULL_PATH);
 
-            actionSetInfo->childActions.insert(info);
+            {
+                auto l = actionSetInfo->GetLock();
+                actionSetInfo->childActions.insert(info);
+            }
 
             OverlaysLayerAddHandleInfoForXrAction(*action, info);
         }
@@ -3519,12 +4354,12 @@ XrResult OverlaysLayerSuggestInteractionProfileBindings(XrInstance instance, con
         auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(instance);
 
         // XXX This does not take into account any extension structs like the one Valve suggested
-        instanceInfo->profilesToBindings[suggestedBindings->interactionProfile] = 
+        instanceInfo->cold->profilesToBindings[suggestedBindings->interactionProfile] = 
             std::vector<XrActionSuggestedBinding>(suggestedBindings->suggestedBindings, suggestedBindings->suggestedBindings + suggestedBindings->countSuggestedBindings);
 
-        for(auto it: instanceInfo->profilesToBindings[suggestedBindings->interactionProfile]) {
-            auto found = instanceInfo->OverlaysLayerPathToWellKnownString.find(it.binding);
-            if(found == instanceInfo->OverlaysLayerPathToWellKnownString.end()) {
+        for(auto it: instanceInfo->cold->profilesToBindings[suggestedBindings->interactionProfile]) {
+            auto found = instanceInfo->cold->OverlaysLayerPathToWellKnownString.find(it.binding);
+            if(found == instanceInfo->cold->OverlaysLayerPathToWellKnownString.end()) {
                 OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, "xrSuggestInteractionProfileBindings",
                     OverlaysLayerNoObjectInfo,
                     fmt("Application suggested binding \"%s\", which this API layer does not know; binding will be ignored", PathToString(instance, it.binding).c_str()).c_str());
@@ -3552,7 +4387,10 @@ XrResult OverlaysLayerCreateActionSpaceOverlay(XrInstance parentInstance, XrSess
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
     auto actionInfo = OverlaysLayerGetHandleInfoFromXrAction(createInfo->action);
 
-    *space = (XrSpace)GetNextLocalHandle();
+    *space = OverlaysLayerNewLocalXrSpace();
+    if(*space == XR_NULL_HANDLE) {
+        return XR_ERROR_LIMIT_REACHED;
+    }
 
     OverlaysLayerXrSpaceHandleInfo::Ptr spaceInfo = std::make_shared<OverlaysLayerXrSpaceHandleInfo>(session, sessionInfo->parentInstance, sessionInfo->downchain);
     spaceInfo->spaceType = SPACE_ACTION;
@@ -3571,11 +4409,10 @@ XrResult OverlaysLayerCreateActionSpaceOverlay(XrInstance parentInstance, XrSess
 
 XrResult OverlaysLayerCreateActionSpaceMain(XrInstance parentInstance, XrSession session, const XrActionSpaceCreateInfo* createInfo, XrSpace* space)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
 
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
 
     // restore the actual handle
     XrSession localHandleStore = session;
@@ -3593,11 +4430,16 @@ XrResult OverlaysLayerCreateActionSpaceMain(XrInstance parentInstance, XrSession
     if(result == XR_SUCCESS) {
 
         XrSpace actualHandle = *space;
-        XrSpace localHandle = (XrSpace)GetNextLocalHandle();
+        XrSpace localHandle = OverlaysLayerNewLocalXrSpace();
+        if(localHandle == XR_NULL_HANDLE) {
+            sessionInfo->downchain->DestroySpace(actualHandle);
+            *space = XR_NULL_HANDLE;
+            return XR_ERROR_LIMIT_REACHED;
+        }
         *space = localHandle;
 
         {
-            std::unique_lock<std::recursive_mutex> lock(gActualXrSpaceToLocalHandleMutex);
+            std::unique_lock<ProfiledMutex> lock(gActualXrSpaceToLocalHandleMutex);
             gActualXrSpaceToLocalHandle.insert({actualHandle, localHandle});
         }
 
@@ -3651,30 +4493,34 @@ XrResult OverlaysLayerCreateActionSpace(XrSession session, const XrActionSpaceCr
 
 XrResult OverlaysLayerCreateActionSpaceFromBinding(ConnectionToOverlay::Ptr connection, XrSession session, WellKnownStringIndex profileString, WellKnownStringIndex bindingString, const XrPosef* poseInActionSpace, XrSpace *space)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session); 
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(sessionInfo->parentInstance);
 
-    XrPath bindingPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(bindingString); // These two .at()s must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-    XrPath profilePath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(profileString);
+    XrPath bindingPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(bindingString); // These two .at()s must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+    XrPath profilePath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(profileString);
 
-    XrAction actualActionHandle = sessionInfo->placeholderActionsByProfileAndFullBinding.at({profilePath, bindingPath}).first; // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+    XrAction actualActionHandle = sessionInfo->cold->placeholderActionsByProfileAndFullBinding.at({profilePath, bindingPath}).first; // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
 
     XrActionSpaceCreateInfo createInfo { XR_TYPE_ACTION_SPACE_CREATE_INFO };
     createInfo.action = actualActionHandle;
-    createInfo.subactionPath = instanceInfo->OverlaysLayerBindingToSubaction.at(bindingPath); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+    createInfo.subactionPath = instanceInfo->cold->OverlaysLayerBindingToSubaction.at(bindingPath); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
     createInfo.poseInActionSpace = *poseInActionSpace; 
     XrResult result = sessionInfo->downchain->CreateActionSpace(sessionInfo->actualHandle, &createInfo, space);
 
     if(result == XR_SUCCESS) {
 
         XrSpace actualHandle = *space;
-        XrSpace localHandle = (XrSpace)GetNextLocalHandle();
+        XrSpace localHandle = OverlaysLayerNewLocalXrSpace();
+        if(localHandle == XR_NULL_HANDLE) {
+            sessionInfo->downchain->DestroySpace(actualHandle);
+            *space = XR_NULL_HANDLE;
+            return XR_ERROR_LIMIT_REACHED;
+        }
         *space = localHandle;
 
         {
-            std::unique_lock<std::recursive_mutex> lock(gActualXrSpaceToLocalHandleMutex);
+            std::unique_lock<ProfiledMutex> lock(gActualXrSpaceToLocalHandleMutex);
             gActualXrSpaceToLocalHandle.insert({actualHandle, localHandle});
         }
 
@@ -3702,13 +4548,14 @@ XrResult OverlaysLayerAttachSessionActionSetsOverlay(XrInstance parentInstance,
     for(uint32_t i = 0; i < attachInfo->countActionSets; i++) {
         auto actionSetInfo = OverlaysLayerGetHandleInfoFromXrActionSet(attachInfo->actionSets[i]);
         actionSetInfo->bindLocation = BOUND_OVERLAY;
+        auto l = actionSetInfo->GetLock();
         for(auto actionInfo: actionSetInfo->childActions) {
             actionInfo->bindLocation = BOUND_OVERLAY;
         }
     }
 
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(parentInstance);
-    for(auto profileAndBindings : instanceInfo->profilesToBindings) {
+    for(auto profileAndBindings : instanceInfo->cold->profilesToBindings) {
         XrPath interactionProfile = profileAndBindings.first;
         auto bindings = profileAndBindings.second;
 
@@ -3718,7 +4565,7 @@ XrResult OverlaysLayerAttachSessionActionSetsOverlay(XrInstance parentInstance,
         }
 
         if(bindings.size() > 0) {
-            sessionInfo->interactionProfiles.insert(interactionProfile);
+            sessionInfo->cold->interactionProfiles.insert(interactionProfile);
         }
     }
 
@@ -3728,8 +4575,6 @@ XrResult OverlaysLayerAttachSessionActionSetsOverlay(XrInstance parentInstance,
 
 XrResult OverlaysLayerAttachSessionActionSetsMain(XrInstance parentInstance, XrSession session, const XrSessionActionSetsAttachInfo* attachInfo)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
 
     // Submit main app's suggestions and our own placeholder suggestions
@@ -3737,17 +4582,18 @@ XrResult OverlaysLayerAttachSessionActionSetsMain(XrInstance parentInstance, XrS
     // XXX check and return ALREADY_ATTACHED, don't call Suggest
 
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session); 
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     if(sessionInfo->actionSetsWereAttached) {
         return XR_ERROR_ACTIONSETS_ALREADY_ATTACHED;
     }
 
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(parentInstance);
-    for(auto profileAndBindings : instanceInfo->profilesToBindings) {
+    for(auto profileAndBindings : instanceInfo->cold->profilesToBindings) {
         XrPath interactionProfile = profileAndBindings.first;
         auto bindings = profileAndBindings.second;
 
         if(bindings.size() > 0) {
-            sessionInfo->interactionProfiles.insert(interactionProfile);
+            sessionInfo->cold->interactionProfiles.insert(interactionProfile);
         }
 
         for(auto binding: bindings) {
@@ -3771,7 +4617,7 @@ XrResult OverlaysLayerAttachSessionActionSetsMain(XrInstance parentInstance, XrS
             OverlaysLayerLogMessage(sessionInfo->parentInstance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "xrAttachSessionActionSets",
                 OverlaysLayerNoObjectInfo,
                 fmt("interactionProfile \"%s\"", PathToString(sessionInfo->parentInstance, interactionProfile).c_str()).c_str());
-            for (const auto& actionBinding : sessionInfo->bindingsByProfile.at(interactionProfile)) { // This must succeed; interactionProfile is from suggested bindings and adding new binding paths would require enabling an extension which API Layer doesn't support
+            for (const auto& actionBinding : sessionInfo->cold->bindingsByProfile.at(interactionProfile)) { // This must succeed; interactionProfile is from suggested bindings and adding new binding paths would require enabling an extension which API Layer doesn't support
                 newBindings.push_back(actionBinding);
                 XrPath binding = actionBinding.binding;
                 XrPath recorded = sessionInfo->bindingsByAction[actionBinding.action];
@@ -3839,6 +4685,7 @@ XrResult OverlaysLayerAttachSessionActionSetsMain(XrInstance parentInstance, XrS
         for(uint32_t i = 0; i < attachInfo->countActionSets; i++) {
             auto actionSetInfo = OverlaysLayerGetHandleInfoFromXrActionSet(attachInfo->actionSets[i]);
             actionSetInfo->bindLocation = BOUND_MAIN;
+            auto l = actionSetInfo->GetLock();
             for(auto actionInfo: actionSetInfo->childActions) {
                 actionInfo->bindLocation = BOUND_MAIN;
             }
@@ -3891,9 +4738,8 @@ XrResult GetActionStates(XrSession session, const ActionGetInfoList& actionsToGe
 {
     XrResult result = XR_SUCCESS;
 
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
 	auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+	auto procLock = LockForProc(&sessionInfo->procMutex);
 
     uint32_t index = 0;
     for(const auto& whatToGet: actionsToGet) {
@@ -3962,7 +4808,7 @@ XrResult OverlaysLayerGetCurrentInteractionProfile(XrSession session, XrPath top
             return XR_ERROR_PATH_INVALID;
         }
             
-        if(sessionInfo->interactionProfiles.count(it->second) > 0) {
+        if(sessionInfo->cold->interactionProfiles.count(it->second) > 0) {
             interactionProfile->interactionProfile = it->second;
         } else {
             interactionProfile->interactionProfile = XR_NULL_PATH;
@@ -3989,11 +4835,10 @@ XrResult OverlaysLayerSyncActionsAndGetStateMainAsOverlay(
     uint32_t countSubactionStrings, const WellKnownStringIndex *subactionStrings,                                               /* input is subactionPaths for which to get current interaction Profile */
     WellKnownStringIndex *interactionProfileStrings)                                                                            /* output is current interaction profiles */
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
 
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(sessionInfo->parentInstance);
 
     XrActiveActionSet activeActionSet { sessionInfo->placeholderActionSet, XR_NULL_PATH };
@@ -4012,22 +4857,22 @@ XrResult OverlaysLayerSyncActionsAndGetStateMainAsOverlay(
     ActionGetInfoList actionsToGet;
 
     for(uint32_t i = 0; i < countProfileAndBindings; i++) {
-        XrPath profilePath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(profileStrings[i]); // These two at()s must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-        XrPath bindingPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(bindingStrings[i]);
-        auto it = sessionInfo->placeholderActionsByProfileAndFullBinding.find({profilePath, bindingPath});
-        if(it == sessionInfo->placeholderActionsByProfileAndFullBinding.end()) {
+        XrPath profilePath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(profileStrings[i]); // These two at()s must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        XrPath bindingPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(bindingStrings[i]);
+        auto it = sessionInfo->cold->placeholderActionsByProfileAndFullBinding.find({profilePath, bindingPath});
+        if(it == sessionInfo->cold->placeholderActionsByProfileAndFullBinding.end()) {
             DebugBreak();
         }
 			
         XrAction action = it->second.first;
         XrActionType type = it->second.second;
-        XrPath subactionPath = instanceInfo->OverlaysLayerBindingToSubaction.at(bindingPath); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        XrPath subactionPath = instanceInfo->cold->OverlaysLayerBindingToSubaction.at(bindingPath); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
         actionsToGet.push_back({ action, type, subactionPath });
 
         if(false) printf("for %s%s, I think I'm getting action %s\n",
             PathToString(sessionInfo->parentInstance, profilePath).c_str(),
             PathToString(sessionInfo->parentInstance, bindingPath).c_str(),
-            sessionInfo->placeholderActionNames.at(action).c_str());
+            sessionInfo->cold->placeholderActionNames.at(action).c_str());
     }
     result = GetActionStates(session, actionsToGet, states);
 
@@ -4038,14 +4883,14 @@ XrResult OverlaysLayerSyncActionsAndGetStateMainAsOverlay(
     // XXX debug
     if(false) for(uint32_t i = 0; i < countProfileAndBindings; i++) {
         auto got = actionsToGet[i];
-        XrPath profilePath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(profileStrings[i]); // This .at() must succeed; it was translated by the overlay side to a well-known string
-        XrPath bindingPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(bindingStrings[i]); // This .at() must succeed; it was translated by the overlay side to a well-known string
+        XrPath profilePath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(profileStrings[i]); // This .at() must succeed; it was translated by the overlay side to a well-known string
+        XrPath bindingPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(bindingStrings[i]); // This .at() must succeed; it was translated by the overlay side to a well-known string
         if(got.actionType == XR_ACTION_TYPE_BOOLEAN_INPUT) {
             XrActionStateBoolean *boolean = (XrActionStateBoolean*)&states[i];
             printf("for %s%s, I got for action %s {state = %s, active = %s}\n",
                 PathToString(sessionInfo->parentInstance, profilePath).c_str(),
                 PathToString(sessionInfo->parentInstance, bindingPath).c_str(),
-                sessionInfo->placeholderActionNames.at(got.action).c_str(),
+                sessionInfo->cold->placeholderActionNames.at(got.action).c_str(),
                 boolean->currentState ? "true" : "false",
                 boolean->isActive ? "true" : "false");
         }
@@ -4056,7 +4901,7 @@ XrResult OverlaysLayerSyncActionsAndGetStateMainAsOverlay(
     }
 
     for(uint32_t i = 0; i < countSubactionStrings; i++) {
-        XrPath p = instanceInfo->OverlaysLayerWellKnownStringToPath.at(subactionStrings[i]); // This .at() must succeed; it was translated by the overlay side to a well-known string
+        XrPath p = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(subactionStrings[i]); // This .at() must succeed; it was translated by the overlay side to a well-known string
         XrInteractionProfileState interactionProfile { XR_TYPE_INTERACTION_PROFILE_STATE };
 
         XrResult result2 = sessionInfo->downchain->GetCurrentInteractionProfile(sessionInfo->actualHandle, p, &interactionProfile);
@@ -4067,7 +4912,7 @@ XrResult OverlaysLayerSyncActionsAndGetStateMainAsOverlay(
                 fmt("Couldn't get current interaction profile for top-level path \"%s\" in OverlaysLayerSyncActionsAndGetStateMainAsOverlay", PathToString(sessionInfo->parentInstance, p).c_str()).c_str());
             interactionProfileStrings[i] = WellKnownStringIndex::NULL_PATH;
         } else {
-            interactionProfileStrings[i] = instanceInfo->OverlaysLayerPathToWellKnownString.at(interactionProfile.interactionProfile); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+            interactionProfileStrings[i] = instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(interactionProfile.interactionProfile); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
         }
     }
 
@@ -4080,6 +4925,7 @@ void ClearSessionLastSyncedActiveActionSets(OverlaysLayerXrSessionHandleInfo::Pt
         XrActionSet actionSet = activeActionSet.actionSet;
         auto actionSetInfo = OverlaysLayerGetHandleInfoFromXrActionSet(actionSet);
         XrPath subactionPath = activeActionSet.subactionPath;
+        auto l = actionSetInfo->GetLock();
         for(auto actionInfo: actionSetInfo->childActions) {
             actionInfo->stateBySubactionPath.clear();
         }
@@ -4092,6 +4938,7 @@ void ClearSyncedActiveActionSets(XrInstance parentInstance, XrSession session, c
         XrActionSet actionSet = syncInfo->activeActionSets[i].actionSet;
         auto actionSetInfo = OverlaysLayerGetHandleInfoFromXrActionSet(actionSet);
         XrPath subactionPath = syncInfo->activeActionSets[i].subactionPath;
+        auto l = actionSetInfo->GetLock();
         for(auto actionInfo: actionSetInfo->childActions) {
             actionInfo->stateBySubactionPath.clear();
         }
@@ -4102,6 +4949,7 @@ void GetPreviousActionStates(XrInstance parentInstance, XrSession session, const
 {
     for(uint32_t i = 0; i < syncInfo->countActiveActionSets; i++) {
         auto actionSetInfo = OverlaysLayerGetHandleInfoFromXrActionSet(syncInfo->activeActionSets[i].actionSet);
+        auto l = actionSetInfo->GetLock();
         for(auto actionInfo: actionSetInfo->childActions) {
             previousActionStates.insert({actionInfo, actionInfo->stateBySubactionPath});
         }
@@ -4129,6 +4977,7 @@ XrResult OverlaysLayerSyncActionsOverlay(XrInstance parentInstance, XrSession se
     }
 
     for(const auto& [actionSetInfo, subactionPaths] : actionSetInfoSubactionPaths) {
+        auto l = actionSetInfo->GetLock();
         for(auto actionInfo: actionSetInfo->childActions) {
             actionInfos.insert(actionInfo);
             for(auto subactionPath: subactionPaths) {
@@ -4152,15 +5001,15 @@ XrResult OverlaysLayerSyncActionsOverlay(XrInstance parentInstance, XrSession se
 
             for(auto fullBindingPath: fullBindingPaths) {
 
-                if(instanceInfo->OverlaysLayerBindingToSubaction.count(fullBindingPath) > 0) {
-                    XrPath bindingSubactionPath = instanceInfo->OverlaysLayerBindingToSubaction.at(fullBindingPath); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+                if(instanceInfo->cold->OverlaysLayerBindingToSubaction.count(fullBindingPath) > 0) {
+                    XrPath bindingSubactionPath = instanceInfo->cold->OverlaysLayerBindingToSubaction.at(fullBindingPath); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
 
                     for(auto subactionPath: subactionPaths) {
 
                         if((subactionPath == XR_NULL_PATH) || (subactionPath == bindingSubactionPath)) {
 
-                            WellKnownStringIndex fullBindingString = instanceInfo->OverlaysLayerPathToWellKnownString.at(fullBindingPath); // These two .at()s must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-                            WellKnownStringIndex profileString = instanceInfo->OverlaysLayerPathToWellKnownString.at(profilePath);
+                            WellKnownStringIndex fullBindingString = instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(fullBindingPath); // These two .at()s must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+                            WellKnownStringIndex profileString = instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(profilePath);
 
                             // get profile and full path which the main process side of the API layer maps to a placeholder action
 
@@ -4188,8 +5037,8 @@ XrResult OverlaysLayerSyncActionsOverlay(XrInstance parentInstance, XrSession se
     std::vector<ActionStateUnion> states(fullBindingStrings.size());
 
     std::vector<WellKnownStringIndex> topLevelStrings;
-    for(XrPath subactionPath: instanceInfo->OverlaysLayerAllSubactionPaths) {
-        topLevelStrings.push_back(instanceInfo->OverlaysLayerPathToWellKnownString.at(subactionPath)); // This .at() must succeed, it was constructed by a table of known strings.
+    for(XrPath subactionPath: instanceInfo->cold->OverlaysLayerAllSubactionPaths) {
+        topLevelStrings.push_back(instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(subactionPath)); // This .at() must succeed, it was constructed by a table of known strings.
     }
 
     std::vector<WellKnownStringIndex> currentInteractionProfileStrings(topLevelStrings.size());
@@ -4281,8 +5130,8 @@ XrResult OverlaysLayerSyncActionsOverlay(XrInstance parentInstance, XrSession se
 
         // Store the interaction profiles current for allowlisted top-level paths
         for(uint32_t i = 0; i < topLevelStrings.size(); i++) {
-            XrPath topLevelPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(topLevelStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-            XrPath interactionProfile = instanceInfo->OverlaysLayerWellKnownStringToPath.at(currentInteractionProfileStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+            XrPath topLevelPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(topLevelStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+            XrPath interactionProfile = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(currentInteractionProfileStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
             XrPath previousProfile = sessionInfo->currentInteractionProfileBySubactionPath.at(topLevelPath); // This .at() must succeed because currentInteractionProfileBySubactionPath.at was filled with all possible topLevelPaths in CreateSessionMain()
             if(previousProfile != interactionProfile) {
                 auto l = sessionInfo->GetLock();
@@ -4299,11 +5148,10 @@ XrResult OverlaysLayerSyncActionsOverlay(XrInstance parentInstance, XrSession se
 
 XrResult OverlaysLayerSyncActionsMain(XrInstance parentInstance, XrSession session, const XrActionsSyncInfo* syncInfo)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
 
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(parentInstance);
 
     // Sync all the actions requested by the Main app
@@ -4339,6 +5187,7 @@ XrResult OverlaysLayerSyncActionsMain(XrInstance parentInstance, XrSession sessi
     }
 
     for(const auto& [actionSetInfo, subactionPaths] : actionSetInfoSubactionPaths) {
+        auto l = actionSetInfo->GetLock();
         for(auto actionInfo: actionSetInfo->childActions) {
             actionInfos.insert(actionInfo);
             for(auto subactionPath: subactionPaths) {
@@ -4422,7 +5271,7 @@ XrResult OverlaysLayerSyncActionsMain(XrInstance parentInstance, XrSession sessi
         }
 
         // update interaction profiles and mark whether we need to synthesize an EVENT_DATA_INTERACTION_PROFILE_CHANGE
-        for(XrPath p: instanceInfo->OverlaysLayerAllSubactionPaths) {
+        for(XrPath p: instanceInfo->cold->OverlaysLayerAllSubactionPaths) {
 
             XrInteractionProfileState interactionProfile { XR_TYPE_INTERACTION_PROFILE_STATE };
             result = sessionInfo->downchain->GetCurrentInteractionProfile(sessionInfo->actualHandle, p, &interactionProfile);
@@ -4662,7 +5511,7 @@ void GetBindingPathsForActionAndSubactionPath(XrSession session, XrAction action
         if(actionInfo->suggestedBindingsByProfile.count(currentInteractionProfile) > 0) {
             for(auto fullBindingPath: actionInfo->suggestedBindingsByProfile.at(currentInteractionProfile)) {
 
-                XrPath bindingSubactionPath = instanceInfo->OverlaysLayerBindingToSubaction.at(fullBindingPath);
+                XrPath bindingSubactionPath = instanceInfo->cold->OverlaysLayerBindingToSubaction.at(fullBindingPath);
 
                 if(subactionPath == bindingSubactionPath) {
                     // get profile and full path which the main process side of the API layer maps to a placeholder action
@@ -4675,22 +5524,19 @@ void GetBindingPathsForActionAndSubactionPath(XrSession session, XrAction action
 
 XrResult OverlaysLayerApplyHapticFeedbackMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t profileStringCount, const WellKnownStringIndex *profileStrings, const WellKnownStringIndex *bindingStrings, const XrHapticBaseHeader* hapticFeedback)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(sessionInfo->parentInstance);
 
-    auto hapticFeedbackCopy = GetSharedCopyHandlesRestored(sessionInfo->parentInstance, "xrStopHapticFeedback", hapticFeedback);
-
     for(uint32_t i = 0; i < profileStringCount; i++) {
-        XrPath bindingPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(bindingStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-        XrPath profilePath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(profileStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        XrPath bindingPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(bindingStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        XrPath profilePath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(profileStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
 
-        XrAction actualActionHandle = sessionInfo->placeholderActionsByProfileAndFullBinding.at({profilePath, bindingPath}).first; // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        XrAction actualActionHandle = sessionInfo->cold->placeholderActionsByProfileAndFullBinding.at({profilePath, bindingPath}).first; // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
 
         XrHapticActionInfo hapticActionInfo { XR_TYPE_HAPTIC_ACTION_INFO, nullptr, actualActionHandle, XR_NULL_PATH };
 
-        XrResult result = sessionInfo->downchain->ApplyHapticFeedback(sessionInfo->actualHandle, &hapticActionInfo, hapticFeedbackCopy.get());
+        XrResult result = sessionInfo->downchain->ApplyHapticFeedback(sessionInfo->actualHandle, &hapticActionInfo, hapticFeedback);
 
         if(result != XR_SUCCESS) {
             return result;
@@ -4702,16 +5548,15 @@ XrResult OverlaysLayerApplyHapticFeedbackMainAsOverlay(ConnectionToOverlay::Ptr
 
 XrResult OverlaysLayerStopHapticFeedbackMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t profileStringCount, const WellKnownStringIndex *profileStrings, const WellKnownStringIndex *bindingStrings)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(sessionInfo->parentInstance);
 
     for(uint32_t i = 0; i < profileStringCount; i++) {
-        XrPath bindingPath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(bindingStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-        XrPath profilePath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(profileStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        XrPath bindingPath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(bindingStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        XrPath profilePath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(profileStrings[i]); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
 
-        XrAction actualActionHandle = sessionInfo->placeholderActionsByProfileAndFullBinding.at({profilePath, bindingPath}).first; // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        XrAction actualActionHandle = sessionInfo->cold->placeholderActionsByProfileAndFullBinding.at({profilePath, bindingPath}).first; // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
 
         XrHapticActionInfo hapticActionInfo { XR_TYPE_HAPTIC_ACTION_INFO, nullptr, actualActionHandle, XR_NULL_PATH };
 
@@ -4747,8 +5592,8 @@ XrResult OverlaysLayerApplyHapticFeedbackOverlay(XrInstance instance, XrSession
     std::vector<WellKnownStringIndex> profileStrings;
     std::vector<WellKnownStringIndex> bindingStrings;
     for(auto profileAndBindingPath: profileAndBindingPaths) {
-        profileStrings.push_back(instanceInfo->OverlaysLayerPathToWellKnownString.at(profileAndBindingPath.first)); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-        bindingStrings.push_back(instanceInfo->OverlaysLayerPathToWellKnownString.at(profileAndBindingPath.second)); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        profileStrings.push_back(instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(profileAndBindingPath.first)); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        bindingStrings.push_back(instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(profileAndBindingPath.second)); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
     }
 
     XrResult result = RPCCallApplyHapticFeedback(sessionInfo->parentInstance, sessionInfo->actualHandle, (uint32_t)profileStrings.size(), profileStrings.data(), bindingStrings.data(), hapticFeedbackCopy.get());
@@ -4758,12 +5603,10 @@ XrResult OverlaysLayerApplyHapticFeedbackOverlay(XrInstance instance, XrSession
 
 XrResult OverlaysLayerApplyHapticFeedbackMain(XrInstance parentInstance, XrSession session, const XrHapticActionInfo* hapticActionInfo, const XrHapticBaseHeader* hapticFeedback)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
 
-    std::unique_lock<std::recursive_mutex> mlock(gOverlaysLayerXrSessionToHandleInfoMutex);
-    OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = gOverlaysLayerXrSessionToHandleInfo.at(session);
+    OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     // restore the actual handle
     XrSession localHandleStore = session;
     session = sessionInfo->actualHandle;
@@ -4777,7 +5620,7 @@ XrResult OverlaysLayerApplyHapticFeedbackMain(XrInstance parentInstance, XrSessi
     hapticFeedback = hapticFeedbackCopy.get();
     
     {
-        std::unique_lock<std::recursive_mutex> HapticQuirkLock(HapticQuirkMutex);
+        std::unique_lock<ProfiledMutex> HapticQuirkLock(HapticQuirkMutex);
         result = sessionInfo->downchain->ApplyHapticFeedback(session, hapticActionInfo, hapticFeedback);
     }
 
@@ -4836,8 +5679,8 @@ XrResult OverlaysLayerStopHapticFeedbackOverlay(XrInstance instance, XrSession s
     std::vector<WellKnownStringIndex> profileStrings;
     std::vector<WellKnownStringIndex> bindingStrings;
     for(auto profileAndBindingPath: profileAndBindingPaths) {
-        profileStrings.push_back(instanceInfo->OverlaysLayerPathToWellKnownString.at(profileAndBindingPath.first)); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
-        bindingStrings.push_back(instanceInfo->OverlaysLayerPathToWellKnownString.at(profileAndBindingPath.second)); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        profileStrings.push_back(instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(profileAndBindingPath.first)); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+        bindingStrings.push_back(instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(profileAndBindingPath.second)); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
     }
 
     XrResult result = RPCCallStopHapticFeedback(sessionInfo->parentInstance, sessionInfo->actualHandle, (uint32_t)profileStrings.size(), profileStrings.data(), bindingStrings.data());
@@ -4847,12 +5690,10 @@ XrResult OverlaysLayerStopHapticFeedbackOverlay(XrInstance instance, XrSession s
 
 XrResult OverlaysLayerStopHapticFeedbackMain(XrInstance parentInstance, XrSession session, const XrHapticActionInfo* hapticActionInfo)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
-
     XrResult result = XR_SUCCESS;
 
-    std::unique_lock<std::recursive_mutex> mlock(gOverlaysLayerXrSessionToHandleInfoMutex);
-    OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = gOverlaysLayerXrSessionToHandleInfo.at(session);
+    OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     // restore the actual handle
     XrSession localHandleStore = session;
     session = sessionInfo->actualHandle;
@@ -4898,15 +5739,15 @@ XrResult OverlaysLayerStopHapticFeedback(XrSession session, const XrHapticAction
 
 XrResult OverlaysLayerGetInputSourceLocalizedNameMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, const XrInputSourceLocalizedNameGetInfo* getInfo /* sourcePath ignored */, WellKnownStringIndex sourceString, uint32_t bufferCapacityInput, uint32_t* bufferCountOutput, char* buffer)
 {
-    auto synchronizeEveryProcLock = gSynchronizeEveryProc ? std::unique_lock<std::recursive_mutex>(gSynchronizeEveryProcMutex) : std::unique_lock<std::recursive_mutex>();
     OverlaysLayerXrSessionHandleInfo::Ptr sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
+    auto procLock = LockForProc(&sessionInfo->procMutex);
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(sessionInfo->parentInstance);
 
     XrInputSourceLocalizedNameGetInfo getInfoCopy = *getInfo;
 
-    getInfoCopy.sourcePath = instanceInfo->OverlaysLayerWellKnownStringToPath.at(sourceString); // This .at() must succeed; it was translated by the overlay side to a well-known string
+    getInfoCopy.sourcePath = instanceInfo->cold->OverlaysLayerWellKnownStringToPath.at(sourceString); // This .at() must succeed; it was translated by the overlay side to a well-known string
 
-	std::unique_lock<std::recursive_mutex> HapticQuirkLock(HapticQuirkMutex);
+	std::unique_lock<ProfiledMutex> HapticQuirkLock(HapticQuirkMutex);
     return sessionInfo->downchain->GetInputSourceLocalizedName(sessionInfo->actualHandle, &getInfoCopy, bufferCapacityInput, bufferCountOutput, buffer);
 }
 
@@ -4915,11 +5756,11 @@ XrResult OverlaysLayerGetInputSourceLocalizedNameOverlay( XrInstance instance, X
     auto sessionInfo = OverlaysLayerGetHandleInfoFromXrSession(session);
     auto instanceInfo = OverlaysLayerGetHandleInfoFromXrInstance(instance);
 
-    if(instanceInfo->OverlaysLayerPathToWellKnownString.count(getInfo->sourcePath) == 0) {
+    if(instanceInfo->cold->OverlaysLayerPathToWellKnownString.count(getInfo->sourcePath) == 0) {
         return XR_ERROR_PATH_UNSUPPORTED;
     }
 
-    WellKnownStringIndex sourceString = instanceInfo->OverlaysLayerPathToWellKnownString.at(getInfo->sourcePath); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
+    WellKnownStringIndex sourceString = instanceInfo->cold->OverlaysLayerPathToWellKnownString.at(getInfo->sourcePath); // This .at() must succeed; adding new binding paths would require enabling an extension which API Layer doesn't support
 
     return RPCCallGetInputSourceLocalizedName(sessionInfo->parentInstance, sessionInfo->actualHandle, getInfo, sourceString, bufferCapacityInput, bufferCountOutput, buffer);
 }
@@ -4948,7 +5789,7 @@ XrResult OverlaysLayerEnumerateBoundSourcesForActionOverlay(XrInstance instance,
                     for(auto fullBindingPath: actionInfo->suggestedBindingsByProfile.at(currentInteractionProfile)) {
 
                         // XXX really should find() this - could be path from an extension
-                        XrPath bindingSubactionPath = instanceInfo->OverlaysLayerBindingToSubaction.at(fullBindingPath);
+                        XrPath bindingSubactionPath = instanceInfo->cold->OverlaysLayerBindingToSubaction.at(fullBindingPath);
 
                         if(subactionPath == bindingSubactionPath) {
 
@@ -25,11 +25,63 @@
 #include <new>
 #include <set>
 #include <unordered_map>
+#include <vector>
 #include <queue>
 #include <functional>
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+
+#include "ipc_transport.h"
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#endif
+
+// Handle to a texture shared from an Overlay swapchain to Main; only
+// D3D11 swapchains are shared, elsewhere it stays an opaque pointer
+#if defined(XR_USE_GRAPHICS_API_D3D11)
+typedef HANDLE SharedImageHandle;
+#else
+typedef void* SharedImageHandle;
+#endif
+
+#if !defined(_WIN32)
+// MSVC CRT and Win32 calls used by the layer and the generated code
+
+inline int strncpy_s(char* dst, size_t dstSize, const char* src, size_t count)
+{
+    size_t length = strnlen(src, count);
+    if(length >= dstSize) {
+        dst[0] = '\0';
+        return ERANGE;
+    }
+    memcpy(dst, src, length);
+    dst[length] = '\0';
+    return 0;
+}
+
+inline size_t strnlen_s(const char* str, size_t maxLength)
+{
+    return str ? strnlen(str, maxLength) : 0;
+}
+
+template <size_t N>
+inline int strncpy_s(char (&dst)[N], const char* src, size_t count)
+{
+    return strncpy_s(dst, N, src, count);
+}
+
+inline void DebugBreak()
+{
+    raise(SIGTRAP);
+}
+#endif
 
 struct OverlaysLayerXrException
 {
@@ -51,16 +103,36 @@ enum CopyType {
     COPY_ONLY_TYPE_NEXT,   // XR command will fill (aka output)
 };
 
-typedef std::function<void* (size_t size)> AllocateFunc;
-typedef std::function<void (const void* p)> FreeFunc;
-XrBaseInStructure *CopyXrStructChain(XrInstance instance, const XrBaseInStructure* srcbase, CopyType copyType, AllocateFunc alloc, std::function<void (void* pointerToPointer)> addOffsetToPointer);
-void FreeXrStructChain(XrInstance instance, const XrBaseInStructure* p, FreeFunc free);
+// CopyXrStructChain() and FreeXrStructChain() are templates on an
+// allocator policy, with allocate(size) and addOffsetToPointer(pointer),
+// and a deallocator policy, with deallocate(pointer), so the per-member
+// calls inline; they are instantiated inside the generated source only.
+size_t XrStructChainSerializedSize(XrInstance instance, const XrBaseInStructure* srcbase);
 XrBaseInStructure* CopyEventChainIntoBuffer(XrInstance instance, const XrEventDataBaseHeader* eventData, XrEventDataBuffer* buffer);
 XrBaseInStructure* CopyXrStructChainWithMalloc(XrInstance instance, const void* xrstruct);
 void FreeXrStructChainWithFree(XrInstance instance, const void* xrstruct);
+XrBaseInStructure* CopyXrStructChainWithScratch(XrInstance instance, const void* xrstruct);
+struct XrStructChainCountingHeap;
+XrBaseInStructure* CopyXrStructChainWithCountingHeap(XrInstance instance, const void* xrstruct, XrStructChainCountingHeap& heap);
+void FreeXrStructChainWithCountingHeap(XrInstance instance, const void* xrstruct, XrStructChainCountingHeap& heap);
+
+// Copies the output members of the chain in Main's reply to the app's
+// chain; structs the app chained that Main doesn't know are skipped
+template <typename T>
+void IPCCopyOut(T* dst, const T* src);
+template <>
+void IPCCopyOut(XrBaseOutStructure* dstbase, const XrBaseOutStructure* srcbase);
 
 bool RestoreActualHandles(XrInstance instance, XrBaseInStructure *xrstruct);
-void SubstituteLocalHandles(XrInstance instance, XrBaseOutStructure *xrstruct);
+bool XrStructChainContainsSubstitutableHandles(const XrBaseInStructure *xrstruct);
+
+// Deep comparison of a chain and a copy CopyXrStructChain made of it;
+// ValidateXrStructChainCopy logs copies that don't match if
+// gValidateStructCopies is set, from OVERLAYS_API_LAYER_VALIDATE_STRUCT_COPIES
+bool XrStructChainEquals(const XrBaseInStructure* a, const XrBaseInStructure* b);
+void ValidateXrStructChainCopy(XrInstance instance, const char* func, const XrBaseInStructure* src, const XrBaseInStructure* copy);
+extern bool gValidateStructCopies;
+bool SubstituteLocalHandles(XrInstance instance, XrBaseOutStructure *xrstruct);
 
 typedef std::pair<uint64_t, XrObjectType> HandleTypePair;
 
@@ -90,76 +162,753 @@ inline std::string fmt(const char* fmt, ...)
     return "(fmt() failed, vsnprintf returned -1)";
 }
 
-// Header laid into the shared memory tracking the RPC type, the result,
-// and all pointers inside the shared memory which have to be fixed up
-// passing from Remote to Host and then back
-struct IPCHeader
+static const int memberAlignment = 8;
+
+static size_t pad(size_t s)
 {
-    uint64_t requestType;
-    XrResult result;
+    return (s + memberAlignment - 1) / memberAlignment * memberAlignment;
+}
 
-    int pointerFixupCount;
-    constexpr static int maxPointerFixupCount = 128;
-    size_t pointerOffsets[maxPointerFixupCount];
+// Allocator policy handing out pieces of one block sized by
+// XrStructChainSerializedSize(), so a deep copy of a chain is a single
+// allocation
+struct XrStructChainBlock
+{
+    unsigned char *next;
+    unsigned char *end;
 
-    IPCHeader(uint64_t requestType) :
-        requestType(requestType),
-        pointerFixupCount(0)
+    XrStructChainBlock(void *base, size_t size) :
+        next(reinterpret_cast<unsigned char*>(base)),
+        end(reinterpret_cast<unsigned char*>(base) + size)
     {}
 
-    bool addOffsetToPointer(void* vbase, void* vp)
+    void *allocate(size_t s)
+    {
+        // The generated sizing and copying code disagree if this fails
+        if(pad(s) > static_cast<size_t>(end - next))
+            abort();
+        void *p = next;
+        next += pad(s);
+        return p;
+    }
+
+    // Pointers in a copy in this process are good as they are
+    void addOffsetToPointer(void *) {}
+};
+
+// Allocator and deallocator policy with a malloc per piece, keeping
+// track of what is live, so a test can tell FreeXrStructChain() freed
+// exactly what CopyXrStructChain() allocated
+struct XrStructChainCountingHeap
+{
+    std::set<const void*> live;
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    uint64_t unknownDeallocations = 0;  // Not from allocate(), or freed twice
+
+    ~XrStructChainCountingHeap()
+    {
+        for(const void* p: live) {
+            free(const_cast<void*>(p));
+        }
+    }
+
+    void *allocate(size_t s)
+    {
+        // Never zero bytes, so every allocation is a distinct pointer
+        void *p = malloc((s > 0) ? s : 1);
+        if(!p) {
+            throw std::bad_alloc();
+        }
+        live.insert(p);
+        allocations++;
+        return p;
+    }
+
+    void addOffsetToPointer(void *) {}
+
+    void deallocate(const void *p)
+    {
+        if(live.erase(p) == 0) {
+            unknownDeallocations++;
+            return;
+        }
+        deallocations++;
+        free(const_cast<void*>(p));
+    }
+
+    bool balanced() const
+    {
+        return live.empty() && (unknownDeallocations == 0);
+    }
+};
+
+// Per-thread memory for the short-lived deep copies passed downchain
+// with actual handles restored.  Allocations bump through the current
+// chunk, and the chunk starts over whenever nothing allocated from it is
+// still alive, which is at least once per frame since these copies last
+// only as long as the call that made them.  So once the chunk has grown
+// to fit a frame, these copies don't touch the general heap.
+// Allocations may be freed on any thread; a chunk that still has live
+// allocations when it has to grow is left to the last of them to free.
+// Chunks double up to maxChunkSize and no further, so a thread that
+// keeps copies alive doesn't grow its arena without bound; an
+// allocation too big for that gets a chunk of its own.
+struct ScratchArena
+{
+    struct Chunk
+    {
+        std::unique_ptr<unsigned char[]> memory;
+        size_t size;
+        size_t used = 0;
+        std::atomic<uint32_t> references{1};    // One for the arena plus one per live allocation
+
+        Chunk(size_t size_) :
+            memory(new(std::nothrow) unsigned char[size_]),
+            size(size_)
+        {}
+    };
+
+    Chunk* current = nullptr;
+
+    constexpr static size_t alignment = alignof(std::max_align_t);
+    constexpr static size_t initialChunkSize = 64 * 1024;
+    constexpr static size_t maxChunkSize = 4 * 1024 * 1024;
+    constexpr static uint64_t warmupFrames = 100;
+
+    ~ScratchArena()
+    {
+        if(current) {
+            Release(current);
+        }
+    }
+
+    static size_t RoundUp(size_t s)
     {
-        if(pointerFixupCount >= maxPointerFixupCount)
+        return (s + alignment - 1) / alignment * alignment;
+    }
+
+    // nullptr if the heap is out of memory
+    void* Allocate(size_t size);
+    static void Free(const void* p);
+    static void Release(Chunk* chunk);
+    static Chunk* NewChunk(size_t size);
+    static ScratchArena& ForThisThread();
+};
+
+// Standard allocator over ScratchArena, for shared_ptr control blocks
+template <class T>
+struct ScratchAllocator
+{
+    typedef T value_type;
+
+    ScratchAllocator() = default;
+    template <class U> ScratchAllocator(const ScratchAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        T* p = static_cast<T*>(ScratchArena::ForThisThread().Allocate(n * sizeof(T)));
+        if(!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        ScratchArena::Free(p);
+    }
+
+    template <class U> bool operator==(const ScratchAllocator<U>&) const { return true; }
+    template <class U> bool operator!=(const ScratchAllocator<U>&) const { return false; }
+};
+
+// Frees a ScratchArena allocation, for std::unique_ptr
+struct ScratchArenaDeleter
+{
+    void operator()(const void* p) const
+    {
+        ScratchArena::Free(p);
+    }
+};
+
+// If set, an allocation that a ScratchArena has to satisfy from the heap
+// after ScratchArena::warmupFrames frames is fatal, to catch heap
+// allocations creeping into steady-state frames; from
+// OVERLAYS_API_LAYER_SCRATCH_ARENA_STRICT
+extern bool gScratchArenaStrict;
+extern std::atomic<uint64_t> gEndFrameCount;
+
+// Epoch-based reclamation for tables that are read on every call and
+// changed rarely.  Readers take no lock; they note the epoch they entered
+// in while inside an EpochReadGuard.  A writer publishes a replacement
+// table and retires the old one, which is deleted once every reader that
+// might still be looking at it has left its guard.
+struct Epochs
+{
+    constexpr static uint32_t maxReaders = 256;
+
+    struct alignas(64) Reader
+    {
+        std::atomic<uint64_t> epoch{0};     // 0 when not inside a guard
+        std::atomic<bool> claimed{false};
+    };
+
+    struct ThisThread
+    {
+        Reader* reader = nullptr;          // nullptr if all maxReaders were claimed
+        uint32_t depth = 0;
+
+        ThisThread();
+        ~ThisThread();
+    };
+
+    static std::atomic<uint64_t> current;
+    static Reader readers[maxReaders];
+
+    // Number of threads that couldn't claim a Reader and are inside a
+    // guard.  Nothing is deleted while it's nonzero, since their epochs
+    // aren't known.
+    static std::atomic<uint32_t> readersWithoutSlot;
+
+    static std::mutex retiredMutex;
+    static std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+
+    static ThisThread& ForThisThread();
+
+    // Call with the old table no longer published; "deleter" runs once
+    // no reader can be using it, possibly right away
+    static void Retire(std::function<void()> deleter);
+
+    // Run the deleters of anything no reader can still be using.  Retire()
+    // does this too, but guards may be held across calls into the runtime,
+    // so call this now and then from outside any guard.
+    static void Reclaim();
+};
+
+struct EpochReadGuard
+{
+    EpochReadGuard()
+    {
+        auto& thisThread = Epochs::ForThisThread();
+        if(thisThread.depth++ == 0) {
+            if(thisThread.reader) {
+                thisThread.reader->epoch.store(Epochs::current.load());
+            } else {
+                Epochs::readersWithoutSlot.fetch_add(1);
+            }
+        }
+    }
+
+    ~EpochReadGuard()
+    {
+        auto& thisThread = Epochs::ForThisThread();
+        if(--thisThread.depth == 0) {
+            if(thisThread.reader) {
+                thisThread.reader->epoch.store(0);
+            } else {
+                Epochs::readersWithoutSlot.fetch_sub(1);
+            }
+        }
+    }
+
+    EpochReadGuard(const EpochReadGuard&) = delete;
+    EpochReadGuard& operator=(const EpochReadGuard&) = delete;
+};
+
+// Hash table for handles the runtime makes, which are looked up on every
+// call but change only when handles are created or destroyed.  Lookups
+// take no lock; they probe an array of slots holding atomic keys and
+// values.  A writer fills in a slot's value before its key, and erasing
+// leaves the key with no value so a later probe doesn't stop short.  When
+// keys fill half the slots the array is replaced by a rehashed copy.
+// Replaced arrays and erased values are freed through Epochs::Retire.
+template <typename Key, typename Value>
+class EpochHashMap
+{
+public:
+    ~EpochHashMap()
+    {
+        const Table* table = published.load();
+        for(size_t i = 0; i < table->capacity; i++) {
+            delete table->slots[i].value.load();
+        }
+        delete table;
+    }
+
+    bool Find(Key key, Value& value) const
+    {
+        EpochReadGuard guard;
+        const Value* found = Borrow(key);
+        if(!found) {
             return false;
+        }
+        value = *found;
+        return true;
+    }
 
-        unsigned char* base = reinterpret_cast<unsigned char *>(vbase);
-        unsigned char* p = reinterpret_cast<unsigned char *>(vp);
-        pointerOffsets[pointerFixupCount++] = p - base;
+    // Only call inside an EpochReadGuard; the value stays valid until
+    // the guard ends even if the key is erased.  nullptr if not found.
+    const Value* Borrow(Key key) const
+    {
+        const Slot* slot = published.load()->Probe(key);
+        return (slot->key.load() == key) ? slot->value.load() : nullptr;
+    }
+
+    // Like std::unordered_map::insert, a key already present keeps its value
+    void Insert(Key key, Value value)
+    {
+        const Table* replaced = nullptr;
+        {
+            std::unique_lock<std::recursive_mutex> lock(writerMutex);
+            Table* table = published.load();
+            if((table->used + 1) * 2 > table->capacity) {
+                replaced = table;
+                table = Rehash(table);
+            }
+            Slot* slot = table->Probe(key);
+            if(slot->key.load() != key) {
+                slot->value.store(new Value(value));
+                slot->key.store(key);
+                table->used++;
+            } else if(!slot->value.load()) {
+                slot->value.store(new Value(value));
+            }
+        }
+        // Same as in Erase(), retiring may run deleters that change this map
+        if(replaced) {
+            Epochs::Retire([replaced]() { delete replaced; });
+        }
+    }
+
+    bool Erase(Key key)
+    {
+        const Value* old;
+        {
+            std::unique_lock<std::recursive_mutex> lock(writerMutex);
+            old = Remove(key);
+        }
+        if(!old) {
+            return false;
+        }
+        // The value may be the last reference to an object whose
+        // destructor changes this map, so this is outside the lock
+        Epochs::Retire([old]() { delete old; });
         return true;
     }
 
-    void makePointersRelative(void* vbase)
+    // Retires the values once however many keys there are; returns how
+    // many of them were in the map
+    size_t Erase(const std::vector<Key>& keys)
     {
-        unsigned char* base = reinterpret_cast<unsigned char *>(vbase);
-        for(int i = 0; i < pointerFixupCount; i++) {
-            unsigned char* pointerToByte = base + pointerOffsets[i];
-            unsigned char** pointerToPointer = reinterpret_cast<unsigned char **>(pointerToByte);
-            unsigned char*& pointer = *pointerToPointer;
-            if(pointer) { // nullptr remains nulltpr
-                pointer = pointer - (base - reinterpret_cast<unsigned char *>(0));
+        std::vector<const Value*> old;
+        {
+            std::unique_lock<std::recursive_mutex> lock(writerMutex);
+            for(const auto& key: keys) {
+                if(const Value* value = Remove(key)) {
+                    old.push_back(value);
+                }
             }
         }
+        if(!old.empty()) {
+            Epochs::Retire([old]() {
+                for(auto value: old) {
+                    delete value;
+                }
+            });
+        }
+        return old.size();
     }
 
-    void makePointersAbsolute(void* vbase)
+private:
+    static constexpr size_t minCapacity = 64;
+
+    struct Slot
     {
-        unsigned char* base = reinterpret_cast<unsigned char *>(vbase);
-        for(int i = 0; i < pointerFixupCount; i++) {
-            unsigned char* pointerToByte = base + pointerOffsets[i];
-            unsigned char** pointerToPointer = reinterpret_cast<unsigned char **>(pointerToByte);
-            unsigned char*& pointer = *pointerToPointer;
-            if(pointer) { // nullptr remains nulltpr
-                pointer = pointer + (base - reinterpret_cast<unsigned char *>(0));
+        std::atomic<Key> key{Key()};
+        std::atomic<const Value*> value{nullptr};
+    };
+
+    struct Table
+    {
+        size_t capacity;        // A power of two
+        uint32_t shift;         // 64 - log2(capacity)
+        size_t used = 0;        // Slots with a key, erased or not; only touched by writers
+        Slot* slots;
+
+        explicit Table(size_t capacity_) :
+            capacity(capacity_),
+            shift(64),
+            slots(new Slot[capacity_])
+        {
+            for(size_t c = capacity; c > 1; c /= 2) {
+                shift--;
+            }
+        }
+
+        ~Table()
+        {
+            delete[] slots;
+        }
+
+        // The slot holding "key" or else the empty slot that ends its
+        // probe.  There is always an empty slot since at most half are used.
+        Slot* Probe(Key key) const
+        {
+            size_t i = size_t((uint64_t(key) * 0x9E3779B97F4A7C15ull) >> shift);
+            while(true) {
+                Key found = slots[i].key.load();
+                if((found == key) || (found == Key())) {
+                    return &slots[i];
+                }
+                i = (i + 1) & (capacity - 1);
+            }
+        }
+    };
+
+    // Call with writerMutex held
+    const Value* Remove(Key key)
+    {
+        Slot* slot = published.load()->Probe(key);
+        if(slot->key.load() != key) {
+            return nullptr;
+        }
+        return slot->value.exchange(nullptr);
+    }
+
+    // Publish a copy of "table" without its erased keys, sized so live
+    // keys fill at most a quarter of it.  The caller retires "table"
+    // after releasing writerMutex.
+    Table* Rehash(Table* table)
+    {
+        size_t live = 0;
+        for(size_t i = 0; i < table->capacity; i++) {
+            live += table->slots[i].value.load() ? 1 : 0;
+        }
+        size_t capacity = minCapacity;
+        while(capacity < (live + 1) * 4) {
+            capacity *= 2;
+        }
+
+        Table* replacement = new Table(capacity);
+        for(size_t i = 0; i < table->capacity; i++) {
+            const Value* value = table->slots[i].value.load();
+            if(value) {
+                Key key = table->slots[i].key.load();
+                Slot* slot = replacement->Probe(key);
+                slot->value.store(value);
+                slot->key.store(key);
+                replacement->used++;
             }
         }
+
+        // The values now belong to the replacement; deleting "table" only
+        // deletes its slots
+        published.store(replacement);
+        return replacement;
     }
+
+    std::recursive_mutex writerMutex;
+    std::atomic<Table*> published{new Table(minCapacity)};
 };
 
-static const int memberAlignment = 8;
+// Table for handles this layer makes up itself.  The low 32 bits of a
+// handle are a slot index and the high 32 bits are the slot's
+// generation, which changes every time the slot is emptied, so a lookup
+// is an array index and a compare, and a stale handle never finds the
+// slot's next occupant.  Like EpochHashMap, lookups take no lock and
+// removed values are freed through Epochs::Retire.
+template <typename Handle, typename Value>
+class LocalHandleTable
+{
+public:
+    ~LocalHandleTable()
+    {
+        for(auto& chunk: chunks) {
+            Slot* slots = chunk.load();
+            if(slots) {
+                for(uint32_t i = 0; i < slotsPerChunk; i++) {
+                    delete slots[i].entry.load();
+                }
+                delete[] slots;
+            }
+        }
+    }
 
-static size_t pad(size_t s)
+    // Reserve a slot and return the handle naming it, or XR_NULL_HANDLE
+    // if every slot is taken.  The handle doesn't find anything until
+    // Insert() is called with it.
+    Handle NewHandle()
+    {
+        std::unique_lock<std::recursive_mutex> lock(writerMutex);
+        uint32_t index;
+        if(!freeIndices.empty()) {
+            index = freeIndices.back();
+            freeIndices.pop_back();
+        } else {
+            if(slotCount.load() == slotsPerChunk * maxChunks) {
+                return XR_NULL_HANDLE;
+            }
+            index = slotCount.load();
+            if(!chunks[index / slotsPerChunk].load()) {
+                chunks[index / slotsPerChunk].store(new Slot[slotsPerChunk]);
+            }
+            slotCount.store(index + 1);
+        }
+        return MakeHandle(index, SlotAt(index)->generation.load());
+    }
+
+    void Insert(Handle handle, Value value)
+    {
+        std::unique_lock<std::recursive_mutex> lock(writerMutex);
+        Slot* slot = SlotFor(handle);
+        if(slot && !slot->entry.load()) {
+            slot->entry.store(new Value(value));
+        }
+    }
+
+    bool Find(Handle handle, Value& value) const
+    {
+        EpochReadGuard guard;
+        const Value* entry = Borrow(handle);
+        if(!entry) {
+            return false;
+        }
+        value = *entry;
+        return true;
+    }
+
+    // Same as EpochHashMap::Borrow()
+    const Value* Borrow(Handle handle) const
+    {
+        const Slot* slot = SlotFor(handle);
+        if(!slot) {
+            return nullptr;
+        }
+        const Value* entry = slot->entry.load();
+        // Erase() empties the slot before changing the generation, so if
+        // the generation still matches, "entry" belongs to this handle
+        if(!entry || (slot->generation.load() != GenerationOf(handle))) {
+            return nullptr;
+        }
+        return entry;
+    }
+
+    bool Erase(Handle handle)
+    {
+        const Value* old;
+        {
+            std::unique_lock<std::recursive_mutex> lock(writerMutex);
+            old = Remove(handle);
+        }
+        if(!old) {
+            return false;
+        }
+        // Same as EpochHashMap::Erase(), the value may be the last
+        // reference to something that removes other handles
+        Epochs::Retire([old]() { delete old; });
+        return true;
+    }
+
+    // Same as EpochHashMap::Erase(const std::vector<Key>&)
+    size_t Erase(const std::vector<Handle>& handles)
+    {
+        std::vector<const Value*> old;
+        {
+            std::unique_lock<std::recursive_mutex> lock(writerMutex);
+            for(auto handle: handles) {
+                if(const Value* value = Remove(handle)) {
+                    old.push_back(value);
+                }
+            }
+        }
+        if(!old.empty()) {
+            Epochs::Retire([old]() {
+                for(auto value: old) {
+                    delete value;
+                }
+            });
+        }
+        return old.size();
+    }
+
+    // Call f(handle, value) for every occupied slot
+    template <class Function>
+    void ForEach(Function f) const
+    {
+        EpochReadGuard guard;
+        uint32_t count = slotCount.load();
+        for(uint32_t index = 0; index < count; index++) {
+            const Slot* slot = SlotAt(index);
+            uint32_t generation = slot->generation.load();
+            const Value* entry = slot->entry.load();
+            if(entry && (slot->generation.load() == generation)) {
+                f(MakeHandle(index, generation), *entry);
+            }
+        }
+    }
+
+private:
+    // Call with writerMutex held
+    const Value* Remove(Handle handle)
+    {
+        Slot* slot = SlotFor(handle);
+        if(!slot || !slot->entry.load()) {
+            return nullptr;
+        }
+        const Value* old = slot->entry.exchange(nullptr);
+        uint32_t generation = slot->generation.load() + 1;
+        slot->generation.store((generation == 0) ? 1 : generation);
+        freeIndices.push_back(IndexOf(handle));
+        return old;
+    }
+
+    static constexpr uint32_t slotsPerChunk = 1024;
+    static constexpr uint32_t maxChunks = 4096;
+
+    struct Slot
+    {
+        std::atomic<uint32_t> generation{1};
+        std::atomic<const Value*> entry{nullptr};
+    };
+
+    static Handle MakeHandle(uint32_t index, uint32_t generation)
+    {
+        return (Handle)((uint64_t(generation) << 32) | index);
+    }
+    static uint32_t IndexOf(Handle handle) { return uint32_t((uint64_t)handle); }
+    static uint32_t GenerationOf(Handle handle) { return uint32_t((uint64_t)handle >> 32); }
+
+    Slot* SlotAt(uint32_t index) const
+    {
+        return chunks[index / slotsPerChunk].load() + index % slotsPerChunk;
+    }
+
+    // nullptr if the handle's index was never handed out or its
+    // generation doesn't match
+    Slot* SlotFor(Handle handle) const
+    {
+        uint32_t index = IndexOf(handle);
+        if(index >= slotCount.load()) {
+            return nullptr;
+        }
+        Slot* slot = SlotAt(index);
+        return (slot->generation.load() == GenerationOf(handle)) ? slot : nullptr;
+    }
+
+    std::recursive_mutex writerMutex;
+    std::vector<uint32_t> freeIndices;
+    std::atomic<uint32_t> slotCount{0};
+    // Chunks are allocated as the table grows and never move, so readers
+    // can index them without a lock
+    std::atomic<Slot*> chunks[maxChunks] = {};
+};
+
+// Child handle infos of a handle, e.g. the XrSpaces of an XrSession.
+// Each child info's indexInParent says where it is in its parent's
+// list, so erase() moves the last child into the hole instead of
+// searching.  Order isn't preserved.  insert() and erase() have the
+// same meaning as for the std::sets this replaced.
+template <class Info>
+class ChildList
 {
-    return (s + memberAlignment - 1) / memberAlignment * memberAlignment;
-}
+public:
+    typedef typename std::vector<std::shared_ptr<Info>>::const_iterator const_iterator;
+
+    void insert(const std::shared_ptr<Info>& child)
+    {
+        if(child->indexInParent != SIZE_MAX) {
+            return;
+        }
+        child->indexInParent = children.size();
+        children.push_back(child);
+    }
+
+    void erase(const std::shared_ptr<Info>& child)
+    {
+        size_t index = child->indexInParent;
+        if((index >= children.size()) || (children[index] != child)) {
+            return;
+        }
+        if(index != children.size() - 1) {
+            children[index] = std::move(children.back());
+            children[index]->indexInParent = index;
+        }
+        children.pop_back();
+        child->indexInParent = SIZE_MAX;
+    }
+
+    void clear()
+    {
+        for(auto& child: children) {
+            child->indexInParent = SIZE_MAX;
+        }
+        children.clear();
+    }
+
+    size_t size() const { return children.size(); }
+    bool empty() const { return children.empty(); }
+    const_iterator begin() const { return children.begin(); }
+    const_iterator end() const { return children.end(); }
+
+private:
+    std::vector<std::shared_ptr<Info>> children;
+};
+
+// Seconds between logging lock profiles, or 0 not to profile locks at
+// all; from OVERLAYS_API_LAYER_LOCK_PROFILE_SECONDS
+extern uint32_t gLockProfileSeconds;
+
+struct LockProfile;
+
+// Recursive mutex for the layer's long-lived locks.  While
+// gLockProfileSeconds is set it counts acquisitions, times waits and
+// holds, and remembers which call site waited on which holder.
+// Mutexes created with the same name (e.g. every XrSession's procMutex)
+// share one profile.
+class ProfiledMutex
+{
+public:
+    explicit ProfiledMutex(const char* name);
+
+    void lock();
+    void unlock();
+
+    ProfiledMutex(const ProfiledMutex&) = delete;
+    ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+private:
+    std::recursive_mutex mutex;
+    LockProfile* profile;
+
+    // Written only by the thread holding "mutex"; "holderSite" is also
+    // read by threads about to wait
+    uint32_t depth = 0;
+    uint64_t acquiredNanoseconds = 0;
+    std::atomic<const void*> holderSite{nullptr};
+};
+
+void LogLockProfiles(XrInstance instance);
+void LogLockProfilesIfDue(XrInstance instance);
 
 // Convenience object representing the shared memory buffer after the
 // header, allowing apps to allocate bytes and then fill them or to read
-// bytes and step over them
+// bytes and step over them.
+//
+// Bytes may also be reserved at the end of the buffer (for the pointer
+// fixup table).  If an allocation doesn't fit, it comes from process
+// memory instead so serialization can run to the end, and the shortfall
+// is counted; the caller checks overflowed() and serializes again into
+// a buffer of at least bytesNeeded().
 struct IPCBuffer
 {
     unsigned char *base;
     size_t size;
     unsigned char *current;
+    size_t reserved = 0;        // Bytes taken from the end
+    size_t overflowBytes = 0;   // Bytes that didn't fit
+    bool overflowAllocationFailed = false;  // Process memory for bytes that didn't fit ran out
+    std::shared_ptr<std::vector<std::unique_ptr<unsigned char[]>>> overflowBlocks;
 
     static const int memberAlignment = 8;
 
@@ -175,84 +924,294 @@ struct IPCBuffer
         current = base;
     }
 
+    bool fits(size_t s) const
+    {
+        return (current - base + reserved + s) <= size;
+    }
+
+    bool overflowed() const
+    {
+        return overflowBytes > 0;
+    }
+
+    size_t bytesNeeded() const
+    {
+        return (current - base) + reserved + overflowBytes;
+    }
+
     void advance(size_t s)
     {
         current += pad(s);
     }
 
-    bool write(const void* p, size_t s)
-    {
-        if((current - base + s) > size)
-            return false;
-        memcpy(current, p, s);
-        advance(s);
+    bool write(const void* p, size_t s)
+    {
+        if(!fits(s))
+            return false;
+        memcpy(current, p, s);
+        advance(s);
+        return true;
+    }
+
+    void read(void *p, size_t s)
+    {
+        if(!fits(s))
+            abort();
+        memcpy(p, current, s);
+        advance(s);
+    }
+
+    template <typename T>
+    bool write(const T* p)
+    {
+        if(!fits(sizeof(T)))
+            return false;
+        memcpy(current, p, sizeof(T));
+        advance(sizeof(T));
+        return true;
+    }
+    
+    template <typename T>
+    bool read(T* p)
+    {
+        if(!fits(sizeof(T)))
+            return false;
+        memcpy(p, current, sizeof(T));
+        advance(sizeof(T));
+        return true;
+    }
+
+    template <typename T>
+    T* getAndAdvance()
+    {
+        if(!fits(sizeof(T)))
+            return nullptr;
+        T *p = reinterpret_cast<T*>(current);
+        advance(sizeof(T));
+        return p;
+    }
+
+    // Take "s" bytes from the end of the buffer and return the new end
+    // offset, or count them as overflow and return 0
+    size_t reserve(size_t s)
+    {
+        if(!fits(s)) {
+            overflowBytes += pad(s);
+            return 0;
+        }
+        reserved += pad(s);
+        return size - reserved;
+    }
+
+    void *allocate (std::size_t s)
+    {
+        if(!fits(s))
+            return allocateOverflow(s);
+        void *p = current;
+        advance(s);
+        return p;
+    }
+    void deallocate (void *) {}
+
+    // Scratch memory that lives as long as any copy of this buffer.
+    // Returns nullptr and sets overflowAllocationFailed if there's no
+    // memory; the bytes aren't counted then, since serialization
+    // can't finish and the caller returns XR_ERROR_OUT_OF_MEMORY.
+    void *allocateOverflow(std::size_t s)
+    {
+        std::unique_ptr<unsigned char[]> block(new (std::nothrow) unsigned char[pad(s)]);
+        if(!block) {
+            overflowAllocationFailed = true;
+            return nullptr;
+        }
+        if(!overflowBlocks) {
+            overflowBlocks = std::make_shared<std::vector<std::unique_ptr<unsigned char[]>>>();
+        }
+        overflowBytes += pad(s);
+        overflowBlocks->push_back(std::move(block));
+        return overflowBlocks->back().get();
+    }
+};
+
+// New and delete for the buffer above; noexcept because allocate()
+// returns nullptr if even the overflow scratch memory can't be had, and
+// callers check for that
+inline void* operator new (std::size_t size, IPCBuffer& buffer) noexcept
+{
+    return buffer.allocate(size);
+}
+
+inline void* operator new[] (std::size_t size, IPCBuffer& buffer) noexcept
+{
+    return buffer.allocate(size);
+}
+
+inline void operator delete(void* p, IPCBuffer& buffer)
+{
+    buffer.deallocate(p);
+}
+
+inline void operator delete[](void* p, IPCBuffer& buffer)
+{
+    buffer.deallocate(p);
+}
+
+// Header laid into the start of each RPC slot tracking the RPC type, the
+// result, and all pointers inside the slot which have to be fixed up
+// passing from Overlay to Main and then back.
+//
+// If both processes mapped the shared memory at the same address, the
+// pointers are good as they are in both and nothing is recorded.
+// Otherwise the offsets of the pointers are kept in a table growing
+// down from the end of the slot, so the count is limited only by the
+// slot size.  (Self-relative offsets resolved on access would also do
+// away with fixups, but Main passes these structs straight to the
+// runtime, which needs real pointers.)
+struct IPCHeader
+{
+    uint64_t requestType;
+    uint64_t sequence;
+    XrResult result;
+
+    bool pointersAreShared;
+    uint32_t pointerFixupCount;
+    uint64_t fixupTableEnd;     // Offset from the start of the slot or overflow segment
+
+    // If nonzero, the arguments are in generation "overflowGeneration" of
+    // the slot's overflow segment rather than after this header
+    uint64_t overflowGeneration;
+    uint64_t overflowSize;
+
+    // IPCGetTimestampNanoseconds() when Overlay published the request
+    // and when Main started and finished serving it
+    uint64_t postedNanoseconds;
+    uint64_t serveStartNanoseconds;
+    uint64_t serveEndNanoseconds;
+
+    IPCHeader(uint64_t requestType, uint64_t sequence, bool pointersAreShared, uint64_t fixupTableEnd) :
+        requestType(requestType),
+        sequence(sequence),
+        pointersAreShared(pointersAreShared),
+        pointerFixupCount(0),
+        fixupTableEnd(fixupTableEnd),
+        overflowGeneration(0),
+        overflowSize(0),
+        postedNanoseconds(0),
+        serveStartNanoseconds(0),
+        serveEndNanoseconds(0)
+    {}
+
+    // Main calls this before following anything Overlay wrote in
+    // "ipcbuf", whose unread part holds the arguments: the fixup table
+    // has to lie between the arguments' start and the end of the buffer,
+    // and every pointer it names has to lie before the table
+    bool fixupTableIsInside(const IPCBuffer& ipcbuf)
+    {
+        if(pointersAreShared) {
+            return true;
+        }
+
+        uint64_t dataStart = ipcbuf.current - ipcbuf.base;
+        if((fixupTableEnd > ipcbuf.size) || (fixupTableEnd < dataStart) || (fixupTableEnd % sizeof(uint64_t) != 0)) {
+            return false;
+        }
+
+        if(pointerFixupCount > (fixupTableEnd - dataStart) / sizeof(uint64_t)) {
+            return false;
+        }
+
+        uint64_t tableStart = fixupTableEnd - pointerFixupCount * sizeof(uint64_t);
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(ipcbuf.base + tableStart);
+        for(uint32_t i = 0; i < pointerFixupCount; i++) {
+            uint64_t offset = offsets[i];
+            if((offset < dataStart) || (offset > tableStart) || (tableStart - offset < sizeof(void*))) {
+                return false;
+            }
+        }
+
         return true;
     }
 
-    void read(void *p, size_t s)
+    uint64_t* pointerOffsets(void* vbase)
     {
-        if((current - base + s) > size)
-            abort();
-        memcpy(p, current, s);
-        advance(s);
+        return reinterpret_cast<uint64_t*>(reinterpret_cast<unsigned char *>(vbase) + fixupTableEnd) - pointerFixupCount;
     }
 
-    template <typename T>
-    bool write(const T* p)
-    {
-        if((current - base + s) > size)
-            return false;
-        memcpy(current, p, s);
-        advance(sizeof(T));
-        return true;
-    }
-    
-    template <typename T>
-    bool read(T* p)
+    // Takes the table entry from the end of "ipcbuf"
+    bool addOffsetToPointer(IPCBuffer& ipcbuf, void* vp)
     {
-        if((current - base + s) > size)
+        if(pointersAreShared)
+            return true;
+
+        if(ipcbuf.reserve(sizeof(uint64_t)) == 0)
             return false;
-        memcpy(p, current, s);
-        advance(sizeof(T));
+
+        pointerFixupCount++;
+
+        unsigned char* p = reinterpret_cast<unsigned char *>(vp);
+        pointerOffsets(ipcbuf.base)[0] = p - ipcbuf.base;
         return true;
     }
 
-    template <typename T>
-    T* getAndAdvance()
+    void makePointersRelative(void* vbase)
     {
-        if(current - base + sizeof(T) > size)
-            return nullptr;
-        T *p = reinterpret_cast<T*>(current);
-        advance(sizeof(T));
-        return p;
+        if(pointersAreShared)
+            return;
+
+        unsigned char* base = reinterpret_cast<unsigned char *>(vbase);
+        uint64_t* offsets = pointerOffsets(vbase);
+        for(uint32_t i = 0; i < pointerFixupCount; i++) {
+            unsigned char* pointerToByte = base + offsets[i];
+            unsigned char** pointerToPointer = reinterpret_cast<unsigned char **>(pointerToByte);
+            unsigned char*& pointer = *pointerToPointer;
+            if(pointer) { // nullptr remains nulltpr
+                pointer = pointer - (base - reinterpret_cast<unsigned char *>(0));
+            }
+        }
     }
 
-    void *allocate (std::size_t s)
+    void makePointersAbsolute(void* vbase)
     {
-        if((current - base + s) > size)
-            return nullptr;
-        void *p = current;
-        advance(s);
-        return p;
+        if(pointersAreShared)
+            return;
+
+        unsigned char* base = reinterpret_cast<unsigned char *>(vbase);
+        uint64_t* offsets = pointerOffsets(vbase);
+        for(uint32_t i = 0; i < pointerFixupCount; i++) {
+            unsigned char* pointerToByte = base + offsets[i];
+            unsigned char** pointerToPointer = reinterpret_cast<unsigned char **>(pointerToByte);
+            unsigned char*& pointer = *pointerToPointer;
+            if(pointer) { // nullptr remains nulltpr
+                pointer = pointer + (base - reinterpret_cast<unsigned char *>(0));
+            }
+        }
     }
-    void deallocate (void *) {}
 };
 
-// New and delete for the buffer above
-inline void* operator new (std::size_t size, IPCBuffer& buffer)
+// Allocator policy for copying XR structs into an RPC request; pieces
+// come from a block taken from "ipcbuf" and every pointer is recorded
+// for fixing up
+struct IPCStructChainAllocator
 {
-    return buffer.allocate(size);
-}
+    XrStructChainBlock block;
+    IPCBuffer& ipcbuf;
+    IPCHeader* header;
 
-inline void operator delete(void* p, IPCBuffer& buffer)
-{
-    buffer.deallocate(p);
-}
+    void *allocate(size_t s)
+    {
+        return block.allocate(s);
+    }
+
+    void addOffsetToPointer(void *pointerToPointer)
+    {
+        header->addOffsetToPointer(ipcbuf, pointerToPointer);
+    }
+};
 
 struct NegotiationParams
 {
-    DWORD mainProcessId;
-    DWORD overlayProcessId;
+    IPCProcessId mainProcessId;
+    IPCProcessId overlayProcessId;
     uint32_t mainLayerBinaryVersion;
     uint32_t overlayLayerBinaryVersion;
     enum {SUCCESS, DIFFERENT_BINARY_VERSION} status;
@@ -262,55 +1221,153 @@ struct NegotiationChannels
 {
     XrInstance instance;
 
-    HANDLE mutexHandle;
+    IPCMutex mutex;
 
-    HANDLE shmemHandle;
+    IPCSharedMemory shmem;
     NegotiationParams* params;
 
-    HANDLE overlayWaitSema;
-    HANDLE mainWaitSema;
+    IPCSemaphore overlayWaitSema;
+    IPCSemaphore mainWaitSema;
 
     std::thread mainThread;
 
-    HANDLE mainNegotiateThreadStop;
+    IPCStopEvent mainNegotiateThreadStop;
 
-    constexpr static char *shmemName = "LUNARG_XR_EXTX_overlay_negotiation_shmem";
-    constexpr static char *overlayWaitSemaName = "LUNARG_XR_EXTX_overlay_negotiation_overlay_wait_sema";
-    constexpr static char *mainWaitSemaName = "LUNARG_XR_EXTX_overlay_negotiation_main_wait_sema";
-    constexpr static char *mutexName = "LUNARG_XR_EXTX_overlay_negotiation_mutex";
+    constexpr static const char *shmemName = "LUNARG_XR_EXTX_overlay_negotiation_shmem";
+    constexpr static const char *overlayWaitSemaName = "LUNARG_XR_EXTX_overlay_negotiation_overlay_wait_sema";
+    constexpr static const char *mainWaitSemaName = "LUNARG_XR_EXTX_overlay_negotiation_main_wait_sema";
+    constexpr static const char *mutexName = "LUNARG_XR_EXTX_overlay_negotiation_mutex";
     constexpr static uint32_t shmemSize = sizeof(NegotiationParams);
-    constexpr static DWORD mutexWaitMillis = 500;
-    constexpr static DWORD negotiationWaitMillis = 2000;
-    constexpr static int NegotiationChannels::maxAttempts = 30;
+    constexpr static uint32_t mutexWaitMillis = 500;
+    constexpr static uint32_t negotiationWaitMillis = 2000;
+    constexpr static int maxAttempts = 30;
 
 };
 
+// How long RPC waits spin on the shared sequence numbers before blocking
+// in the kernel, and whether to yield the CPU while spinning rather than
+// only pausing; from OVERLAYS_API_LAYER_RPC_SPIN_MICROSECONDS and
+// OVERLAYS_API_LAYER_RPC_SPIN_YIELD
+extern uint32_t gRPCSpinMicroseconds;
+extern bool gRPCSpinYield;
+
+// Seconds between logging the RPC latency histograms, or 0 to log them
+// only when a session ends; from OVERLAYS_API_LAYER_RPC_HISTOGRAM_SECONDS
+extern uint32_t gRPCHistogramSeconds;
+
+// Where the time in an RPC goes.  Overlay records every phase, taking
+// Service from timestamps Main leaves in the header; Main records Service.
+enum RPCLatencyPhase {
+    RPC_PHASE_SERIALIZE,    // Overlay writing the request into the slot
+    RPC_PHASE_WAKE,         // Request waiting for Main plus response waiting for Overlay
+    RPC_PHASE_SERVICE,      // Main unpacking and running the request
+    RPC_PHASE_COPY_OUT,     // Overlay reading the response out of the slot
+    RPC_PHASE_COUNT,
+};
+
+void RPCRecordLatency(uint64_t requestType, RPCLatencyPhase phase, uint64_t nanoseconds);
+void RPCLogLatencyHistograms(XrInstance instance, const char* processName);
+void RPCLogLatencyHistogramsIfDue(XrInstance instance, const char* processName);
+
+// Generated; e.g. "LocateSpace" for RPC_XR_LOCATE_SPACE
+const char* RPCRequestTypeName(uint64_t requestType);
+
 extern bool gHaveMainSessionActive;
 extern XrInstance gMainSessionInstance;
-extern HANDLE gMainMutexHandle; // Held by Main for duration of operation as Main Session
+extern IPCMutex gMainMutex; // Held by Main for duration of operation as Main Session
+
+// Start of the RPC shared memory.  The rest of the shared memory is
+// RPCChannels::slotCount request slots.  Overlay writes requests into
+// slots in sequence order and Main serves them in that same order, so
+// Overlay may have several independent requests in flight at once.
+// Sequence numbers start at 1 and sequence N lives in slot
+// (N - 1) % slotCount.  Overlay is the only writer of requestSequence
+// and Main is the only writer of responseSequence.
+//
+// A thread counts itself in its process's "Waiting" count before
+// blocking on its semaphore and then checks the sequence number once
+// more; the other process stores the sequence number and then posts the
+// semaphore only if the count isn't zero.  Both sides use sequentially consistent operations, so at least
+// one of them sees the other's write and no wakeup is lost.
+struct RPCRingHeader
+{
+    std::atomic<uint64_t> requestSequence;      // Last request published by Overlay
+    std::atomic<uint64_t> responseSequence;     // Last request served by Main
+    std::atomic<uint32_t> overlayWaiting;       // Overlay threads blocked (or about to block) on mainResponseSema
+    std::atomic<uint32_t> mainWaiting;          // Main threads blocked (or about to block) on overlayRequestSema
+    std::atomic<uint64_t> mainBase;             // Address of the shared memory in Main
+    std::atomic<uint64_t> overlayBase;          // Address of the shared memory in Overlay
+    std::atomic<uint32_t> mainClosed;           // Main has answered its last request; later ones get no response
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "RPC ring sequence numbers must be lock-free to be shared between processes");
 
 struct RPCChannels
 {
     XrInstance instance;
 
-    HANDLE shmemHandle;
-    void* shmem;
+    IPCSharedMemory shmem;
+    RPCRingHeader* ring = nullptr;
+
+    IPCMutex mutex;
+
+    // These are wakeups only; waiters always recheck the sequence
+    // numbers in the ring, so an extra or coalesced post is harmless
+    IPCSemaphore overlayRequestSema;
+    IPCSemaphore mainResponseSema;
+
+    IPCProcess otherProcess;
+
+    IPCProcessId overlayId;
+    uint32_t channelIndex;
 
-    HANDLE mutexHandle;
+    constexpr static uint32_t slotCount = 4;
 
-    HANDLE overlayRequestSema;
-    HANDLE mainResponseSema;
+    // Overlay only; next sequence to publish and which slots hold a
+    // request whose response hasn't been collected
+    uint64_t nextRequestSequence = 1;
+    bool slotInFlight[slotCount] = {};
 
-    DWORD otherProcessId;
-    HANDLE otherProcessHandle;
+    // Overlay only; sequence of the asynchronous request in each slot
+    // whose result hasn't been checked yet (0 for none), and the first
+    // failure from an asynchronous request that hasn't been reported
+    uint64_t asyncSequence[slotCount] = {};
+    XrResult deferredAsyncResult = XR_SUCCESS;
 
-    constexpr static char *shmemNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_shmem_%u";
-    constexpr static char *overlayRequestSemaNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_overlay_request_sema_%u";
-    constexpr static char *mainResponseSemaNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_main_response_sema_%u";
-    constexpr static char *mutexNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_mutex_%u";
-    constexpr static uint32_t shmemSize = 1024 * 1024;
-    constexpr static DWORD mutexWaitMillis = 500;
-    constexpr static DWORD overlayRequestWaitMillis = 500;
+    // Requests too big for their slot go in a shared memory segment
+    // belonging to the slot instead.  Overlay creates it when first
+    // needed and replaces it with a bigger one (the next generation) as
+    // needed, up to maxOverflowSize; Main maps a generation when it
+    // first sees it in a request header.
+    struct OverflowSegment
+    {
+        IPCSharedMemory shmem;
+        uint64_t generation = 0;
+    } overflowSegments[slotCount];
+
+    // Overlay only; size of the largest request serialized so far
+    size_t requestHighWater = 0;
+
+    // Which way each wait in this process was satisfied, for tuning the spin time
+    struct WaitCounters
+    {
+        uint64_t alreadyReady = 0;
+        uint64_t spinning = 0;
+        uint64_t blocking = 0;
+    } waitCounters;
+
+    constexpr static const char *shmemNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_shmem_%u_%u";
+    constexpr static const char *overlayRequestSemaNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_overlay_request_sema_%u_%u";
+    constexpr static const char *mainResponseSemaNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_main_response_sema_%u_%u";
+    constexpr static const char *mutexNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_mutex_%u_%u";
+    constexpr static const char *overflowShmemNameTemplate = "LUNARG_XR_EXTX_overlay_rpc_overflow_shmem_%u_%u_%u_%llu";
+    constexpr static uint32_t channelsPerConnection = 4;
+    constexpr static uint32_t ringHeaderSize = 64;
+    constexpr static uint32_t slotSize = 256 * 1024;
+    constexpr static uint32_t shmemSize = ringHeaderSize + slotCount * slotSize;
+    constexpr static size_t maxOverflowSize = 64 * 1024 * 1024;
+    constexpr static uint32_t mutexWaitMillis = 500;
+    constexpr static uint32_t overlayRequestWaitMillis = 500;
 
     enum WaitResult {
         OVERLAY_REQUEST_READY,
@@ -323,74 +1380,391 @@ struct RPCChannels
         WAIT_ERROR,
     };
 
-    // Get the shared memory wrapped in a convenient structure
-    IPCBuffer GetIPCBuffer()
+    // Point "ring" at the start of the freshly mapped shared memory
+    void AttachRing()
     {
-        return IPCBuffer(shmem, shmemSize);
+        ring = reinterpret_cast<RPCRingHeader*>(shmem.base);
     }
 
-    WaitResult WaitForMainResponseOrFail()
+    // Main and Overlay mapped the shared memory at the same address, so
+    // pointers in requests don't need fixing up
+    bool PointersAreShared()
     {
-        HANDLE handles[2];
+        uint64_t mainBase = ring->mainBase.load();
+        return (mainBase != 0) && (mainBase == ring->overlayBase.load());
+    }
 
-        handles[0] = mainResponseSema;
-        handles[1] = otherProcessHandle;
+    static uint32_t SlotIndex(uint64_t sequence)
+    {
+        return static_cast<uint32_t>((sequence - 1) % slotCount);
+    }
 
-        DWORD result;
+    // Get the shared memory slot for a request wrapped in a convenient structure
+    IPCBuffer GetSlotIPCBuffer(uint64_t sequence)
+    {
+        unsigned char* slotBase = reinterpret_cast<unsigned char*>(shmem.base) + ringHeaderSize + SlotIndex(sequence) * slotSize;
+        return IPCBuffer(slotBase, slotSize);
+    }
 
-        do {
-            result = WaitForMultipleObjects(2, handles, FALSE, overlayRequestWaitMillis);
-        } while(result == WAIT_TIMEOUT);
+    std::string OverflowShmemName(uint32_t slot, uint64_t generation)
+    {
+        return fmt(overflowShmemNameTemplate, overlayId, channelIndex, slot, (unsigned long long)generation);
+    }
 
-        if(result == WAIT_OBJECT_0 + 0) {
-            return WaitResult::MAIN_RESPONSE_READY;
+    // Call from Overlay when a request serialized into "ipcbuf" didn't
+    // fit.  Point "ipcbuf" at the slot's overflow segment, growing it if
+    // needed, and note that in "header".  Return false if the request is
+    // too big or the segment couldn't be created.
+    bool PrepareOverflowIPCBuffer(uint64_t sequence, IPCHeader* header, IPCBuffer& ipcbuf)
+    {
+        size_t needed = ipcbuf.bytesNeeded();
+        if(needed > maxOverflowSize) {
+            return false;
         }
 
-        if(result == WAIT_OBJECT_0 + 1) {
-            return WaitResult::MAIN_PROCESS_TERMINATED_UNEXPECTEDLY;
+        uint32_t slot = SlotIndex(sequence);
+        OverflowSegment& segment = overflowSegments[slot];
+
+        if(segment.shmem.size < needed) {
+            size_t size = slotSize;
+            while(size < needed) {
+                size *= 2;
+            }
+            size = std::min(size, maxOverflowSize);
+
+            // Main is done with the previous generation since the last
+            // request in this slot was served
+            if(segment.generation != 0) {
+                segment.shmem.Close();
+                IPCSharedMemory::Unlink(OverflowShmemName(slot, segment.generation).c_str());
+            }
+
+            segment.generation++;
+            if(!segment.shmem.Open(OverflowShmemName(slot, segment.generation).c_str(), size)) {
+                return false;
+            }
         }
 
-        // XXX log error
-        return WaitResult::WAIT_ERROR;
+        header->pointersAreShared = false;
+        header->pointerFixupCount = 0;
+        header->fixupTableEnd = segment.shmem.size;
+        header->overflowGeneration = segment.generation;
+        header->overflowSize = segment.shmem.size;
+
+        ipcbuf = IPCBuffer(segment.shmem.base, segment.shmem.size);
+        return true;
+    }
+
+    // Get the arguments of the request in "sequence" whose header is
+    // "header", mapping the slot's overflow segment if they're there
+    bool GetRequestIPCBuffer(uint64_t sequence, IPCHeader* header, IPCBuffer& ipcbuf)
+    {
+        ipcbuf = GetSlotIPCBuffer(sequence);
+        ipcbuf.getAndAdvance<IPCHeader>();
+
+        if(header->overflowGeneration == 0) {
+            return true;
+        }
+
+        uint32_t slot = SlotIndex(sequence);
+        OverflowSegment& segment = overflowSegments[slot];
+
+        // Overlay sized the segment; don't map or trust more than it
+        // could have made
+        if((header->overflowSize > maxOverflowSize) || (header->overflowSize < slotSize)) {
+            return false;
+        }
+
+        if(segment.generation != header->overflowGeneration) {
+            if(segment.generation != 0) {
+                segment.shmem.Close();
+                segment.generation = 0;
+            }
+            if(!segment.shmem.Open(OverflowShmemName(slot, header->overflowGeneration).c_str(), header->overflowSize)) {
+                return false;
+            }
+            segment.generation = header->overflowGeneration;
+        } else if(header->overflowSize > segment.shmem.size) {
+            return false;
+        }
+
+        ipcbuf = IPCBuffer(segment.shmem.base, header->overflowSize);
+        return true;
+    }
+
+    // Close any overflow segments and remove their names.  Main only
+    // knows the generations it mapped, so Overlay, which created them,
+    // calls this too when it disconnects.
+    void CloseOverflowSegments()
+    {
+        for(uint32_t slot = 0; slot < slotCount; slot++) {
+            OverflowSegment& segment = overflowSegments[slot];
+            if(segment.generation != 0) {
+                segment.shmem.Close();
+                IPCSharedMemory::Unlink(OverflowShmemName(slot, segment.generation).c_str());
+                segment.generation = 0;
+            }
+        }
+    }
+
+    // Call from Overlay to get the sequence of the next request, or 0 if
+    // every slot is still waiting for its response to be collected.
+    // An asynchronous request still in the next slot is waited for.
+    // Nothing is published until FinishOverlayRequest().
+    uint64_t BeginOverlayRequest()
+    {
+        uint32_t slot = SlotIndex(nextRequestSequence);
+        if(asyncSequence[slot] != 0) {
+            if(CollectAsyncResponses(asyncSequence[slot]) != WaitResult::MAIN_RESPONSE_READY) {
+                return 0;
+            }
+        }
+        if(slotInFlight[slot]) {
+            return 0;
+        }
+        return nextRequestSequence;
+    }
+
+    void FinishOverlayRequest(uint64_t sequence)
+    {
+        slotInFlight[SlotIndex(sequence)] = true;
+        nextRequestSequence = sequence + 1;
+        ring->requestSequence.store(sequence);
+        if(ring->mainWaiting.load()) {
+            overlayRequestSema.Post();
+        }
+    }
+
+    // Call from Overlay after the response in the slot has been read
+    void RetireOverlayRequest(uint64_t sequence)
+    {
+        slotInFlight[SlotIndex(sequence)] = false;
+    }
+
+    // Publish a request whose response Overlay won't wait for; its
+    // result is checked when the slot is needed again or by the next
+    // synchronous request
+    void FinishOverlayAsyncRequest(uint64_t sequence)
+    {
+        asyncSequence[SlotIndex(sequence)] = sequence;
+        FinishOverlayRequest(sequence);
+    }
+
+    // Call from Overlay to check the results of asynchronous requests up
+    // to and including "throughSequence", waiting for them if necessary.
+    // Failures are logged and the first is kept in deferredAsyncResult.
+    WaitResult CollectAsyncResponses(uint64_t throughSequence)
+    {
+        for(uint64_t sequence = throughSequence + 1 - std::min<uint64_t>(throughSequence, slotCount); sequence <= throughSequence; sequence++) {
+
+            uint32_t slot = SlotIndex(sequence);
+            if(asyncSequence[slot] != sequence) {
+                continue;
+            }
+
+            WaitResult result = WaitForMainResponseOrFail(sequence);
+            if(result != WaitResult::MAIN_RESPONSE_READY) {
+                return result;
+            }
+
+            IPCBuffer ipcbuf = GetSlotIPCBuffer(sequence);
+            IPCHeader* header = ipcbuf.getAndAdvance<IPCHeader>();
+
+            if(!XR_SUCCEEDED(header->result)) {
+                OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+                    fmt("asynchronous RPC %s failed with %d in the main process", RPCRequestTypeName(header->requestType), header->result).c_str());
+                if(deferredAsyncResult == XR_SUCCESS) {
+                    deferredAsyncResult = header->result;
+                }
+            }
+
+            asyncSequence[slot] = 0;
+            RetireOverlayRequest(sequence);
+        }
+
+        return WaitResult::MAIN_RESPONSE_READY;
+    }
+
+    // Return and clear the first unreported asynchronous failure; the
+    // generated RPCCall functions return it in place of a synchronous
+    // request's own success result
+    XrResult TakeDeferredAsyncResult()
+    {
+        XrResult result = deferredAsyncResult;
+        deferredAsyncResult = XR_SUCCESS;
+        return result;
+    }
+
+    // Wait until "isReady()" returns true.  Spin for gRPCSpinMicroseconds
+    // first, since most requests and responses arrive within a few
+    // microseconds during a frame, then block on "sema" as BlockUntil does.
+    template <class IsReady, class IsAbandoned>
+    IPCWaitStatus SpinThenBlock(IsReady isReady, std::atomic<uint32_t>& waiting, IPCSemaphore& sema, IsAbandoned isAbandoned)
+    {
+        if(isReady()) {
+            waitCounters.alreadyReady++;
+            return IPC_WAIT_SIGNALED;
+        }
+
+        if(gRPCSpinMicroseconds > 0) {
+            auto spinUntil = std::chrono::steady_clock::now() + std::chrono::microseconds(gRPCSpinMicroseconds);
+            uint32_t spins = 0;
+            do {
+                if(gRPCSpinYield) {
+                    std::this_thread::yield();
+                } else {
+                    IPCCpuRelax();
+                }
+                if(isReady()) {
+                    waitCounters.spinning++;
+                    return IPC_WAIT_SIGNALED;
+                }
+                // Reading the clock costs more than a pause, so only do it every so often
+            } while((++spins % 16 != 0) || (std::chrono::steady_clock::now() < spinUntil));
+        }
+
+        IPCWaitStatus result = BlockUntil(isReady, waiting, sema, isAbandoned);
+        if(result == IPC_WAIT_SIGNALED) {
+            waitCounters.blocking++;
+        }
+        return result;
+    }
+
+    // Wait on "sema" until "isReady()" returns true, counting this
+    // thread in "waiting" so the other process knows to post it.  More
+    // than one thread may wait on the same semaphore, so a thread that
+    // leaves after a post passes a post on to the ones still waiting.
+    // If "isAbandoned()" returns true while blocked and the wait still
+    // isn't satisfied, return IPC_WAIT_STOPPED.
+    template <class IsReady, class IsAbandoned>
+    IPCWaitStatus BlockUntil(IsReady isReady, std::atomic<uint32_t>& waiting, IPCSemaphore& sema, IsAbandoned isAbandoned)
+    {
+        waiting.fetch_add(1);
+
+        IPCWaitStatus result = IPC_WAIT_SIGNALED;
+        bool woken = false;
+
+        while(!isReady()) {
+
+            result = IPCWaitForSemaphoreOrProcessExit(sema, otherProcess, overlayRequestWaitMillis);
+            woken = woken || (result == IPC_WAIT_SIGNALED);
+
+            if((result != IPC_WAIT_SIGNALED) && (result != IPC_WAIT_TIMEOUT)) {
+                break;
+            }
+
+            if((result == IPC_WAIT_TIMEOUT) && isAbandoned() && !isReady()) {
+                result = IPC_WAIT_STOPPED;
+                break;
+            }
+
+            result = IPC_WAIT_SIGNALED;
+        }
+
+        if((waiting.fetch_sub(1) > 1) && woken) {
+            sema.Post();
+        }
+
+        return result;
     }
 
-    // Call from Host to get complete request in shmem
-    WaitResult WaitForOverlayRequestOrFail()
+    // Call from Overlay to wait until Main has served "sequence", or
+    // until Main has stopped serving this channel without serving it
+    WaitResult WaitForMainResponseOrFail(uint64_t sequence)
     {
-        HANDLE handles[2];
+        IPCWaitStatus result = SpinThenBlock([this, sequence]{ return ring->responseSequence.load() >= sequence; }, ring->overlayWaiting, mainResponseSema,
+            [this]{ return ring->mainClosed.load() != 0; });
+
+        if(result == IPC_WAIT_SIGNALED) {
+            return WaitResult::MAIN_RESPONSE_READY;
+        }
+
+        if(result == IPC_WAIT_STOPPED) {
+            return WaitResult::MAIN_PROCESS_TERMINATED_GRACEFULLY;
+        }
 
-        handles[0] = overlayRequestSema;
-        handles[1] = otherProcessHandle;
+        if(result == IPC_WAIT_PROCESS_EXITED) {
+            OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+                fmt("main process exited before answering RPC request %llu", (unsigned long long)sequence).c_str());
+            return WaitResult::MAIN_PROCESS_TERMINATED_UNEXPECTEDLY;
+        }
 
-        DWORD result;
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+            fmt("couldn't wait for main process to answer RPC request %llu: %s", (unsigned long long)sequence, IPCGetLastErrorString().c_str()).c_str());
+        return WaitResult::WAIT_ERROR;
+    }
 
-        do {
-            result = WaitForMultipleObjects(2, handles, FALSE, overlayRequestWaitMillis);
-        } while(result == WAIT_TIMEOUT);
+    // Call from Main to wait until Overlay has published a request after
+    // "servedSequence", or until "closed" is set
+    WaitResult WaitForOverlayRequestOrFail(uint64_t servedSequence, const std::atomic<bool>& closed)
+    {
+        IPCWaitStatus result = SpinThenBlock([this, servedSequence]{ return ring->requestSequence.load() > servedSequence; }, ring->mainWaiting, overlayRequestSema,
+            [&closed]{ return closed.load(); });
 
-        if(result == WAIT_OBJECT_0 + 0) {
+        if(result == IPC_WAIT_SIGNALED) {
             return WaitResult::OVERLAY_REQUEST_READY;
         }
 
-        if(result == WAIT_OBJECT_0 + 1) {
+        if(result == IPC_WAIT_STOPPED) {
+            return WaitResult::OVERLAY_PROCESS_TERMINATED_GRACEFULLY;
+        }
+
+        if(result == IPC_WAIT_PROCESS_EXITED) {
+            OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+                fmt("overlay process exited after RPC request %llu", (unsigned long long)servedSequence).c_str());
             return WaitResult::OVERLAY_PROCESS_TERMINATED_UNEXPECTEDLY;
         }
 
-        // XXX log error
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+            fmt("couldn't wait for an overlay RPC request after %llu: %s", (unsigned long long)servedSequence, IPCGetLastErrorString().c_str()).c_str());
         return WaitResult::WAIT_ERROR;
     }
 
-    void FinishOverlayRequest()
+    void FinishMainResponse(uint64_t sequence)
     {
-        ReleaseSemaphore(overlayRequestSema, 1, nullptr);
+        ring->responseSequence.store(sequence);
+        if(ring->overlayWaiting.load()) {
+            mainResponseSema.Post();
+        }
+    }
+
+    // Call from Main when it stops serving this channel.  Requests
+    // already published are answered with "result" without being
+    // served; Overlay stops waiting for any published after this.
+    // Returns the last sequence answered.
+    uint64_t CloseMainAndAnswerPublished(uint64_t servedSequence, XrResult result)
+    {
+        uint64_t publishedSequence = ring->requestSequence.load();
+        while(servedSequence < publishedSequence) {
+            uint64_t sequence = servedSequence + 1;
+            IPCBuffer ipcbuf = GetSlotIPCBuffer(sequence);
+            IPCHeader* header = ipcbuf.getAndAdvance<IPCHeader>();
+            if(header->sequence != sequence) {
+                break;
+            }
+            header->result = result;
+            FinishMainResponse(sequence);
+            servedSequence = sequence;
+        }
+
+        // Wake Overlay threads blocked on requests that won't be answered
+        ring->mainClosed.store(1);
+        mainResponseSema.Post();
+
+        return servedSequence;
     }
 
-    void FinishMainResponse()
+    void LogWaitCounters(const char* processName)
     {
-        ReleaseSemaphore(mainResponseSema, 1, nullptr);
+        OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT, nullptr, OverlaysLayerNoObjectInfo,
+            fmt("%s RPC waits: %llu already ready, %llu ready while spinning, %llu blocked; largest request %zu bytes", processName,
+                (unsigned long long)waitCounters.alreadyReady, (unsigned long long)waitCounters.spinning, (unsigned long long)waitCounters.blocking,
+                requestHighWater).c_str());
     }
 };
 
+static_assert(sizeof(RPCRingHeader) <= RPCChannels::ringHeaderSize, "RPC ring header doesn't fit before the first slot");
+
 void OverlaysLayerRemoveXrSpaceHandleInfo(XrSpace localHandle);
 void OverlaysLayerRemoveXrSwapchainHandleInfo(XrSwapchain localHandle);
 void OverlaysLayerRemoveXrActionHandleInfo(XrAction localHandle);
@@ -497,10 +1871,12 @@ struct SwapchainCachedData
     };
 
     XrSwapchain swapchain;
+    std::vector<uint32_t>   acquired;
+
+#if defined(XR_USE_GRAPHICS_API_D3D11)
     std::vector<ID3D11Texture2D*> swapchainImages;
     std::set<HANDLE> remoteImagesAcquired;
     std::unordered_map<HANDLE, ID3D11Texture2D*> handleTextureMap;
-    std::vector<uint32_t>   acquired;
 
     SwapchainCachedData(XrSwapchain swapchain_, const std::vector<ID3D11Texture2D*>& swapchainImages_) :
         swapchain(swapchain_),
@@ -513,6 +1889,7 @@ struct SwapchainCachedData
 
     ~SwapchainCachedData();
     ID3D11Texture2D* getSharedTexture(ID3D11Device *d3d11Device, HANDLE sourceHandle);
+#endif
 
     typedef std::shared_ptr<SwapchainCachedData> Ptr;
 };
@@ -555,6 +1932,10 @@ struct MainAsOverlaySessionContext
     constexpr static int maxOverlayCompositionLayers = 16;
     std::vector<std::shared_ptr<const XrCompositionLayerBaseHeader>> overlayLayers;
 
+    // First failure of a SubmitFrame that carried a frame, held for
+    // Overlay's next xrWaitFrame to return since xrEndFrame doesn't wait
+    XrResult endFrameResult = XR_SUCCESS;
+
     // This structure needs to be locked because Main could Destroy its
     // shared XrSession and all of its children and that would need to go
     // through here to mark those handles destroyed.
@@ -584,20 +1965,24 @@ struct MainAsOverlaySessionContext
 
 struct ConnectionToOverlay
 {
-    bool closed = false;
-    std::recursive_mutex mutex;
-    RPCChannels conn;
+    std::atomic<bool> closed {false};
+    ProfiledMutex mutex{"ConnectionToOverlay::mutex"};
+    RPCChannels channels[RPCChannels::channelsPerConnection];
     MainAsOverlaySessionContext::Ptr ctx = nullptr;
-    std::thread thread;
 
-    ConnectionToOverlay(const RPCChannels& conn) :
-        conn(conn)
-    { }
+    // One thread serves each channel; the last one to exit cleans up the connection
+    std::thread threads[RPCChannels::channelsPerConnection];
+    std::atomic<uint32_t> threadsRunning {0};
+
+    ConnectionToOverlay(const RPCChannels (&channels_)[RPCChannels::channelsPerConnection])
+    {
+        std::copy(std::begin(channels_), std::end(channels_), std::begin(channels));
+    }
 
     // This structure probably does not need to be locked.
-    std::unique_lock<std::recursive_mutex> GetLock()
+    std::unique_lock<ProfiledMutex> GetLock()
     {
-        return std::unique_lock<std::recursive_mutex>(mutex);
+        return std::unique_lock<ProfiledMutex>(mutex);
     }
 
     ~ConnectionToOverlay()
@@ -610,12 +1995,87 @@ struct ConnectionToOverlay
 
 struct ConnectionToMain
 {
-    RPCChannels conn;
+    // Each Overlay thread uses its own channel so that calls from
+    // different threads don't wait on each other; threads beyond
+    // channelsPerConnection share channels.
+    struct Channel
+    {
+        RPCChannels conn;
+
+        // Held while publishing requests and collecting responses; hold
+        // it across several RPCPost*() and RPCWait*() calls to have more
+        // than one request in flight
+        std::mutex mutex;
+
+        // Last asynchronous request published on this channel
+        std::atomic<uint64_t> lastAsyncSequence {0};
+    };
+
+    Channel channels[RPCChannels::channelsPerConnection];
+
+    // Swapchain images Overlay has released that haven't been sent to
+    // Main yet; they go along with the next xrEndFrame in one
+    // SubmitFrame request, or before the swapchain is used again.
+    // Take a channel's mutex before this one.
+    std::mutex pendingReleaseMutex;
+    std::vector<XrSwapchain> pendingReleaseSwapchains;  // actual handles
+    std::vector<SharedImageHandle> pendingReleaseSourceImages;
+
+    Channel& GetChannelForThisThread()
+    {
+        static std::atomic<uint32_t> nextChannel {0};
+        thread_local uint32_t channel = nextChannel++ % RPCChannels::channelsPerConnection;
+        return channels[channel];
+    }
+
+    std::unique_lock<std::mutex> LockChannelForThisThread()
+    {
+        return std::unique_lock<std::mutex>(GetChannelForThisThread().mutex);
+    }
+
+    // Wait for Main to serve asynchronous requests already published on
+    // other channels, so Main sees requests made one after another by
+    // different threads in that same order.  Returns XR_ERROR_SESSION_LOST
+    // if Main closed a channel first and XR_ERROR_INSTANCE_LOST if Main
+    // exited.
+    XrResult WaitForAsyncOnOtherChannels(const Channel& channel);
+
     typedef std::shared_ptr<ConnectionToMain> Ptr;
 };
 
-extern std::recursive_mutex gSynchronizeEveryProcMutex;
+extern ProfiledMutex gSynchronizeEveryProcMutex;
 extern bool gSynchronizeEveryProc;
+extern bool gSynchronizePerHandle;
+
+// Lock to hold around calls into the runtime.  By default that's
+// gSynchronizeEveryProcMutex around everything.  With
+// OVERLAYS_API_LAYER_SYNCHRONIZE_PER_HANDLE it's procMutex of the
+// XrSession, XrSwapchain, or XrSpace the call is made on, and calls on
+// only an XrInstance, XrActionSet, or XrAction take no lock.
+//
+// Lock order in per-handle mode, outermost first:
+//   1. XrSession procMutex
+//   2. XrSwapchain or XrSpace procMutex
+//   3. EndFrameMutex, HapticQuirkMutex
+//   4. gMainSessionContext, then gConnectionsToOverlayByProcessIdMutex
+//   5. ConnectionToOverlay, then its MainSessionContext, then handle info GetLock()s
+// A thread never takes a session procMutex while holding a swapchain or
+// space procMutex, and never takes any procMutex while holding a lock
+// from 3 to 5.  xrWaitFrame takes no lock in this mode, because it may
+// block until xrEndFrame on another thread.  Handle info GetLock()s also
+// guard their child lists.  tests/overlay_layer_stress.cpp exercises this
+// order in both modes; run it in a build configured with
+// OVERLAY_LAYER_SANITIZE_THREAD to have ThreadSanitizer check it.
+inline std::unique_lock<ProfiledMutex> LockForProc(ProfiledMutex* procMutex)
+{
+    if(gSynchronizeEveryProc) {
+        return std::unique_lock<ProfiledMutex>(gSynchronizeEveryProcMutex);
+    }
+    if(gSynchronizePerHandle && procMutex) {
+        return std::unique_lock<ProfiledMutex>(*procMutex);
+    }
+    return std::unique_lock<ProfiledMutex>();
+}
 
 extern std::recursive_mutex gMainSessionContextMutex;
 extern MainSessionContext::Ptr gMainSessionContext;
@@ -623,32 +2083,31 @@ extern MainSessionContext::Ptr gMainSessionContext;
 extern ConnectionToMain::Ptr gConnectionToMain;
 
 extern std::recursive_mutex gConnectionsToOverlayByProcessIdMutex;
-extern std::unordered_map<DWORD, ConnectionToOverlay::Ptr> gConnectionsToOverlayByProcessId;
+extern std::unordered_map<IPCProcessId, ConnectionToOverlay::Ptr> gConnectionsToOverlayByProcessId;
 
 constexpr uint32_t gLayerBinaryVersion = 0x00000001;
 
-uint64_t GetNextLocalHandle();
-
 // Local render target for passing to "Swapchain"
 struct OverlaySwapchain
 {
     XrSwapchain             swapchain;
-    std::vector<ID3D11Texture2D*> swapchainTextures;
-    std::vector<HANDLE>          swapchainHandles;
+    std::vector<SharedImageHandle> swapchainHandles;
     std::vector<uint32_t>   acquired;
     bool                    waited;
     int                     width;
     int                     height;
-    DXGI_FORMAT             format;
 
+#if defined(XR_USE_GRAPHICS_API_D3D11)
+    std::vector<ID3D11Texture2D*> swapchainTextures;
+    DXGI_FORMAT             format;
 
     OverlaySwapchain(XrSwapchain sc, size_t count, const XrSwapchainCreateInfo* createInfo) :
         swapchain(sc),
-        swapchainTextures(count),
         swapchainHandles(count),
         waited(false),
         width(createInfo->width),
         height(createInfo->height),
+        swapchainTextures(count),
         format(static_cast<DXGI_FORMAT>(createInfo->format))
     {
     }
@@ -660,6 +2119,7 @@ struct OverlaySwapchain
             swapchainTextures[i]->Release();
         }
     }
+#endif
     typedef std::shared_ptr<OverlaySwapchain> Ptr;
 };
 
@@ -741,16 +2201,52 @@ struct OverlaysLayerRPCCreateSession
     XrSession*                                  session;
 };
 
-template <typename T> 
-std::shared_ptr<T> GetSharedCopyHandlesRestored(XrInstance instance, const char *func, const T *obj)
+// Point "restored" at a copy of "obj" with actual handles in place of
+// local handles, held in "copy", or at "obj" itself if it has none to
+// restore.  Doesn't throw, so entry points can call it outside a try.
+template <typename T>
+XrResult TryCopyHandlesRestored(XrInstance instance, const char *func, const T *obj, std::unique_ptr<T, ScratchArenaDeleter>& copy, const T*& restored)
 {
-    XrBaseInStructure *chainCopy = CopyXrStructChainWithMalloc(instance, obj);
+    if(!XrStructChainContainsSubstitutableHandles(reinterpret_cast<const XrBaseInStructure*>(obj))) {
+        restored = obj;
+        return XR_SUCCESS;
+    }
+
+    XrBaseInStructure *chainCopy = CopyXrStructChainWithScratch(instance, obj);
+    // A chain of only unknown structs copies to nothing; otherwise the
+    // arena is out of memory
+    if(!chainCopy && (XrStructChainSerializedSize(instance, reinterpret_cast<const XrBaseInStructure*>(obj)) != 0)) {
+        return XR_ERROR_OUT_OF_MEMORY;
+    }
+    copy.reset(reinterpret_cast<T*>(chainCopy));
     if(!RestoreActualHandles(instance, chainCopy)) {
         OverlaysLayerLogMessage(instance, XR_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT, func,
             OverlaysLayerNoObjectInfo, "FATAL: handles could not be restored.\n");
-        throw OverlaysLayerXrException(XR_ERROR_HANDLE_INVALID);
+        return XR_ERROR_HANDLE_INVALID;
+    }
+    restored = copy.get();
+    return XR_SUCCESS;
+}
+
+// could throw if handles couldn't be restored
+template <typename T> 
+std::shared_ptr<T> GetSharedCopyHandlesRestored(XrInstance instance, const char *func, const T *obj)
+{
+    std::unique_ptr<T, ScratchArenaDeleter> copy;
+    const T* restored;
+    XrResult result = TryCopyHandlesRestored(instance, func, obj, copy, restored);
+    if(result == XR_ERROR_OUT_OF_MEMORY) {
+        throw std::bad_alloc();
+    } else if(result != XR_SUCCESS) {
+        throw OverlaysLayerXrException(result);
+    }
+
+    if(!copy) {
+        // Nothing to rewrite, so hand back the caller's own struct,
+        // owned by no one
+        return std::shared_ptr<T>(std::shared_ptr<T>(), const_cast<T*>(restored));
     }
-    std::shared_ptr<T> chainPtr(reinterpret_cast<T*>(chainCopy), [instance](const T *p){FreeXrStructChainWithFree(instance, p);});
+    std::shared_ptr<T> chainPtr(copy.release(), [](const T *p){ScratchArena::Free(p);}, ScratchAllocator<T>());
     return chainPtr;
 }
 
@@ -946,6 +2442,20 @@ enum WellKnownStringIndex {
 
 }; // Existing entries will need to not change for subsequent versions for backward compatibility after the first public release
 
+// A binding Main makes a placeholder action for in its session, so it
+// can get that binding's state for an Overlay
+struct PlaceholderActionId
+{
+    std::string name;
+    XrActionType type;
+    WellKnownStringIndex interactionProfileString;
+    WellKnownStringIndex subActionString;
+    WellKnownStringIndex componentString;
+    WellKnownStringIndex fullBindingString;
+};
+
+extern std::vector<PlaceholderActionId> PlaceholderActionIds;
+
 // Manually written functions -----------------------------------------------
 
 XrResult OverlaysLayerCreateSessionMainAsOverlay(ConnectionToOverlay::Ptr connection, XrFormFactor formFactor, const XrInstanceCreateInfo *instanceCreateInfo, const XrSessionCreateInfo *createInfo, const XrSessionCreateInfoOverlayEXTX *createInfoOverlay, XrSession *session);
@@ -981,13 +2491,15 @@ XrResult OverlaysLayerBeginFrameOverlay(XrInstance instance, XrSession session,
 XrResult OverlaysLayerAcquireSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageAcquireInfo* acquireInfo, uint32_t *index);
 XrResult OverlaysLayerAcquireSwapchainImageOverlay(XrInstance instance, XrSwapchain swapchain, const XrSwapchainImageAcquireInfo* acquireInfo, uint32_t *index);
 
-XrResult OverlaysLayerWaitSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageWaitInfo* waitInfo, HANDLE sourceImage);
+XrResult OverlaysLayerWaitSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageWaitInfo* waitInfo, SharedImageHandle sourceImage);
 XrResult OverlaysLayerWaitSwapchainImageOverlay(XrInstance instance, XrSwapchain swapchain, const XrSwapchainImageWaitInfo* waitInfo);
 
-XrResult OverlaysLayerReleaseSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageReleaseInfo* waitInfo, HANDLE sourceImage);
+XrResult OverlaysLayerReleaseSwapchainImageMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSwapchain swapchain, const XrSwapchainImageReleaseInfo* waitInfo, SharedImageHandle sourceImage);
 XrResult OverlaysLayerReleaseSwapchainImageOverlay(XrInstance instance, XrSwapchain swapchain, const XrSwapchainImageReleaseInfo* waitInfo);
 
 XrResult OverlaysLayerEndFrameMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, const XrFrameEndInfo* frameEndInfo);
+XrResult OverlaysLayerSubmitFrameMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t releaseCount, const XrSwapchain* releaseSwapchains, const SharedImageHandle* releaseSourceImages, const XrFrameEndInfo* frameEndInfo);
+void FlushSwapchainReleasesToMain(XrInstance instance, std::shared_ptr<OverlaysLayerXrSwapchainHandleInfo> swapchainInfo);
 XrResult OverlaysLayerEndFrame(XrSession session, const XrFrameEndInfo* frameEndInfo);
 
 XrResult OverlaysLayerEnumerateReferenceSpacesMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t spaceCapacityInput, uint32_t* spaceCountOutput, XrReferenceSpaceType* spaces);
@@ -1043,6 +2555,7 @@ XrResult OverlaysLayerLocateSpace(XrSpace space, XrSpace baseSpace, XrTime time,
 
 XrResult OverlaysLayerStopHapticFeedbackMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t profileStringCount, const WellKnownStringIndex *profileStrings, const WellKnownStringIndex *bindingStrings);
 XrResult OverlaysLayerApplyHapticFeedbackMainAsOverlay(ConnectionToOverlay::Ptr connection, XrSession session, uint32_t profileStringCount, const WellKnownStringIndex *profileStrings, const WellKnownStringIndex *bindingStrings, const XrHapticBaseHeader* hapticFeedback);
+XrResult OverlaysLayerPingMainAsOverlay(ConnectionToOverlay::Ptr connection, uint32_t payloadSize, const uint8_t *payload);
 XrResult OverlaysLayerApplyHapticFeedback(XrSession session, const XrHapticActionInfo* hapticActionInfo, const XrHapticBaseHeader* hapticFeedback);
 XrResult OverlaysLayerStopHapticFeedback(XrSession session, const XrHapticActionInfo* hapticActionInfo);
 
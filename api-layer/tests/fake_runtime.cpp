@@ -0,0 +1,421 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "fake_runtime.h"
+#include "overlays.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" XrResult XRAPI_CALL Overlays_xrNegotiateLoaderApiLayerInterface(const XrNegotiateLoaderInfo *loaderInfo,
+    const char* apiLayerName, XrNegotiateApiLayerRequest *apiLayerRequest);
+
+extern const char *kOverlayLayerName;
+
+std::atomic<uint64_t> gFakeRuntimeCallCount{0};
+
+namespace {
+
+std::atomic<uint64_t> gNextHandle{0x100};
+
+template <typename Handle>
+Handle NewHandle()
+{
+    return (Handle)gNextHandle.fetch_add(1);
+}
+
+std::mutex gPathsMutex;
+std::unordered_map<std::string, XrPath> gPathsByString;
+std::vector<std::string> gStringsByPath{""};
+
+XrResult XRAPI_CALL FakeDestroyInstance(XrInstance)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeStringToPath(XrInstance, const char* pathString, XrPath* path)
+{
+    gFakeRuntimeCallCount++;
+    std::unique_lock<std::mutex> lock(gPathsMutex);
+    auto it = gPathsByString.find(pathString);
+    if(it == gPathsByString.end()) {
+        it = gPathsByString.insert({pathString, XrPath(gStringsByPath.size())}).first;
+        gStringsByPath.push_back(pathString);
+    }
+    *path = it->second;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakePathToString(XrInstance, XrPath path, uint32_t bufferCapacityInput, uint32_t* bufferCountOutput, char* buffer)
+{
+    gFakeRuntimeCallCount++;
+    std::unique_lock<std::mutex> lock(gPathsMutex);
+    if((path == XR_NULL_PATH) || (path >= gStringsByPath.size())) {
+        return XR_ERROR_PATH_INVALID;
+    }
+    const std::string& string = gStringsByPath[path];
+    *bufferCountOutput = uint32_t(string.size() + 1);
+    if(bufferCapacityInput == 0) {
+        return XR_SUCCESS;
+    }
+    if(bufferCapacityInput < string.size() + 1) {
+        return XR_ERROR_SIZE_INSUFFICIENT;
+    }
+    memcpy(buffer, string.c_str(), string.size() + 1);
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeStructureTypeToString(XrInstance, XrStructureType value, char buffer[XR_MAX_STRUCTURE_NAME_SIZE])
+{
+    gFakeRuntimeCallCount++;
+    snprintf(buffer, XR_MAX_STRUCTURE_NAME_SIZE, "XR_UNKNOWN_STRUCTURE_TYPE_%d", value);
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeResultToString(XrInstance, XrResult value, char buffer[XR_MAX_RESULT_STRING_SIZE])
+{
+    gFakeRuntimeCallCount++;
+    snprintf(buffer, XR_MAX_RESULT_STRING_SIZE, "XR_UNKNOWN_RESULT_%d", value);
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakePollEvent(XrInstance, XrEventDataBuffer*)
+{
+    gFakeRuntimeCallCount++;
+    return XR_EVENT_UNAVAILABLE;
+}
+
+XrResult XRAPI_CALL FakeGetSystem(XrInstance, const XrSystemGetInfo* getInfo, XrSystemId* systemId)
+{
+    gFakeRuntimeCallCount++;
+    if(getInfo->formFactor != XR_FORM_FACTOR_HEAD_MOUNTED_DISPLAY) {
+        return XR_ERROR_FORM_FACTOR_UNSUPPORTED;
+    }
+    *systemId = XrSystemId(1);
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeCreateSession(XrInstance, const XrSessionCreateInfo*, XrSession* session)
+{
+    gFakeRuntimeCallCount++;
+    *session = NewHandle<XrSession>();
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeDestroySession(XrSession)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeBeginSession(XrSession, const XrSessionBeginInfo*)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeEndSession(XrSession)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeRequestExitSession(XrSession)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeCreateActionSet(XrInstance, const XrActionSetCreateInfo*, XrActionSet* actionSet)
+{
+    gFakeRuntimeCallCount++;
+    *actionSet = NewHandle<XrActionSet>();
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeDestroyActionSet(XrActionSet)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeCreateAction(XrActionSet, const XrActionCreateInfo*, XrAction* action)
+{
+    gFakeRuntimeCallCount++;
+    *action = NewHandle<XrAction>();
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeDestroyAction(XrAction)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeSuggestInteractionProfileBindings(XrInstance, const XrInteractionProfileSuggestedBinding*)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeAttachSessionActionSets(XrSession, const XrSessionActionSetsAttachInfo*)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeSyncActions(XrSession, const XrActionsSyncInfo*)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+// Every action is active and at rest, and nothing is held or moving
+XrResult XRAPI_CALL FakeGetActionStateBoolean(XrSession, const XrActionStateGetInfo*, XrActionStateBoolean* state)
+{
+    gFakeRuntimeCallCount++;
+    state->currentState = XR_FALSE;
+    state->changedSinceLastSync = XR_FALSE;
+    state->lastChangeTime = 0;
+    state->isActive = XR_TRUE;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeGetActionStateFloat(XrSession, const XrActionStateGetInfo*, XrActionStateFloat* state)
+{
+    gFakeRuntimeCallCount++;
+    state->currentState = 0.0f;
+    state->changedSinceLastSync = XR_FALSE;
+    state->lastChangeTime = 0;
+    state->isActive = XR_TRUE;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeGetActionStateVector2f(XrSession, const XrActionStateGetInfo*, XrActionStateVector2f* state)
+{
+    gFakeRuntimeCallCount++;
+    state->currentState = {0.0f, 0.0f};
+    state->changedSinceLastSync = XR_FALSE;
+    state->lastChangeTime = 0;
+    state->isActive = XR_TRUE;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeGetActionStatePose(XrSession, const XrActionStateGetInfo*, XrActionStatePose* state)
+{
+    gFakeRuntimeCallCount++;
+    state->isActive = XR_TRUE;
+    return XR_SUCCESS;
+}
+
+// No controllers, so no interaction profile for any top level path
+XrResult XRAPI_CALL FakeGetCurrentInteractionProfile(XrSession, XrPath, XrInteractionProfileState* interactionProfile)
+{
+    gFakeRuntimeCallCount++;
+    interactionProfile->interactionProfile = XR_NULL_PATH;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeEnumerateReferenceSpaces(XrSession, uint32_t spaceCapacityInput, uint32_t* spaceCountOutput, XrReferenceSpaceType* spaces)
+{
+    gFakeRuntimeCallCount++;
+    static const XrReferenceSpaceType types[] = {XR_REFERENCE_SPACE_TYPE_VIEW, XR_REFERENCE_SPACE_TYPE_LOCAL, XR_REFERENCE_SPACE_TYPE_STAGE};
+    *spaceCountOutput = 3;
+    if(spaceCapacityInput == 0) {
+        return XR_SUCCESS;
+    }
+    if(spaceCapacityInput < 3) {
+        return XR_ERROR_SIZE_INSUFFICIENT;
+    }
+    memcpy(spaces, types, sizeof(types));
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeCreateReferenceSpace(XrSession, const XrReferenceSpaceCreateInfo*, XrSpace* space)
+{
+    gFakeRuntimeCallCount++;
+    *space = NewHandle<XrSpace>();
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeDestroySpace(XrSpace)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeLocateSpace(XrSpace, XrSpace, XrTime, XrSpaceLocation* location)
+{
+    gFakeRuntimeCallCount++;
+    location->locationFlags = XR_SPACE_LOCATION_ORIENTATION_VALID_BIT | XR_SPACE_LOCATION_POSITION_VALID_BIT;
+    location->pose.orientation = {0.0f, 0.0f, 0.0f, 1.0f};
+    location->pose.position = {0.0f, 1.6f, 0.0f};
+    return XR_SUCCESS;
+}
+
+std::atomic<XrTime> gPredictedDisplayTime{1000000000};
+
+XrResult XRAPI_CALL FakeWaitFrame(XrSession, const XrFrameWaitInfo*, XrFrameState* frameState)
+{
+    gFakeRuntimeCallCount++;
+    const XrDuration period = 11111111;
+    frameState->predictedDisplayTime = gPredictedDisplayTime.fetch_add(period) + period;
+    frameState->predictedDisplayPeriod = period;
+    frameState->shouldRender = XR_TRUE;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeBeginFrame(XrSession, const XrFrameBeginInfo*)
+{
+    gFakeRuntimeCallCount++;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeEndFrame(XrSession, const XrFrameEndInfo* frameEndInfo)
+{
+    gFakeRuntimeCallCount++;
+    // Read the layers as a compositor would
+    for(uint32_t i = 0; i < frameEndInfo->layerCount; i++) {
+        if(!frameEndInfo->layers[i] || (frameEndInfo->layers[i]->space == XR_NULL_HANDLE)) {
+            return XR_ERROR_LAYER_INVALID;
+        }
+    }
+    return XR_SUCCESS;
+}
+
+const std::unordered_map<std::string, PFN_xrVoidFunction> gFakeFunctions = {
+    {"xrGetInstanceProcAddr", reinterpret_cast<PFN_xrVoidFunction>(FakeRuntimeGetInstanceProcAddr)},
+    {"xrDestroyInstance", reinterpret_cast<PFN_xrVoidFunction>(FakeDestroyInstance)},
+    {"xrStringToPath", reinterpret_cast<PFN_xrVoidFunction>(FakeStringToPath)},
+    {"xrPathToString", reinterpret_cast<PFN_xrVoidFunction>(FakePathToString)},
+    {"xrStructureTypeToString", reinterpret_cast<PFN_xrVoidFunction>(FakeStructureTypeToString)},
+    {"xrResultToString", reinterpret_cast<PFN_xrVoidFunction>(FakeResultToString)},
+    {"xrPollEvent", reinterpret_cast<PFN_xrVoidFunction>(FakePollEvent)},
+    {"xrGetSystem", reinterpret_cast<PFN_xrVoidFunction>(FakeGetSystem)},
+    {"xrCreateSession", reinterpret_cast<PFN_xrVoidFunction>(FakeCreateSession)},
+    {"xrDestroySession", reinterpret_cast<PFN_xrVoidFunction>(FakeDestroySession)},
+    {"xrBeginSession", reinterpret_cast<PFN_xrVoidFunction>(FakeBeginSession)},
+    {"xrEndSession", reinterpret_cast<PFN_xrVoidFunction>(FakeEndSession)},
+    {"xrRequestExitSession", reinterpret_cast<PFN_xrVoidFunction>(FakeRequestExitSession)},
+    {"xrCreateActionSet", reinterpret_cast<PFN_xrVoidFunction>(FakeCreateActionSet)},
+    {"xrDestroyActionSet", reinterpret_cast<PFN_xrVoidFunction>(FakeDestroyActionSet)},
+    {"xrCreateAction", reinterpret_cast<PFN_xrVoidFunction>(FakeCreateAction)},
+    {"xrDestroyAction", reinterpret_cast<PFN_xrVoidFunction>(FakeDestroyAction)},
+    {"xrSuggestInteractionProfileBindings", reinterpret_cast<PFN_xrVoidFunction>(FakeSuggestInteractionProfileBindings)},
+    {"xrAttachSessionActionSets", reinterpret_cast<PFN_xrVoidFunction>(FakeAttachSessionActionSets)},
+    {"xrSyncActions", reinterpret_cast<PFN_xrVoidFunction>(FakeSyncActions)},
+    {"xrGetActionStateBoolean", reinterpret_cast<PFN_xrVoidFunction>(FakeGetActionStateBoolean)},
+    {"xrGetActionStateFloat", reinterpret_cast<PFN_xrVoidFunction>(FakeGetActionStateFloat)},
+    {"xrGetActionStateVector2f", reinterpret_cast<PFN_xrVoidFunction>(FakeGetActionStateVector2f)},
+    {"xrGetActionStatePose", reinterpret_cast<PFN_xrVoidFunction>(FakeGetActionStatePose)},
+    {"xrGetCurrentInteractionProfile", reinterpret_cast<PFN_xrVoidFunction>(FakeGetCurrentInteractionProfile)},
+    {"xrEnumerateReferenceSpaces", reinterpret_cast<PFN_xrVoidFunction>(FakeEnumerateReferenceSpaces)},
+    {"xrCreateReferenceSpace", reinterpret_cast<PFN_xrVoidFunction>(FakeCreateReferenceSpace)},
+    {"xrDestroySpace", reinterpret_cast<PFN_xrVoidFunction>(FakeDestroySpace)},
+    {"xrLocateSpace", reinterpret_cast<PFN_xrVoidFunction>(FakeLocateSpace)},
+    {"xrWaitFrame", reinterpret_cast<PFN_xrVoidFunction>(FakeWaitFrame)},
+    {"xrBeginFrame", reinterpret_cast<PFN_xrVoidFunction>(FakeBeginFrame)},
+    {"xrEndFrame", reinterpret_cast<PFN_xrVoidFunction>(FakeEndFrame)},
+};
+
+}  // namespace
+
+XrResult XRAPI_CALL FakeRuntimeGetInstanceProcAddr(XrInstance, const char* name, PFN_xrVoidFunction* function)
+{
+    auto it = gFakeFunctions.find(name);
+    if(it == gFakeFunctions.end()) {
+        *function = nullptr;
+        return XR_ERROR_FUNCTION_UNSUPPORTED;
+    }
+    *function = it->second;
+    return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL FakeRuntimeCreateApiLayerInstance(const XrInstanceCreateInfo*, const XrApiLayerCreateInfo*, XrInstance* instance)
+{
+    gFakeRuntimeCallCount++;
+    *instance = NewHandle<XrInstance>();
+    return XR_SUCCESS;
+}
+
+XrResult LayeredInstance::Create(const XrInstanceCreateInfo* createInfo)
+{
+    XrNegotiateLoaderInfo loaderInfo{};
+    loaderInfo.structType = XR_LOADER_INTERFACE_STRUCT_LOADER_INFO;
+    loaderInfo.structVersion = XR_LOADER_INFO_STRUCT_VERSION;
+    loaderInfo.structSize = sizeof(XrNegotiateLoaderInfo);
+    loaderInfo.minInterfaceVersion = XR_CURRENT_LOADER_API_LAYER_VERSION;
+    loaderInfo.maxInterfaceVersion = XR_CURRENT_LOADER_API_LAYER_VERSION;
+    loaderInfo.minApiVersion = XR_CURRENT_API_VERSION;
+    loaderInfo.maxApiVersion = XR_CURRENT_API_VERSION;
+
+    XrNegotiateApiLayerRequest layerRequest{};
+    layerRequest.structType = XR_LOADER_INTERFACE_STRUCT_API_LAYER_REQUEST;
+    layerRequest.structVersion = XR_API_LAYER_INFO_STRUCT_VERSION;
+    layerRequest.structSize = sizeof(XrNegotiateApiLayerRequest);
+
+    XrResult result = Overlays_xrNegotiateLoaderApiLayerInterface(&loaderInfo, kOverlayLayerName, &layerRequest);
+    if(result != XR_SUCCESS) {
+        return result;
+    }
+    getInstanceProcAddr = layerRequest.getInstanceProcAddr;
+
+    XrApiLayerNextInfo nextInfo{};
+    nextInfo.structType = XR_LOADER_INTERFACE_STRUCT_API_LAYER_NEXT_INFO;
+    nextInfo.structVersion = XR_API_LAYER_NEXT_INFO_STRUCT_VERSION;
+    nextInfo.structSize = sizeof(XrApiLayerNextInfo);
+    strncpy_s(nextInfo.layerName, kOverlayLayerName, XR_MAX_API_LAYER_NAME_SIZE);
+    nextInfo.nextGetInstanceProcAddr = FakeRuntimeGetInstanceProcAddr;
+    nextInfo.nextCreateApiLayerInstance = FakeRuntimeCreateApiLayerInstance;
+
+    XrApiLayerCreateInfo apiLayerInfo{};
+    apiLayerInfo.structType = XR_LOADER_INTERFACE_STRUCT_API_LAYER_CREATE_INFO;
+    apiLayerInfo.structVersion = XR_API_LAYER_CREATE_INFO_STRUCT_VERSION;
+    apiLayerInfo.structSize = sizeof(XrApiLayerCreateInfo);
+    apiLayerInfo.nextInfo = &nextInfo;
+
+    result = layerRequest.createApiLayerInstance(createInfo, &apiLayerInfo, &instance);
+    if(result != XR_SUCCESS) {
+        return result;
+    }
+
+    XrSystemGetInfo systemGetInfo{XR_TYPE_SYSTEM_GET_INFO};
+    systemGetInfo.formFactor = XR_FORM_FACTOR_HEAD_MOUNTED_DISPLAY;
+    return Get<PFN_xrGetSystem>("xrGetSystem")(instance, &systemGetInfo, &systemId);
+}
+
+void LayeredInstance::Destroy()
+{
+    if(instance != XR_NULL_HANDLE) {
+        Get<PFN_xrDestroyInstance>("xrDestroyInstance")(instance);
+        instance = XR_NULL_HANDLE;
+    }
+}
+
+void UnlinkNegotiationChannels()
+{
+    IPCSharedMemory::Unlink(NegotiationChannels::shmemName);
+    IPCSemaphore::Unlink(NegotiationChannels::overlayWaitSemaName);
+    IPCSemaphore::Unlink(NegotiationChannels::mainWaitSemaName);
+    IPCMutex::Unlink(NegotiationChannels::mutexName);
+}
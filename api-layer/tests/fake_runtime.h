@@ -0,0 +1,72 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef _FAKE_RUNTIME_H_
+#define _FAKE_RUNTIME_H_
+
+#include <openxr/openxr.h>
+#include "loader_interfaces.h"
+
+#include <atomic>
+#include <cstdint>
+
+// A runtime that does next to nothing, for standing below the layer so
+// the layer's own costs can be measured and its paths run without an XR
+// device.  Handles are made up from a counter, paths are interned
+// strings, frames are ready as soon as they're waited for, and there
+// are never any events.  Commands it doesn't implement aren't handed
+// out, so the layer's dispatch table has nullptr for them.
+
+// Every call into the fake runtime, so callers can check calls got
+// through the layer
+extern std::atomic<uint64_t> gFakeRuntimeCallCount;
+
+XrResult XRAPI_CALL FakeRuntimeGetInstanceProcAddr(XrInstance instance, const char* name, PFN_xrVoidFunction* function);
+XrResult XRAPI_CALL FakeRuntimeCreateApiLayerInstance(const XrInstanceCreateInfo* createInfo, const XrApiLayerCreateInfo* apiLayerInfo, XrInstance* instance);
+
+// An XrInstance made through the layer as the loader makes one, with the
+// fake runtime as the next and last element of the chain
+struct LayeredInstance
+{
+    XrInstance instance = XR_NULL_HANDLE;
+    XrSystemId systemId = XR_NULL_SYSTEM_ID;
+    PFN_xrGetInstanceProcAddr getInstanceProcAddr = nullptr;
+
+    // Negotiates with the layer, creates the instance and gets the HMD
+    // system
+    XrResult Create(const XrInstanceCreateInfo* createInfo);
+    void Destroy();
+
+    // The layer's entry point for "name", or nullptr
+    template <typename PFN>
+    PFN Get(const char* name) const
+    {
+        PFN_xrVoidFunction function = nullptr;
+        if(getInstanceProcAddr(instance, name, &function) != XR_SUCCESS) {
+            return nullptr;
+        }
+        return reinterpret_cast<PFN>(function);
+    }
+};
+
+// Remove negotiation objects a Main process killed earlier may have left
+// holding stale counts, so Main and Overlay processes started next find
+// each other.  Only call while no Main or Overlay is running.
+void UnlinkNegotiationChannels();
+
+#endif /* _FAKE_RUNTIME_H_ */
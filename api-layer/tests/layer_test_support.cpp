@@ -0,0 +1,178 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "layer_test_support.h"
+
+#include <cstring>
+
+int gTestFailures = 0;
+
+int RunTests(const TestCase* tests, size_t count, int argc, char **argv)
+{
+    bool ranAny = false;
+    for(size_t i = 0; i < count; i++) {
+        if((argc > 1) && (strcmp(argv[1], tests[i].name) != 0)) {
+            continue;
+        }
+        int failuresBefore = gTestFailures;
+        tests[i].function();
+        printf("%s: %s\n", tests[i].name, (gTestFailures == failuresBefore) ? "passed" : "FAILED");
+        ranAny = true;
+    }
+    if(!ranAny) {
+        fprintf(stderr, "no test named \"%s\"\n", argv[1]);
+        return 1;
+    }
+    return (gTestFailures == 0) ? 0 : 1;
+}
+
+RegisteredHandles::RegisteredHandles(uint32_t count, uint64_t actualBase)
+{
+    for(uint32_t i = 0; i < count; i++) {
+        XrSwapchain swapchain = OverlaysLayerNewLocalXrSwapchain();
+        auto swapchainInfo = std::make_shared<OverlaysLayerXrSwapchainHandleInfo>(XR_NULL_HANDLE, XR_NULL_HANDLE, nullptr);
+        swapchainInfo->actualHandle = ActualHandleFor<XrSwapchain>(actualBase, i);
+        swapchainInfo->localHandle = swapchain;
+        swapchainInfo->isProxied = true;
+        OverlaysLayerAddHandleInfoForXrSwapchain(swapchain, swapchainInfo);
+        swapchains.push_back(swapchain);
+
+        XrSpace space = OverlaysLayerNewLocalXrSpace();
+        auto spaceInfo = std::make_shared<OverlaysLayerXrSpaceHandleInfo>(XR_NULL_HANDLE, XR_NULL_HANDLE, nullptr);
+        spaceInfo->actualHandle = ActualHandleFor<XrSpace>(actualBase, i);
+        spaceInfo->localHandle = space;
+        spaceInfo->isProxied = true;
+        OverlaysLayerAddHandleInfoForXrSpace(space, spaceInfo);
+        spaces.push_back(space);
+    }
+}
+
+RegisteredHandles::~RegisteredHandles()
+{
+    OverlaysLayerRemoveXrSwapchainsFromHandleInfoMap(swapchains);
+    OverlaysLayerRemoveXrSpacesFromHandleInfoMap(spaces);
+}
+
+FrameSubmission::FrameSubmission(uint32_t projectionCount, uint32_t quadCount, const RegisteredHandles& handles) :
+    views(projectionCount * 2),
+    projections(projectionCount),
+    quads(quadCount)
+{
+    uint32_t handleIndex = 0;
+
+    for(uint32_t i = 0; i < projectionCount; i++) {
+        for(uint32_t eye = 0; eye < 2; eye++) {
+            XrCompositionLayerProjectionView& view = views[i * 2 + eye];
+            view = {XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW};
+            view.pose.orientation.w = 1.0f;
+            view.pose.position = {eye ? 0.032f : -0.032f, 1.6f, 0.0f};
+            view.fov = {-0.8f - i * 0.01f, 0.8f, 0.75f, -0.75f};
+            view.subImage.swapchain = handles.swapchains[handleIndex % handles.swapchains.size()];
+            view.subImage.imageRect = {{int32_t(eye * 1440), 0}, {1440, 1600}};
+            view.subImage.imageArrayIndex = 0;
+        }
+
+        XrCompositionLayerProjection& projection = projections[i];
+        projection = {XR_TYPE_COMPOSITION_LAYER_PROJECTION};
+        projection.layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT;
+        projection.space = handles.spaces[handleIndex % handles.spaces.size()];
+        projection.viewCount = 2;
+        projection.views = &views[i * 2];
+        layers.push_back(reinterpret_cast<const XrCompositionLayerBaseHeader*>(&projection));
+        handleIndex++;
+    }
+
+    for(uint32_t i = 0; i < quadCount; i++) {
+        XrCompositionLayerQuad& quad = quads[i];
+        quad = {XR_TYPE_COMPOSITION_LAYER_QUAD};
+        quad.space = handles.spaces[handleIndex % handles.spaces.size()];
+        quad.eyeVisibility = XR_EYE_VISIBILITY_BOTH;
+        quad.subImage.swapchain = handles.swapchains[handleIndex % handles.swapchains.size()];
+        quad.subImage.imageRect = {{0, 0}, {512, 512}};
+        quad.pose.orientation.w = 1.0f;
+        quad.pose.position = {0.0f, 1.5f, -1.0f - i * 0.1f};
+        quad.size = {0.5f, 0.5f};
+        layers.push_back(reinterpret_cast<const XrCompositionLayerBaseHeader*>(&quad));
+        handleIndex++;
+    }
+
+    endInfo = {XR_TYPE_FRAME_END_INFO};
+    endInfo.displayTime = 123456789;
+    endInfo.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
+    endInfo.layerCount = uint32_t(layers.size());
+    endInfo.layers = layers.data();
+}
+
+ActionRequests::ActionRequests(uint32_t count)
+{
+    // Actions and action sets keep the runtime's handles in this layer
+    for(uint32_t i = 0; i < count; i++) {
+        activeSets.push_back({(XrActionSet)uint64_t(0x1000 + i), XR_NULL_PATH});
+    }
+    syncInfo = {XR_TYPE_ACTIONS_SYNC_INFO};
+    syncInfo.countActiveActionSets = uint32_t(activeSets.size());
+    syncInfo.activeActionSets = activeSets.data();
+
+    for(uint32_t i = 0; i < count; i++) {
+        bindings.push_back({(XrAction)uint64_t(0x2000 + i), XrPath(1000 + i)});
+    }
+    suggestedBindings = {XR_TYPE_INTERACTION_PROFILE_SUGGESTED_BINDING};
+    suggestedBindings.interactionProfile = XrPath(42);
+    suggestedBindings.countSuggestedBindings = uint32_t(bindings.size());
+    suggestedBindings.suggestedBindings = bindings.data();
+}
+
+SessionCreation::SessionCreation() :
+    extensions{XR_EXTX_OVERLAY_EXTENSION_NAME, "XR_KHR_convert_timespec_time", "XR_EXT_debug_utils"}
+{
+    instanceCreateInfo = {XR_TYPE_INSTANCE_CREATE_INFO};
+    strncpy_s(instanceCreateInfo.applicationInfo.applicationName, "overlay layer test", XR_MAX_APPLICATION_NAME_SIZE);
+    instanceCreateInfo.applicationInfo.applicationVersion = 1;
+    strncpy_s(instanceCreateInfo.applicationInfo.engineName, "none", XR_MAX_ENGINE_NAME_SIZE);
+    instanceCreateInfo.applicationInfo.apiVersion = XR_CURRENT_API_VERSION;
+    instanceCreateInfo.enabledExtensionCount = uint32_t(extensions.size());
+    instanceCreateInfo.enabledExtensionNames = extensions.data();
+
+    overlayInfo = {XR_TYPE_SESSION_CREATE_INFO_OVERLAY_EXTX};
+    overlayInfo.sessionLayersPlacement = 1;
+
+    createInfo = {XR_TYPE_SESSION_CREATE_INFO};
+    createInfo.next = &overlayInfo;
+    createInfo.systemId = XrSystemId(1);
+}
+
+RepresentativeChains::RepresentativeChains()
+{
+    velocity.velocityFlags = XR_SPACE_VELOCITY_LINEAR_VALID_BIT;
+    velocity.linearVelocity = {0.1f, 0.2f, 0.3f};
+    location.next = &velocity;
+    location.locationFlags = XR_SPACE_LOCATION_POSITION_VALID_BIT;
+    location.pose.orientation.w = 1.0f;
+}
+
+std::vector<const XrBaseInStructure*> RepresentativeChains::All() const
+{
+    return {
+        reinterpret_cast<const XrBaseInStructure*>(&frame.endInfo),
+        reinterpret_cast<const XrBaseInStructure*>(&actions.syncInfo),
+        reinterpret_cast<const XrBaseInStructure*>(&actions.suggestedBindings),
+        reinterpret_cast<const XrBaseInStructure*>(&session.instanceCreateInfo),
+        reinterpret_cast<const XrBaseInStructure*>(&session.createInfo),
+        reinterpret_cast<const XrBaseInStructure*>(&location),
+    };
+}
@@ -0,0 +1,226 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef _LAYER_TEST_SUPPORT_H_
+#define _LAYER_TEST_SUPPORT_H_
+
+#include "overlays.h"
+#include "xr_generated_overlays.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Minimal harness shared by the test programs.  Each test is a function
+// registered by name; main() runs the one named on the command line, or
+// all of them, and exits nonzero if any CHECK failed.
+extern int gTestFailures;
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            gTestFailures++; \
+        } \
+    } while(0)
+
+struct TestCase
+{
+    const char* name;
+    void (*function)();
+};
+
+int RunTests(const TestCase* tests, size_t count, int argc, char **argv);
+
+#if !defined(_WIN32)
+
+// Run "f" in a child process.  A Main session's negotiation thread lives
+// until its process exits, so tests and benchmarks that make one do it
+// in a child and leave this process as they found it.
+template <class Function>
+void RunInChildProcess(Function f)
+{
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0) {
+        f();
+        fflush(stdout);
+        _exit((gTestFailures == 0) ? 0 : 1);
+    }
+
+    int status;
+    waitpid(child, &status, 0);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+}
+
+#endif
+
+// Swapchains and spaces registered in the layer's tables as if the layer
+// had made them, standing for actual handles "actualBase" and up.  The
+// infos are marked proxied so dropping them doesn't call a runtime.
+struct RegisteredHandles
+{
+    std::vector<XrSwapchain> swapchains;
+    std::vector<XrSpace> spaces;
+
+    RegisteredHandles(uint32_t count, uint64_t actualBase);
+    ~RegisteredHandles();
+};
+
+// Actual handle the layer should substitute for local handle "index" of
+// a RegisteredHandles made with "actualBase"
+template <typename Handle>
+Handle ActualHandleFor(uint64_t actualBase, uint32_t index)
+{
+    return (Handle)(actualBase + index);
+}
+
+// An xrEndFrame submission like an app's: "projectionCount" stereo
+// projection layers followed by "quadCount" quad layers, each layer on
+// its own swapchain and space from "handles"
+struct FrameSubmission
+{
+    std::vector<XrCompositionLayerProjectionView> views;
+    std::vector<XrCompositionLayerProjection> projections;
+    std::vector<XrCompositionLayerQuad> quads;
+    std::vector<const XrCompositionLayerBaseHeader*> layers;
+    XrFrameEndInfo endInfo;
+
+    FrameSubmission(uint32_t projectionCount, uint32_t quadCount, const RegisteredHandles& handles);
+    FrameSubmission(const FrameSubmission&) = delete;
+    FrameSubmission& operator=(const FrameSubmission&) = delete;
+};
+
+// Action sync and binding suggestion requests over "count" action sets
+// and actions
+struct ActionRequests
+{
+    std::vector<XrActiveActionSet> activeSets;
+    XrActionsSyncInfo syncInfo;
+    std::vector<XrActionSuggestedBinding> bindings;
+    XrInteractionProfileSuggestedBinding suggestedBindings;
+
+    explicit ActionRequests(uint32_t count);
+    ActionRequests(const ActionRequests&) = delete;
+    ActionRequests& operator=(const ActionRequests&) = delete;
+};
+
+// Session creation chain as an Overlay app makes it, and the instance
+// creation info it came from
+struct SessionCreation
+{
+    std::vector<const char*> extensions;
+    XrInstanceCreateInfo instanceCreateInfo;
+    XrSessionCreateInfoOverlayEXTX overlayInfo;
+    XrSessionCreateInfo createInfo;
+
+    SessionCreation();
+    SessionCreation(const SessionCreation&) = delete;
+    SessionCreation& operator=(const SessionCreation&) = delete;
+};
+
+// Chains the layer copies, one of each shape: arrays of pointers to
+// structs, arrays of structs, strings, and next chains
+struct RepresentativeChains
+{
+    constexpr static uint64_t actualBase = 0x10000;
+
+    RegisteredHandles handles{4, actualBase};
+    FrameSubmission frame{2, 3, handles};
+    ActionRequests actions{5};
+    SessionCreation session;
+    XrSpaceVelocity velocity{XR_TYPE_SPACE_VELOCITY};
+    XrSpaceLocation location{XR_TYPE_SPACE_LOCATION};
+
+    RepresentativeChains();
+    RepresentativeChains(const RepresentativeChains&) = delete;
+    RepresentativeChains& operator=(const RepresentativeChains&) = delete;
+
+    std::vector<const XrBaseInStructure*> All() const;
+};
+
+// Seeded random values for the struct fixtures generate.py makes, and
+// the storage everything they point to lives in
+struct XrStructFixtureArena
+{
+    std::mt19937_64 random;
+    std::vector<std::unique_ptr<uint64_t[]>> blocks;
+
+    explicit XrStructFixtureArena(uint64_t seed) : random(seed) {}
+    XrStructFixtureArena(const XrStructFixtureArena&) = delete;
+    XrStructFixtureArena& operator=(const XrStructFixtureArena&) = delete;
+
+    // "count" zeroed Ts, never nullptr even for none
+    template <typename T>
+    T* New(size_t count = 1)
+    {
+        blocks.emplace_back(new uint64_t[(sizeof(T) * count + sizeof(uint64_t) - 1) / sizeof(uint64_t) + 1]());
+        return reinterpret_cast<T*>(blocks.back().get());
+    }
+
+    uint64_t Bits() { return random(); }
+    uint32_t Below(uint32_t n) { return uint32_t(random() % n); }
+    uint64_t Handle() { return random() | 1; }
+    float Real() { return float(int64_t(random() % 20001) - 10000) / 100.0f; }
+
+    // 1 to 31 printable characters, but no more than fit
+    void FillString(char* s, size_t capacity)
+    {
+        size_t length = 1 + Below(uint32_t(std::min<size_t>(capacity - 1, 31)));
+        for(size_t i = 0; i < length; i++) {
+            s[i] = char('a' + Below(26));
+        }
+        s[length] = '\0';
+    }
+
+    const char* String()
+    {
+        char* s = New<char>(32);
+        FillString(s, 32);
+        return s;
+    }
+
+    void FillBytes(void* p, size_t size)
+    {
+        for(size_t i = 0; i < size; i++) {
+            static_cast<unsigned char*>(p)[i] = static_cast<unsigned char>(random());
+        }
+    }
+};
+
+// A struct type with a fixture, for every type with an XrStructureType
+// in generate.py's supported_structs except those holding runtime objects
+struct XrStructFixtureType
+{
+    const char* name;
+    XrStructureType type;
+    size_t size;
+    bool copiedOut;     // Main returns its output members to Overlay through IPCCopyOut
+    XrBaseInStructure* (*make)(XrStructFixtureArena& arena);
+};
+
+extern const std::vector<XrStructFixtureType> gXrStructFixtureTypes;
+
+#endif /* _LAYER_TEST_SUPPORT_H_ */
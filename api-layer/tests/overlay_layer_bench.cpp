@@ -0,0 +1,844 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks of the layer's own costs, with the fake runtime below it.
+// Run with no arguments for every benchmark, or name one; "--quick" cuts
+// the iteration counts so a run only checks the benchmarks still work.
+// Numbers are only worth comparing from a Release build.
+
+#include "layer_test_support.h"
+#include "fake_runtime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+uint64_t gIterationDivisor = 1;
+
+uint64_t Iterations(uint64_t count)
+{
+    return std::max<uint64_t>(1, count / gIterationDivisor);
+}
+
+// Best of a few runs of "count" calls of "f", in nanoseconds per call,
+// so a preemption in one run doesn't skew the result
+template <class Function>
+double NanosecondsPerCall(uint64_t count, Function f)
+{
+    double best = 0;
+    for(int run = 0; run < 5; run++) {
+        uint64_t start = IPCGetTimestampNanoseconds();
+        for(uint64_t i = 0; i < count; i++) {
+            f(i);
+        }
+        double perCall = double(IPCGetTimestampNanoseconds() - start) / count;
+        best = (run == 0) ? perCall : std::min(best, perCall);
+    }
+    return best;
+}
+
+// Like NanosecondsPerCall but with "threadCount" threads each making
+// "countPerThread" calls of "f(thread, i)" at once; the result is wall
+// time over all calls, so it drops as threads scale
+template <class Function>
+double NanosecondsPerCallOnThreads(uint32_t threadCount, uint64_t countPerThread, Function f)
+{
+    double best = 0;
+    for(int run = 0; run < 5; run++) {
+        std::atomic<bool> go{false};
+        std::vector<std::thread> threads;
+        for(uint32_t t = 0; t < threadCount; t++) {
+            threads.emplace_back([&, t]() {
+                while(!go.load()) {
+                    std::this_thread::yield();
+                }
+                for(uint64_t i = 0; i < countPerThread; i++) {
+                    f(t, i);
+                }
+            });
+        }
+        uint64_t start = IPCGetTimestampNanoseconds();
+        go = true;
+        for(auto& thread: threads) {
+            thread.join();
+        }
+        double perCall = double(IPCGetTimestampNanoseconds() - start) / (countPerThread * threadCount);
+        best = (run == 0) ? perCall : std::min(best, perCall);
+    }
+    return best;
+}
+
+// This thread's last-level cache misses, where the kernel and hardware
+// expose them; virtual machines often don't
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+#if defined(__linux__)
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if(fd < 0) {
+            unavailableReason = strerror(errno);
+        }
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#if defined(__linux__)
+        if(fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    bool Available() const { return fd >= 0; }
+    const std::string& UnavailableReason() const { return unavailableReason; }
+
+    void Start()
+    {
+#if defined(__linux__)
+        if(fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t Stop()
+    {
+        uint64_t count = 0;
+#if defined(__linux__)
+        if(fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if(read(fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd = -1;
+    std::string unavailableReason = "not supported on this platform";
+};
+
+void Report(const char* benchmark, const std::string& variant, double nanoseconds, const char* extra = "")
+{
+    printf("%-20s %-52s %10.1f ns/call %s\n", benchmark, variant.c_str(), nanoseconds, extra);
+    fflush(stdout);
+}
+
+// Deep copies of representative chains by each of the layer's
+// allocators: malloc for copies that outlive the call, the per-thread
+// scratch arena for downchain copies, and an RPC slot for requests
+void BenchCopyThroughput()
+{
+    RepresentativeChains chains;
+    static const char* names[] = {
+        "xrEndFrame, 2 projections + 3 quads",
+        "xrSyncActions, 5 sets",
+        "xrSuggestInteractionProfileBindings, 5",
+        "xrCreateInstance, 3 extensions",
+        "xrCreateSession + overlay",
+        "xrLocateSpace + velocity",
+    };
+    std::vector<const XrBaseInStructure*> all = chains.All();
+
+    const size_t slotSize = 64 * 1024;
+    std::vector<uint64_t> slot(slotSize / sizeof(uint64_t));
+
+    for(size_t c = 0; c < all.size(); c++) {
+        const XrBaseInStructure* chain = all[c];
+        size_t size = XrStructChainSerializedSize(XR_NULL_HANDLE, chain);
+        uint64_t count = Iterations(200000);
+
+        double nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+            FreeXrStructChainWithFree(XR_NULL_HANDLE, CopyXrStructChainWithMalloc(XR_NULL_HANDLE, chain));
+        });
+        Report("copy_throughput", fmt("malloc: %s", names[c]), nanoseconds, fmt("(%zu bytes, %.0f MB/s)", size, size * 1e3 / nanoseconds).c_str());
+
+        nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+            ScratchArena::Free(CopyXrStructChainWithScratch(XR_NULL_HANDLE, chain));
+        });
+        Report("copy_throughput", fmt("scratch: %s", names[c]), nanoseconds, fmt("(%zu bytes, %.0f MB/s)", size, size * 1e3 / nanoseconds).c_str());
+
+        nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+            IPCBuffer ipcbuf(slot.data(), slotSize);
+            IPCHeader* header = new(ipcbuf) IPCHeader(0, 1, false, slotSize);
+            CHECK(IPCSerialize(XR_NULL_HANDLE, ipcbuf, header, chain, COPY_EVERYTHING) != nullptr);
+        });
+        Report("copy_throughput", fmt("rpc slot: %s", names[c]), nanoseconds, fmt("(%zu bytes, %.0f MB/s)", size, size * 1e3 / nanoseconds).c_str());
+    }
+
+    // What xrEndFrame actually does on its way downchain
+    double nanoseconds = NanosecondsPerCall(Iterations(200000), [&](uint64_t) {
+        GetSharedCopyHandlesRestored(XR_NULL_HANDLE, "xrEndFrame", &chains.frame.endInfo);
+    });
+    Report("copy_throughput", "handles restored: xrEndFrame", nanoseconds);
+}
+
+// Copies of each struct type's generated fixtures, a row per type: ns per
+// top-level struct copied with malloc and freed, then serialized into an
+// RPC slot.  Sizes are the mean over the fixtures' random arrays and
+// strings.
+void BenchCopyPerType()
+{
+    const uint32_t fixtureCount = 16;
+    const size_t slotSize = 64 * 1024;
+    std::vector<uint64_t> slot(slotSize / sizeof(uint64_t));
+
+    for(const auto& type: gXrStructFixtureTypes) {
+        XrStructFixtureArena arena(1);
+        std::vector<const XrBaseInStructure*> fixtures;
+        size_t totalSize = 0;
+        for(uint32_t i = 0; i < fixtureCount; i++) {
+            fixtures.push_back(type.make(arena));
+            totalSize += XrStructChainSerializedSize(XR_NULL_HANDLE, fixtures.back());
+        }
+        double size = double(totalSize) / fixtureCount;
+        uint64_t count = Iterations(200000);
+
+        double mallocNanoseconds = NanosecondsPerCall(count, [&](uint64_t i) {
+            FreeXrStructChainWithFree(XR_NULL_HANDLE, CopyXrStructChainWithMalloc(XR_NULL_HANDLE, fixtures[i % fixtureCount]));
+        });
+
+        double slotNanoseconds = NanosecondsPerCall(count, [&](uint64_t i) {
+            IPCBuffer ipcbuf(slot.data(), slotSize);
+            IPCHeader* header = new(ipcbuf) IPCHeader(0, 1, false, slotSize);
+            CHECK(IPCSerialize(XR_NULL_HANDLE, ipcbuf, header, fixtures[i % fixtureCount], COPY_EVERYTHING) != nullptr);
+        });
+
+        Report("copy_per_type", fmt("malloc: %s", type.name), mallocNanoseconds,
+            fmt("(%.0f bytes, %.0f MB/s; rpc slot %.1f ns, %.0f MB/s)", size, size * 1e3 / mallocNanoseconds, slotNanoseconds, size * 1e3 / slotNanoseconds).c_str());
+    }
+}
+
+// Handle info lookups as every generated entry point makes them, from
+// several threads at once as a main app's render and input threads and
+// the RPC threads serving overlays do.  "mutex map" is how the generated
+// lookups worked before the tables went lock-free, for comparison.
+void BenchHandleLookup()
+{
+    const uint32_t handleCount = 64;
+    RegisteredHandles handles{handleCount, RepresentativeChains::actualBase};
+
+    std::vector<XrAction> actions;
+    for(uint32_t i = 0; i < handleCount; i++) {
+        XrAction action = (XrAction)uint64_t(0x3000 + i);
+        auto info = std::make_shared<OverlaysLayerXrActionHandleInfo>(XR_NULL_HANDLE, XR_NULL_HANDLE, nullptr);
+        info->handle = action;
+        OverlaysLayerAddHandleInfoForXrAction(action, info);
+        actions.push_back(action);
+    }
+
+    std::recursive_mutex mutexMapMutex;
+    std::unordered_map<XrSpace, OverlaysLayerXrSpaceHandleInfo::Ptr> mutexMap;
+    for(XrSpace space: handles.spaces) {
+        mutexMap[space] = OverlaysLayerGetHandleInfoFromXrSpace(space);
+    }
+
+    // Keeps the lookups from being optimized away
+    std::atomic<uint64_t> sink{0};
+
+    for(uint32_t threadCount: {1, 2, 4}) {
+        uint64_t count = Iterations(1000000);
+
+        double nanoseconds = NanosecondsPerCallOnThreads(threadCount, count, [&](uint32_t, uint64_t i) {
+            OverlaysLayerXrSpaceHandleInfo::Ptr info;
+            {
+                std::unique_lock<std::recursive_mutex> lock(mutexMapMutex);
+                info = mutexMap.at(handles.spaces[i % handleCount]);
+            }
+            if(info->actualHandle == XR_NULL_HANDLE) {
+                sink++;
+            }
+        });
+        Report("handle_lookup", fmt("%u threads: XrSpace, mutex map", threadCount), nanoseconds, fmt("(%.1f M/s)", 1e3 / nanoseconds).c_str());
+
+        nanoseconds = NanosecondsPerCallOnThreads(threadCount, count, [&](uint32_t, uint64_t i) {
+            OverlaysLayerXrSpaceHandleInfo::Ptr info = OverlaysLayerGetHandleInfoFromXrSpace(handles.spaces[i % handleCount]);
+            if(info->actualHandle == XR_NULL_HANDLE) {
+                sink++;
+            }
+        });
+        Report("handle_lookup", fmt("%u threads: XrSpace, slot table Get", threadCount), nanoseconds, fmt("(%.1f M/s)", 1e3 / nanoseconds).c_str());
+
+        nanoseconds = NanosecondsPerCallOnThreads(threadCount, count, [&](uint32_t, uint64_t i) {
+            OverlaysLayerXrActionHandleInfo::Ptr info = OverlaysLayerGetHandleInfoFromXrAction(actions[i % handleCount]);
+            if(info->handle == XR_NULL_HANDLE) {
+                sink++;
+            }
+        });
+        Report("handle_lookup", fmt("%u threads: XrAction, hash map Get", threadCount), nanoseconds, fmt("(%.1f M/s)", 1e3 / nanoseconds).c_str());
+    }
+    CHECK(sink == 0);
+
+    OverlaysLayerRemoveXrActionsFromHandleInfoMap(actions);
+}
+
+// What a generated entry point pays to reach its handle's info: taking
+// a shared_ptr to it, or borrowing it under an EpochReadGuard.  Every
+// thread looks up the same handle, as the render thread, input thread and
+// RPC threads all reach the one XrSession, so with Get they all change
+// the same reference count.
+void BenchBorrowVersusGet()
+{
+    RegisteredHandles handles{1, RepresentativeChains::actualBase};
+    XrSpace space = handles.spaces[0];
+    std::atomic<uint64_t> sink{0};
+
+    for(uint32_t threadCount: {1, 2, 4}) {
+        uint64_t count = Iterations(1000000);
+
+        double nanoseconds = NanosecondsPerCallOnThreads(threadCount, count, [&](uint32_t, uint64_t) {
+            OverlaysLayerXrSpaceHandleInfo::Ptr info;
+            if((OverlaysLayerTryGetHandleInfoFromXrSpace(space, info) != XR_SUCCESS) || (info->actualHandle == XR_NULL_HANDLE)) {
+                sink++;
+            }
+        });
+        Report("borrow_vs_get", fmt("%u threads: TryGet, shared_ptr", threadCount), nanoseconds);
+
+        nanoseconds = NanosecondsPerCallOnThreads(threadCount, count, [&](uint32_t, uint64_t) {
+            EpochReadGuard guard;
+            OverlaysLayerXrSpaceHandleInfo* info;
+            if((OverlaysLayerTryBorrowHandleInfoFromXrSpace(space, &info) != XR_SUCCESS) || (info->actualHandle == XR_NULL_HANDLE)) {
+                sink++;
+            }
+        });
+        Report("borrow_vs_get", fmt("%u threads: EpochReadGuard + TryBorrow", threadCount), nanoseconds);
+    }
+    CHECK(sink == 0);
+}
+
+// Byte offset of "member" in "object"; offsetof isn't defined for these
+// structs since they aren't standard layout
+template <class Object>
+size_t OffsetIn(const Object& object, const void* member)
+{
+    return size_t(reinterpret_cast<const char*>(member) - reinterpret_cast<const char*>(&object));
+}
+
+// Where the per-call members of the XrSession and XrInstance infos fall,
+// and what an entry point pays to reach them when the infos aren't in
+// cache, as with many sessions or after the app has thrashed the cache
+// between frames.  Reaching into the cold part costs another miss.
+void BenchHotColdLayout()
+{
+    const size_t cacheLine = 64;
+
+    // The per-call members are those before procMutex, which is only
+    // taken with per-handle locking
+    OverlaysLayerXrSessionHandleInfo session(XR_NULL_HANDLE, XR_NULL_HANDLE, nullptr);
+    session.isProxied = true;
+    size_t sessionHotEnd = OffsetIn(session, &session.procMutex);
+    printf("%-20s %-52s per-call members in bytes 0-%zu (%zu 64-byte lines); %zu bytes if cold were inline\n", "hot_cold_layout",
+        fmt("XrSession info: %zu bytes + %zu cold", sizeof(session), sizeof(*session.cold)).c_str(),
+        sessionHotEnd, (sessionHotEnd + cacheLine - 1) / cacheLine, sizeof(session) + sizeof(*session.cold) - sizeof(session.cold));
+
+    OverlaysLayerXrInstanceHandleInfo instance(nullptr);
+    size_t instanceHotEnd = OffsetIn(instance, &instance.procMutex);
+    printf("%-20s %-52s per-call members in bytes 0-%zu (%zu 64-byte lines); %zu bytes if cold were inline\n", "hot_cold_layout",
+        fmt("XrInstance info: %zu bytes + %zu cold", sizeof(instance), sizeof(*instance.cold)).c_str(),
+        instanceHotEnd, (instanceHotEnd + cacheLine - 1) / cacheLine, sizeof(instance) + sizeof(*instance.cold) - sizeof(instance.cold));
+
+    CacheMissCounter misses;
+    if(!misses.Available()) {
+        printf("hot_cold_layout: no cache miss counter (%s); timing only\n", misses.UnavailableReason().c_str());
+    }
+
+    // Enough sessions that they don't fit in cache, visited in an order
+    // the prefetcher can't follow
+    for(uint32_t sessionCount: {256, 65536}) {
+        std::vector<OverlaysLayerXrSessionHandleInfo::Ptr> sessions;
+        for(uint32_t i = 0; i < sessionCount; i++) {
+            sessions.push_back(std::make_shared<OverlaysLayerXrSessionHandleInfo>(XR_NULL_HANDLE, XR_NULL_HANDLE, nullptr));
+            sessions.back()->isProxied = true;
+            sessions.back()->actualHandle = (XrSession)uint64_t(i + 1);
+        }
+        std::vector<uint32_t> order(sessionCount);
+        for(uint32_t i = 0; i < sessionCount; i++) {
+            order[i] = uint32_t((uint64_t(i) * 40503) % sessionCount);
+        }
+
+        uint64_t count = Iterations(4000000);
+        uint64_t sink = 0;
+        for(bool touchCold: {false, true}) {
+            misses.Start();
+            double nanoseconds = NanosecondsPerCall(count, [&](uint64_t i) {
+                const OverlaysLayerXrSessionHandleInfo* info = sessions[order[i % sessionCount]].get();
+                if(info->isProxied && info->valid) {
+                    sink += uint64_t(info->actualHandle) + uint64_t(info->parentInstance) + (info->downchain ? 1 : 0);
+                }
+                if(touchCold) {
+                    sink += info->cold->interactionProfiles.size();
+                }
+            });
+            uint64_t missCount = misses.Stop();
+            std::string variant = fmt("%u sessions: %s", sessionCount, touchCold ? "per-call + cold members" : "per-call members");
+            Report("hot_cold_layout", variant, nanoseconds,
+                misses.Available() ? fmt("(%.2f cache misses/call)", double(missCount) / (count * 5)).c_str() : "");
+        }
+        CHECK(sink != 0);
+    }
+}
+
+#if !defined(_WIN32)
+
+// Overlay side of BenchRPCRoundTrip: connect to Main and time RPCs as
+// the Overlay side of the layer makes them, each with the handles and
+// well-known strings Main expects.  Ping has a few payload sizes; the
+// largest doesn't fit in a slot and goes through an overflow segment.
+void RunRoundTripOverlay(int mainReadyFd)
+{
+    char ready;
+    if(read(mainReadyFd, &ready, 1) != 1) {
+        fprintf(stderr, "Overlay didn't hear from Main\n");
+        gTestFailures++;
+        return;
+    }
+
+    SessionCreation creation;
+    LayeredInstance overlay;
+    if(overlay.Create(&creation.instanceCreateInfo) != XR_SUCCESS) {
+        fprintf(stderr, "Overlay couldn't create an instance\n");
+        gTestFailures++;
+        return;
+    }
+
+    creation.createInfo.systemId = overlay.systemId;
+    XrSession session;
+    if(overlay.Get<PFN_xrCreateSession>("xrCreateSession")(overlay.instance, &creation.createInfo, &session) != XR_SUCCESS) {
+        fprintf(stderr, "Overlay couldn't connect to Main\n");
+        gTestFailures++;
+        return;
+    }
+    XrSession actualSession = OverlaysLayerGetHandleInfoFromXrSession(session)->actualHandle;
+
+    static const uint32_t payloadSizes[] = {0, 4 * 1024, 64 * 1024, 1024 * 1024};
+    std::vector<uint8_t> payload(*std::max_element(std::begin(payloadSizes), std::end(payloadSizes)), 0x5a);
+
+    for(uint32_t payloadSize: payloadSizes) {
+        uint64_t count = Iterations(payloadSize > 64 * 1024 ? 2000 : 20000);
+        double nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+            CHECK(RPCCallPing(overlay.instance, payloadSize, payload.data()) == XR_SUCCESS);
+        });
+        Report("rpc_round_trip", fmt("Ping, %u byte payload", payloadSize), nanoseconds,
+            fmt("(%.1f MB/s)", payloadSize * 1e3 / nanoseconds).c_str());
+    }
+
+    // Locating one reference space in another; Main locates them in the
+    // runtime
+    auto createReferenceSpace = overlay.Get<PFN_xrCreateReferenceSpace>("xrCreateReferenceSpace");
+    XrReferenceSpaceCreateInfo spaceCreateInfo{XR_TYPE_REFERENCE_SPACE_CREATE_INFO};
+    spaceCreateInfo.poseInReferenceSpace.orientation.w = 1.0f;
+    XrSpace spaces[2];
+    spaceCreateInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_VIEW;
+    CHECK(createReferenceSpace(session, &spaceCreateInfo, &spaces[0]) == XR_SUCCESS);
+    spaceCreateInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_LOCAL;
+    CHECK(createReferenceSpace(session, &spaceCreateInfo, &spaces[1]) == XR_SUCCESS);
+    XrSpace actualSpace = OverlaysLayerGetHandleInfoFromXrSpace(spaces[0])->actualHandle;
+    XrSpace actualBaseSpace = OverlaysLayerGetHandleInfoFromXrSpace(spaces[1])->actualHandle;
+    {
+        double nanoseconds = NanosecondsPerCall(Iterations(20000), [&](uint64_t i) {
+            XrSpaceLocation location{XR_TYPE_SPACE_LOCATION};
+            CHECK(RPCCallLocateSpace(overlay.instance, actualSpace, actualBaseSpace, XrTime(i + 1), &location) == XR_SUCCESS);
+        });
+        Report("rpc_round_trip", "LocateSpace", nanoseconds, fmt("(%.0f calls/s)", 1e9 / nanoseconds).c_str());
+    }
+
+    // Syncing actions and getting the state of "bindingCount" bindings,
+    // which Main gets from its placeholder actions, along with the
+    // interaction profile of each top level path those bindings are on
+    std::vector<const PlaceholderActionId*> inputs;
+    for(const auto& id: PlaceholderActionIds) {
+        if(id.type != XR_ACTION_TYPE_VIBRATION_OUTPUT) {
+            inputs.push_back(&id);
+        }
+    }
+    for(uint32_t bindingCount: {1, 8, 64}) {
+        CHECK(bindingCount <= inputs.size());
+        std::vector<WellKnownStringIndex> profileStrings;
+        std::vector<WellKnownStringIndex> bindingStrings;
+        std::vector<WellKnownStringIndex> topLevelStrings;
+        for(uint32_t i = 0; i < bindingCount; i++) {
+            profileStrings.push_back(inputs[i]->interactionProfileString);
+            bindingStrings.push_back(inputs[i]->fullBindingString);
+            if(std::find(topLevelStrings.begin(), topLevelStrings.end(), inputs[i]->subActionString) == topLevelStrings.end()) {
+                topLevelStrings.push_back(inputs[i]->subActionString);
+            }
+        }
+        std::vector<ActionStateUnion> states(bindingCount);
+        std::vector<WellKnownStringIndex> interactionProfileStrings(topLevelStrings.size());
+
+        double nanoseconds = NanosecondsPerCall(Iterations(20000), [&](uint64_t) {
+            CHECK(RPCCallSyncActionsAndGetState(overlay.instance, actualSession, bindingCount, profileStrings.data(), bindingStrings.data(), states.data(),
+                uint32_t(topLevelStrings.size()), topLevelStrings.data(), interactionProfileStrings.data()) == XR_SUCCESS);
+        });
+        Report("rpc_round_trip", fmt("SyncActionsAndGetState, %u bindings", bindingCount), nanoseconds,
+            fmt("(%.0f bindings/s)", bindingCount * 1e9 / nanoseconds).c_str());
+    }
+
+    // A frame with "layerCount" quad layers: WaitFrame's round trip, and
+    // BeginFrame and SubmitFrame posted behind it.  SubmitFrame isn't
+    // waited for, so each frame's WaitFrame also waits for the last
+    // frame's layers to be taken.  Overlays can't make swapchains here,
+    // so the quads name a made-up one, which Main only copies.
+    XrSwapchain madeUpSwapchain = XrSwapchain(uint64_t(0x5a5a));
+    for(uint32_t layerCount: {1u, 4u, uint32_t(MainAsOverlaySessionContext::maxOverlayCompositionLayers)}) {
+        std::vector<XrCompositionLayerQuad> quads(layerCount, XrCompositionLayerQuad{XR_TYPE_COMPOSITION_LAYER_QUAD});
+        std::vector<const XrCompositionLayerBaseHeader*> layers;
+        for(auto& quad: quads) {
+            quad.space = actualBaseSpace;
+            quad.subImage.swapchain = madeUpSwapchain;
+            quad.subImage.imageRect.extent = {512, 512};
+            quad.pose.orientation.w = 1.0f;
+            quad.size = {1.0f, 1.0f};
+            layers.push_back(reinterpret_cast<const XrCompositionLayerBaseHeader*>(&quad));
+        }
+
+        double nanoseconds = NanosecondsPerCall(Iterations(20000), [&](uint64_t) {
+            XrFrameState frameState{XR_TYPE_FRAME_STATE};
+            CHECK(RPCCallWaitFrame(overlay.instance, actualSession, nullptr, &frameState) == XR_SUCCESS);
+            CHECK(RPCCallBeginFrame(overlay.instance, actualSession, nullptr) == XR_SUCCESS);
+
+            XrFrameEndInfo endInfo{XR_TYPE_FRAME_END_INFO};
+            endInfo.displayTime = frameState.predictedDisplayTime;
+            endInfo.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
+            endInfo.layerCount = layerCount;
+            endInfo.layers = layers.data();
+            CHECK(RPCCallSubmitFrame(overlay.instance, actualSession, 0, nullptr, nullptr, &endInfo) == XR_SUCCESS);
+        });
+        Report("rpc_round_trip", fmt("WaitFrame + BeginFrame + SubmitFrame, %u quad layers", layerCount), nanoseconds,
+            fmt("(%.0f frames/s)", 1e9 / nanoseconds).c_str());
+    }
+
+    // Collects the last frame's result
+    XrFrameState frameState{XR_TYPE_FRAME_STATE};
+    CHECK(RPCCallWaitFrame(overlay.instance, actualSession, nullptr, &frameState) == XR_SUCCESS);
+
+    auto destroySpace = overlay.Get<PFN_xrDestroySpace>("xrDestroySpace");
+    destroySpace(spaces[0]);
+    destroySpace(spaces[1]);
+    overlay.Get<PFN_xrDestroySession>("xrDestroySession")(session);
+    overlay.Destroy();
+}
+
+// Main side of BenchRPCRoundTrip: a headless session for the Overlay to
+// connect to, with one frame for Overlay's WaitFrame to start from, held
+// until the Overlay is done
+void RunRoundTripMain()
+{
+    UnlinkNegotiationChannels();
+
+    int mainReady[2];
+    CHECK(pipe(mainReady) == 0);
+
+    // Before anything here starts a thread
+    fflush(stdout);
+    pid_t overlayProcess = fork();
+    if(overlayProcess == 0) {
+        close(mainReady[1]);
+        RunRoundTripOverlay(mainReady[0]);
+        fflush(stdout);
+        _exit((gTestFailures == 0) ? 0 : 1);
+    }
+    close(mainReady[0]);
+
+    SessionCreation creation;
+    LayeredInstance main;
+    CHECK(main.Create(&creation.instanceCreateInfo) == XR_SUCCESS);
+
+    XrSessionCreateInfo createInfo{XR_TYPE_SESSION_CREATE_INFO};
+    createInfo.systemId = main.systemId;
+    XrSession session;
+    CHECK(main.Get<PFN_xrCreateSession>("xrCreateSession")(main.instance, &createInfo, &session) == XR_SUCCESS);
+
+    XrFrameState frameState{XR_TYPE_FRAME_STATE};
+    CHECK(main.Get<PFN_xrWaitFrame>("xrWaitFrame")(session, nullptr, &frameState) == XR_SUCCESS);
+    CHECK(main.Get<PFN_xrBeginFrame>("xrBeginFrame")(session, nullptr) == XR_SUCCESS);
+    XrFrameEndInfo endInfo{XR_TYPE_FRAME_END_INFO};
+    endInfo.displayTime = frameState.predictedDisplayTime;
+    endInfo.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
+    CHECK(main.Get<PFN_xrEndFrame>("xrEndFrame")(session, &endInfo) == XR_SUCCESS);
+
+    CHECK(write(mainReady[1], "r", 1) == 1);
+    close(mainReady[1]);
+
+    int status;
+    waitpid(overlayProcess, &status, 0);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+    main.Get<PFN_xrDestroySession>("xrDestroySession")(session);
+    main.Destroy();
+}
+
+// Round trips through the RPC transport: Main with a headless session
+// on the fake runtime in one process, Overlay in another
+void BenchRPCRoundTrip()
+{
+    RunInChildProcess(RunRoundTripMain);
+}
+
+// Creating many spaces and actions through the layer and dropping their
+// handle infos one at a time and all at once through their parent, so
+// the cost of keeping and dropping children shows per child.  Main's own
+// destroy commands leave handle infos to the runtime's handles, so this
+// drops them as an Overlay's destroy commands and Main serving them do.
+// Each Main session starts a negotiation thread that outlives it, so each
+// parent pair is made in a child process of its own.
+void RunCreateDestroyMain(uint32_t childCount, bool singly)
+{
+    UnlinkNegotiationChannels();
+
+    SessionCreation creation;
+    LayeredInstance main;
+    CHECK(main.Create(&creation.instanceCreateInfo) == XR_SUCCESS);
+
+    auto createSession = main.Get<PFN_xrCreateSession>("xrCreateSession");
+    auto createReferenceSpace = main.Get<PFN_xrCreateReferenceSpace>("xrCreateReferenceSpace");
+    auto createActionSet = main.Get<PFN_xrCreateActionSet>("xrCreateActionSet");
+    auto createAction = main.Get<PFN_xrCreateAction>("xrCreateAction");
+
+    XrSessionCreateInfo sessionCreateInfo{XR_TYPE_SESSION_CREATE_INFO};
+    sessionCreateInfo.systemId = main.systemId;
+
+    XrReferenceSpaceCreateInfo spaceCreateInfo{XR_TYPE_REFERENCE_SPACE_CREATE_INFO};
+    spaceCreateInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_LOCAL;
+    spaceCreateInfo.poseInReferenceSpace.orientation.w = 1.0f;
+
+    XrActionSetCreateInfo actionSetCreateInfo{XR_TYPE_ACTION_SET_CREATE_INFO};
+    strncpy_s(actionSetCreateInfo.actionSetName, "bench", XR_MAX_ACTION_SET_NAME_SIZE);
+    strncpy_s(actionSetCreateInfo.localizedActionSetName, "Bench", XR_MAX_LOCALIZED_ACTION_SET_NAME_SIZE);
+
+    uint32_t count = uint32_t(Iterations(childCount));
+    std::vector<XrSpace> spaces(count);
+    std::vector<XrAction> actions(count);
+
+    XrSession session;
+    CHECK(createSession(main.instance, &sessionCreateInfo, &session) == XR_SUCCESS);
+    uint64_t start = IPCGetTimestampNanoseconds();
+    for(uint32_t i = 0; i < count; i++) {
+        CHECK(createReferenceSpace(session, &spaceCreateInfo, &spaces[i]) == XR_SUCCESS);
+    }
+    uint64_t created = IPCGetTimestampNanoseconds();
+    if(singly) {
+        for(uint32_t i = 0; i < count; i++) {
+            OverlaysLayerRemoveXrSpaceHandleInfo(spaces[i]);
+        }
+    }
+    uint64_t removed = IPCGetTimestampNanoseconds();
+    OverlaysLayerRemoveXrSessionHandleInfo(session);
+    uint64_t parentRemoved = IPCGetTimestampNanoseconds();
+    if(singly) {
+        Report("create_destroy", fmt("%u spaces: remove singly", count), double(removed - created) / count);
+    } else {
+        Report("create_destroy", fmt("%u spaces: xrCreateReferenceSpace", count), double(created - start) / count);
+        Report("create_destroy", fmt("%u spaces: remove with session, per space", count), double(parentRemoved - removed) / count);
+    }
+
+    XrActionSet actionSet;
+    CHECK(createActionSet(main.instance, &actionSetCreateInfo, &actionSet) == XR_SUCCESS);
+    start = IPCGetTimestampNanoseconds();
+    for(uint32_t i = 0; i < count; i++) {
+        XrActionCreateInfo actionCreateInfo{XR_TYPE_ACTION_CREATE_INFO};
+        snprintf(actionCreateInfo.actionName, XR_MAX_ACTION_NAME_SIZE, "action_%u", i);
+        snprintf(actionCreateInfo.localizedActionName, XR_MAX_LOCALIZED_ACTION_NAME_SIZE, "Action %u", i);
+        actionCreateInfo.actionType = XR_ACTION_TYPE_BOOLEAN_INPUT;
+        CHECK(createAction(actionSet, &actionCreateInfo, &actions[i]) == XR_SUCCESS);
+    }
+    created = IPCGetTimestampNanoseconds();
+    if(singly) {
+        for(uint32_t i = 0; i < count; i++) {
+            OverlaysLayerRemoveXrActionHandleInfo(actions[i]);
+        }
+    }
+    removed = IPCGetTimestampNanoseconds();
+    OverlaysLayerRemoveXrActionSetHandleInfo(actionSet);
+    parentRemoved = IPCGetTimestampNanoseconds();
+    if(singly) {
+        Report("create_destroy", fmt("%u actions: remove singly", count), double(removed - created) / count);
+    } else {
+        Report("create_destroy", fmt("%u actions: xrCreateAction", count), double(created - start) / count);
+        Report("create_destroy", fmt("%u actions: remove with action set, per action", count), double(parentRemoved - removed) / count);
+    }
+
+    main.Destroy();
+}
+
+void BenchCreateDestroy()
+{
+    // Each parent is made twice, once to drop its children with it and
+    // once to drop them singly in creation order, which always takes from
+    // the front of the parent's list
+    for(uint32_t childCount: {100, 1000, 10000}) {
+        for(bool singly: {false, true}) {
+            RunInChildProcess([childCount, singly]() { RunCreateDestroyMain(childCount, singly); });
+        }
+    }
+}
+
+// Whole calls through the layer's entry points on a Main session, so
+// what's timed is the layer's own work per call: looking up infos,
+// restoring handles, and reporting errors.  The invalid handle cases are
+// what an app pays when it passes a handle the layer doesn't know.
+void RunEntryPointsMain()
+{
+    UnlinkNegotiationChannels();
+
+    SessionCreation creation;
+    LayeredInstance main;
+    CHECK(main.Create(&creation.instanceCreateInfo) == XR_SUCCESS);
+
+    auto createSession = main.Get<PFN_xrCreateSession>("xrCreateSession");
+    auto createReferenceSpace = main.Get<PFN_xrCreateReferenceSpace>("xrCreateReferenceSpace");
+    auto beginFrame = main.Get<PFN_xrBeginFrame>("xrBeginFrame");
+    auto locateSpace = main.Get<PFN_xrLocateSpace>("xrLocateSpace");
+    auto stringToPath = main.Get<PFN_xrStringToPath>("xrStringToPath");
+    auto pathToString = main.Get<PFN_xrPathToString>("xrPathToString");
+
+    XrSessionCreateInfo sessionCreateInfo{XR_TYPE_SESSION_CREATE_INFO};
+    sessionCreateInfo.systemId = main.systemId;
+    XrSession session;
+    CHECK(createSession(main.instance, &sessionCreateInfo, &session) == XR_SUCCESS);
+
+    XrReferenceSpaceCreateInfo spaceCreateInfo{XR_TYPE_REFERENCE_SPACE_CREATE_INFO};
+    spaceCreateInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_LOCAL;
+    spaceCreateInfo.poseInReferenceSpace.orientation.w = 1.0f;
+    XrSpace space, baseSpace;
+    CHECK(createReferenceSpace(session, &spaceCreateInfo, &space) == XR_SUCCESS);
+    CHECK(createReferenceSpace(session, &spaceCreateInfo, &baseSpace) == XR_SUCCESS);
+
+    // Neither was ever handed out
+    XrSession invalidSession = (XrSession)uint64_t(0xdead0000beef);
+    XrSpace invalidSpace = (XrSpace)uint64_t(0xdead0000beef);
+
+    uint64_t count = Iterations(200000);
+    XrFrameBeginInfo frameBeginInfo{XR_TYPE_FRAME_BEGIN_INFO};
+    XrSpaceLocation location{XR_TYPE_SPACE_LOCATION};
+    XrPath path;
+    CHECK(stringToPath(main.instance, "/user/hand/left", &path) == XR_SUCCESS);
+    char pathString[XR_MAX_PATH_LENGTH];
+    uint32_t pathLength;
+
+    double nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+        CHECK(beginFrame(session, &frameBeginInfo) == XR_SUCCESS);
+    });
+    Report("entry_points", "xrBeginFrame", nanoseconds);
+
+    nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+        CHECK(locateSpace(space, baseSpace, 1, &location) == XR_SUCCESS);
+    });
+    Report("entry_points", "xrLocateSpace", nanoseconds);
+
+    nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+        CHECK(pathToString(main.instance, path, sizeof(pathString), &pathLength, pathString) == XR_SUCCESS);
+    });
+    Report("entry_points", "xrPathToString", nanoseconds);
+
+    // Each failure logs, which costs the same either way, so there are
+    // fewer of them
+    count = Iterations(20000);
+    nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+        CHECK(beginFrame(invalidSession, &frameBeginInfo) == XR_ERROR_HANDLE_INVALID);
+    });
+    Report("entry_points", "xrBeginFrame, invalid session", nanoseconds);
+
+    nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+        CHECK(locateSpace(invalidSpace, baseSpace, 1, &location) == XR_ERROR_HANDLE_INVALID);
+    });
+    Report("entry_points", "xrLocateSpace, invalid space", nanoseconds);
+
+    nanoseconds = NanosecondsPerCall(count, [&](uint64_t) {
+        CHECK(locateSpace(space, invalidSpace, 1, &location) == XR_ERROR_HANDLE_INVALID);
+    });
+    Report("entry_points", "xrLocateSpace, invalid base space", nanoseconds);
+
+    main.Destroy();
+}
+
+void BenchEntryPoints()
+{
+    RunInChildProcess(RunEntryPointsMain);
+}
+
+#else
+
+void BenchRPCRoundTrip()
+{
+    printf("rpc_round_trip needs fork(); skipped\n");
+}
+
+void BenchCreateDestroy()
+{
+    printf("create_destroy needs fork(); skipped\n");
+}
+
+void BenchEntryPoints()
+{
+    printf("entry_points needs fork(); skipped\n");
+}
+
+#endif
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    if((argc > 1) && (strcmp(argv[1], "--quick") == 0)) {
+        gIterationDivisor = 100;
+        argc--;
+        argv++;
+    }
+
+    static const TestCase benchmarks[] = {
+        {"borrow_vs_get", BenchBorrowVersusGet},
+        {"copy_per_type", BenchCopyPerType},
+        {"copy_throughput", BenchCopyThroughput},
+        {"create_destroy", BenchCreateDestroy},
+        {"entry_points", BenchEntryPoints},
+        {"handle_lookup", BenchHandleLookup},
+        {"hot_cold_layout", BenchHotColdLayout},
+        {"rpc_round_trip", BenchRPCRoundTrip},
+    };
+    return RunTests(benchmarks, sizeof(benchmarks) / sizeof(benchmarks[0]), argc, argv);
+}
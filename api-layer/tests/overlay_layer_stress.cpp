@@ -0,0 +1,415 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Tests that drive the layer in a Main and an Overlay process, with the
+// fake runtime below it.  The locking stress tests run many threads and
+// check results, but they are mostly for running under ThreadSanitizer
+// (configure with OVERLAY_LAYER_SANITIZE_THREAD) so it can see the
+// layer's locking.
+
+#include "layer_test_support.h"
+#include "fake_runtime.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+#if !defined(_WIN32)
+
+const uint32_t frameCount = 2000;
+const uint32_t iterationsPerThread = 1000;
+
+// Wait, begin, and end "count" frames with no layers
+void RunFrames(const LayeredInstance& instance, XrSession session, uint32_t count)
+{
+    auto waitFrame = instance.Get<PFN_xrWaitFrame>("xrWaitFrame");
+    auto beginFrame = instance.Get<PFN_xrBeginFrame>("xrBeginFrame");
+    auto endFrame = instance.Get<PFN_xrEndFrame>("xrEndFrame");
+
+    for(uint32_t i = 0; i < count; i++) {
+        XrFrameState frameState{XR_TYPE_FRAME_STATE};
+        CHECK(waitFrame(session, nullptr, &frameState) == XR_SUCCESS);
+        CHECK(beginFrame(session, nullptr) == XR_SUCCESS);
+
+        XrFrameEndInfo endInfo{XR_TYPE_FRAME_END_INFO};
+        endInfo.displayTime = frameState.predictedDisplayTime;
+        endInfo.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
+        CHECK(endFrame(session, &endInfo) == XR_SUCCESS);
+    }
+}
+
+// Create reference spaces, locate them against "baseSpace", and destroy
+// them, as an app's tracking code might while another thread renders
+void RunSpaces(const LayeredInstance& instance, XrSession session, XrSpace baseSpace, uint32_t count)
+{
+    auto createReferenceSpace = instance.Get<PFN_xrCreateReferenceSpace>("xrCreateReferenceSpace");
+    auto locateSpace = instance.Get<PFN_xrLocateSpace>("xrLocateSpace");
+    auto destroySpace = instance.Get<PFN_xrDestroySpace>("xrDestroySpace");
+
+    XrReferenceSpaceCreateInfo createInfo{XR_TYPE_REFERENCE_SPACE_CREATE_INFO};
+    createInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_STAGE;
+    createInfo.poseInReferenceSpace.orientation.w = 1.0f;
+
+    for(uint32_t i = 0; i < count; i++) {
+        XrSpace space;
+        CHECK(createReferenceSpace(session, &createInfo, &space) == XR_SUCCESS);
+        XrSpaceLocation location{XR_TYPE_SPACE_LOCATION};
+        CHECK(locateSpace(space, baseSpace, 1, &location) == XR_SUCCESS);
+        CHECK(locateSpace(baseSpace, space, 1, &location) == XR_SUCCESS);
+        CHECK(destroySpace(space) == XR_SUCCESS);
+    }
+}
+
+// Create and destroy actions in "actionSet" and look up paths, all of
+// which take no per-handle lock
+void RunActionsAndPaths(const LayeredInstance& instance, XrActionSet actionSet, uint32_t thread, uint32_t count)
+{
+    auto createAction = instance.Get<PFN_xrCreateAction>("xrCreateAction");
+    auto destroyAction = instance.Get<PFN_xrDestroyAction>("xrDestroyAction");
+    auto stringToPath = instance.Get<PFN_xrStringToPath>("xrStringToPath");
+    auto pathToString = instance.Get<PFN_xrPathToString>("xrPathToString");
+
+    for(uint32_t i = 0; i < count; i++) {
+        XrActionCreateInfo createInfo{XR_TYPE_ACTION_CREATE_INFO};
+        snprintf(createInfo.actionName, sizeof(createInfo.actionName), "action_%u_%u", thread, i);
+        snprintf(createInfo.localizedActionName, sizeof(createInfo.localizedActionName), "Action %u %u", thread, i);
+        createInfo.actionType = XR_ACTION_TYPE_BOOLEAN_INPUT;
+        XrAction action;
+        CHECK(createAction(actionSet, &createInfo, &action) == XR_SUCCESS);
+
+        XrPath path;
+        CHECK(stringToPath(instance.instance, (i % 2) ? "/user/hand/left" : "/user/hand/right", &path) == XR_SUCCESS);
+        char pathString[XR_MAX_PATH_LENGTH];
+        uint32_t pathLength;
+        CHECK(pathToString(instance.instance, path, sizeof(pathString), &pathLength, pathString) == XR_SUCCESS);
+
+        CHECK(destroyAction(action) == XR_SUCCESS);
+    }
+}
+
+// Overlay side of RunLockingStress: once Main has a frame, render
+// frames on one thread while another creates and locates spaces, both
+// through RPCs that Main serves concurrently with its own threads
+void RunStressOverlay(int mainReadyFd)
+{
+    char ready;
+    if(read(mainReadyFd, &ready, 1) != 1) {
+        fprintf(stderr, "Overlay didn't hear from Main\n");
+        gTestFailures++;
+        return;
+    }
+
+    SessionCreation creation;
+    LayeredInstance overlay;
+    if(overlay.Create(&creation.instanceCreateInfo) != XR_SUCCESS) {
+        fprintf(stderr, "Overlay couldn't create an instance\n");
+        gTestFailures++;
+        return;
+    }
+
+    creation.createInfo.systemId = overlay.systemId;
+    XrSession session;
+    if(overlay.Get<PFN_xrCreateSession>("xrCreateSession")(overlay.instance, &creation.createInfo, &session) != XR_SUCCESS) {
+        fprintf(stderr, "Overlay couldn't connect to Main\n");
+        gTestFailures++;
+        return;
+    }
+
+    XrReferenceSpaceCreateInfo spaceCreateInfo{XR_TYPE_REFERENCE_SPACE_CREATE_INFO};
+    spaceCreateInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_LOCAL;
+    spaceCreateInfo.poseInReferenceSpace.orientation.w = 1.0f;
+    XrSpace baseSpace;
+    CHECK(overlay.Get<PFN_xrCreateReferenceSpace>("xrCreateReferenceSpace")(session, &spaceCreateInfo, &baseSpace) == XR_SUCCESS);
+
+    std::thread frames([&]() { RunFrames(overlay, session, frameCount / 4); });
+    std::thread spaces([&]() { RunSpaces(overlay, session, baseSpace, iterationsPerThread / 4); });
+    frames.join();
+    spaces.join();
+
+    overlay.Get<PFN_xrDestroySpace>("xrDestroySpace")(baseSpace);
+    overlay.Get<PFN_xrDestroySession>("xrDestroySession")(session);
+    overlay.Destroy();
+}
+
+// Many threads calling into Main, and an Overlay calling in through
+// RPCs: a frame loop, spaces made, located, and destroyed beside it,
+// actions and paths, and events polled.  The flags are set directly,
+// as OVERLAYS_API_LAYER_SYNCHRONIZE_EVERYTHING and
+// OVERLAYS_API_LAYER_SYNCHRONIZE_PER_HANDLE would set them, in both
+// processes.
+void RunLockingStress(bool synchronizeEveryProc, bool synchronizePerHandle)
+{
+    gSynchronizeEveryProc = synchronizeEveryProc;
+    gSynchronizePerHandle = synchronizePerHandle;
+
+    UnlinkNegotiationChannels();
+
+    int mainReady[2];
+    CHECK(pipe(mainReady) == 0);
+
+    // Before anything here starts a thread
+    fflush(stdout);
+    pid_t overlayProcess = fork();
+    if(overlayProcess == 0) {
+        close(mainReady[1]);
+        RunStressOverlay(mainReady[0]);
+        fflush(stdout);
+        _exit((gTestFailures == 0) ? 0 : 1);
+    }
+    close(mainReady[0]);
+
+    SessionCreation creation;
+    LayeredInstance main;
+    CHECK(main.Create(&creation.instanceCreateInfo) == XR_SUCCESS);
+
+    XrSessionCreateInfo createInfo{XR_TYPE_SESSION_CREATE_INFO};
+    createInfo.systemId = main.systemId;
+    XrSession session;
+    CHECK(main.Get<PFN_xrCreateSession>("xrCreateSession")(main.instance, &createInfo, &session) == XR_SUCCESS);
+
+    XrReferenceSpaceCreateInfo spaceCreateInfo{XR_TYPE_REFERENCE_SPACE_CREATE_INFO};
+    spaceCreateInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_LOCAL;
+    spaceCreateInfo.poseInReferenceSpace.orientation.w = 1.0f;
+    XrSpace baseSpace;
+    CHECK(main.Get<PFN_xrCreateReferenceSpace>("xrCreateReferenceSpace")(session, &spaceCreateInfo, &baseSpace) == XR_SUCCESS);
+
+    XrActionSetCreateInfo actionSetCreateInfo{XR_TYPE_ACTION_SET_CREATE_INFO};
+    strncpy_s(actionSetCreateInfo.actionSetName, "stress", XR_MAX_ACTION_SET_NAME_SIZE);
+    strncpy_s(actionSetCreateInfo.localizedActionSetName, "Stress", XR_MAX_LOCALIZED_ACTION_SET_NAME_SIZE);
+    XrActionSet actionSet;
+    CHECK(main.Get<PFN_xrCreateActionSet>("xrCreateActionSet")(main.instance, &actionSetCreateInfo, &actionSet) == XR_SUCCESS);
+
+    // Overlay's xrWaitFrame returns Main's last frame state, so Main
+    // needs one before Overlay connects
+    RunFrames(main, session, 1);
+    CHECK(write(mainReady[1], "r", 1) == 1);
+    close(mainReady[1]);
+
+    std::atomic<bool> done{false};
+    std::thread frames([&]() { RunFrames(main, session, frameCount); });
+    std::thread spaces[2] = {
+        std::thread([&]() { RunSpaces(main, session, baseSpace, iterationsPerThread); }),
+        std::thread([&]() { RunSpaces(main, session, baseSpace, iterationsPerThread); }),
+    };
+    std::thread actions[2] = {
+        std::thread([&]() { RunActionsAndPaths(main, actionSet, 0, iterationsPerThread); }),
+        std::thread([&]() { RunActionsAndPaths(main, actionSet, 1, iterationsPerThread); }),
+    };
+    std::thread events([&]() {
+        auto pollEvent = main.Get<PFN_xrPollEvent>("xrPollEvent");
+        while(!done) {
+            XrEventDataBuffer event{XR_TYPE_EVENT_DATA_BUFFER};
+            XrResult result = pollEvent(main.instance, &event);
+            CHECK((result == XR_SUCCESS) || (result == XR_EVENT_UNAVAILABLE));
+            std::this_thread::yield();
+        }
+    });
+
+    frames.join();
+    for(auto& thread: spaces) {
+        thread.join();
+    }
+    for(auto& thread: actions) {
+        thread.join();
+    }
+
+    // Main keeps serving Overlay's RPCs until it's done
+    int status;
+    waitpid(overlayProcess, &status, 0);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+    done = true;
+    events.join();
+
+    // The threads that served Overlay log and clean up after it leaves;
+    // let them finish before the instance and then this process go away
+    while(true) {
+        std::unique_lock<std::recursive_mutex> lock(gConnectionsToOverlayByProcessIdMutex);
+        if(gConnectionsToOverlayByProcessId.empty()) {
+            break;
+        }
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    main.Get<PFN_xrDestroyActionSet>("xrDestroyActionSet")(actionSet);
+    main.Get<PFN_xrDestroySpace>("xrDestroySpace")(baseSpace);
+    main.Get<PFN_xrDestroySession>("xrDestroySession")(session);
+    main.Destroy();
+}
+
+// The default, with gSynchronizeEveryProcMutex around every call
+void TestGlobalLocking()
+{
+    RunInChildProcess([]() { RunLockingStress(true, false); });
+}
+
+// Each call locks only the procMutex of its session, swapchain, or space
+void TestPerHandleLocking()
+{
+    RunInChildProcess([]() { RunLockingStress(false, true); });
+}
+
+// Overlay side of TestEndFrameFailure: send a frame Main refuses, the
+// way xrEndFrame sends one, and check the next xrWaitFrame says so
+void RunEndFrameFailureOverlay(int mainReadyFd)
+{
+    char ready;
+    if(read(mainReadyFd, &ready, 1) != 1) {
+        fprintf(stderr, "Overlay didn't hear from Main\n");
+        gTestFailures++;
+        return;
+    }
+
+    SessionCreation creation;
+    LayeredInstance overlay;
+    if(overlay.Create(&creation.instanceCreateInfo) != XR_SUCCESS) {
+        fprintf(stderr, "Overlay couldn't create an instance\n");
+        gTestFailures++;
+        return;
+    }
+
+    creation.createInfo.systemId = overlay.systemId;
+    XrSession session;
+    if(overlay.Get<PFN_xrCreateSession>("xrCreateSession")(overlay.instance, &creation.createInfo, &session) != XR_SUCCESS) {
+        fprintf(stderr, "Overlay couldn't connect to Main\n");
+        gTestFailures++;
+        return;
+    }
+
+    auto waitFrame = overlay.Get<PFN_xrWaitFrame>("xrWaitFrame");
+    auto beginFrame = overlay.Get<PFN_xrBeginFrame>("xrBeginFrame");
+    XrFrameState frameState{XR_TYPE_FRAME_STATE};
+    CHECK(waitFrame(session, nullptr, &frameState) == XR_SUCCESS);
+    CHECK(beginFrame(session, nullptr) == XR_SUCCESS);
+
+    // More layers than Main takes from an Overlay.  Overlays can't make
+    // swapchains here, so this goes straight to the RPC xrEndFrame uses,
+    // past the handle restoring that would refuse these layers first.
+    std::vector<XrCompositionLayerQuad> quads(MainAsOverlaySessionContext::maxOverlayCompositionLayers + 1, XrCompositionLayerQuad{XR_TYPE_COMPOSITION_LAYER_QUAD});
+    std::vector<const XrCompositionLayerBaseHeader*> layers;
+    for(auto& quad: quads) {
+        layers.push_back(reinterpret_cast<const XrCompositionLayerBaseHeader*>(&quad));
+    }
+    XrFrameEndInfo endInfo{XR_TYPE_FRAME_END_INFO};
+    endInfo.displayTime = frameState.predictedDisplayTime;
+    endInfo.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
+    endInfo.layerCount = uint32_t(layers.size());
+    endInfo.layers = layers.data();
+
+    XrSession actualSession = OverlaysLayerGetHandleInfoFromXrSession(session)->actualHandle;
+    CHECK(RPCCallSubmitFrame(overlay.instance, actualSession, 0, nullptr, nullptr, &endInfo) == XR_SUCCESS);
+
+    // Reported once, from another thread's xrWaitFrame, and then frames
+    // go on as before
+    std::thread([&]() {
+        CHECK(waitFrame(session, nullptr, &frameState) == XR_ERROR_LAYER_LIMIT_EXCEEDED);
+    }).join();
+    RunFrames(overlay, session, 2);
+
+    overlay.Get<PFN_xrDestroySession>("xrDestroySession")(session);
+    overlay.Destroy();
+}
+
+void RunEndFrameFailure()
+{
+    UnlinkNegotiationChannels();
+
+    int mainReady[2];
+    CHECK(pipe(mainReady) == 0);
+
+    fflush(stdout);
+    pid_t overlayProcess = fork();
+    if(overlayProcess == 0) {
+        close(mainReady[1]);
+        RunEndFrameFailureOverlay(mainReady[0]);
+        fflush(stdout);
+        _exit((gTestFailures == 0) ? 0 : 1);
+    }
+    close(mainReady[0]);
+
+    SessionCreation creation;
+    LayeredInstance main;
+    CHECK(main.Create(&creation.instanceCreateInfo) == XR_SUCCESS);
+
+    XrSessionCreateInfo createInfo{XR_TYPE_SESSION_CREATE_INFO};
+    createInfo.systemId = main.systemId;
+    XrSession session;
+    CHECK(main.Get<PFN_xrCreateSession>("xrCreateSession")(main.instance, &createInfo, &session) == XR_SUCCESS);
+
+    RunFrames(main, session, 1);
+    CHECK(write(mainReady[1], "r", 1) == 1);
+    close(mainReady[1]);
+
+    int status;
+    waitpid(overlayProcess, &status, 0);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+    while(true) {
+        std::unique_lock<std::recursive_mutex> lock(gConnectionsToOverlayByProcessIdMutex);
+        if(gConnectionsToOverlayByProcessId.empty()) {
+            break;
+        }
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    main.Get<PFN_xrDestroySession>("xrDestroySession")(session);
+    main.Destroy();
+}
+
+// xrEndFrame doesn't wait for Main, so Main's refusal of a frame comes
+// back from the next xrWaitFrame
+void TestEndFrameFailure()
+{
+    RunInChildProcess(RunEndFrameFailure);
+}
+
+#else
+
+void TestGlobalLocking()
+{
+    printf("global_locking needs fork(); skipped\n");
+}
+
+void TestPerHandleLocking()
+{
+    printf("per_handle_locking needs fork(); skipped\n");
+}
+
+void TestEndFrameFailure()
+{
+    printf("end_frame_failure needs fork(); skipped\n");
+}
+
+#endif
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    static const TestCase tests[] = {
+        {"global_locking", TestGlobalLocking},
+        {"per_handle_locking", TestPerHandleLocking},
+        {"end_frame_failure", TestEndFrameFailure},
+    };
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]), argc, argv);
+}
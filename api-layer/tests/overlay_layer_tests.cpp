@@ -0,0 +1,430 @@
+// Copyright (c) 2020-2021 LunarG, Inc.
+// Copyright (c) 2017-2021 PlutoVR Inc.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Tests of the generated struct chain code and the layer's tables that
+// need no runtime and no second process
+
+#include "layer_test_support.h"
+
+#include <cstring>
+
+namespace {
+
+const uint64_t actualBase = RepresentativeChains::actualBase;
+
+void TestCopyWithMalloc()
+{
+    RepresentativeChains chains;
+    for(auto chain: chains.All()) {
+        XrBaseInStructure* copy = CopyXrStructChainWithMalloc(XR_NULL_HANDLE, chain);
+        CHECK(copy != nullptr);
+        CHECK(copy != chain);
+        CHECK(XrStructChainEquals(chain, copy));
+        FreeXrStructChainWithFree(XR_NULL_HANDLE, copy);
+    }
+
+    // The copy is deep, down to the views of each projection layer
+    auto copy = reinterpret_cast<XrFrameEndInfo*>(CopyXrStructChainWithMalloc(XR_NULL_HANDLE, &chains.frame.endInfo));
+    CHECK(copy->layers != chains.frame.endInfo.layers);
+    auto projection = reinterpret_cast<const XrCompositionLayerProjection*>(copy->layers[0]);
+    CHECK(projection != &chains.frame.projections[0]);
+    CHECK(projection->views != chains.frame.projections[0].views);
+    CHECK(projection->views[1].fov.angleLeft == chains.frame.views[1].fov.angleLeft);
+    FreeXrStructChainWithFree(XR_NULL_HANDLE, copy);
+
+    // Strings and string arrays are copied, not shared
+    auto instanceCopy = reinterpret_cast<XrInstanceCreateInfo*>(CopyXrStructChainWithMalloc(XR_NULL_HANDLE, &chains.session.instanceCreateInfo));
+    CHECK(instanceCopy->enabledExtensionNames != chains.session.instanceCreateInfo.enabledExtensionNames);
+    CHECK(instanceCopy->enabledExtensionNames[1] != chains.session.extensions[1]);
+    CHECK(strcmp(instanceCopy->enabledExtensionNames[1], chains.session.extensions[1]) == 0);
+    FreeXrStructChainWithFree(XR_NULL_HANDLE, instanceCopy);
+}
+
+void TestCopyWithScratch()
+{
+    RepresentativeChains chains;
+    std::vector<XrBaseInStructure*> copies;
+    for(auto chain: chains.All()) {
+        XrBaseInStructure* copy = CopyXrStructChainWithScratch(XR_NULL_HANDLE, chain);
+        CHECK(copy != nullptr);
+        CHECK(XrStructChainEquals(chain, copy));
+        copies.push_back(copy);
+    }
+    for(auto copy: copies) {
+        ScratchArena::Free(copy);
+    }
+}
+
+void TestEqualsFindsDifferences()
+{
+    RepresentativeChains chains;
+
+    auto frameCopy = reinterpret_cast<XrFrameEndInfo*>(CopyXrStructChainWithMalloc(XR_NULL_HANDLE, &chains.frame.endInfo));
+    auto projection = const_cast<XrCompositionLayerProjection*>(reinterpret_cast<const XrCompositionLayerProjection*>(frameCopy->layers[1]));
+    const_cast<XrCompositionLayerProjectionView*>(projection->views)[1].fov.angleUp += 0.01f;
+    CHECK(!XrStructChainEquals(reinterpret_cast<const XrBaseInStructure*>(&chains.frame.endInfo), reinterpret_cast<const XrBaseInStructure*>(frameCopy)));
+    FreeXrStructChainWithFree(XR_NULL_HANDLE, frameCopy);
+
+    auto instanceCopy = reinterpret_cast<XrInstanceCreateInfo*>(CopyXrStructChainWithMalloc(XR_NULL_HANDLE, &chains.session.instanceCreateInfo));
+    const_cast<char*>(instanceCopy->enabledExtensionNames[2])[3] = '!';
+    CHECK(!XrStructChainEquals(reinterpret_cast<const XrBaseInStructure*>(&chains.session.instanceCreateInfo), reinterpret_cast<const XrBaseInStructure*>(instanceCopy)));
+    FreeXrStructChainWithFree(XR_NULL_HANDLE, instanceCopy);
+
+    // A chain missing its tail isn't equal either
+    auto locationCopy = reinterpret_cast<XrSpaceLocation*>(CopyXrStructChainWithMalloc(XR_NULL_HANDLE, &chains.location));
+    locationCopy->next = nullptr;
+    CHECK(!XrStructChainEquals(reinterpret_cast<const XrBaseInStructure*>(&chains.location), reinterpret_cast<const XrBaseInStructure*>(locationCopy)));
+    FreeXrStructChainWithFree(XR_NULL_HANDLE, locationCopy);
+}
+
+void TestRestoreActualHandles()
+{
+    RepresentativeChains chains;
+
+    auto restored = GetSharedCopyHandlesRestored(XR_NULL_HANDLE, "test", &chains.frame.endInfo);
+    CHECK(restored.get() != &chains.frame.endInfo);
+
+    uint32_t handleIndex = 0;
+    for(uint32_t i = 0; i < restored->layerCount; i++) {
+        const XrCompositionLayerBaseHeader* layer = restored->layers[i];
+        CHECK(layer->space == ActualHandleFor<XrSpace>(actualBase, handleIndex % 4));
+        if(layer->type == XR_TYPE_COMPOSITION_LAYER_PROJECTION) {
+            auto projection = reinterpret_cast<const XrCompositionLayerProjection*>(layer);
+            for(uint32_t v = 0; v < projection->viewCount; v++) {
+                CHECK(projection->views[v].subImage.swapchain == ActualHandleFor<XrSwapchain>(actualBase, handleIndex % 4));
+            }
+        } else {
+            auto quad = reinterpret_cast<const XrCompositionLayerQuad*>(layer);
+            CHECK(quad->subImage.swapchain == ActualHandleFor<XrSwapchain>(actualBase, handleIndex % 4));
+        }
+        handleIndex++;
+    }
+
+    // The app's own structs keep the layer's handles
+    CHECK(chains.frame.projections[0].space == chains.handles.spaces[0]);
+    CHECK(chains.frame.views[0].subImage.swapchain == chains.handles.swapchains[0]);
+
+    // Chains with nothing to restore aren't copied at all
+    auto unchanged = GetSharedCopyHandlesRestored(XR_NULL_HANDLE, "test", &chains.actions.syncInfo);
+    CHECK(unchanged.get() == &chains.actions.syncInfo);
+
+    // A handle the layer doesn't know fails the whole copy
+    XrSpace savedSpace = chains.frame.quads[2].space;
+    chains.frame.quads[2].space = (XrSpace)uint64_t(0xdead00000001);
+    XrResult result = XR_SUCCESS;
+    try {
+        GetSharedCopyHandlesRestored(XR_NULL_HANDLE, "test", &chains.frame.endInfo);
+    } catch (const OverlaysLayerXrException& exc) {
+        result = exc.result();
+    }
+    CHECK(result == XR_ERROR_HANDLE_INVALID);
+    chains.frame.quads[2].space = savedSpace;
+}
+
+void TestSubstituteLocalHandles()
+{
+    XrSession actualSession = (XrSession)uint64_t(0x5e55);
+    XrSession localSession = (XrSession)uint64_t(0x1000000005e55);
+    {
+        std::unique_lock<ProfiledMutex> lock(gActualXrSessionToLocalHandleMutex);
+        gActualXrSessionToLocalHandle[actualSession] = localSession;
+    }
+
+    XrEventDataSessionStateChanged event{XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED};
+    event.session = actualSession;
+    event.state = XR_SESSION_STATE_FOCUSED;
+    event.time = 1000;
+
+    XrEventDataBuffer buffer{XR_TYPE_EVENT_DATA_BUFFER};
+    XrBaseInStructure* copy = CopyEventChainIntoBuffer(XR_NULL_HANDLE, reinterpret_cast<const XrEventDataBaseHeader*>(&event), &buffer);
+    CHECK(copy == reinterpret_cast<XrBaseInStructure*>(&buffer));
+    CHECK(XrStructChainEquals(reinterpret_cast<const XrBaseInStructure*>(&event), copy));
+
+    CHECK(SubstituteLocalHandles(XR_NULL_HANDLE, reinterpret_cast<XrBaseOutStructure*>(&buffer)));
+    auto substituted = reinterpret_cast<const XrEventDataSessionStateChanged*>(&buffer);
+    CHECK(substituted->session == localSession);
+    CHECK(substituted->state == XR_SESSION_STATE_FOCUSED);
+
+    {
+        std::unique_lock<ProfiledMutex> lock(gActualXrSessionToLocalHandleMutex);
+        gActualXrSessionToLocalHandle.erase(actualSession);
+    }
+
+    // A runtime handle with no local handle is reported, not thrown
+    CopyEventChainIntoBuffer(XR_NULL_HANDLE, reinterpret_cast<const XrEventDataBaseHeader*>(&event), &buffer);
+    CHECK(!SubstituteLocalHandles(XR_NULL_HANDLE, reinterpret_cast<XrBaseOutStructure*>(&buffer)));
+}
+
+// Growth, erasing and inserting a key again, as handle values the
+// runtime reuses would be
+void TestEpochHashMap()
+{
+    EpochHashMap<XrAction, uint32_t> map;
+    const uint32_t count = 1000;
+    auto key = [](uint32_t i) { return (XrAction)uint64_t(0x1000 + i * 8); };
+
+    for(uint32_t i = 0; i < count; i++) {
+        map.Insert(key(i), i);
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        uint32_t value = 0;
+        CHECK(map.Find(key(i), value) && (value == i));
+    }
+    CHECK(!map.Borrow((XrAction)uint64_t(0x999)));
+
+    // An existing key keeps its value
+    map.Insert(key(7), 1234);
+    uint32_t value = 0;
+    CHECK(map.Find(key(7), value) && (value == 7));
+
+    for(uint32_t i = 0; i < count; i += 2) {
+        CHECK(map.Erase(key(i)));
+    }
+    CHECK(!map.Erase(key(0)));
+    for(uint32_t i = 0; i < count; i++) {
+        CHECK(map.Find(key(i), value) == (i % 2 == 1));
+    }
+
+    for(uint32_t i = 0; i < count; i += 2) {
+        map.Insert(key(i), i + count);
+    }
+    for(uint32_t i = 0; i < count; i += 2) {
+        CHECK(map.Find(key(i), value) && (value == i + count));
+    }
+
+    std::vector<XrAction> keys;
+    for(uint32_t i = 0; i < count; i++) {
+        keys.push_back(key(i));
+    }
+    keys.push_back((XrAction)uint64_t(0x999));
+    CHECK(map.Erase(keys) == count);
+    CHECK(!map.Borrow(key(1)));
+}
+
+// Serialize as Overlay does into an RPC slot that Main maps at another
+// address, and check Main sees the same chain
+void TestIPCSerializeAcrossMappings()
+{
+    RepresentativeChains chains;
+    const size_t slotSize = 64 * 1024;
+
+    for(auto chain: chains.All()) {
+        std::vector<uint64_t> overlaySlot(slotSize / sizeof(uint64_t));
+        std::vector<uint64_t> mainSlot(slotSize / sizeof(uint64_t));
+
+        IPCBuffer ipcbuf(overlaySlot.data(), slotSize);
+        IPCHeader* header = new(ipcbuf) IPCHeader(0, 1, false, slotSize);
+        XrBaseInStructure* serialized = IPCSerialize(XR_NULL_HANDLE, ipcbuf, header, chain, COPY_EVERYTHING);
+        CHECK(serialized != nullptr);
+        CHECK(!ipcbuf.overflowed());
+        CHECK(XrStructChainEquals(chain, serialized));
+        CHECK(header->pointerFixupCount > 0 || chain->next == nullptr);
+
+        header->makePointersRelative(overlaySlot.data());
+        memcpy(mainSlot.data(), overlaySlot.data(), slotSize);
+        auto mainHeader = reinterpret_cast<IPCHeader*>(mainSlot.data());
+        mainHeader->makePointersAbsolute(mainSlot.data());
+
+        size_t offset = reinterpret_cast<unsigned char*>(serialized) - reinterpret_cast<unsigned char*>(overlaySlot.data());
+        auto received = reinterpret_cast<const XrBaseInStructure*>(reinterpret_cast<unsigned char*>(mainSlot.data()) + offset);
+        CHECK(XrStructChainEquals(chain, received));
+    }
+}
+
+// A request that doesn't fit reports how much it needs, and fits in that
+void TestIPCSerializeOverflow()
+{
+    RepresentativeChains chains;
+    const XrBaseInStructure* chain = reinterpret_cast<const XrBaseInStructure*>(&chains.frame.endInfo);
+
+    const size_t smallSize = 256;
+    std::vector<uint64_t> smallSlot(smallSize / sizeof(uint64_t));
+    IPCBuffer small(smallSlot.data(), smallSize);
+    IPCHeader* header = new(small) IPCHeader(0, 1, false, smallSize);
+    IPCSerialize(XR_NULL_HANDLE, small, header, chain, COPY_EVERYTHING);
+    CHECK(small.overflowed());
+    CHECK(!small.overflowAllocationFailed);
+    size_t needed = small.bytesNeeded();
+    CHECK(needed > smallSize);
+
+    std::vector<uint64_t> bigSlot((needed + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    IPCBuffer big(bigSlot.data(), needed);
+    header = new(big) IPCHeader(0, 1, false, needed);
+    XrBaseInStructure* serialized = IPCSerialize(XR_NULL_HANDLE, big, header, chain, COPY_EVERYTHING);
+    CHECK(!big.overflowed());
+    CHECK(XrStructChainEquals(chain, serialized));
+}
+
+// Main rejects a fixup table Overlay left pointing outside the request
+void TestIPCFixupTableBounds()
+{
+    RepresentativeChains chains;
+    const XrBaseInStructure* chain = reinterpret_cast<const XrBaseInStructure*>(&chains.frame.endInfo);
+    const size_t slotSize = 64 * 1024;
+    std::vector<uint64_t> slot(slotSize / sizeof(uint64_t));
+
+    IPCBuffer ipcbuf(slot.data(), slotSize);
+    IPCHeader* header = new(ipcbuf) IPCHeader(0, 1, false, slotSize);
+    CHECK(IPCSerialize(XR_NULL_HANDLE, ipcbuf, header, chain, COPY_EVERYTHING) != nullptr);
+    CHECK(header->pointerFixupCount > 0);
+
+    // As Main sees it, with the arguments after the header
+    IPCBuffer received(slot.data(), slotSize);
+    received.getAndAdvance<IPCHeader>();
+    CHECK(header->fixupTableIsInside(received));
+
+    uint64_t* offsets = header->pointerOffsets(slot.data());
+    uint64_t savedOffset = offsets[0];
+    offsets[0] = slotSize;
+    CHECK(!header->fixupTableIsInside(received));
+    offsets[0] = 0;
+    CHECK(!header->fixupTableIsInside(received));
+    offsets[0] = savedOffset;
+
+    uint32_t savedCount = header->pointerFixupCount;
+    header->pointerFixupCount = uint32_t(slotSize / sizeof(uint64_t));
+    CHECK(!header->fixupTableIsInside(received));
+    header->pointerFixupCount = savedCount;
+
+    header->fixupTableEnd = slotSize + sizeof(uint64_t);
+    CHECK(!header->fixupTableIsInside(received));
+    header->fixupTableEnd = slotSize - 1;
+    CHECK(!header->fixupTableIsInside(received));
+    header->fixupTableEnd = sizeof(uint64_t);
+    CHECK(!header->fixupTableIsInside(received));
+    header->fixupTableEnd = slotSize;
+    CHECK(header->fixupTableIsInside(received));
+}
+
+const uint32_t fixtureSeeds = 64;
+
+// CHECK() saying which fixture failed
+void CheckFixture(bool condition, const XrStructFixtureType& type, uint32_t seed, const char* what)
+{
+    if(!condition) {
+        fprintf(stderr, "%s, seed %u: %s\n", type.name, seed, what);
+        gTestFailures++;
+    }
+}
+
+// Every fixture type comes through each of the layer's allocators equal
+// to the original, and the per-member FreeXrStructChain() frees exactly
+// what CopyXrStructChain() allocated for it
+void TestFixtureCopies()
+{
+    const size_t slotSize = 64 * 1024;
+    std::vector<uint64_t> slot(slotSize / sizeof(uint64_t));
+
+    for(const auto& type: gXrStructFixtureTypes) {
+        for(uint32_t seed = 0; seed < fixtureSeeds; seed++) {
+            XrStructFixtureArena arena(seed);
+            const XrBaseInStructure* fixture = type.make(arena);
+            CheckFixture(fixture->type == type.type, type, seed, "fixture has the wrong type");
+
+            XrStructChainCountingHeap heap;
+            XrBaseInStructure* copy = CopyXrStructChainWithCountingHeap(XR_NULL_HANDLE, fixture, heap);
+            CheckFixture(copy != nullptr, type, seed, "no counting heap copy");
+            CheckFixture(XrStructChainEquals(fixture, copy), type, seed, "counting heap copy differs");
+            CheckFixture(heap.allocations > 0, type, seed, "counting heap unused");
+            FreeXrStructChainWithCountingHeap(XR_NULL_HANDLE, copy, heap);
+            CheckFixture(heap.balanced(), type, seed, "free doesn't match copy");
+            CheckFixture(heap.deallocations == heap.allocations, type, seed, "free doesn't match copy");
+
+            copy = CopyXrStructChainWithMalloc(XR_NULL_HANDLE, fixture);
+            CheckFixture(XrStructChainEquals(fixture, copy), type, seed, "malloc copy differs");
+            FreeXrStructChainWithFree(XR_NULL_HANDLE, copy);
+
+            copy = CopyXrStructChainWithScratch(XR_NULL_HANDLE, fixture);
+            CheckFixture(XrStructChainEquals(fixture, copy), type, seed, "scratch copy differs");
+            ScratchArena::Free(copy);
+
+            IPCBuffer ipcbuf(slot.data(), slotSize);
+            IPCHeader* header = new(ipcbuf) IPCHeader(0, 1, false, slotSize);
+            copy = IPCSerialize(XR_NULL_HANDLE, ipcbuf, header, fixture, COPY_EVERYTHING);
+            CheckFixture(!ipcbuf.overflowed(), type, seed, "RPC slot overflowed");
+            CheckFixture(XrStructChainEquals(fixture, copy), type, seed, "RPC slot copy differs");
+        }
+    }
+}
+
+const XrStructFixtureType* FindFixtureType(XrStructureType type)
+{
+    for(const auto& fixtureType: gXrStructFixtureTypes) {
+        if(fixtureType.type == type) {
+            return &fixtureType;
+        }
+    }
+    return nullptr;
+}
+
+// What Main returns through IPCCopyOut reaches the app's chain field by
+// field, extending structs included
+void TestFixtureCopyOut()
+{
+    uint32_t copiedOutTypes = 0;
+
+    for(const auto& type: gXrStructFixtureTypes) {
+        if(!type.copiedOut) {
+            continue;
+        }
+        copiedOutTypes++;
+
+        for(uint32_t seed = 0; seed < fixtureSeeds; seed++) {
+            XrStructFixtureArena arena(seed);
+            const XrBaseInStructure* reply = type.make(arena);
+
+            // The app's chain has the same shape, with everything but
+            // "type" and "next" not yet filled in
+            auto output = reinterpret_cast<XrBaseOutStructure*>(CopyXrStructChainWithMalloc(XR_NULL_HANDLE, reply));
+            for(XrBaseOutStructure* p = output; p; p = p->next) {
+                const XrStructFixtureType* outputType = FindFixtureType(p->type);
+                CheckFixture(outputType && outputType->copiedOut, type, seed, "chained struct isn't copied out");
+                if(outputType) {
+                    arena.FillBytes(p + 1, outputType->size - sizeof(XrBaseOutStructure));
+                }
+            }
+            CheckFixture(!XrStructChainEquals(reply, reinterpret_cast<XrBaseInStructure*>(output)), type, seed, "output not changed");
+
+            IPCCopyOut(output, reinterpret_cast<const XrBaseOutStructure*>(reply));
+            CheckFixture(XrStructChainEquals(reply, reinterpret_cast<XrBaseInStructure*>(output)), type, seed, "copied out fields differ");
+            FreeXrStructChainWithFree(XR_NULL_HANDLE, output);
+        }
+    }
+
+    CHECK(copiedOutTypes > 0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    static const TestCase tests[] = {
+        {"copy_with_malloc", TestCopyWithMalloc},
+        {"copy_with_scratch", TestCopyWithScratch},
+        {"equals_finds_differences", TestEqualsFindsDifferences},
+        {"restore_actual_handles", TestRestoreActualHandles},
+        {"substitute_local_handles", TestSubstituteLocalHandles},
+        {"epoch_hash_map", TestEpochHashMap},
+        {"ipc_serialize_across_mappings", TestIPCSerializeAcrossMappings},
+        {"ipc_serialize_overflow", TestIPCSerializeOverflow},
+        {"ipc_fixup_table_bounds", TestIPCFixupTableBounds},
+        {"fixture_copies", TestFixtureCopies},
+        {"fixture_copy_out", TestFixtureCopyOut},
+    };
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]), argc, argv);
+}